@@ -22,6 +22,7 @@ make tests-pmtud
 make tests-tap
 make tests-ip-fragment
 make tests-thread
+make tests-acl
 
 ./../tests/antispoof/test.sh
 ./../tests/core/test.sh
@@ -37,6 +38,7 @@ make tests-thread
 ./../tests/tap/test.sh
 ./../tests/ip-fragment/test.sh
 ./../tests/thread/test.sh
+./../tests/acl/test.sh
 
 ./../tests/antispoof/bench.sh
 ./../tests/core/bench.sh
@@ -51,3 +53,4 @@ make tests-thread
 ./../tests/pmtud/bench.sh
 ./../tests/tap/bench.sh
 ./../tests/ip-fragment/bench.sh
+./../tests/acl/bench.sh
@@ -0,0 +1,110 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Packetgraph.
+ *
+ * Packetgraph is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Packetgraph is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PG_ACL_H
+#define _PG_ACL_H
+
+#include <packetgraph/common.h>
+#include <packetgraph/errors.h>
+
+enum pg_acl_action {
+	PG_ACL_DENY,
+	PG_ACL_ALLOW,
+};
+
+struct pg_acl_rule {
+	/* AF_INET or AF_INET6 */
+	int family;
+	/* IP protocol number, 0 matches any protocol */
+	uint8_t proto;
+	/* addresses in network byte order, only the first 4 bytes are used
+	 * for AF_INET, a prefix length of 0 matches any address
+	 */
+	uint8_t src[16];
+	uint8_t src_prefix_len;
+	uint8_t dst[16];
+	uint8_t dst_prefix_len;
+	/* inclusive port ranges in host byte order, 0 to 65535 for any port */
+	uint16_t src_port_min;
+	uint16_t src_port_max;
+	uint16_t dst_port_min;
+	uint16_t dst_port_max;
+	enum pg_acl_action action;
+};
+
+/**
+ * Create a new stateless ACL brick.
+ * Packets are matched on their protocol, addresses and ports against
+ * rules loaded with pg_acl_reload. The first matching rule decides,
+ * IP packets matching no rule or with a malformed header are dropped and
+ * non-IP packets pass.
+ * Fragments are matched as if their ports were 0.
+ *
+ * @param	name name of the brick
+ * @param	errp is set in case of an error
+ * @return	a pointer to a brick structure on success, NULL on error
+ */
+PG_WARN_UNUSED
+struct pg_brick *pg_acl_new(const char *name, struct pg_error **errp);
+
+/**
+ * Add a rule in the ACL.
+ * The rule won't be effective before pg_acl_reload. Rules added first
+ * take precedence.
+ *
+ * @param	brick pointer to the ACL brick
+ * @param	rule the rule to add
+ * @param	dir side the filtered packets come from, PG_MAX_SIDE for both
+ * @param	id set to the id of the rule, may be NULL
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error and errp is set.
+ */
+int pg_acl_rule_add(struct pg_brick *brick, const struct pg_acl_rule *rule,
+		    enum pg_side dir, uint32_t *id, struct pg_error **errp);
+
+/**
+ * Flush all rules of the ACL.
+ * The flush won't be effective before pg_acl_reload, rule ids start
+ * again from 0.
+ *
+ * @param	brick pointer to the ACL brick
+ */
+void pg_acl_rule_flush(struct pg_brick *brick);
+
+/**
+ * Compile and load the rules of the ACL.
+ * The new rules replace the old ones at once, even when packets are
+ * burst in another thread, and the old rules are freed once no burst
+ * uses them anymore.
+ *
+ * @param	brick pointer to the ACL brick
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error and errp is set.
+ */
+int pg_acl_reload(struct pg_brick *brick, struct pg_error **errp);
+
+/**
+ * Get the number of packets which matched a loaded rule.
+ * Counters start from 0 on each reload.
+ *
+ * @param	brick pointer to the ACL brick
+ * @param	id id of the rule
+ * @return	number of matching packets, 0 if the rule is not loaded
+ */
+uint64_t pg_acl_rule_hits(struct pg_brick *brick, uint32_t id);
+
+#endif  /* _PG_ACL_H */
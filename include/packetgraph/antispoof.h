@@ -52,6 +52,8 @@ struct pg_brick *pg_antispoof_new(const char *name,
 void pg_antispoof_arp_enable(struct pg_brick *brick);
 
 /** Add authorized ip to antispoof brick
+ *
+ * Up to 65536 IPs can be added, adding an IP twice has no effect.
  *
  * @param	brick pointer to an antispoof brick
  * @param	ip IPv4 to associate with mac address
@@ -101,6 +103,8 @@ void pg_antispoof_arp_disable(struct pg_brick *brick);
 void pg_antispoof_ndp_enable(struct pg_brick *brick);
 
 /** Add authorized ip6 to antispoof brick
+ *
+ * Up to 65536 IPs can be added, adding an IP twice has no effect.
  *
  * @param	brick pointer to an antispoof brick
  * @param	ip IPv6 to associate with mac address (16 bytes)
@@ -133,4 +137,74 @@ void pg_antispoof_ndp_del_all(struct pg_brick *brick);
  */
 void pg_antispoof_ndp_disable(struct pg_brick *brick);
 
+/**
+ * Enable source address validation of IP packets
+ *
+ * IPv4 and IPv6 packets coming from the inside are dropped when their
+ * source address does not belong to an allowed prefix. Addresses like
+ * 0.0.0.0 (DHCP) or IPv6 link-local and unspecified addresses must be
+ * allowed explicitly when needed. IP packets whose header can't be parsed
+ * are dropped too.
+ *
+ * @param	brick pointer to an antispoof brick
+ */
+void pg_antispoof_ip_enable(struct pg_brick *brick);
+
+/** Add an allowed IPv4 source prefix to antispoof brick
+ *
+ * @param	brick pointer to an antispoof brick
+ * @param	ip IPv4 prefix in network byte order
+ * @param	prefix_len length of the prefix, 32 for one address
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error
+ **/
+int pg_antispoof_ipv4_add(struct pg_brick *brick, uint32_t ip,
+			  uint8_t prefix_len, struct pg_error **errp);
+
+/** Remove an allowed IPv4 source prefix from antispoof brick
+ *
+ * @param	brick pointer to an antispoof brick
+ * @param	ip IPv4 prefix in network byte order
+ * @param	prefix_len length of the prefix
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error
+ **/
+int pg_antispoof_ipv4_del(struct pg_brick *brick, uint32_t ip,
+			  uint8_t prefix_len, struct pg_error **errp);
+
+/** Add an allowed IPv6 source prefix to antispoof brick
+ *
+ * @param	brick pointer to an antispoof brick
+ * @param	ip IPv6 prefix (16 bytes)
+ * @param	prefix_len length of the prefix, 128 for one address
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error
+ **/
+int pg_antispoof_ipv6_add(struct pg_brick *brick, uint8_t *ip,
+			  uint8_t prefix_len, struct pg_error **errp);
+
+/** Remove an allowed IPv6 source prefix from antispoof brick
+ *
+ * @param	brick pointer to an antispoof brick
+ * @param	ip IPv6 prefix (16 bytes)
+ * @param	prefix_len length of the prefix
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error
+ **/
+int pg_antispoof_ipv6_del(struct pg_brick *brick, uint8_t *ip,
+			  uint8_t prefix_len, struct pg_error **errp);
+
+/** Remove all allowed source prefixes from antispoof brick
+ *
+ * @param	brick pointer to an antispoof brick
+ **/
+void pg_antispoof_ip_del_all(struct pg_brick *brick);
+
+/**
+ * Disable source address validation of IP packets
+ *
+ * @param	brick pointer to an antispoof brick
+ */
+void pg_antispoof_ip_disable(struct pg_brick *brick);
+
 #endif  /* _PG_ANTISPOOF_H */
@@ -111,6 +111,43 @@ bool pg_brick_pollable(struct pg_brick *brick);
  */
 uint64_t pg_brick_pkts_count_get(struct pg_brick *brick, enum pg_side side);
 
+enum pg_drop_reason {
+	PG_DROP_FILTERED,	/* refused by a filtering brick */
+	PG_DROP_NO_ROUTE,	/* no destination for the packet */
+	PG_DROP_TX_FULL,	/* output queue or ring full */
+	PG_DROP_INVALID,	/* malformed packet */
+	PG_DROP_MAX,
+};
+
+struct pg_brick_stats {
+	uint64_t pkts_in;
+	uint64_t bytes_in;
+	uint64_t bursts_in;
+	uint64_t pkts_out;
+	uint64_t bytes_out;
+	uint64_t bursts_out;
+	uint64_t drops[PG_DROP_MAX];
+};
+
+/**
+ * Get a consistent snapshot of the datapath counters of a brick side
+ * or of one of its edges. Counters are updated by the thread running
+ * the brick and can be read from any other thread. They are only
+ * consistent if a single thread bursts packets through a side at a time.
+ * "in" counts packets received through the edges of @side and "out"
+ * packets sent through them.
+ *
+ * @param	brick brick pointer
+ * @param	side side the edges are on
+ * @param	edge edge index, or -1 for the whole side
+ * @param	stats filled with the counters
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error, with EAGAIN if counters were being
+ *		updated for too long
+ */
+int pg_brick_stats_get(struct pg_brick *brick, enum pg_side side, int edge,
+		       struct pg_brick_stats *stats, struct pg_error **errp);
+
 /**
  * Data received by brick from outside world.
  * May be implemented only by some monopole bricks.
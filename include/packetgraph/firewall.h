@@ -23,6 +23,8 @@
 
 #define PG_NONE 0
 #define PG_NO_CONN_WORKER 0x00000001
+#define PG_NO_FLOW_CACHE 0x00000002
+#define PG_NO_JIT 0x00000004
 
 extern uint32_t pg_npf_nworkers;
 
@@ -30,6 +32,8 @@ extern uint32_t pg_npf_nworkers;
  * Create a new firewall brick.
  * This function should be call in the same thread than the one
  * which process packets.
+ * A firewall brick must not be burst by several threads at once, use
+ * pg_firewall_new_shared to get one brick per thread.
  *
  * @param	name name of the brick
  * @param	west_max maximum of links you can connect on the west side
@@ -38,6 +42,11 @@ extern uint32_t pg_npf_nworkers;
  *              separated thread to run garbage collector to clean old
  *              connexions. If you pass this flag, then you will be responsible
  *              of calling pg_firewall_gc.
+ *              Pass PG_NO_FLOW_CACHE to send every packet to NPF instead of
+ *              passing packets of established UDP connections directly.
+ *              Pass PG_NO_JIT to interpret rules instead of compiling them
+ *              to native code on reload. Rules the JIT cannot compile are
+ *              always interpreted.
  * @param	errp is set in case of an error
  * @return	a pointer to a brick structure on success, NULL on error
  */
@@ -45,6 +54,25 @@ PG_WARN_UNUSED
 struct pg_brick *pg_firewall_new(const char *name, uint64_t flags,
 				 struct pg_error **errp);
 
+/**
+ * Create several firewall bricks sharing the same rules and connections,
+ * so each one can be burst by a different thread. Each brick must still
+ * be burst by only one thread at a time.
+ * Rules changes made through any of them apply to all of them and the
+ * NPF instance is destroyed with the last brick.
+ *
+ * @param	name prefix of the bricks names, "-<index>" is appended
+ * @param	nb_bricks number of bricks to create
+ * @param	flags same as in pg_firewall_new
+ * @param	fws array of nb_bricks bricks, filled on success
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error and errp is set.
+ */
+PG_WARN_UNUSED
+int pg_firewall_new_shared(const char *name, uint16_t nb_bricks,
+			   uint64_t flags, struct pg_brick **fws,
+			   struct pg_error **errp);
+
 /**
  * Add a new rule in the firewall.
  * Note that the rule won't be effective, you will need to call
@@ -64,6 +92,78 @@ int pg_firewall_rule_add(struct pg_brick *brick, const char *filter,
 			 enum pg_side dir, int stateful,
 			 struct pg_error **errp);
 
+/**
+ * Add a new rule in the firewall, matching packets whose source or
+ * destination address is in a table.
+ * Like pg_firewall_rule_add, the rule won't be effective before
+ * firewall_reload(), which also creates the table if needed.
+ * Table entries can then be changed at any time and are kept across
+ * reloads.
+ *
+ * @param	brick pointer to the firewall brick
+ * @param	table name of the table
+ * @param	source match the source address if set, else the destination
+ * @param	dir side where the filter will occurs, PG_MAX_SIDE for both
+ * @param	stateful track connections of matching packets if set
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error and errp is set.
+ */
+int pg_firewall_rule_add_table(struct pg_brick *brick, const char *table,
+			       int source, enum pg_side dir, int stateful,
+			       struct pg_error **errp);
+
+/**
+ * Add a rule to a running firewall without reloading it.
+ * The rule is effective when this function returns and is kept across
+ * reloads and flushes until it is removed with pg_firewall_rule_remove.
+ *
+ * @param	brick pointer to the firewall brick
+ * @param	filter a pcap-filter string, NULL allows all traffic
+ * @param	dir side where the filter will occurs, PG_MAX_SIDE for both
+ * @param	stateful track connections of matching packets if set
+ * @param	id set to the id of the rule on success
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error and errp is set.
+ */
+int pg_firewall_rule_insert(struct pg_brick *brick, const char *filter,
+			    enum pg_side dir, int stateful, uint64_t *id,
+			    struct pg_error **errp);
+
+/**
+ * Remove a rule added with pg_firewall_rule_insert, without reloading.
+ * Established connections keep their state.
+ *
+ * @param	brick pointer to the firewall brick
+ * @param	id id of the rule
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error and errp is set.
+ */
+int pg_firewall_rule_remove(struct pg_brick *brick, uint64_t id,
+			    struct pg_error **errp);
+
+/**
+ * Add an address or a network to a table of a running firewall.
+ *
+ * @param	brick pointer to the firewall brick
+ * @param	table name of a table loaded by firewall_reload()
+ * @param	family AF_INET or AF_INET6
+ * @param	addr address in network byte order (4 or 16 bytes)
+ * @param	prefix_len prefix length of the network
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error and errp is set.
+ */
+int pg_firewall_table_add(struct pg_brick *brick, const char *table,
+			  int family, const void *addr, uint8_t prefix_len,
+			  struct pg_error **errp);
+
+/**
+ * Remove an address or a network from a table of a running firewall.
+ * Parameters are the same as in pg_firewall_table_add.
+ */
+int pg_firewall_table_remove(struct pg_brick *brick, const char *table,
+			     int family, const void *addr, uint8_t prefix_len,
+			     struct pg_error **errp);
+
 /**
  * Manually call the firewall garbage collector.
  * NPF firewall tracks all connexions when stateful.
@@ -95,4 +195,15 @@ void pg_firewall_rule_flush(struct pg_brick *brick);
  */
 int pg_firewall_reload(struct pg_brick *brick, struct pg_error **errp);
 
+/**
+ * Get the flow cache statistics of the firewall.
+ * Only packets which may use the cache (UDP) are counted.
+ *
+ * @param	brick pointer to the firewall brick
+ * @param	hits packets passed by the flow cache
+ * @param	misses packets which went through NPF
+ */
+void pg_firewall_flow_cache_stats(struct pg_brick *brick, uint64_t *hits,
+				  uint64_t *misses);
+
 #endif  /* _PG_FIREWALL_H */
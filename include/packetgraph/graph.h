@@ -235,4 +235,25 @@ int pg_graph_merge(struct pg_graph *graph1,
 int pg_graph_dot(struct pg_graph *graph, FILE *fd,
 		 struct pg_error **error);
 
+/**
+ * Write the cycles spent in each brick of a graph, most expensive first.
+ * Self time excludes the time spent in downstream bricks.
+ * Only available when packetgraph is configured with
+ * --enable-brick-profiling.
+ *
+ * @param	graph graph to report
+ * @param	fd file descriptor where to write the report
+ * @param	error is set in case of an error
+ * @return	0 on success, -1 on error
+ */
+int pg_graph_profile_dump(struct pg_graph *graph, FILE *fd,
+			  struct pg_error **error);
+
+/**
+ * Reset the profiling counters of all bricks of a graph.
+ *
+ * @param	graph graph to reset
+ */
+void pg_graph_profile_reset(struct pg_graph *graph);
+
 #endif /* _PG_GRAPH_H */
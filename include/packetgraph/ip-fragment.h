@@ -21,9 +21,17 @@
 #include <packetgraph/common.h>
 #include <packetgraph/errors.h>
 
+/* default number of packets which can be reassembled at the same time */
+#define PG_IP_FRAGMENT_TBL_SIZE (1 << 15)
+/* default time after which incomplete packets are dropped */
+#define PG_IP_FRAGMENT_TIMEOUT_MS 3000
+
 /**
  * Create a new ip fragment brick
  *
+ * IPv4 and IPv6 packets are fragmented and reassembled, except IPv6
+ * packets with extension headers before the fragment header.
+ *
  * @name:	name of the brick
  * @output:	side where packets can be fragmented,
  *		the oposite side is where packets are reasemble
@@ -37,4 +45,25 @@ struct pg_brick *pg_ip_fragment_new(const char *name,
 				    uint32_t mtu_size,
 				    struct pg_error **errp);
 
+/**
+ * Create a new ip fragment brick with a custom reassembly table
+ *
+ * @name:	name of the brick
+ * @output:	side where packets can be fragmented,
+ *		the oposite side is where packets are reasemble
+ * @mtu_size:	allowed MTU size, must be a multiple of 8
+ * @tbl_size:	number of packets which can be reassembled at the same
+ *		time, rounded up to a power of 2
+ * @timeout_ms:	time after which incomplete packets are dropped
+ * @errp:	is set in case of an error
+ * @return:	a pointer to a brick, NULL on error
+ */
+PG_WARN_UNUSED
+struct pg_brick *pg_ip_fragment_new_full(const char *name,
+					 enum pg_side output,
+					 uint32_t mtu_size,
+					 uint32_t tbl_size,
+					 uint32_t timeout_ms,
+					 struct pg_error **errp);
+
 #endif  /* _PG_IP_FRAGMENT_H */
@@ -53,6 +53,93 @@ struct pg_brick *pg_nic_new_by_id(const char *name,
 				  uint8_t portid,
 				  struct pg_error **errp);
 
+#define PG_NIC_RSS_IP  0x00000001
+#define PG_NIC_RSS_UDP 0x00000002
+#define PG_NIC_RSS_TCP 0x00000004
+
+struct pg_nic_queues_params {
+	/* number of RX/TX queue pairs */
+	uint16_t nb_queues;
+	/* descriptors per queue, 0 for default */
+	uint16_t nb_rx_desc;
+	uint16_t nb_tx_desc;
+	/* fields hashed by RSS to pick an RX queue, see PG_NIC_RSS_* flags */
+	uint32_t rss;
+};
+
+/**
+ * Create one nic brick per RX/TX queue pair of the same port.
+ * Each brick only polls and bursts its own queue, so each one can be
+ * polled by a different thread.
+ * The port is closed when the last of these bricks is destroyed.
+ *
+ * @name:	prefix of the bricks names, "-<queue>" is appended
+ * @ifname:	the name of the interface, same syntax as in pg_nic_new
+ * @params:	queues and RSS configuration
+ * @nics:	array of params->nb_queues bricks, filled on success
+ * @errp:	set in case of an error
+ * @return:	0 on success, -1 on error
+ */
+PG_WARN_UNUSED
+int pg_nic_new_queues(const char *name,
+		      const char *ifname,
+		      const struct pg_nic_queues_params *params,
+		      struct pg_brick **nics,
+		      struct pg_error **errp);
+
+/**
+ * Set the RSS redirection table of the nic port
+ *
+ * @nic:	any nic brick of the port
+ * @queues:	queue of each RETA entry
+ * @size:	number of entries, must match the port RETA size
+ * @errp:	set in case of an error
+ * @return:	0 on success, -1 on error
+ */
+int pg_nic_set_reta(struct pg_brick *nic, const uint16_t *queues,
+		    uint16_t size, struct pg_error **errp);
+
+enum pg_nic_tx_drop {
+	/* TX ring still full after all retries */
+	PG_NIC_TX_DROP_FULL,
+	/* packet rejected by the PMD TX preparation */
+	PG_NIC_TX_DROP_PREPARE,
+	PG_NIC_TX_DROP_MAX,
+};
+
+/**
+ * Configure TX buffering and retries of a nic brick.
+ * Buffered packets are sent once @threshold packets are queued, or by
+ * the first poll of the brick after @flush_us microseconds.
+ *
+ * @nic:	the nic brick
+ * @threshold:	packets to coalesce before sending, 0 disables buffering,
+ *		at most PG_MAX_PKTS_BURST
+ * @flush_us:	maximum time a packet waits in the buffer
+ * @retries:	extra TX attempts on a full ring before dropping
+ * @errp:	set in case of an error
+ * @return:	0 on success, -1 on error
+ */
+int pg_nic_set_tx_buffer(struct pg_brick *nic, uint16_t threshold,
+			 uint32_t flush_us, uint16_t retries,
+			 struct pg_error **errp);
+
+/**
+ * Send all packets waiting in the nic TX buffer
+ *
+ * @nic:	the nic brick
+ */
+void pg_nic_tx_flush(struct pg_brick *nic);
+
+/**
+ * Get the number of packets the nic dropped on TX
+ *
+ * @nic:	the nic brick
+ * @reason:	why packets were dropped
+ * @return:	number of dropped packets
+ */
+uint64_t pg_nic_tx_drops(struct pg_brick *nic, enum pg_nic_tx_drop reason);
+
 /**
  * Get number of available DPDK ports
  *
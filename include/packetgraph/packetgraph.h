@@ -42,5 +42,6 @@
 #include <packetgraph/tap.h>
 #include <packetgraph/pmtud.h>
 #include <packetgraph/ip-fragment.h>
+#include <packetgraph/acl.h>
 
 #endif /* _PG_PACKETGRAPH_H */
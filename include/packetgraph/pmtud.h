@@ -21,8 +21,16 @@
 #include <packetgraph/common.h>
 #include <packetgraph/errors.h>
 
+/* default number of ICMP messages per second for each source */
+#define PG_PMTUD_ICMP_RATE 100
+/* default number of ICMP messages a source can get at once */
+#define PG_PMTUD_ICMP_BURST 10
+
 /**
  * Create a new path MTU discovery brick
+ * Oversize IPv4 packets with the DF flag and oversize IPv6 packets are
+ * dropped and answered with an ICMP fragmentation needed or an ICMPv6
+ * packet too big message.
  *
  * @name:	name of the brick
  * @output:	side where packets can exit without been check
@@ -36,4 +44,28 @@ struct pg_brick *pg_pmtud_new(const char *name,
 			      uint32_t mtu_size,
 			      struct pg_error **errp);
 
+/**
+ * Limit the ICMP messages sent back to each source with a token bucket
+ * (PG_PMTUD_ICMP_RATE and PG_PMTUD_ICMP_BURST by default).
+ * Sources are hashed in a fixed number of buckets, so a few sources may
+ * share their limit.
+ *
+ * @brick:	pointer to a pmtud brick
+ * @rate:	messages per second for each source, 0 disable the limit
+ * @burst:	messages a source can get at once, at least 1
+ */
+void pg_pmtud_set_icmp_rate(struct pg_brick *brick, uint32_t rate,
+			    uint32_t burst);
+
+/**
+ * Lower the MSS option of TCP SYN and SYN-ACK packets going through the
+ * brick in both directions, so TCP segments fit in the MTU and need
+ * neither fragmentation nor ICMP. Disabled by default.
+ * Shared packets (refcounted or indirect mbufs) are left untouched.
+ *
+ * @brick:	pointer to a pmtud brick
+ * @enable:	true to clamp the MSS
+ */
+void pg_pmtud_set_tcp_mss_clamp(struct pg_brick *brick, bool enable);
+
 #endif  /* _PG_PMTUD_H */
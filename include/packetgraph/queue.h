@@ -57,6 +57,28 @@ PG_WARN_UNUSED
 struct pg_brick *pg_queue_new(const char *name, int size,
 			      struct pg_error **error);
 
+/**
+ * Create a new queue brick using a lock-free ring
+ *
+ * Same as pg_queue_new() but bursts are copied in a preallocated,
+ * single-producer/single-consumer ring instead of a GAsyncQueue: no lock and
+ * no allocation is done when bursting or polling.
+ * Only one thread can burst in the queue and only one thread can poll it's
+ * friend.
+ * Unlike pg_queue_new(), if you burst in a full queue, the new burst will be
+ * dropped.
+ * A ring queue can only be friend with an other ring queue.
+ *
+ * @name:	name of the brick
+ * @size:	maximal number of bursts in the queue. If size <= 0, a default
+ *		queue size of 10 will be chosen.
+ * @error:	is set in case of an error
+ * @return:	a pointer to a brick structure on success, NULL on error
+ */
+PG_WARN_UNUSED
+struct pg_brick *pg_queue_ring_new(const char *name, int size,
+				   struct pg_error **error);
+
 /**
  * Make two queues friend together.
  *
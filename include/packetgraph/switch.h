@@ -37,4 +37,38 @@ struct pg_brick *pg_switch_new(const char *name,
 			       enum pg_side output,
 			       struct pg_error **errp);
 
+/**
+ * Set the time after which a MAC address which has not been seen is
+ * forgotten by the switch (300 seconds by default).
+ * Aged addresses are removed a few at a time at each burst.
+ *
+ * @param	brick pointer to a switch brick
+ * @param	seconds aging time, 0 disable aging
+ */
+void pg_switch_set_aging(struct pg_brick *brick, uint32_t seconds);
+
+/**
+ * @param	brick pointer to a switch brick
+ * @return	number of MAC addresses learned since the switch creation
+ */
+uint64_t pg_switch_learned_count(struct pg_brick *brick);
+
+/**
+ * @param	brick pointer to a switch brick
+ * @return	number of MAC addresses forgotten because of aging
+ */
+uint64_t pg_switch_aged_count(struct pg_brick *brick);
+
+/**
+ * @param	brick pointer to a switch brick
+ * @return	number of times a known MAC address has been seen on another port
+ */
+uint64_t pg_switch_moved_count(struct pg_brick *brick);
+
+/**
+ * @param	brick pointer to a switch brick
+ * @return	number of MAC addresses currently known by the switch
+ */
+uint32_t pg_switch_mac_count(struct pg_brick *brick);
+
 #endif  /* _PG_SWITCH_H */
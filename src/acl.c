@@ -0,0 +1,505 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Packetgraph.
+ *
+ * Packetgraph is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Packetgraph is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <rte_config.h>
+#include <rte_acl.h>
+#include <rte_cycles.h>
+#include <rte_errno.h>
+
+#include <packetgraph/packetgraph.h>
+#include "utils/bitmask.h"
+#include "utils/network.h"
+#include "brick-int.h"
+
+#define ACL_FAMILY_IPV4 0
+#define ACL_FAMILY_IPV6 1
+#define ACL_FAMILIES 2
+
+/* Classification keys, built from each packet in network byte order.
+ * rte_acl reads them by groups of 4 bytes and the first field must be a
+ * single byte.
+ */
+struct acl_ipv4_key {
+	uint8_t proto;
+	uint8_t pad[3];
+	uint32_t src;
+	uint32_t dst;
+	/* source then destination port */
+	uint32_t ports;
+};
+
+struct acl_ipv6_key {
+	uint8_t proto;
+	uint8_t pad[3];
+	uint32_t src[4];
+	uint32_t dst[4];
+	uint32_t ports;
+};
+
+/* protocol, source, destination, source port and destination port */
+#define ACL_IPV4_FIELDS 5
+#define ACL_IPV6_FIELDS 11
+
+RTE_ACL_RULE_DEF(acl_ipv6_rule, ACL_IPV6_FIELDS);
+
+struct acl_rule {
+	struct pg_acl_rule rule;
+	enum pg_side dir;
+};
+
+/* compiled rules, replaced as a whole by pg_acl_reload() */
+struct acl_set {
+	/* by side packets come from and family, NULL if there is no rule */
+	struct rte_acl_ctx *ctx[PG_MAX_SIDE][ACL_FAMILIES];
+	uint32_t nb_rules;
+	/* by rule id */
+	bool *allow;
+	uint64_t *hits;
+};
+
+struct pg_acl_state {
+	struct pg_brick brick;
+	/* rules added since the last flush, the id of a rule is its index */
+	GArray *rules;
+	struct acl_set *set;
+	/* odd while a burst is running */
+	uint32_t burst_seq;
+	struct acl_ipv4_key keys4[PG_MAX_PKTS_BURST];
+	struct acl_ipv6_key keys6[PG_MAX_PKTS_BURST];
+	/* keys of each family, and index of their packet in the burst */
+	const uint8_t *keys[ACL_FAMILIES][PG_MAX_PKTS_BURST];
+	uint16_t idx[ACL_FAMILIES][PG_MAX_PKTS_BURST];
+	uint32_t results[PG_MAX_PKTS_BURST];
+};
+
+static void acl_field_def(struct rte_acl_config *cfg, uint8_t type,
+			  uint8_t size, uint32_t offset)
+{
+	struct rte_acl_field_def *def = &cfg->defs[cfg->num_fields];
+
+	def->type = type;
+	def->size = size;
+	def->field_index = cfg->num_fields++;
+	def->input_index = offset / sizeof(uint32_t);
+	def->offset = offset;
+}
+
+static void acl_config(struct rte_acl_config *cfg, int family)
+{
+	uint32_t ports;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->num_categories = 1;
+	acl_field_def(cfg, RTE_ACL_FIELD_TYPE_BITMASK, sizeof(uint8_t), 0);
+	if (family == ACL_FAMILY_IPV4) {
+		acl_field_def(cfg, RTE_ACL_FIELD_TYPE_MASK, sizeof(uint32_t),
+			      offsetof(struct acl_ipv4_key, src));
+		acl_field_def(cfg, RTE_ACL_FIELD_TYPE_MASK, sizeof(uint32_t),
+			      offsetof(struct acl_ipv4_key, dst));
+		ports = offsetof(struct acl_ipv4_key, ports);
+	} else {
+		for (int i = 0; i < 4; i++)
+			acl_field_def(cfg, RTE_ACL_FIELD_TYPE_MASK,
+				      sizeof(uint32_t),
+				      offsetof(struct acl_ipv6_key, src) +
+				      i * sizeof(uint32_t));
+		for (int i = 0; i < 4; i++)
+			acl_field_def(cfg, RTE_ACL_FIELD_TYPE_MASK,
+				      sizeof(uint32_t),
+				      offsetof(struct acl_ipv6_key, dst) +
+				      i * sizeof(uint32_t));
+		ports = offsetof(struct acl_ipv6_key, ports);
+	}
+	acl_field_def(cfg, RTE_ACL_FIELD_TYPE_RANGE, sizeof(uint16_t), ports);
+	acl_field_def(cfg, RTE_ACL_FIELD_TYPE_RANGE, sizeof(uint16_t),
+		      ports + sizeof(uint16_t));
+}
+
+/* rte_acl wants rule fields in host byte order */
+static void acl_prefix_fill(struct rte_acl_field *f, const uint8_t *addr,
+			    int prefix_len, int nb_words)
+{
+	for (int i = 0; i < nb_words; i++) {
+		uint32_t word;
+
+		memcpy(&word, addr + i * sizeof(uint32_t), sizeof(word));
+		f[i].value.u32 = rte_be_to_cpu_32(word);
+		f[i].mask_range.u32 = RTE_MIN(RTE_MAX(prefix_len - 32 * i, 0),
+					      32);
+	}
+}
+
+static void acl_rule_fill(struct rte_acl_field *f,
+			  const struct pg_acl_rule *rule)
+{
+	int nb_words = rule->family == AF_INET ? 1 : 4;
+
+	f[0].value.u8 = rule->proto;
+	f[0].mask_range.u8 = rule->proto ? UINT8_MAX : 0;
+	acl_prefix_fill(&f[1], rule->src, rule->src_prefix_len, nb_words);
+	acl_prefix_fill(&f[1 + nb_words], rule->dst, rule->dst_prefix_len,
+			nb_words);
+	f[1 + 2 * nb_words].value.u16 = rule->src_port_min;
+	f[1 + 2 * nb_words].mask_range.u16 = rule->src_port_max;
+	f[2 + 2 * nb_words].value.u16 = rule->dst_port_min;
+	f[2 + 2 * nb_words].mask_range.u16 = rule->dst_port_max;
+}
+
+/* compile the rules of a side and a family, *ctx is NULL without rules */
+static int acl_ctx_build(GArray *rules, enum pg_side side, int family,
+			 struct rte_acl_ctx **ctx, struct pg_error **errp)
+{
+	static uint32_t acl_ctx_cnt;
+
+	int af = family == ACL_FAMILY_IPV4 ? AF_INET : AF_INET6;
+	uint32_t nb_fields = family == ACL_FAMILY_IPV4 ?
+		ACL_IPV4_FIELDS : ACL_IPV6_FIELDS;
+	char name[RTE_ACL_NAMESIZE];
+	struct rte_acl_param param;
+	struct rte_acl_config cfg;
+	uint32_t nb = 0;
+	int ret;
+
+	*ctx = NULL;
+	for (guint i = 0; i < rules->len; i++) {
+		struct acl_rule *r = &g_array_index(rules, struct acl_rule, i);
+
+		if (r->rule.family == af &&
+		    (r->dir == side || r->dir == PG_MAX_SIDE))
+			nb++;
+	}
+	if (!nb)
+		return 0;
+
+	/* contexts are looked up by name */
+	snprintf(name, sizeof(name), "pg-acl-%u", acl_ctx_cnt++);
+	param.name = name;
+	param.socket_id = SOCKET_ID_ANY;
+	param.rule_size = RTE_ACL_RULE_SZ(nb_fields);
+	param.max_rule_num = nb;
+	*ctx = rte_acl_create(&param);
+	if (!*ctx) {
+		*errp = pg_error_new_errno(rte_errno,
+					   "cannot create ACL context");
+		return -1;
+	}
+
+	for (guint i = 0; i < rules->len; i++) {
+		struct acl_rule *r = &g_array_index(rules, struct acl_rule, i);
+		struct acl_ipv6_rule rule;
+
+		if (r->rule.family != af ||
+		    (r->dir != side && r->dir != PG_MAX_SIDE))
+			continue;
+		memset(&rule, 0, sizeof(rule));
+		rule.data.category_mask = 1;
+		/* first added, first matched */
+		rule.data.priority = RTE_ACL_MAX_PRIORITY - i;
+		/* 0 means no match */
+		rule.data.userdata = i + 1;
+		acl_rule_fill(rule.field, &r->rule);
+		ret = rte_acl_add_rules(*ctx, (struct rte_acl_rule *)&rule, 1);
+		if (ret < 0)
+			goto error;
+	}
+
+	acl_config(&cfg, family);
+	ret = rte_acl_build(*ctx, &cfg);
+	if (ret < 0)
+		goto error;
+	return 0;
+error:
+	*errp = pg_error_new_errno(-ret, "cannot compile ACL rules");
+	rte_acl_free(*ctx);
+	*ctx = NULL;
+	return -1;
+}
+
+static void acl_set_free(struct acl_set *set)
+{
+	if (!set)
+		return;
+	for (int s = 0; s < PG_MAX_SIDE; s++)
+		for (int f = 0; f < ACL_FAMILIES; f++)
+			rte_acl_free(set->ctx[s][f]);
+	g_free(set->allow);
+	g_free(set->hits);
+	g_free(set);
+}
+
+int pg_acl_rule_add(struct pg_brick *brick, const struct pg_acl_rule *rule,
+		    enum pg_side dir, uint32_t *id, struct pg_error **errp)
+{
+	struct pg_acl_state *state =
+		pg_brick_get_state(brick, struct pg_acl_state);
+	struct acl_rule r = { .rule = *rule, .dir = dir };
+	uint8_t max_prefix_len;
+
+	if (rule->family == AF_INET) {
+		max_prefix_len = 32;
+	} else if (rule->family == AF_INET6) {
+		max_prefix_len = 128;
+	} else {
+		*errp = pg_error_new("invalid address family %i",
+				     rule->family);
+		return -1;
+	}
+	if (rule->src_prefix_len > max_prefix_len ||
+	    rule->dst_prefix_len > max_prefix_len) {
+		*errp = pg_error_new("invalid prefix length");
+		return -1;
+	}
+	if (rule->src_port_min > rule->src_port_max ||
+	    rule->dst_port_min > rule->dst_port_max) {
+		*errp = pg_error_new("invalid port range");
+		return -1;
+	}
+	if (dir > PG_MAX_SIDE) {
+		*errp = pg_error_new("invalid side %i", dir);
+		return -1;
+	}
+	g_array_append_val(state->rules, r);
+	if (id)
+		*id = state->rules->len - 1;
+	return 0;
+}
+
+void pg_acl_rule_flush(struct pg_brick *brick)
+{
+	struct pg_acl_state *state =
+		pg_brick_get_state(brick, struct pg_acl_state);
+
+	g_array_set_size(state->rules, 0);
+}
+
+int pg_acl_reload(struct pg_brick *brick, struct pg_error **errp)
+{
+	struct pg_acl_state *state =
+		pg_brick_get_state(brick, struct pg_acl_state);
+	struct acl_set *set = g_new0(struct acl_set, 1);
+	struct acl_set *old;
+	uint32_t seq;
+
+	set->nb_rules = state->rules->len;
+	set->allow = g_new0(bool, set->nb_rules);
+	set->hits = g_new0(uint64_t, set->nb_rules);
+	for (uint32_t i = 0; i < set->nb_rules; i++)
+		set->allow[i] = g_array_index(state->rules, struct acl_rule,
+					      i).rule.action == PG_ACL_ALLOW;
+	for (int s = 0; s < PG_MAX_SIDE; s++) {
+		for (int f = 0; f < ACL_FAMILIES; f++) {
+			if (acl_ctx_build(state->rules, s, f, &set->ctx[s][f],
+					  errp) < 0) {
+				acl_set_free(set);
+				return -1;
+			}
+		}
+	}
+
+	old = state->set;
+	state->set = set;
+	rte_smp_mb();
+	/* a running burst may still use the old rules, wait for its end */
+	seq = *(volatile uint32_t *)&state->burst_seq;
+	if (seq & 1) {
+		while (*(volatile uint32_t *)&state->burst_seq == seq)
+			rte_pause();
+	}
+	acl_set_free(old);
+	return 0;
+}
+
+uint64_t pg_acl_rule_hits(struct pg_brick *brick, uint32_t id)
+{
+	struct pg_acl_state *state =
+		pg_brick_get_state(brick, struct pg_acl_state);
+
+	if (id >= state->set->nb_rules)
+		return 0;
+	return state->set->hits[id];
+}
+
+static inline uint32_t acl_ports(struct rte_mbuf *pkt)
+{
+	uint32_t l4 = pkt->packet_type & RTE_PTYPE_L4_MASK;
+
+	/* only the first fragment has ports */
+	if ((l4 == RTE_PTYPE_L4_TCP || l4 == RTE_PTYPE_L4_UDP) &&
+	    pkt->l2_len + pkt->l3_len + sizeof(uint32_t) <=
+	    rte_pktmbuf_data_len(pkt))
+		return *(uint32_t *)pg_utils_get_l4(pkt);
+	return 0;
+}
+
+static inline void acl_ipv4_key(struct rte_mbuf *pkt,
+				struct acl_ipv4_key *key)
+{
+	struct ipv4_hdr *ip = pg_utils_get_l3(pkt);
+
+	key->proto = ip->next_proto_id;
+	key->src = ip->src_addr;
+	key->dst = ip->dst_addr;
+	key->ports = acl_ports(pkt);
+}
+
+static inline void acl_ipv6_key(struct rte_mbuf *pkt,
+				struct acl_ipv6_key *key)
+{
+	struct ipv6_hdr *ip = pg_utils_get_l3(pkt);
+	uint8_t proto = ip->proto;
+	bool frag;
+
+	/* the parser does not keep the protocol after extension headers */
+	if (pkt->l3_len != sizeof(struct ipv6_hdr))
+		pg_utils_ipv6_hdr_len(ip, rte_pktmbuf_mtod(pkt, uint8_t *) +
+				      rte_pktmbuf_data_len(pkt), &proto, &frag);
+	key->proto = proto;
+	memcpy(key->src, ip->src_addr, sizeof(key->src));
+	memcpy(key->dst, ip->dst_addr, sizeof(key->dst));
+	key->ports = acl_ports(pkt);
+}
+
+/* return the mask of packets allowed by the rules */
+static inline uint64_t acl_classify(struct pg_acl_state *state,
+				    struct acl_set *set, enum pg_side from,
+				    struct rte_mbuf **pkts, uint64_t pkts_mask)
+{
+	uint32_t n[ACL_FAMILIES] = {0, 0};
+	uint64_t passed = 0;
+
+	PG_FOREACH_BIT(pkts_mask, i) {
+		struct rte_mbuf *pkt = pkts[i];
+		uint32_t ptype;
+
+		pg_utils_parse(pkt);
+		ptype = pkt->packet_type;
+		if (RTE_ETH_IS_IPV4_HDR(ptype)) {
+			acl_ipv4_key(pkt, &state->keys4[n[ACL_FAMILY_IPV4]]);
+			state->idx[ACL_FAMILY_IPV4][n[ACL_FAMILY_IPV4]++] = i;
+		} else if (RTE_ETH_IS_IPV6_HDR(ptype)) {
+			acl_ipv6_key(pkt, &state->keys6[n[ACL_FAMILY_IPV6]]);
+			state->idx[ACL_FAMILY_IPV6][n[ACL_FAMILY_IPV6]++] = i;
+		} else if (!pg_utils_is_bad_ip(pkt)) {
+			/* let non-IP packets (like ARP) pass, unparsable IP
+			 * packets are denied
+			 */
+			passed |= ONE64 << i;
+		}
+	}
+
+	for (int f = 0; f < ACL_FAMILIES; f++) {
+		struct rte_acl_ctx *ctx = set->ctx[from][f];
+
+		if (!n[f] || !ctx)
+			continue;
+		/* the whole burst of a family at once */
+		rte_acl_classify(ctx, state->keys[f], state->results, n[f], 1);
+		for (uint32_t k = 0; k < n[f]; k++) {
+			uint32_t id = state->results[k];
+
+			if (!id)
+				continue;
+			set->hits[id - 1]++;
+			if (set->allow[id - 1])
+				passed |= ONE64 << state->idx[f][k];
+		}
+	}
+	return passed;
+}
+
+static int acl_burst(struct pg_brick *brick, enum pg_side from,
+		     uint16_t edge_index, struct rte_mbuf **pkts,
+		     uint64_t pkts_mask, struct pg_error **errp)
+{
+	struct pg_brick_side *s = &brick->sides[pg_flip_side(from)];
+	struct pg_acl_state *state =
+		pg_brick_get_state(brick, struct pg_acl_state);
+	uint64_t passed;
+
+	/* pg_acl_reload() frees old rules when no burst runs */
+	state->burst_seq++;
+	rte_smp_mb();
+	passed = acl_classify(state, state->set, from, pkts, pkts_mask);
+	rte_smp_mb();
+	state->burst_seq++;
+
+	if (unlikely(passed != pkts_mask))
+		pg_brick_count_drops(brick, from, PG_DROP_FILTERED,
+				     pg_mask_count(pkts_mask & ~passed));
+	if (unlikely(passed == 0))
+		return 0;
+	return pg_brick_burst(s->edge.link, from, s->edge.pair_index,
+			      pkts, passed, errp);
+}
+
+static int acl_init(struct pg_brick *brick, struct pg_brick_config *config,
+		    struct pg_error **errp)
+{
+	struct pg_acl_state *state =
+		pg_brick_get_state(brick, struct pg_acl_state);
+
+	brick->burst = acl_burst;
+	for (int i = 0; i < PG_MAX_PKTS_BURST; i++) {
+		state->keys[ACL_FAMILY_IPV4][i] =
+			(const uint8_t *)&state->keys4[i];
+		state->keys[ACL_FAMILY_IPV6][i] =
+			(const uint8_t *)&state->keys6[i];
+	}
+	state->rules = g_array_new(FALSE, FALSE, sizeof(struct acl_rule));
+	/* no rule: IP packets are dropped */
+	if (pg_acl_reload(brick, errp) < 0) {
+		g_array_free(state->rules, TRUE);
+		return -1;
+	}
+	return 0;
+}
+
+static void acl_destroy(struct pg_brick *brick, struct pg_error **errp)
+{
+	struct pg_acl_state *state =
+		pg_brick_get_state(brick, struct pg_acl_state);
+
+	acl_set_free(state->set);
+	g_array_free(state->rules, TRUE);
+}
+
+struct pg_brick *pg_acl_new(const char *name, struct pg_error **errp)
+{
+	struct pg_brick_config *config = pg_brick_config_new(name, 1, 1,
+							     PG_DIPOLE);
+	struct pg_brick *ret = pg_brick_new("acl", config, errp);
+
+	pg_brick_config_free(config);
+	return ret;
+}
+
+static struct pg_brick_ops acl_ops = {
+	.name		= "acl",
+	.state_size	= sizeof(struct pg_acl_state),
+
+	.init		= acl_init,
+	.destroy	= acl_destroy,
+
+	.unlink		= pg_brick_generic_unlink,
+};
+
+pg_brick_register(acl, &acl_ops);
@@ -17,17 +17,20 @@
 
 #include <rte_config.h>
 #include <rte_ether.h>
+#include <rte_hash_crc.h>
 #include <rte_ip.h>
 #include <rte_memcpy.h>
+#include <lpm.h>
 #include <packetgraph/packetgraph.h>
 #include "brick-int.h"
 #include "utils/bitmask.h"
 #include "utils/mac.h"
-#include "utils/ip.h"
 #include "utils/network.h"
 
-#define ARP_MAX 100
-#define NPD_MAX 100
+/* maximal number of addresses of each family */
+#define ANTISPOOF_ADDR_MAX (1 << 16)
+#define ANTISPOOF_SET_MIN_SIZE 16
+#define ANTISPOOF_PREFIX_LEN_MAX 128
 
 struct pg_antispoof_arp {
 	/* Format of hardware address.  */
@@ -50,11 +53,6 @@ struct pg_antispoof_arp {
 	uint32_t target_ip;
 } __attribute__ ((__packed__));
 
-struct arp {
-	uint32_t ip;
-	struct pg_antispoof_arp packet;
-};
-
 struct opt_ll_addr {
 	/* 1 for Source Link-layer Address
 	 * 2 for Target Link-layer Address (X)
@@ -78,8 +76,24 @@ struct neighbor_advertisement {
 	struct opt_ll_addr ll;
 } __attribute__ ((__packed__));
 
-struct ndp {
-	uint8_t ip[16];
+/* set of allowed addresses of one family */
+struct antispoof_set {
+	/* addresses, without holes */
+	uint8_t *addrs;
+	uint32_t addr_size;
+	uint32_t nb;
+	uint32_t max;
+	/* open addressing hash of addresses, contain index + 1, 0 is empty */
+	uint32_t *index;
+	uint32_t mask;
+};
+
+/* allowed source prefixes of one family */
+struct antispoof_prefixes {
+	lpm_t *lpm;
+	size_t addr_size;
+	/* prefix lengths inserted since the last clear */
+	bool used[ANTISPOOF_PREFIX_LEN_MAX + 1];
 };
 
 struct pg_antispoof_state {
@@ -87,12 +101,16 @@ struct pg_antispoof_state {
 	enum pg_side outside;
 	struct ether_addr mac;
 	bool arp_enabled;
-	uint16_t arps_size;
-	struct arp arps[ARP_MAX];
+	/* ARP header allowed packets start with, except ar_op and IPs */
+	struct pg_antispoof_arp arp_ref;
+	struct antispoof_set arps;
 	/* icmpv6 / neighbor discovery */
 	bool ndp_enabled;
-	uint16_t ndps_size;
-	struct ndp ndps[NPD_MAX];
+	struct antispoof_set ndps;
+	/* source address validation of IP packets */
+	bool ip_enabled;
+	struct antispoof_prefixes prefixes4;
+	struct antispoof_prefixes prefixes6;
 };
 
 struct pg_antispoof_config {
@@ -103,74 +121,170 @@ struct pg_antispoof_config {
 /* Size of the beginning of struct pg_antispoof_arp until ar_op (excluded) */
 #define PG_ANTISPOOF_ARP_CHECK_PART1 (2 + 2 + 1 + 1)
 
-/* Size of the "Sender" part of struct pg_antispoof_arp */
-#define PG_ANTISPOOF_ARP_CHECK_PART2 (6 + 4)
+static void antispoof_set_init(struct antispoof_set *set,
+			       uint32_t addr_size)
+{
+	set->addr_size = addr_size;
+	set->nb = 0;
+	set->max = ANTISPOOF_SET_MIN_SIZE;
+	set->addrs = g_malloc(set->max * addr_size);
+	/* the index is at least twice as big as the number of addresses */
+	set->mask = ANTISPOOF_SET_MIN_SIZE * 2 - 1;
+	set->index = g_new0(uint32_t, set->mask + 1);
+}
 
-void pg_antispoof_arp_enable(struct pg_brick *brick)
+static void antispoof_set_free(struct antispoof_set *set)
 {
-	pg_brick_get_state(brick, struct pg_antispoof_state)->arp_enabled =
-		true;
+	g_free(set->addrs);
+	g_free(set->index);
 }
 
-int pg_antispoof_arp_add(struct pg_brick *brick, uint32_t ip,
-			 struct pg_error **errp)
+static inline uint8_t *antispoof_set_addr(struct antispoof_set *set,
+					  uint32_t i)
 {
-	struct pg_antispoof_state *state =
-		pg_brick_get_state(brick, struct pg_antispoof_state);
-	uint16_t n = state->arps_size;
-	struct arp *arp = &state->arps[n];
+	return &set->addrs[i * set->addr_size];
+}
+
+static inline uint32_t antispoof_set_hash(struct antispoof_set *set,
+					  const void *addr)
+{
+	return rte_hash_crc(addr, set->addr_size, 0) & set->mask;
+}
+
+/* @return slot of the address in the index or -1 */
+static inline int64_t antispoof_set_slot(struct antispoof_set *set,
+					 const void *addr)
+{
+	uint32_t mask = set->mask;
+
+	for (uint32_t h = antispoof_set_hash(set, addr); set->index[h];
+	     h = (h + 1) & mask) {
+		if (!memcmp(antispoof_set_addr(set, set->index[h] - 1), addr,
+			    set->addr_size))
+			return h;
+	}
+	return -1;
+}
 
-	if (unlikely(n == ARP_MAX)) {
+static inline bool antispoof_set_has(struct antispoof_set *set,
+				     const void *addr)
+{
+	return antispoof_set_slot(set, addr) >= 0;
+}
+
+static void antispoof_set_index_add(struct antispoof_set *set, uint32_t i)
+{
+	uint32_t h = antispoof_set_hash(set, antispoof_set_addr(set, i));
+
+	while (set->index[h])
+		h = (h + 1) & set->mask;
+	set->index[h] = i + 1;
+}
+
+static int antispoof_set_add(struct antispoof_set *set, const void *addr,
+			     struct pg_error **errp)
+{
+	if (antispoof_set_has(set, addr))
+		return 0;
+	if (unlikely(set->nb == ANTISPOOF_ADDR_MAX)) {
 		*errp = pg_error_new("Maximal IP reached");
 		return -1;
 	}
+	if (set->nb == set->max) {
+		set->max *= 2;
+		set->addrs = g_realloc(set->addrs, set->max * set->addr_size);
+		/* growing is rare enough to simply rebuild the whole index */
+		g_free(set->index);
+		set->mask = set->max * 2 - 1;
+		set->index = g_new0(uint32_t, set->mask + 1);
+		for (uint32_t i = 0; i < set->nb; i++)
+			antispoof_set_index_add(set, i);
+	}
+	memcpy(antispoof_set_addr(set, set->nb), addr, set->addr_size);
+	antispoof_set_index_add(set, set->nb);
+	set->nb++;
+	return 0;
+}
 
-	/* let's start the pre-build of ARP anti-spoof */
-	arp->packet.ar_hrd = rte_cpu_to_be_16(1);
-	arp->packet.ar_pro = PG_BE_ETHER_TYPE_IPv4;
-	arp->packet.ar_hln = ETHER_ADDR_LEN;
-	arp->packet.ar_pln = 4;
-	arp->packet.sender_ip = ip;
-	rte_memcpy(&arp->packet.sender_mac, &state->mac, ETHER_ADDR_LEN);
+static int antispoof_set_del(struct antispoof_set *set, const void *addr,
+			     struct pg_error **errp)
+{
+	uint32_t mask = set->mask;
+	int64_t slot = antispoof_set_slot(set, addr);
+	uint32_t i, j, hole, last;
 
-	arp->ip = ip;
+	if (slot < 0) {
+		*errp = pg_error_new("IP not found");
+		return -1;
+	}
+	i = set->index[slot] - 1;
 
-	state->arps_size++;
+	/* backward shift the following slots, no tombstone is needed */
+	for (hole = j = slot;;) {
+		uint32_t h;
+
+		j = (j + 1) & mask;
+		if (!set->index[j])
+			break;
+		h = antispoof_set_hash(set,
+				       antispoof_set_addr(set,
+							  set->index[j] - 1));
+		/* the entry stays if its hash is after the hole */
+		if (hole <= j ? (hole < h && h <= j) : (hole < h || h <= j))
+			continue;
+		set->index[hole] = set->index[j];
+		hole = j;
+	}
+	set->index[hole] = 0;
+
+	/* move the last address in the hole */
+	last = set->nb - 1;
+	if (i != last) {
+		slot = antispoof_set_slot(set, antispoof_set_addr(set, last));
+		memcpy(antispoof_set_addr(set, i),
+		       antispoof_set_addr(set, last), set->addr_size);
+		set->index[slot] = i + 1;
+	}
+	set->nb--;
 	return 0;
 }
 
-int pg_antispoof_arp_del(struct pg_brick *brick, uint32_t ip,
+static void antispoof_set_del_all(struct antispoof_set *set)
+{
+	set->nb = 0;
+	memset(set->index, 0, (set->mask + 1) * sizeof(uint32_t));
+}
+
+void pg_antispoof_arp_enable(struct pg_brick *brick)
+{
+	pg_brick_get_state(brick, struct pg_antispoof_state)->arp_enabled =
+		true;
+}
+
+int pg_antispoof_arp_add(struct pg_brick *brick, uint32_t ip,
 			 struct pg_error **errp)
 {
 	struct pg_antispoof_state *state =
 		pg_brick_get_state(brick, struct pg_antispoof_state);
-	int index = -1;
-	uint16_t size = state->arps_size;
-	struct arp *arps = state->arps;
 
-	for (int16_t i = 0; i < size; i++) {
-		if (arps[i].ip == ip) {
-			index = i;
-			break;
-		}
-	}
+	return antispoof_set_add(&state->arps, &ip, errp);
+}
 
-	if (index < 0) {
-		*errp = pg_error_new("IP not found");
-		return -1;
-	}
+int pg_antispoof_arp_del(struct pg_brick *brick, uint32_t ip,
+			 struct pg_error **errp)
+{
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
 
-	if (index != size - 1)
-		rte_memcpy(&arps[index], &arps[size - 1], sizeof(struct arp));
-	state->arps_size--;
-	return 0;
+	return antispoof_set_del(&state->arps, &ip, errp);
 }
 
 void pg_antispoof_arp_del_all(struct pg_brick *brick)
 {
 	struct pg_antispoof_state *state =
 		pg_brick_get_state(brick, struct pg_antispoof_state);
-	state->arps_size = 0;
+
+	antispoof_set_del_all(&state->arps);
 }
 
 void pg_antispoof_arp_disable(struct pg_brick *brick)
@@ -197,21 +311,16 @@ static struct pg_brick_config *antispoof_config_new(const char *name,
 static inline int antispoof_arp(struct pg_antispoof_state *state,
 				struct rte_mbuf *pkt)
 {
-	uint16_t size = state->arps_size;
-	struct pg_antispoof_arp *p;
+	struct pg_antispoof_arp *p = &state->arp_ref;
 	struct pg_antispoof_arp *a = pg_utils_get_l3(pkt);
 
-	for (uint16_t i = 0; i < size; i++) {
-		/* Check that all fields match reference packet except the
-		 * "ar_op" (arp operation code) part.
-		 */
-		p = &state->arps[i].packet;
-		if (!memcmp(p, a, PG_ANTISPOOF_ARP_CHECK_PART1) &&
-		    memcmp(&p->sender_mac, &a->sender_mac,
-			   PG_ANTISPOOF_ARP_CHECK_PART2) == 0) {
-			return 0;
-		}
-	}
+	/* Check that all fields match reference packet except the
+	 * "ar_op" (arp operation code) part, then look for the sender IP.
+	 */
+	if (!memcmp(p, a, PG_ANTISPOOF_ARP_CHECK_PART1) &&
+	    !memcmp(&p->sender_mac, &a->sender_mac, ETHER_ADDR_LEN) &&
+	    antispoof_set_has(&state->arps, &a->sender_ip))
+		return 0;
 	return -1;
 }
 
@@ -226,18 +335,8 @@ int pg_antispoof_ndp_add(struct pg_brick *brick, uint8_t *ip,
 {
 	struct pg_antispoof_state *state =
 		pg_brick_get_state(brick, struct pg_antispoof_state);
-	uint16_t n = state->ndps_size;
-	struct ndp *ndp = &state->ndps[n];
-
-	if (unlikely(n == NPD_MAX)) {
-		*errp = pg_error_new("Maximal IPV6 reached");
-		return -1;
-	}
-
-	pg_ip_copy(ip, ndp->ip);
-	state->ndps_size++;
-	return 0;
 
+	return antispoof_set_add(&state->ndps, ip, errp);
 }
 
 int pg_antispoof_ndp_del(struct pg_brick *brick, uint8_t *ip,
@@ -245,31 +344,16 @@ int pg_antispoof_ndp_del(struct pg_brick *brick, uint8_t *ip,
 {
 	struct pg_antispoof_state *state =
 		pg_brick_get_state(brick, struct pg_antispoof_state);
-	int index = -1;
-	uint16_t size = state->ndps_size;
-	struct ndp *ndps = state->ndps;
-
-	for (int16_t i = 0; i < size; i++) {
-		if (pg_ip_is_same(ndps[i].ip, ip)) {
-			index = i;
-			break;
-		}
-	}
-
-	if (index < 0) {
-		*errp = pg_error_new("IPV6 not found");
-		return -1;
-	}
 
-	if (index != size - 1)
-		pg_ip_copy(ndps[size - 1].ip, ndps[index].ip);
-	state->ndps_size--;
-	return 0;
+	return antispoof_set_del(&state->ndps, ip, errp);
 }
 
 void pg_antispoof_ndp_del_all(struct pg_brick *brick)
 {
-	pg_brick_get_state(brick, struct pg_antispoof_state)->ndps_size = 0;
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+
+	antispoof_set_del_all(&state->ndps);
 }
 
 void pg_antispoof_ndp_disable(struct pg_brick *brick)
@@ -281,35 +365,26 @@ void pg_antispoof_ndp_disable(struct pg_brick *brick)
 static inline int antispoof_ndp(struct pg_antispoof_state *state,
 				struct rte_mbuf *pkt)
 {
-	uint8_t ipv6_type;
-	uint8_t *ipv6_payload;
+	uint32_t l4_type = pkt->packet_type & RTE_PTYPE_L4_MASK;
 
-	if (pg_utils_get_ipv6_l4(pkt, &ipv6_type, &ipv6_payload) < 0)
+	/* IPv6 extension headers could not be walked */
+	if (unlikely(!l4_type))
 		return -1;
-	if (likely(ipv6_type != PG_IP_TYPE_ICMPV6))
+	if (likely(l4_type != RTE_PTYPE_L4_ICMP))
 		return 0;
 
 	/* check ICMPv6 message type */
 	struct neighbor_advertisement *na =
-		(struct neighbor_advertisement *) ipv6_payload;
+		(struct neighbor_advertisement *) pg_utils_get_l4(pkt);
 
 	if (likely(na->type != PG_ICMPV6_TYPE_NA))
 		return 0;
 
 	/* check ipv6 source validity */
-	uint16_t size = state->ndps_size;
-	struct ndp *ndps = state->ndps;
-	bool ipv6_allowed = false;
 	struct ipv6_hdr *h6 = (struct ipv6_hdr *) pg_utils_get_l3(pkt);
 
-	for (uint16_t i = 0; i < size; i++) {
-		if (pg_ip_is_same(h6->src_addr, ndps[i].ip) &&
-		    !memcmp(na->target_address, ndps[i].ip, 16)) {
-			ipv6_allowed = true;
-			break;
-		}
-	}
-	if (unlikely(!ipv6_allowed))
+	if (unlikely(memcmp(h6->src_addr, na->target_address, 16) ||
+		     !antispoof_set_has(&state->ndps, na->target_address)))
 		return -1;
 
 	/* check link layer address option */
@@ -321,6 +396,172 @@ static inline int antispoof_ndp(struct pg_antispoof_state *state,
 	return 0;
 }
 
+static int antispoof_prefixes_init(struct antispoof_prefixes *prefixes,
+				   size_t addr_size, struct pg_error **errp)
+{
+	prefixes->lpm = lpm_create();
+	if (!prefixes->lpm) {
+		*errp = pg_error_new("cannot create LPM table");
+		return -1;
+	}
+	prefixes->addr_size = addr_size;
+	memset(prefixes->used, 0, sizeof(prefixes->used));
+	return 0;
+}
+
+static int antispoof_prefixes_add(struct antispoof_prefixes *prefixes,
+				  const void *addr, uint8_t prefix_len,
+				  struct pg_error **errp)
+{
+	if (prefix_len > prefixes->addr_size * 8) {
+		*errp = pg_error_new("invalid prefix length %u", prefix_len);
+		return -1;
+	}
+	/* the value only tells that a prefix matched */
+	if (lpm_insert(prefixes->lpm, addr, prefixes->addr_size, prefix_len,
+		       prefixes) < 0) {
+		*errp = pg_error_new("cannot insert prefix");
+		return -1;
+	}
+	prefixes->used[prefix_len] = true;
+	return 0;
+}
+
+static int antispoof_prefixes_del(struct antispoof_prefixes *prefixes,
+				  const void *addr, uint8_t prefix_len,
+				  struct pg_error **errp)
+{
+	/* liblpm can't remove a prefix length it never had */
+	if (prefix_len > prefixes->addr_size * 8 ||
+	    !prefixes->used[prefix_len] ||
+	    lpm_remove(prefixes->lpm, addr, prefixes->addr_size,
+		       prefix_len) < 0) {
+		*errp = pg_error_new("prefix not found");
+		return -1;
+	}
+	return 0;
+}
+
+static void antispoof_prefixes_clear(struct antispoof_prefixes *prefixes)
+{
+	lpm_clear(prefixes->lpm, NULL, NULL);
+	memset(prefixes->used, 0, sizeof(prefixes->used));
+}
+
+void pg_antispoof_ip_enable(struct pg_brick *brick)
+{
+	pg_brick_get_state(brick, struct pg_antispoof_state)->ip_enabled =
+		true;
+}
+
+int pg_antispoof_ipv4_add(struct pg_brick *brick, uint32_t ip,
+			  uint8_t prefix_len, struct pg_error **errp)
+{
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+
+	return antispoof_prefixes_add(&state->prefixes4, &ip, prefix_len,
+				      errp);
+}
+
+int pg_antispoof_ipv4_del(struct pg_brick *brick, uint32_t ip,
+			  uint8_t prefix_len, struct pg_error **errp)
+{
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+
+	return antispoof_prefixes_del(&state->prefixes4, &ip, prefix_len,
+				      errp);
+}
+
+int pg_antispoof_ipv6_add(struct pg_brick *brick, uint8_t *ip,
+			  uint8_t prefix_len, struct pg_error **errp)
+{
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+
+	return antispoof_prefixes_add(&state->prefixes6, ip, prefix_len,
+				      errp);
+}
+
+int pg_antispoof_ipv6_del(struct pg_brick *brick, uint8_t *ip,
+			  uint8_t prefix_len, struct pg_error **errp)
+{
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+
+	return antispoof_prefixes_del(&state->prefixes6, ip, prefix_len,
+				      errp);
+}
+
+void pg_antispoof_ip_del_all(struct pg_brick *brick)
+{
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+
+	antispoof_prefixes_clear(&state->prefixes4);
+	antispoof_prefixes_clear(&state->prefixes6);
+}
+
+void pg_antispoof_ip_disable(struct pg_brick *brick)
+{
+	pg_brick_get_state(brick, struct pg_antispoof_state)->ip_enabled =
+		false;
+}
+
+/*
+ * Check the sources of the IPv4 packets of a burst, once all packets have
+ * been parsed. Packets of a VM mostly share the same source, so a source
+ * is only looked up when it changes.
+ *
+ * @return	mask of spoofed packets
+ */
+static inline uint64_t antispoof_ipv4(struct pg_antispoof_state *state,
+				      struct rte_mbuf **pkts, uint64_t mask)
+{
+	uint64_t spoofed = 0;
+	uint32_t last = 0;
+	bool allowed = false;
+	bool first = true;
+
+	PG_FOREACH_BIT(mask, i) {
+		struct ipv4_hdr *ip = pg_utils_get_l3(pkts[i]);
+
+		if (first || ip->src_addr != last) {
+			last = ip->src_addr;
+			allowed = lpm_lookup(state->prefixes4.lpm, &last,
+					     sizeof(last)) != NULL;
+			first = false;
+		}
+		if (unlikely(!allowed))
+			spoofed |= ONE64 << i;
+	}
+	return spoofed;
+}
+
+static inline uint64_t antispoof_ipv6(struct pg_antispoof_state *state,
+				      struct rte_mbuf **pkts, uint64_t mask)
+{
+	uint64_t spoofed = 0;
+	uint8_t last[16];
+	bool allowed = false;
+	bool first = true;
+
+	PG_FOREACH_BIT(mask, i) {
+		struct ipv6_hdr *ip = pg_utils_get_l3(pkts[i]);
+
+		if (first || memcmp(ip->src_addr, last, sizeof(last))) {
+			memcpy(last, ip->src_addr, sizeof(last));
+			allowed = lpm_lookup(state->prefixes6.lpm, last,
+					     sizeof(last)) != NULL;
+			first = false;
+		}
+		if (unlikely(!allowed))
+			spoofed |= ONE64 << i;
+	}
+	return spoofed;
+}
+
 static int antispoof_burst(struct pg_brick *brick, enum pg_side from,
 			   uint16_t edge_index, struct rte_mbuf **pkts,
 			   uint64_t pkts_mask,
@@ -330,6 +571,9 @@ static int antispoof_burst(struct pg_brick *brick, enum pg_side from,
 	struct pg_brick_side *s;
 	struct ether_hdr *eth;
 	uint16_t etype;
+	uint64_t in_mask = pkts_mask;
+	uint64_t ip4_mask = 0;
+	uint64_t ip6_mask = 0;
 	uint64_t it_mask;
 	uint64_t bit;
 	uint16_t i;
@@ -346,6 +590,7 @@ static int antispoof_burst(struct pg_brick *brick, enum pg_side from,
 	for (; it_mask;) {
 		pg_low_bit_iterate_full(it_mask, bit, i);
 		eth = rte_pktmbuf_mtod(pkts[i], struct ether_hdr*);
+		pg_utils_parse(pkts[i]);
 		etype = pg_utils_get_ether_type(pkts[i]);
 
 		/* MAC antispoof */
@@ -362,7 +607,23 @@ static int antispoof_burst(struct pg_brick *brick, enum pg_side from,
 			 unlikely(etype == PG_BE_ETHER_TYPE_IPv6) &&
 			 antispoof_ndp(state, pkts[i]) < 0)
 			pkts_mask &= ~bit;
+		else if (state->ip_enabled &&
+			 unlikely(pg_utils_is_bad_ip(pkts[i])))
+			pkts_mask &= ~bit;
+		else if (state->ip_enabled &&
+			 RTE_ETH_IS_IPV4_HDR(pkts[i]->packet_type))
+			ip4_mask |= bit;
+		else if (state->ip_enabled &&
+			 RTE_ETH_IS_IPV6_HDR(pkts[i]->packet_type))
+			ip6_mask |= bit;
 	}
+	if (ip4_mask)
+		pkts_mask &= ~antispoof_ipv4(state, pkts, ip4_mask);
+	if (ip6_mask)
+		pkts_mask &= ~antispoof_ipv6(state, pkts, ip6_mask);
+	if (unlikely(pkts_mask != in_mask))
+		pg_brick_count_drops(brick, from, PG_DROP_FILTERED,
+				     pg_mask_count(in_mask & ~pkts_mask));
 	if (unlikely(pkts_mask == 0))
 		return 0;
 forward:
@@ -384,10 +645,37 @@ static int antispoof_init(struct pg_brick *brick,
 	state->outside = antispoof_config->outside;
 	rte_memcpy(&state->mac, &antispoof_config->mac, ETHER_ADDR_LEN);
 	state->arp_enabled = false;
-	state->arps_size = 0;
+
+	/* let's start the pre-build of ARP anti-spoof */
+	state->arp_ref.ar_hrd = rte_cpu_to_be_16(1);
+	state->arp_ref.ar_pro = PG_BE_ETHER_TYPE_IPv4;
+	state->arp_ref.ar_hln = ETHER_ADDR_LEN;
+	state->arp_ref.ar_pln = 4;
+	rte_memcpy(&state->arp_ref.sender_mac, &state->mac, ETHER_ADDR_LEN);
+
+	if (antispoof_prefixes_init(&state->prefixes4, sizeof(uint32_t),
+				    errp) < 0)
+		return -1;
+	if (antispoof_prefixes_init(&state->prefixes6, 16, errp) < 0) {
+		lpm_destroy(state->prefixes4.lpm);
+		return -1;
+	}
+	antispoof_set_init(&state->arps, sizeof(uint32_t));
+	antispoof_set_init(&state->ndps, 16);
 	return 0;
 }
 
+static void antispoof_destroy(struct pg_brick *brick, struct pg_error **errp)
+{
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+
+	antispoof_set_free(&state->arps);
+	antispoof_set_free(&state->ndps);
+	lpm_destroy(state->prefixes4.lpm);
+	lpm_destroy(state->prefixes6.lpm);
+}
+
 struct pg_brick *pg_antispoof_new(const char *name,
 				  enum pg_side outside,
 				  struct ether_addr *mac,
@@ -407,10 +695,8 @@ static struct pg_brick_ops antispoof_ops = {
 	.name		= "antispoof",
 	.state_size	= sizeof(struct pg_antispoof_state),
 	.init		= antispoof_init,
+	.destroy	= antispoof_destroy,
 	.unlink		= pg_brick_generic_unlink,
 };
 
 pg_brick_register(antispoof, &antispoof_ops);
-
-#undef NPD_MAX
-#undef ARP_MAX
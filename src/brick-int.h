@@ -58,7 +58,14 @@ struct pg_brick_edge {
 };
 
 struct pg_brick_side {
-	rte_atomic64_t packet_count;	/* incoming pkts count */
+	/* Datapath counters, only written by the thread running the brick.
+	 * stats_seq is odd while they are updated, see pg_brick_stats_get.
+	 * There must be a single writer: a side receiving bursts from
+	 * several threads at once gets corrupted counters.
+	 */
+	uint32_t stats_seq;
+	struct pg_brick_stats stats;
+	struct pg_brick_stats *edges_stats;	/* multipoles only */
 	/* Optional callback to set to get the number of packets which has been
 	 * bursted/enqueue. Default: NULL.
 	 */
@@ -79,6 +86,20 @@ struct pg_brick_side {
 };
 
 
+#ifdef PG_BRICK_PROFILING
+#define PG_PROFILE_HIST_SIZE 16
+
+/* Cycles spent in a brick, see pg_graph_profile_dump */
+struct pg_brick_profile {
+	uint64_t calls;
+	uint64_t pkts;
+	uint64_t cycles;		/* including downstream bricks */
+	uint64_t self_cycles;
+	/* calls by log2 of self cycles per packet */
+	uint64_t hist[PG_PROFILE_HIST_SIZE];
+};
+#endif /* PG_BRICK_PROFILING */
+
 /**
  * Brick State
  *
@@ -111,6 +132,10 @@ struct pg_brick {
 		struct pg_brick_side sides[PG_MAX_SIDE];
 		struct pg_brick_side side;
 	};
+
+#ifdef PG_BRICK_PROFILING
+	struct pg_brick_profile profile;
+#endif
 };
 
 
@@ -238,6 +263,37 @@ int pg_brick_side_forward(struct pg_brick_side *brick_side, enum pg_side from,
 			  struct rte_mbuf **pkts, uint64_t pkts_mask,
 			  struct pg_error **errp);
 
+static inline void pg_brick_stats_write_begin(struct pg_brick_side *side)
+{
+	side->stats_seq++;
+	rte_smp_wmb();
+}
+
+static inline void pg_brick_stats_write_end(struct pg_brick_side *side)
+{
+	rte_smp_wmb();
+	side->stats_seq++;
+}
+
+/**
+ * Count packets dropped by a brick
+ * @brick:	the brick dropping packets
+ * @side:	side the packets were received on
+ * @reason:	why they were dropped
+ * @nb:		number of dropped packets
+ */
+static inline void pg_brick_count_drops(struct pg_brick *brick,
+					enum pg_side side,
+					enum pg_drop_reason reason,
+					uint64_t nb)
+{
+	struct pg_brick_side *s = &brick->sides[side];
+
+	pg_brick_stats_write_begin(s);
+	s->stats.drops[reason] += nb;
+	pg_brick_stats_write_end(s);
+}
+
 /**
  * Get the edge of a brick.
  * @brick:	the brick
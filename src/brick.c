@@ -19,8 +19,10 @@
  * the public brick API function implementations.
  */
 
+#include <errno.h>
 #include <string.h>
 #include <glib.h>
+#include <rte_cycles.h>
 #include <packetgraph/packetgraph.h>
 #include "brick-int.h"
 #include "utils/bitmask.h"
@@ -63,6 +65,9 @@ static int alloc_edges(struct pg_brick *brick, struct pg_error **errp)
 			} else {
 				side->edges = g_new0(struct pg_brick_edge,
 						     side->max);
+				side->edges_stats =
+					g_new0(struct pg_brick_stats,
+					       side->max);
 			}
 		} else {
 			side->edge.link = NULL;
@@ -91,13 +96,18 @@ static void zero_brick_counters(struct pg_brick *brick)
 {
 	enum pg_side i;
 
-	for (i = 0; i < PG_MAX_SIDE; ++i)
-		rte_atomic64_set(&brick->sides[i].packet_count, 0);
+	for (i = 0; i < PG_MAX_SIDE; ++i) {
+		brick->sides[i].stats_seq = 0;
+		memset(&brick->sides[i].stats, 0,
+		       sizeof(struct pg_brick_stats));
+	}
 }
 
 /* Convenient macro to get a pointer to brick ops */
 #define pg_brick_get(it) ((struct pg_brick_ops *)(it->data))
 
+#define PG_BRICK_STATS_RETRIES 4096
+
 static int check_side_max(struct pg_brick_config *config,
 			  struct pg_error **errp)
 {
@@ -255,8 +265,10 @@ struct pg_brick *pg_brick_decref(struct pg_brick *brick, struct pg_error **errp)
 		brick->ops->destroy(brick, errp);
 
 	if (brick->type == PG_MULTIPOLE) {
-		for (int i = 0; i < PG_MAX_SIDE; i++)
+		for (int i = 0; i < PG_MAX_SIDE; i++) {
 			g_free(brick->sides[i].edges);
+			g_free(brick->sides[i].edges_stats);
+		}
 	}
 
 	g_free(brick->name);
@@ -404,6 +416,10 @@ static uint16_t insert_link(struct pg_brick *from,
 				s->nb++;
 				pg_brick_incref(to);
 				s->edges[i].link = to;
+				pg_brick_stats_write_begin(s);
+				memset(&s->edges_stats[i], 0,
+				       sizeof(struct pg_brick_stats));
+				pg_brick_stats_write_end(s);
 				return i;
 			}
 		}
@@ -609,17 +625,117 @@ void pg_brick_generic_unlink(struct pg_brick *brick, struct pg_error **errp)
  * function.
  */
 
+static inline void stats_add(struct pg_brick_stats *stats,
+			     uint64_t nb, uint64_t bytes, int in)
+{
+	if (in) {
+		stats->pkts_in += nb;
+		stats->bytes_in += bytes;
+		stats->bursts_in++;
+	} else {
+		stats->pkts_out += nb;
+		stats->bytes_out += bytes;
+		stats->bursts_out++;
+	}
+}
+
+static inline void side_stats_add(struct pg_brick *brick, enum pg_side side,
+				  uint32_t edge_index, uint64_t nb,
+				  uint64_t bytes, int in)
+{
+	struct pg_brick_side *s = &brick->sides[side];
+
+	pg_brick_stats_write_begin(s);
+	stats_add(&s->stats, nb, bytes, in);
+	if (brick->type == PG_MULTIPOLE && edge_index < s->max)
+		stats_add(&s->edges_stats[edge_index], nb, bytes, in);
+	pg_brick_stats_write_end(s);
+}
+
+/*
+ * Packets arrive on the @from side of @brick, and leave the opposite side
+ * of the brick linked to that edge.
+ */
+static inline void count_burst(struct pg_brick *brick, enum pg_side from,
+			       uint16_t edge_index, struct rte_mbuf **pkts,
+			       uint64_t pkts_mask)
+{
+	struct pg_brick_edge *edge = NULL;
+	uint64_t nb = pg_mask_count(pkts_mask);
+	uint64_t bytes = 0;
+
+	PG_FOREACH_BIT(pkts_mask, it)
+		bytes += pkts[it]->pkt_len;
+
+	side_stats_add(brick, from, edge_index, nb, bytes, 1);
+	if (brick->type != PG_MULTIPOLE ||
+	    edge_index < brick->sides[from].max)
+		edge = pg_brick_get_edge(brick, from, edge_index);
+	if (edge && edge->link)
+		side_stats_add(edge->link, pg_flip_side(from),
+			       edge->pair_index, nb, bytes, 0);
+}
+
+#ifdef PG_BRICK_PROFILING
+
+/* cycles spent in the bricks called by the one currently profiled */
+static __thread uint64_t profile_children_cycles;
+
+static inline uint64_t profile_start(uint64_t *start)
+{
+	uint64_t parent_children_cycles = profile_children_cycles;
+
+	profile_children_cycles = 0;
+	*start = rte_rdtsc();
+	return parent_children_cycles;
+}
+
+static inline void profile_end(struct pg_brick *brick, uint64_t nb,
+			       uint64_t start, uint64_t parent_children_cycles)
+{
+	struct pg_brick_profile *p = &brick->profile;
+	uint64_t cycles = rte_rdtsc() - start;
+	uint64_t self = cycles - profile_children_cycles;
+
+	p->calls++;
+	p->pkts += nb;
+	p->cycles += cycles;
+	p->self_cycles += self;
+	if (nb) {
+		uint64_t per_pkt = self / nb;
+		int bucket = per_pkt ? pg_last_bit_pos(per_pkt) : 0;
+
+		if (bucket >= PG_PROFILE_HIST_SIZE)
+			bucket = PG_PROFILE_HIST_SIZE - 1;
+		p->hist[bucket]++;
+	}
+	/* our whole time is downstream time for the caller */
+	profile_children_cycles = parent_children_cycles + cycles;
+}
+
+#endif /* PG_BRICK_PROFILING */
+
 inline int pg_brick_burst(struct pg_brick *brick, enum pg_side from,
 			  uint16_t edge_index, struct rte_mbuf **pkts,
 			  uint64_t pkts_mask, struct pg_error **errp)
 {
+#ifdef PG_BRICK_PROFILING
+	uint64_t start, parent_children_cycles;
+	int ret;
+#endif
+
 	if (unlikely(!brick))
 		return 0;
-	/* @from is the opposite side of the direction on which
-	* we send the packets, so we flip it */
-	rte_atomic64_add(&brick->sides[pg_flip_side(from)].packet_count,
-			 pg_mask_count(pkts_mask));
+	count_burst(brick, from, edge_index, pkts, pkts_mask);
+#ifdef PG_BRICK_PROFILING
+	parent_children_cycles = profile_start(&start);
+	ret = brick->burst(brick, from, edge_index, pkts, pkts_mask, errp);
+	profile_end(brick, pg_mask_count(pkts_mask), start,
+		    parent_children_cycles);
+	return ret;
+#else
 	return brick->burst(brick, from, edge_index, pkts, pkts_mask, errp);
+#endif
 }
 
 inline int pg_brick_burst_to_east(struct pg_brick *brick, uint16_t edge_index,
@@ -651,7 +767,18 @@ int pg_brick_poll(struct pg_brick *brick,
 		return -1;
 	}
 
+#ifdef PG_BRICK_PROFILING
+	uint64_t start, parent_children_cycles;
+	int ret;
+
+	*count = 0;
+	parent_children_cycles = profile_start(&start);
+	ret = brick->poll(brick, count, errp);
+	profile_end(brick, *count, start, parent_children_cycles);
+	return ret;
+#else
 	return brick->poll(brick, count, errp);
+#endif
 }
 
 bool pg_brick_pollable(struct pg_brick *brick)
@@ -717,7 +844,58 @@ uint64_t pg_brick_pkts_count_get(struct pg_brick *brick, enum pg_side side)
 {
 	if (!brick)
 		return 0;
-	return rte_atomic64_read(&brick->sides[side].packet_count);
+	/* packets going toward @side were received on the other side */
+	return brick->sides[pg_flip_side(side)].stats.pkts_in;
+}
+
+int pg_brick_stats_get(struct pg_brick *brick, enum pg_side side, int edge,
+		       struct pg_brick_stats *stats, struct pg_error **errp)
+{
+	struct pg_brick_side *s;
+	const struct pg_brick_stats *src;
+	uint32_t seq;
+
+	if (!brick) {
+		*errp = pg_error_new("brick is NULL");
+		return -1;
+	}
+	if (side >= PG_MAX_SIDE) {
+		*errp = pg_error_new("invalid side %i", side);
+		return -1;
+	}
+	s = &brick->sides[side];
+	if (edge < 0 || brick->type != PG_MULTIPOLE) {
+		/* other bricks have a single edge per side */
+		if (edge > 0) {
+			*errp = pg_error_new("invalid edge %i", edge);
+			return -1;
+		}
+		src = &s->stats;
+	} else if (edge < s->max) {
+		src = &s->edges_stats[edge];
+	} else {
+		*errp = pg_error_new("invalid edge %i", edge);
+		return -1;
+	}
+
+	/* don't spin forever if the writer is preempted or if two threads
+	 * wrongly update the same side
+	 */
+	for (int i = 0; i < PG_BRICK_STATS_RETRIES; i++) {
+		seq = *(volatile uint32_t *)&s->stats_seq;
+		if (seq & 1) {
+			rte_pause();
+			continue;
+		}
+		rte_smp_rmb();
+		*stats = *src;
+		rte_smp_rmb();
+		if (seq == *(volatile uint32_t *)&s->stats_seq)
+			return 0;
+	}
+	*errp = pg_error_new_errno(EAGAIN, "counters of side %i are busy",
+				   side);
+	return -1;
 }
 
 uint64_t pg_brick_rx_bytes(struct pg_brick *brick)
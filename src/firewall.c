@@ -17,54 +17,125 @@
 #include <glib.h>
 #include <rte_config.h>
 #include <rte_ether.h>
+#include <rte_prefetch.h>
 #include <pcap/pcap.h>
 #include <endian.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/socket.h>
 
 #include <packetgraph/packetgraph.h>
 #include "utils/bitmask.h"
 #include "brick-int.h"
 #include "packets.h"
 #include "utils/network.h"
+/* NPF BPF coprocessor calls, see npf_bpf.c */
+#define NPF_BPFCOP
 #include "src/npf/npf/dpdk/npf_dpdk.h"
+#include <bpf-compat.h>
 
 #define FIREWALL_SIDE_TO_NPF(side) \
 	((side) == PG_WEST_SIDE ? PFIL_OUT : PFIL_IN)
 
+/* rules which can be changed without reload */
+#define FIREWALL_DYNAMIC_GROUP "pg-dynamic"
+
+/* SRC_FLAG_BIT of npf_bpf.c, look up the source address in tables */
+#define FIREWALL_COP_TABLE_SRC (1U << 31)
+
+/* must be a power of two */
+#define FIREWALL_FLOW_BUCKETS 4096
+#define FIREWALL_FLOW_WAYS 2
+
 uint32_t pg_npf_nworkers = 1;
 
 struct ifnet;
 
-struct pg_firewall_state {
-	struct pg_brick brick;
+struct firewall_table {
+	gchar *name;
+	nl_table_t *table;
+};
+
+struct firewall_flow_key {
+	/* source then destination, IPv4 only uses the first two */
+	uint32_t addrs[8];
+	uint32_t ports;
+	uint32_t side;
+};
+
+struct firewall_flow {
+	struct firewall_flow_key key;
+	/* NPF connection generation when the entry was added */
+	uint64_t gen;
+	struct npf_conn *conn;
+};
+
+struct firewall_flow_bucket {
+	/* most recently added first */
+	struct firewall_flow ways[FIREWALL_FLOW_WAYS];
+};
+
+/* NPF instance and configuration, shared by the bricks of
+ * pg_firewall_new_shared()
+ */
+struct firewall_shared {
 	npf_t *npf;
 	struct ifnet *ifp;
 	GList *rules;
+	/* NPF tables, the id of a table is its position */
+	GList *tables;
+	/* group of the rules inserted without reload */
+	nl_rule_t *dynamic;
+	/* number of bricks using it */
+	int users;
+};
+
+struct pg_firewall_state {
+	struct pg_brick brick;
+	struct firewall_shared *shared;
+	/* established connections which can skip NPF, NULL if disabled */
+	struct firewall_flow_bucket *flows;
+	uint64_t flow_hits;
+	uint64_t flow_misses;
+	/* burst scratch space, a brick is burst by one thread at a time */
+	struct firewall_flow_key keys[PG_MAX_PKTS_BURST];
+	struct firewall_flow_bucket *buckets[PG_MAX_PKTS_BURST];
+	/* packets handed to NPF, with their index in the burst */
+	struct rte_mbuf *npf_pkts[PG_MAX_PKTS_BURST];
+	struct npf_conn *npf_conns[PG_MAX_PKTS_BURST];
+	uint16_t npf_idx[PG_MAX_PKTS_BURST];
 };
 
 struct pg_firewall_config {
 	int flags;
+	/* NULL to create a new NPF instance */
+	struct firewall_shared *shared;
 };
 
 static uint64_t nb_firewall;
 
-static struct pg_brick_config *firewall_config_new(const char *name, int flags)
+static struct pg_brick_config *
+firewall_config_new(const char *name, int flags,
+		    struct firewall_shared *shared)
 {
 	struct pg_brick_config *config = g_new0(struct pg_brick_config, 1);
 	struct pg_firewall_config *firewall_config =
 		g_new0(struct pg_firewall_config, 1);
 
 	firewall_config->flags = flags;
+	firewall_config->shared = shared;
 	config->brick_config = (void *) firewall_config;
 	return pg_brick_config_init(config, name, 1, 1, PG_DIPOLE);
 }
 
-void pg_firewall_gc(struct pg_brick *brick)
+static inline struct firewall_shared *firewall_shared(struct pg_brick *brick)
 {
-	struct pg_firewall_state *state;
+	return pg_brick_get_state(brick, struct pg_firewall_state)->shared;
+}
 
-	state = pg_brick_get_state(brick,
-				   struct pg_firewall_state);
-	npf_gc(state->npf);
+void pg_firewall_gc(struct pg_brick *brick)
+{
+	npf_gc(firewall_shared(brick)->npf);
 }
 
 static int firewall_build_pcap_filter(nl_rule_t *rl, const char *filter)
@@ -88,6 +159,24 @@ static int firewall_build_pcap_filter(nl_rule_t *rl, const char *filter)
 	return 0;
 }
 
+static int firewall_build_table_filter(nl_rule_t *rl, uint32_t tid,
+				       int source)
+{
+	struct bpf_insn insns[] = {
+		/* A <- IP version, 0 if NPF could not parse the packet */
+		BPF_STMT(BPF_MISC + BPF_COP, NPF_COP_L3),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0, 3, 0),
+		/* A <- 1 if the address is in the table */
+		BPF_STMT(BPF_LD + BPF_IMM,
+			 tid | (source ? FIREWALL_COP_TABLE_SRC : 0)),
+		BPF_STMT(BPF_MISC + BPF_COP, NPF_COP_TABLE),
+		BPF_STMT(BPF_RET + BPF_A, 0),
+		BPF_STMT(BPF_RET + BPF_K, 0),
+	};
+
+	return npf_rule_setcode(rl, NPF_CODE_BPF, insns, sizeof(insns));
+}
+
 static inline int firewall_side_to_npf_rule(enum pg_side side)
 {
 	switch (side) {
@@ -97,14 +186,12 @@ static inline int firewall_side_to_npf_rule(enum pg_side side)
 	}
 }
 
-int pg_firewall_rule_add(struct pg_brick *brick, const char *filter,
-			 enum pg_side dir, int stateful, struct pg_error **errp)
+static nl_rule_t *firewall_rule_new(const char *filter, enum pg_side dir,
+				    int stateful, int options,
+				    struct pg_error **errp)
 {
-	struct pg_firewall_state *state;
-	struct nl_rule *rule;
-	int options = 0;
+	nl_rule_t *rule;
 
-	state = pg_brick_get_state(brick, struct pg_firewall_state);
 	options |= firewall_side_to_npf_rule(dir);
 	if (stateful)
 		options |= NPF_RULE_STATEFUL;
@@ -114,30 +201,180 @@ int pg_firewall_rule_add(struct pg_brick *brick, const char *filter,
 	if (filter && firewall_build_pcap_filter(rule, filter)) {
 		*errp = pg_error_new("this filter failed to build: %s",
 				     filter);
+		npf_rule_destroy(rule);
+		return NULL;
+	}
+	return rule;
+}
+
+int pg_firewall_rule_add(struct pg_brick *brick, const char *filter,
+			 enum pg_side dir, int stateful, struct pg_error **errp)
+{
+	struct firewall_shared *shared = firewall_shared(brick);
+	struct nl_rule *rule;
+
+	rule = firewall_rule_new(filter, dir, stateful, 0, errp);
+	if (!rule)
+		return -1;
+	shared->rules = g_list_append(shared->rules, rule);
+	return 0;
+}
+
+int pg_firewall_rule_add_table(struct pg_brick *brick, const char *table,
+			       int source, enum pg_side dir, int stateful,
+			       struct pg_error **errp)
+{
+	struct firewall_shared *shared = firewall_shared(brick);
+	struct nl_rule *rule;
+	GList *it;
+	int tid = 0;
+	int ret;
+
+	for (it = shared->tables; it != NULL; it = g_list_next(it), tid++) {
+		struct firewall_table *t = it->data;
+
+		if (!g_strcmp0(t->name, table))
+			break;
+	}
+	if (!it) {
+		struct firewall_table *t = g_new0(struct firewall_table, 1);
+
+		t->table = npf_table_create(table, tid, NPF_TABLE_TREE);
+		if (!t->table) {
+			*errp = pg_error_new("NPF failed to create table %s",
+					     table);
+			g_free(t);
+			return -1;
+		}
+		t->name = g_strdup(table);
+		shared->tables = g_list_append(shared->tables, t);
+	}
+
+	rule = firewall_rule_new(NULL, dir, stateful, 0, errp);
+	if (!rule)
+		return -1;
+	ret = firewall_build_table_filter(rule, tid, source);
+	if (ret) {
+		*errp = pg_error_new_errno(ret,
+					   "failed to build filter of table %s",
+					   table);
+		npf_rule_destroy(rule);
+		return -1;
+	}
+	shared->rules = g_list_append(shared->rules, rule);
+	return 0;
+}
+
+int pg_firewall_rule_insert(struct pg_brick *brick, const char *filter,
+			    enum pg_side dir, int stateful, uint64_t *id,
+			    struct pg_error **errp)
+{
+	struct nl_rule *rule;
+	int ret;
+
+	rule = firewall_rule_new(filter, dir, stateful, NPF_RULE_DYNAMIC,
+				 errp);
+	if (!rule)
+		return -1;
+	ret = npf_dynrule_add(firewall_shared(brick)->npf,
+			      FIREWALL_DYNAMIC_GROUP,
+			      npf_rule_build(rule), id);
+	npf_rule_destroy(rule);
+	if (ret) {
+		*errp = pg_error_new_errno(ret, "NPF failed to insert rule");
 		return -1;
 	}
-	state->rules = g_list_append(state->rules, rule);
 	return 0;
 }
 
+int pg_firewall_rule_remove(struct pg_brick *brick, uint64_t id,
+			    struct pg_error **errp)
+{
+	int ret;
+
+	ret = npf_dynrule_remove(firewall_shared(brick)->npf,
+				 FIREWALL_DYNAMIC_GROUP, id);
+	if (ret) {
+		*errp = pg_error_new_errno(ret, "NPF failed to remove rule %"
+					   PRIu64, id);
+		return -1;
+	}
+	return 0;
+}
+
+static int firewall_table_ctl(struct pg_brick *brick, int cmd,
+			      const char *table, int family,
+			      const void *addr, uint8_t prefix_len,
+			      struct pg_error **errp)
+{
+	npf_ioctl_table_t nct = {
+		.nct_cmd = cmd,
+		.nct_name = table,
+	};
+	int alen;
+	int ret;
+
+	switch (family) {
+	case AF_INET:
+		alen = 4;
+		break;
+	case AF_INET6:
+		alen = 16;
+		break;
+	default:
+		*errp = pg_error_new("unsupported address family %i", family);
+		return -1;
+	}
+	if (prefix_len > alen * 8) {
+		*errp = pg_error_new("invalid prefix length %u", prefix_len);
+		return -1;
+	}
+	nct.nct_data.ent.alen = alen;
+	memcpy(&nct.nct_data.ent.addr, addr, alen);
+	nct.nct_data.ent.mask = prefix_len;
+
+	ret = npf_table_ctl(firewall_shared(brick)->npf, &nct);
+	if (ret) {
+		*errp = pg_error_new_errno(ret, "NPF failed to update table %s",
+					   table);
+		return -1;
+	}
+	return 0;
+}
+
+int pg_firewall_table_add(struct pg_brick *brick, const char *table,
+			  int family, const void *addr, uint8_t prefix_len,
+			  struct pg_error **errp)
+{
+	return firewall_table_ctl(brick, NPF_CMD_TABLE_ADD, table, family,
+				  addr, prefix_len, errp);
+}
+
+int pg_firewall_table_remove(struct pg_brick *brick, const char *table,
+			     int family, const void *addr, uint8_t prefix_len,
+			     struct pg_error **errp)
+{
+	return firewall_table_ctl(brick, NPF_CMD_TABLE_REMOVE, table, family,
+				  addr, prefix_len, errp);
+}
+
 void pg_firewall_rule_flush(struct pg_brick *brick)
 {
-	struct pg_firewall_state *state;
+	struct firewall_shared *shared = firewall_shared(brick);
 	GList *it;
 
-	state = pg_brick_get_state(brick, struct pg_firewall_state);
 	/* clean all rules */
-	it = state->rules;
+	it = shared->rules;
 	while (it) {
 		npf_rule_destroy(it->data);
 		it = g_list_next(it);
 	}
 	/* flush list */
-	g_list_free(state->rules);
-	state->rules = NULL;
+	g_list_free(shared->rules);
+	shared->rules = NULL;
 }
 
-static int firewall_reload_internal(struct pg_firewall_state *state,
+static int firewall_reload_internal(struct firewall_shared *shared,
 				    struct pg_error **errp)
 {
 	npf_error_t errinfo;
@@ -148,14 +385,26 @@ static int firewall_reload_internal(struct pg_firewall_state *state,
 
 	config = npf_config_create();
 
-	it = state->rules;
+	it = shared->rules;
 	while (it != NULL) {
 		npf_rule_insert(config, NULL, it->data);
 		it = g_list_next(it);
 	}
 
+	/* NPF keeps the entries of our (empty) tables and the rules of the
+	 * dynamic group across reloads.
+	 */
+	it = shared->tables;
+	while (it != NULL) {
+		struct firewall_table *t = it->data;
+
+		npf_table_insert(config, t->table);
+		it = g_list_next(it);
+	}
+	npf_rule_insert(config, NULL, shared->dynamic);
+
 	config_build = npf_config_build(config);
-	npf_ret = npf_load(state->npf, config_build, &errinfo);
+	npf_ret = npf_load(shared->npf, config_build, &errinfo);
 	npf_config_destroy(config);
 	if (npf_ret != 0) {
 		*errp = pg_error_new_errno(npf_ret,
@@ -167,9 +416,7 @@ static int firewall_reload_internal(struct pg_firewall_state *state,
 
 int pg_firewall_reload(struct pg_brick *brick, struct pg_error **errp)
 {
-	struct pg_firewall_state *state =
-		pg_brick_get_state(brick, struct pg_firewall_state);
-	return firewall_reload_internal(state, errp);
+	return firewall_reload_internal(firewall_shared(brick), errp);
 }
 
 struct pg_brick *pg_firewall_new(const char *name, uint64_t flags,
@@ -178,12 +425,94 @@ struct pg_brick *pg_firewall_new(const char *name, uint64_t flags,
 	struct pg_brick_config *config;
 	struct pg_brick *ret;
 
-	config = firewall_config_new(name, flags);
+	config = firewall_config_new(name, flags, NULL);
 	ret = pg_brick_new("firewall", config, errp);
 	pg_brick_config_free(config);
 	return ret;
 }
 
+int pg_firewall_new_shared(const char *name, uint16_t nb_bricks,
+			   uint64_t flags, struct pg_brick **fws,
+			   struct pg_error **errp)
+{
+	struct firewall_shared *shared = NULL;
+	uint16_t i;
+
+	if (!nb_bricks) {
+		*errp = pg_error_new("At least one brick is needed");
+		return -1;
+	}
+	for (i = 0; i < nb_bricks; i++) {
+		gchar *fname = g_strdup_printf("%s-%u", name, i);
+		struct pg_brick_config *config =
+			firewall_config_new(fname, flags, shared);
+
+		fws[i] = pg_brick_new("firewall", config, errp);
+		pg_brick_config_free(config);
+		g_free(fname);
+		if (!fws[i])
+			goto error;
+		shared = firewall_shared(fws[i]);
+	}
+	return 0;
+error:
+	/* the last brick destroyed destroys the NPF instance */
+	while (i--)
+		pg_brick_destroy(fws[i]);
+	return -1;
+}
+
+static inline bool firewall_flow_key(struct rte_mbuf *pkt, enum pg_side side,
+				     struct firewall_flow_key *key)
+{
+	uint32_t ptype = pkt->packet_type;
+
+	if ((ptype & RTE_PTYPE_L4_MASK) != RTE_PTYPE_L4_UDP ||
+	    pkt->l2_len + pkt->l3_len + sizeof(uint32_t) >
+	    rte_pktmbuf_data_len(pkt))
+		return false;
+
+	if (RTE_ETH_IS_IPV4_HDR(ptype)) {
+		struct ipv4_hdr *ip = pg_utils_get_l3(pkt);
+
+		key->addrs[0] = ip->src_addr;
+		key->addrs[1] = ip->dst_addr;
+		memset(&key->addrs[2], 0, 6 * sizeof(uint32_t));
+	} else {
+		struct ipv6_hdr *ip = pg_utils_get_l3(pkt);
+
+		memcpy(key->addrs, ip->src_addr, sizeof(key->addrs));
+	}
+	key->ports = *(uint32_t *)pg_utils_get_l4(pkt);
+	key->side = side;
+	return true;
+}
+
+static inline struct firewall_flow *
+firewall_flow_lookup(struct firewall_flow_bucket *bucket,
+		     struct firewall_flow_key *key, uint64_t gen)
+{
+	for (int w = 0; w < FIREWALL_FLOW_WAYS; w++) {
+		struct firewall_flow *flow = &bucket->ways[w];
+
+		if (flow->gen == gen && flow->conn &&
+		    !memcmp(&flow->key, key, sizeof(*key)))
+			return flow;
+	}
+	return NULL;
+}
+
+static inline void firewall_flow_add(struct firewall_flow_bucket *bucket,
+				     struct firewall_flow_key *key,
+				     uint64_t gen, struct npf_conn *conn)
+{
+	memmove(&bucket->ways[1], &bucket->ways[0],
+		(FIREWALL_FLOW_WAYS - 1) * sizeof(struct firewall_flow));
+	bucket->ways[0].key = *key;
+	bucket->ways[0].gen = gen;
+	bucket->ways[0].conn = conn;
+}
+
 static int firewall_burst(struct pg_brick *brick, enum pg_side from,
 			  uint16_t edge_index, struct rte_mbuf **pkts,
 			  uint64_t pkts_mask,
@@ -191,99 +520,211 @@ static int firewall_burst(struct pg_brick *brick, enum pg_side from,
 {
 	struct pg_brick_side *s = &brick->sides[pg_flip_side(from)];
 	struct pg_firewall_state *state;
+	struct firewall_shared *shared;
 	int pf_side;
+	uint64_t in_mask = pkts_mask;
+	uint64_t flow_mask = 0;
 	uint64_t it_mask;
+	uint64_t passed;
 	uint64_t bit;
+	uint64_t gen;
+	uint64_t now = 0;
 	uint16_t i;
-	int ret;
+	uint16_t n = 0;
 	struct rte_mbuf *tmp;
-	uint16_t ether_type;
+	uint32_t ptype;
 
 	state = pg_brick_get_state(brick, struct pg_firewall_state);
+	shared = state->shared;
 	pf_side = FIREWALL_SIDE_TO_NPF(from);
 
+	/* Cached connections are only valid while the generation does not
+	 * change, it must be read after our last QSBR checkpoint.
+	 */
+	npf_thread_checkpoint(shared->npf);
+	gen = npf_conn_gen(shared->npf);
+
+	if (likely(state->flows != NULL)) {
+		PG_FOREACH_BIT(pkts_mask, j) {
+			pg_utils_parse(pkts[j]);
+			if (!firewall_flow_key(pkts[j], from, &state->keys[j]))
+				continue;
+			state->buckets[j] = &state->flows[
+				pg_utils_flow_hash(pkts[j]) &
+				(FIREWALL_FLOW_BUCKETS - 1)];
+			rte_prefetch0(state->buckets[j]);
+			flow_mask |= ONE64 << j;
+		}
+		if (flow_mask)
+			now = npf_conn_now();
+	}
+
 	it_mask = pkts_mask;
 	for (; it_mask;) {
 		pg_low_bit_iterate_full(it_mask, bit, i);
 		tmp = pkts[i];
-		ether_type = pg_utils_get_ether_type(tmp);
+		pg_utils_parse(tmp);
+		ptype = tmp->packet_type;
 
 		/* Firewall only manage IPv4 or IPv6 filtering.
-		 * Let non-ip packets (like ARP) pass.
+		 * Let non-ip packets (like ARP) pass, but not IP packets
+		 * whose header could not be parsed.
 		 */
-		if (unlikely(ether_type != PG_BE_ETHER_TYPE_IPv4 &&
-			     ether_type != PG_BE_ETHER_TYPE_IPv6)) {
+		if (unlikely(!RTE_ETH_IS_IPV4_HDR(ptype) &&
+			     !RTE_ETH_IS_IPV6_HDR(ptype))) {
+			if (pg_utils_is_bad_ip(tmp))
+				pkts_mask &= ~bit;
 			continue;
 		}
 
-		/* NPF only manage layer 3 so we temporaly cut off layer 2.
-		 * Note that this trick is not thread safe. To do so, we will
-		 * have to clone packets just for filtering and will have to
-		 * restroy cloned packets after handling them in NPF.
-		 * We directly modify data_off instead of calling
-		 * rte_pktmbuf_adj because it's faster
-		 */
-		tmp->data_off += tmp->l2_len;
-		ret = npf_packet_handler(state->npf,
-					 (struct mbuf **) &tmp,
-					 state->ifp,
-					 pf_side);
-		pkts[i]->data_off -= pkts[i]->l2_len;
-		if (ret)
+		if (flow_mask & bit) {
+			struct firewall_flow *flow =
+				firewall_flow_lookup(state->buckets[i],
+						     &state->keys[i], gen);
+
+			if (flow && npf_conn_fastpass(flow->conn, now)) {
+				state->flow_hits++;
+				continue;
+			}
+			state->flow_misses++;
+		}
+
+		/* NPF skips layer 2 using l2_len */
+		state->npf_pkts[n] = tmp;
+		state->npf_idx[n] = i;
+		n++;
+	}
+	if (n == 0)
+		goto forward;
+
+	passed = npf_packet_handler_burst(shared->npf,
+					  (struct mbuf **) state->npf_pkts, n,
+					  shared->ifp, pf_side,
+					  state->npf_conns);
+	for (uint16_t k = 0; k < n; k++) {
+		i = state->npf_idx[k];
+		bit = ONE64 << i;
+		if (!(passed & (ONE64 << k)))
 			pkts_mask &= ~bit;
+		else if (state->npf_conns[k] && (flow_mask & bit))
+			firewall_flow_add(state->buckets[i], &state->keys[i],
+					  gen, state->npf_conns[k]);
 	}
+forward:
+	/* let rule and connection updates go on while we do not burst */
+	npf_thread_offline(shared->npf);
+	if (unlikely(pkts_mask != in_mask))
+		pg_brick_count_drops(brick, from, PG_DROP_FILTERED,
+				     pg_mask_count(in_mask & ~pkts_mask));
 	if (unlikely(pkts_mask == 0))
 		return 0;
 	return pg_brick_burst(s->edge.link, from, s->edge.pair_index,
 			      pkts, pkts_mask, errp);
 }
 
-static int firewall_init(struct pg_brick *brick,
-			 struct pg_brick_config *config,
-			 struct pg_error **errp)
+void pg_firewall_flow_cache_stats(struct pg_brick *brick, uint64_t *hits,
+				  uint64_t *misses)
+{
+	struct pg_firewall_state *state =
+		pg_brick_get_state(brick, struct pg_firewall_state);
+
+	*hits = state->flow_hits;
+	*misses = state->flow_misses;
+}
+
+static struct firewall_shared *firewall_shared_new(uint64_t flags,
+						   struct pg_error **errp)
 {
 	/* Global counter for virtual interface. */
 	static uint32_t firewall_iface_cnt;
 
+	struct firewall_shared *shared;
+	int npf_flags = 0;
 	npf_t *npf;
-	struct pg_firewall_state *state;
-	struct pg_firewall_config *fw_config;
-
-	state = pg_brick_get_state(brick, struct pg_firewall_state);
 
-	fw_config = (struct pg_firewall_config *) config->brick_config;
-	/* initialize fast path */
-	brick->burst = firewall_burst;
 	/* init NPF configuration */
-	if (pg_npf_nworkers == 0 || fw_config->flags & PG_NO_CONN_WORKER)
-		fw_config->flags |= NPF_NO_GC;
+	if (pg_npf_nworkers == 0 || flags & PG_NO_CONN_WORKER)
+		npf_flags |= NPF_NO_GC;
+	if (flags & PG_NO_JIT)
+		npf_flags |= NPF_NO_JIT;
 	if (!nb_firewall) {
 		if (unlikely(npf_sysinit(pg_npf_nworkers) < 0)) {
 			*errp = pg_error_new("fail during npf initialisation");
-			return -1;
+			return NULL;
 		}
 	}
-	npf = npf_dpdk_create(fw_config->flags);
+	npf = npf_dpdk_create(npf_flags);
 	if (unlikely(!npf)) {
 		*errp = pg_error_new("fail to create npf");
-		return -1;
+		return NULL;
 	}
-	npf_thread_register(npf);
-	state->ifp = npf_dpdk_ifattach(npf, "firewall", firewall_iface_cnt++);
-	state->npf = npf;
-	state->rules = NULL;
+	shared = g_new0(struct firewall_shared, 1);
+	shared->ifp = npf_dpdk_ifattach(npf, "firewall", firewall_iface_cnt++);
+	shared->npf = npf;
+	shared->dynamic = npf_rule_create(FIREWALL_DYNAMIC_GROUP,
+					  NPF_RULE_GROUP | NPF_RULE_DYNAMIC |
+					  NPF_RULE_IN | NPF_RULE_OUT, NULL);
+	g_assert(shared->dynamic);
+	npf_rule_setprio(shared->dynamic, NPF_PRI_LAST);
+	shared->users = 1;
+	return shared;
+}
+
+static int firewall_init(struct pg_brick *brick,
+			 struct pg_brick_config *config,
+			 struct pg_error **errp)
+{
+	struct pg_firewall_state *state;
+	struct pg_firewall_config *fw_config;
+
+	state = pg_brick_get_state(brick, struct pg_firewall_state);
+
+	fw_config = (struct pg_firewall_config *) config->brick_config;
+	/* initialize fast path */
+	brick->burst = firewall_burst;
+	if (fw_config->shared) {
+		/* another brick of pg_firewall_new_shared() */
+		state->shared = fw_config->shared;
+		state->shared->users++;
+	} else {
+		state->shared = firewall_shared_new(fw_config->flags, errp);
+		if (!state->shared)
+			return -1;
+	}
+	if (!(fw_config->flags & PG_NO_FLOW_CACHE))
+		state->flows = g_new0(struct firewall_flow_bucket,
+				      FIREWALL_FLOW_BUCKETS);
 	++nb_firewall;
-	return firewall_reload_internal(state, errp);
+	if (state->shared->users > 1)
+		return 0;
+	return firewall_reload_internal(state->shared, errp);
+}
+
+static void firewall_table_free(gpointer data)
+{
+	struct firewall_table *t = data;
+
+	npf_table_destroy(t->table);
+	g_free(t->name);
+	g_free(t);
 }
 
 static void firewall_destroy(struct pg_brick *brick,
 			     struct pg_error **errp) {
 	struct pg_firewall_state *state;
+	struct firewall_shared *shared;
 
 	state = pg_brick_get_state(brick, struct pg_firewall_state);
-	npf_dpdk_ifdetach(state->npf, state->ifp);
-	npf_destroy(state->npf);
-	pg_firewall_rule_flush(brick);
+	shared = state->shared;
+	g_free(state->flows);
+	if (--shared->users == 0) {
+		npf_dpdk_ifdetach(shared->npf, shared->ifp);
+		npf_destroy(shared->npf);
+		pg_firewall_rule_flush(brick);
+		g_list_free_full(shared->tables, firewall_table_free);
+		npf_rule_destroy(shared->dynamic);
+		g_free(shared);
+	}
 	--nb_firewall;
 	if (!nb_firewall)
 		npf_sysfini();
@@ -15,10 +15,13 @@
  * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <inttypes.h>
+#include <string.h>
 #include <glib.h>
 #include <packetgraph/packetgraph.h>
 #include "brick-int.h"
 #include "graph-int.h"
+#include "utils/bitmask.h"
 
 static void brick_destroy_cb(gpointer data)
 {
@@ -382,3 +385,78 @@ void pg_graph_empty(struct pg_graph *graph)
 {
 	empty_graph(graph);
 }
+
+#ifdef PG_BRICK_PROFILING
+
+static gint profile_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct pg_brick *ba = a;
+	const struct pg_brick *bb = b;
+
+	if (ba->profile.self_cycles == bb->profile.self_cycles)
+		return 0;
+	return ba->profile.self_cycles < bb->profile.self_cycles ? 1 : -1;
+}
+
+static void profile_dump_brick(struct pg_brick *b, FILE *fd)
+{
+	struct pg_brick_profile *p = &b->profile;
+	uint64_t pkts = p->pkts ? p->pkts : 1;
+
+	fprintf(fd, "%-24s %-12s %12"PRIu64" %14"PRIu64" %10"PRIu64
+		" %10"PRIu64"\n", b->name, b->ops->name, p->calls, p->pkts,
+		p->self_cycles / pkts, p->cycles / pkts);
+	fprintf(fd, "  self cycles/pkt:");
+	for (int i = 0; i < PG_PROFILE_HIST_SIZE; i++) {
+		if (!p->hist[i])
+			continue;
+		if (i == PG_PROFILE_HIST_SIZE - 1)
+			fprintf(fd, " >=%"PRIu64":%"PRIu64, ONE64 << (i - 1),
+				p->hist[i]);
+		else
+			fprintf(fd, " <%"PRIu64":%"PRIu64, ONE64 << i,
+				p->hist[i]);
+	}
+	fprintf(fd, "\n");
+}
+
+int pg_graph_profile_dump(struct pg_graph *graph, FILE *fd,
+			  struct pg_error **error)
+{
+	GList *bricks = g_hash_table_get_values(graph->all);
+
+	bricks = g_list_sort(bricks, profile_cmp);
+	fprintf(fd, "%-24s %-12s %12s %14s %10s %10s\n", "brick", "type",
+		"calls", "packets", "self/pkt", "total/pkt");
+	for (GList *it = bricks; it; it = it->next)
+		profile_dump_brick(it->data, fd);
+	g_list_free(bricks);
+	return 0;
+}
+
+void pg_graph_profile_reset(struct pg_graph *graph)
+{
+	GHashTableIter iter;
+	gpointer brick;
+
+	g_hash_table_iter_init(&iter, graph->all);
+	while (g_hash_table_iter_next(&iter, NULL, &brick))
+		memset(&((struct pg_brick *)brick)->profile, 0,
+		       sizeof(struct pg_brick_profile));
+}
+
+#else
+
+int pg_graph_profile_dump(struct pg_graph *graph, FILE *fd,
+			  struct pg_error **error)
+{
+	*error = pg_error_new(
+		"brick profiling disabled, use --enable-brick-profiling");
+	return -1;
+}
+
+void pg_graph_profile_reset(struct pg_graph *graph)
+{
+}
+
+#endif /* PG_BRICK_PROFILING */
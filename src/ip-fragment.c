@@ -31,12 +31,16 @@
 struct pg_ip_fragment_config {
 	enum pg_side output;
 	uint32_t mtu_size;
+	uint32_t tbl_size;
+	uint32_t timeout_ms;
 };
 
 struct pg_ip_fragment_state {
 	struct pg_brick brick;
 	enum pg_side output;
-	struct rte_mbuf *pkts_out[64];
+	struct rte_mbuf *pkts_out[PG_MAX_PKTS_BURST];
+	/* fragments waiting in pkts_out */
+	uint16_t nb_frags;
 	uint32_t mtu_size;
 	struct rte_ip_frag_tbl *tbl;
 	struct rte_ip_frag_death_row dr;
@@ -44,7 +48,9 @@ struct pg_ip_fragment_state {
 
 static struct pg_brick_config *ip_fragment_config_new(const char *name,
 						enum pg_side output,
-						uint32_t mtu_size)
+						uint32_t mtu_size,
+						uint32_t tbl_size,
+						uint32_t timeout_ms)
 {
 	struct pg_brick_config *config = g_new0(struct pg_brick_config, 1);
 	struct pg_ip_fragment_config *ip_fragment_config =
@@ -52,58 +58,150 @@ static struct pg_brick_config *ip_fragment_config_new(const char *name,
 
 	ip_fragment_config->output = output;
 	ip_fragment_config->mtu_size = mtu_size;
+	ip_fragment_config->tbl_size = tbl_size;
+	ip_fragment_config->timeout_ms = timeout_ms;
 	config->brick_config = (void *) ip_fragment_config;
 	return pg_brick_config_init(config, name, 1, 1, PG_DIPOLE);
 }
 
+/* Because ip RCF ask for the fragment size to be a multiple of 8,
+ * and rte_ipv4_fragment_packet don't check if fragment size is
+ * a multiple of 8, we need to be sure to give a multiple of 8.
+ */
+static inline uint16_t fragment_mtu(struct pg_ip_fragment_state *state,
+				    struct rte_mbuf *pkt)
+{
+	int l2_size = pkt->l2_len;
+
+	if (RTE_ETH_IS_IPV6_HDR(pkt->packet_type))
+		/* each fragment has an IPv6 and a fragment header */
+		return RTE_ALIGN_FLOOR(state->mtu_size - l2_size -
+				       sizeof(struct ipv6_hdr) -
+				       sizeof(struct ipv6_extension_fragment),
+				       8) +
+			sizeof(struct ipv6_hdr) +
+			sizeof(struct ipv6_extension_fragment);
+	return state->mtu_size - l2_size -
+		(8 - ((sizeof(struct ipv4_hdr) + l2_size) % 8));
+}
+
+static inline uint32_t nb_fragments(struct pg_ip_fragment_state *state,
+				    struct rte_mbuf *pkt)
+{
+	uint32_t frag_size = fragment_mtu(state, pkt);
+
+	/* Upper bound of the number of fragments: counting the whole IPv4
+	 * header, options included, as per-fragment overhead can only
+	 * overestimate it.
+	 */
+	if (RTE_ETH_IS_IPV6_HDR(pkt->packet_type))
+		frag_size -= sizeof(struct ipv6_hdr) +
+			sizeof(struct ipv6_extension_fragment);
+	else
+		frag_size -= pkt->l3_len;
+	return (pkt->pkt_len - pkt->l2_len - pkt->l3_len + frag_size - 1) /
+		frag_size;
+}
+
+/* send and free the fragments accumulated so far */
+static int flush_fragments(struct pg_ip_fragment_state *state,
+			   struct pg_brick_edge *edge, enum pg_side from,
+			   struct pg_error **errp)
+{
+	uint64_t mask = pg_mask_firsts(state->nb_frags);
+	int ret;
+
+	if (!mask)
+		return 0;
+	ret = pg_brick_burst(edge->link, from, edge->pair_index,
+			     state->pkts_out, mask, errp);
+	pg_packets_free(state->pkts_out, mask);
+	state->nb_frags = 0;
+	return ret;
+}
+
+/* append the fragments of a packet to pkts_out, which must have room */
 static int do_fragmentation(struct pg_ip_fragment_state *state,
-			    struct rte_mbuf *pkt, struct pg_brick_edge *edge,
-			    enum pg_side from, struct pg_error **errp)
+			    struct rte_mbuf *pkt)
 {
-	uint64_t mask;
 	int32_t nb_frags;
 	struct ether_hdr *eth = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
-	struct rte_mbuf **pkts_out = state->pkts_out;
+	struct rte_mbuf **pkts_out = &state->pkts_out[state->nb_frags];
 	int l2_size = pkt->l2_len;
-	int ret;
+
+	uint16_t mtu = fragment_mtu(state, pkt);
 
 	rte_pktmbuf_adj(pkt, l2_size);
-	/* Because ip RCF ask for the fragment size to be a multiple of 8,
-	* and rte_ipv4_fragment_packet don't check if fragment size is
-	* a multiple of 8, we need to be sure to give a multiple of 8 for the
-	* 4rd argument*/
-	nb_frags = rte_ipv4_fragment_packet(pkt, pkts_out, 64,
-					    state->mtu_size - l2_size -
-					    (8 - ((sizeof(struct ipv4_hdr) +
-						   l2_size) % 8)),
-					    pg_get_mempool(), pg_get_mempool());
+	/* payloads are not copied: fragments are indirect mbufs attached
+	 * to the packet, behind a new header
+	 */
+	if (RTE_ETH_IS_IPV6_HDR(pkt->packet_type))
+		nb_frags = rte_ipv6_fragment_packet(pkt, pkts_out,
+						    PG_MAX_PKTS_BURST -
+						    state->nb_frags, mtu,
+						    pg_get_mempool(),
+						    pg_get_indirect_mempool());
+	else
+		nb_frags = rte_ipv4_fragment_packet(pkt, pkts_out,
+						    PG_MAX_PKTS_BURST -
+						    state->nb_frags, mtu,
+						    pg_get_mempool(),
+						    pg_get_indirect_mempool());
+	rte_pktmbuf_prepend(pkt, l2_size);
 	if (unlikely(nb_frags < 0))
 		return -1;
-	mask = pg_mask_firsts(nb_frags);
 
-	rte_pktmbuf_prepend(pkt, l2_size);
-	PG_FOREACH_BIT(mask, i) {
+	for (int32_t i = 0; i < nb_frags; i++) {
 		rte_memcpy(rte_pktmbuf_prepend(pkts_out[i],
 					       l2_size),
 			   eth, l2_size);
 		pkts_out[i]->l2_len = l2_size;
 		pkts_out[i]->udata64 |= PG_FRAGMENTED_MBUF;
 	}
-
-	ret = pg_brick_burst(edge->link, from, edge->pair_index,
-			     pkts_out, mask, errp);
-	pg_packets_free(pkts_out, mask);
-	return ret;
+	state->nb_frags += nb_frags;
+	return 0;
 }
 
 static inline bool
-should_be_reassemble(struct rte_mbuf const * const restrict pkt)
+should_be_reassemble(struct rte_mbuf * const restrict pkt)
 {
-	return pg_utils_get_ether_type((struct rte_mbuf *) pkt) ==
-		PG_BE_ETHER_TYPE_IPv4 &&
-		rte_ipv4_frag_pkt_is_fragmented(
-			(struct ipv4_hdr *) pg_utils_get_l3(
-				(struct rte_mbuf *) pkt));
+	pg_utils_parse(pkt);
+	return (pkt->packet_type & RTE_PTYPE_L4_MASK) == RTE_PTYPE_L4_FRAG;
+}
+
+/* @return the reassembled packet if pkt was its last missing fragment */
+static inline struct rte_mbuf *
+reassemble(struct pg_ip_fragment_state *state, struct rte_mbuf *pkt,
+	   uint64_t cur_time)
+{
+	struct rte_mbuf *tmp;
+
+	if (RTE_ETH_IS_IPV6_HDR(pkt->packet_type)) {
+		struct ipv6_hdr *ip6 = pg_utils_get_l3(pkt);
+		struct ipv6_extension_fragment *frag_hdr =
+			rte_ipv6_frag_get_ipv6_fragment_header(ip6);
+
+		/* DPDK wants the fragment header right after the IPv6 one */
+		pkt->l3_len = sizeof(*ip6) + sizeof(*frag_hdr);
+		tmp = rte_ipv6_frag_reassemble_packet(state->tbl, &state->dr,
+						      pkt, cur_time, ip6,
+						      frag_hdr);
+		if (tmp)
+			pg_utils_reset_metadata(tmp);
+	} else {
+		tmp = rte_ipv4_frag_reassemble_packet(state->tbl, &state->dr,
+						      pkt, cur_time,
+						      pg_utils_get_l3(pkt));
+		if (tmp) {
+			struct ipv4_hdr *tmp_ip =
+				(struct ipv4_hdr *) pg_utils_get_l3(tmp);
+
+			tmp_ip->hdr_checksum = 0;
+			tmp_ip->hdr_checksum = rte_ipv4_cksum(tmp_ip);
+			pg_utils_reset_metadata(tmp);
+		}
+	}
+	return tmp;
 }
 
 static inline int do_reassemble(struct pg_ip_fragment_state *state,
@@ -118,28 +216,25 @@ static inline int do_reassemble(struct pg_ip_fragment_state *state,
 	uint64_t cur_time = rte_rdtsc();
 
 	PG_FOREACH_BIT(*pkts_mask, i) {
-		struct ipv4_hdr *ip =
-			(struct ipv4_hdr *) pg_utils_get_l3(pkts[i]);
-
-		if (should_be_reassemble(pkts[i])) {
-			struct rte_mbuf *tmp;
-
-			remove_mask |= (ONE64 << i);
-			tmp = rte_ipv4_frag_reassemble_packet(state->tbl,
-							      &state->dr,
-							      pkts[i],
-							      cur_time,
-							      ip);
-			if (tmp) {
-				struct ipv4_hdr *tmp_ip =
-					(struct ipv4_hdr *)
-					pg_utils_get_l3(tmp);
-				tmp_ip->hdr_checksum = 0;
-				tmp_ip->hdr_checksum = rte_ipv4_cksum(tmp_ip);
-				state->pkts_out[j] = tmp;
-				snd_mask |= (ONE64 << j);
-				++j;
-			}
+		struct rte_mbuf *tmp;
+
+		if (!should_be_reassemble(pkts[i]))
+			continue;
+		/* IPv6 fragment headers after other extension headers are
+		 * not supported by DPDK, let such fragments pass
+		 */
+		if (RTE_ETH_IS_IPV6_HDR(pkts[i]->packet_type) &&
+		    !rte_ipv6_frag_get_ipv6_fragment_header(
+			    pg_utils_get_l3(pkts[i])))
+			continue;
+
+		remove_mask |= (ONE64 << i);
+		tmp = reassemble(state, pkts[i], cur_time);
+		if (tmp) {
+			pg_utils_parse(tmp);
+			state->pkts_out[j] = tmp;
+			snd_mask |= (ONE64 << j);
+			++j;
 		}
 	}
 
@@ -156,17 +251,23 @@ static inline int do_reassemble(struct pg_ip_fragment_state *state,
 }
 
 static inline bool
-should_be_fragmented(struct rte_mbuf const * const pkt,
+should_be_fragmented(struct rte_mbuf * const pkt,
 		     const struct pg_ip_fragment_state * const restrict state)
 {
-	struct ipv4_hdr *ip = (struct ipv4_hdr *)
-		pg_utils_get_l3((struct rte_mbuf *) pkt);
-	int dont_fragment = (ip->fragment_offset) &
-		rte_cpu_to_be_16(IPV4_HDR_DF_FLAG);
-
-	return pg_utils_get_ether_type((struct rte_mbuf *) pkt) ==
-			PG_BE_ETHER_TYPE_IPv4 &&
-		(!dont_fragment) && pkt->pkt_len > state->mtu_size;
+	struct ipv4_hdr *ip;
+
+	if (pkt->pkt_len <= state->mtu_size)
+		return false;
+	pg_utils_parse(pkt);
+	/* DPDK can't fragment IPv6 packets with extension headers, this
+	 * includes packets which are already fragments
+	 */
+	if (RTE_ETH_IS_IPV6_HDR(pkt->packet_type))
+		return pkt->l3_len == sizeof(struct ipv6_hdr);
+	if (!RTE_ETH_IS_IPV4_HDR(pkt->packet_type))
+		return false;
+	ip = (struct ipv4_hdr *) pg_utils_get_l3(pkt);
+	return !(ip->fragment_offset & rte_cpu_to_be_16(IPV4_HDR_DF_FLAG));
 }
 
 static int ip_fragment_burst(struct pg_brick *brick, enum pg_side from,
@@ -179,14 +280,34 @@ static int ip_fragment_burst(struct pg_brick *brick, enum pg_side from,
 	struct pg_brick_side *s = &brick->sides[to];
 
 	if (from != state->output) {
+		/* fragments of the whole burst are sent together */
 		PG_FOREACH_BIT(pkts_mask, i) {
-			if (should_be_fragmented(pkts[i], state)) {
-				if (likely(do_fragmentation(state, pkts[i],
-							    &s->edge, from,
-							    errp) >= 0))
-					pkts_mask ^= (ONE64 << i);
+			uint32_t nb;
+
+			if (!should_be_fragmented(pkts[i], state))
+				continue;
+			nb = nb_fragments(state, pkts[i]);
+			if (unlikely(nb > PG_MAX_PKTS_BURST))
+				continue;
+			if (state->nb_frags + nb > PG_MAX_PKTS_BURST &&
+			    flush_fragments(state, &s->edge, from, errp) < 0)
+				return -1;
+			/* the estimation may be short, retry in an empty
+			 * burst before letting the packet pass
+			 */
+			if (unlikely(do_fragmentation(state, pkts[i]) < 0)) {
+				if (!state->nb_frags)
+					continue;
+				if (flush_fragments(state, &s->edge, from,
+						    errp) < 0)
+					return -1;
+				if (do_fragmentation(state, pkts[i]) < 0)
+					continue;
 			}
+			pkts_mask ^= (ONE64 << i);
 		}
+		if (flush_fragments(state, &s->edge, from, errp) < 0)
+			return -1;
 	} else if (do_reassemble(state, pkts, s, from, &pkts_mask, errp) < 0) {
 		return -1;
 	}
@@ -196,24 +317,31 @@ static int ip_fragment_burst(struct pg_brick *brick, enum pg_side from,
 			       pkts, pkts_mask, errp);
 }
 
-struct pg_brick *pg_ip_fragment_new(const char *name,
-			      enum pg_side output,
-			      uint32_t mtu_size,
-			      struct pg_error **errp)
+struct pg_brick *pg_ip_fragment_new_full(const char *name,
+					 enum pg_side output,
+					 uint32_t mtu_size,
+					 uint32_t tbl_size,
+					 uint32_t timeout_ms,
+					 struct pg_error **errp)
 {
-	struct pg_brick_config *config = ip_fragment_config_new(name, output,
-							  mtu_size);
+	struct pg_brick_config *config =
+		ip_fragment_config_new(name, output, mtu_size, tbl_size,
+				       timeout_ms);
 	struct pg_brick *ret = pg_brick_new("ip_fragment", config, errp);
 
 	pg_brick_config_free(config);
 	return ret;
 }
 
-#define FRAG_TIMEOUT_IN_S 3
-#define FRAG_TBL_NB_PKTS_PER_BUCKETS (1 << 15)
-#define FRAG_TBL_NB_BUCKETS 1
-#define FRAG_TBL_TOTAL_MAX_PKTS					\
-	(FRAG_TBL_NB_BUCKETS * FRAG_TBL_NB_PKTS_PER_BUCKETS)
+struct pg_brick *pg_ip_fragment_new(const char *name,
+			      enum pg_side output,
+			      uint32_t mtu_size,
+			      struct pg_error **errp)
+{
+	return pg_ip_fragment_new_full(name, output, mtu_size,
+				       PG_IP_FRAGMENT_TBL_SIZE,
+				       PG_IP_FRAGMENT_TIMEOUT_MS, errp);
+}
 
 static int ip_fragment_init(struct pg_brick *brick,
 		      struct pg_brick_config *config,
@@ -222,6 +350,7 @@ static int ip_fragment_init(struct pg_brick *brick,
 	struct pg_ip_fragment_state *state =
 		pg_brick_get_state(brick, struct pg_ip_fragment_state);
 	struct pg_ip_fragment_config *ip_fragment_config;
+	uint32_t tbl_size;
 
 	ip_fragment_config =
 		(struct pg_ip_fragment_config *) config->brick_config;
@@ -229,16 +358,22 @@ static int ip_fragment_init(struct pg_brick *brick,
 		*errp = pg_error_new("mtu must be a multiplier of 8");
 		return -1;
 	}
+	if (!ip_fragment_config->tbl_size) {
+		*errp = pg_error_new("fragment table size can't be 0");
+		return -1;
+	}
 
 	brick->burst = ip_fragment_burst;
 	state->output = ip_fragment_config->output;
 	state->mtu_size = ip_fragment_config->mtu_size;
-	state->tbl = rte_ip_frag_table_create(FRAG_TBL_NB_PKTS_PER_BUCKETS,
-					      FRAG_TBL_NB_BUCKETS,
-					      FRAG_TBL_TOTAL_MAX_PKTS,
-					      /* ~3s of timeout per segment */
+	/* IPv4 and IPv6 packets share the same table, one entry per
+	 * bucket
+	 */
+	tbl_size = rte_align32pow2(ip_fragment_config->tbl_size);
+	state->tbl = rte_ip_frag_table_create(tbl_size, 1, tbl_size,
 					      rte_get_timer_hz() *
-					      FRAG_TIMEOUT_IN_S,
+					      ip_fragment_config->timeout_ms /
+					      1000,
 					      SOCKET_ID_ANY);
 	if (!state->tbl) {
 		*errp = pg_error_new("can't create ip frag table");
@@ -247,11 +382,6 @@ static int ip_fragment_init(struct pg_brick *brick,
 	return 0;
 }
 
-#undef FRAG_TBL_NB_PKTS_PER_BUCKETS
-#undef FRAG_TBL_NB_BUCKETS
-#undef FRAG_TBL_TOTAL_MAX_PKTS
-#undef FRAG_TIMEOUT_IN_S
-
 static void ip_fragment_destroy(struct pg_brick *brick, struct pg_error **errp)
 {
 	struct pg_ip_fragment_state *state =
@@ -34,12 +34,19 @@
 #include "nic-int.h"
 
 #define NIC_ARGS_MAX_SIZE 1024
+#define NIC_DEFAULT_NB_DESC 128
+/* a full burst can be appended to a buffer just below its threshold */
+#define NIC_TX_BUF_SIZE (PG_MAX_PKTS_BURST * 2)
 #define TCP_PROTOCOL_NUMBER 6
 #define UDP_PROTOCOL_NUMBER 17
 
 struct pg_nic_config {
 	char ifname[NIC_ARGS_MAX_SIZE];
 	uint8_t portid;
+	/* queue pair used by the brick */
+	uint16_t queue;
+	/* port already set up by pg_nic_new_queues */
+	int shared;
 };
 
 struct pg_nic_state {
@@ -47,10 +54,26 @@ struct pg_nic_state {
 	struct rte_mbuf *pkts[PG_MAX_PKTS_BURST];
 	struct rte_mbuf *exit_pkts[PG_MAX_PKTS_BURST];
 	uint8_t portid;
+	uint16_t queue;
+	int shared;
 	/* side of the physical NIC/PMD */
 	enum pg_side output;
+	/* TX buffering, disabled when tx_threshold is 0 */
+	struct rte_mbuf *tx_buf[NIC_TX_BUF_SIZE];
+	uint16_t tx_len;
+	uint16_t tx_threshold;
+	uint16_t tx_retries;
+	uint64_t tx_flush_cycles;
+	uint64_t tx_deadline;
+	uint64_t tx_drops[PG_NIC_TX_DROP_MAX];
 };
 
+/* Ports shared by several queue bricks, closed by the last one. */
+static struct nic_port {
+	uint16_t users;
+	uint16_t nb_queues;
+} nic_ports[RTE_MAX_ETHPORTS];
+
 struct headers_eth_ipv4_l4 {
 	struct ether_hdr ethernet;
 	struct ipv4_hdr ipv4; /* define in rte_ip.h */
@@ -105,6 +128,8 @@ static uint64_t rx_bytes(struct pg_brick *brick)
 
 	state = pg_brick_get_state(brick, struct pg_nic_state);
 	rte_eth_stats_get(state->portid, &tmp);
+	if (state->shared && state->queue < RTE_ETHDEV_QUEUE_STAT_CNTRS)
+		return tmp.q_ibytes[state->queue];
 	return tmp.ibytes;
 }
 
@@ -115,38 +140,57 @@ static uint64_t tx_bytes(struct pg_brick *brick)
 
 	state = pg_brick_get_state(brick, struct pg_nic_state);
 	rte_eth_stats_get(state->portid, &tmp);
+	if (state->shared && state->queue < RTE_ETHDEV_QUEUE_STAT_CNTRS)
+		return tmp.q_obytes[state->queue];
 	return tmp.obytes;
 }
 
-/* The fastpath data function of the nic_brick just forward the bursts */
-static int nic_burst(struct pg_brick *brick, enum pg_side from,
-		     uint16_t edge_index, struct rte_mbuf **pkts,
-		     uint64_t pkts_mask,
-		     struct pg_error **errp)
+/* Drop packets rejected by the PMD and return how many are left */
+static uint16_t nic_tx_prepare(struct pg_nic_state *state,
+			       struct rte_mbuf **pkts, uint16_t count)
 {
-	uint16_t count = 0;
-	uint16_t pkts_bursted;
-	struct pg_nic_state *state = pg_brick_get_state(brick,
-							struct pg_nic_state);
-	struct rte_mbuf **exit_pkts = state->exit_pkts;
-
-	count = pg_packets_pack(exit_pkts,
-				pkts, pkts_mask);
+	uint16_t done = 0;
+
+	for (;;) {
+		done += rte_eth_tx_prepare(state->portid, state->queue,
+					   pkts + done, count - done);
+		if (likely(done == count))
+			return count;
+		rte_pktmbuf_free(pkts[done]);
+		--count;
+		memmove(&pkts[done], &pkts[done + 1],
+			(count - done) * sizeof(*pkts));
+		state->tx_drops[PG_NIC_TX_DROP_PREPARE]++;
+		pg_brick_count_drops(&state->brick,
+				     pg_flip_side(state->output),
+				     PG_DROP_INVALID, 1);
+	}
+}
 
-	pg_packets_incref(pkts, pkts_mask);
-	rte_eth_tx_prepare(state->portid, 0, exit_pkts, count);
-#ifndef PG_NIC_STUB
-	pkts_bursted = rte_eth_tx_burst(state->portid, 0,
-					exit_pkts,
-					count);
-#else
+static inline uint16_t nic_tx_burst(struct pg_nic_state *state,
+				    struct rte_mbuf **pkts, uint16_t count)
+{
+#ifdef PG_NIC_STUB
 	if (count > max_pkts)
-		pkts_bursted = rte_eth_tx_burst(state->portid, 0,
-						exit_pkts, max_pkts);
-	else
-		pkts_bursted = rte_eth_tx_burst(state->portid, 0,
-						exit_pkts, count);
-#endif /* #ifndef PG_NIC_STUB */
+		count = max_pkts;
+#endif /* #ifdef PG_NIC_STUB */
+	return rte_eth_tx_burst(state->portid, state->queue, pkts, count);
+}
+
+static void nic_tx(struct pg_brick *brick, struct pg_nic_state *state,
+		   struct rte_mbuf **pkts, uint16_t count)
+{
+	uint16_t pkts_bursted = 0;
+
+	count = nic_tx_prepare(state, pkts, count);
+	pkts_bursted = nic_tx_burst(state, pkts, count);
+	/* give the PMD a chance to free descriptors before dropping */
+	for (uint16_t retry = 0;
+	     unlikely(pkts_bursted < count) && retry < state->tx_retries;
+	     ++retry) {
+		pkts_bursted += nic_tx_burst(state, pkts + pkts_bursted,
+					     count - pkts_bursted);
+	}
 
 #ifdef PG_NIC_BENCH
 	struct pg_brick_side *side = &brick->side;
@@ -158,9 +202,54 @@ static int nic_burst(struct pg_brick *brick, enum pg_side from,
 #endif /* #ifdef PG_NIC_BENCH */
 
 	if (unlikely(pkts_bursted < count)) {
-		pg_packets_free(exit_pkts, pg_mask_firsts(count) &
+		pg_packets_free(pkts, pg_mask_firsts(count) &
 				~pg_mask_firsts(pkts_bursted));
+		state->tx_drops[PG_NIC_TX_DROP_FULL] += count - pkts_bursted;
+		pg_brick_count_drops(brick, pg_flip_side(state->output),
+				     PG_DROP_TX_FULL, count - pkts_bursted);
+	}
+}
+
+static void nic_tx_flush(struct pg_brick *brick, struct pg_nic_state *state)
+{
+	uint16_t len = state->tx_len;
+
+	if (!len)
+		return;
+	state->tx_len = 0;
+	/* a full buffer does not fit in a pg_packets_free mask */
+	if (len > PG_MAX_PKTS_BURST) {
+		nic_tx(brick, state, state->tx_buf, PG_MAX_PKTS_BURST);
+		nic_tx(brick, state, state->tx_buf + PG_MAX_PKTS_BURST,
+		       len - PG_MAX_PKTS_BURST);
+	} else {
+		nic_tx(brick, state, state->tx_buf, len);
+	}
+}
+
+/* The fastpath data function of the nic_brick just forward the bursts */
+static int nic_burst(struct pg_brick *brick, enum pg_side from,
+		     uint16_t edge_index, struct rte_mbuf **pkts,
+		     uint64_t pkts_mask,
+		     struct pg_error **errp)
+{
+	uint16_t count;
+	struct pg_nic_state *state = pg_brick_get_state(brick,
+							struct pg_nic_state);
+
+	pg_packets_incref(pkts, pkts_mask);
+	if (!state->tx_threshold) {
+		count = pg_packets_pack(state->exit_pkts, pkts, pkts_mask);
+		nic_tx(brick, state, state->exit_pkts, count);
+		return 0;
 	}
+
+	if (!state->tx_len)
+		state->tx_deadline = rte_rdtsc() + state->tx_flush_cycles;
+	state->tx_len += pg_packets_pack(state->tx_buf + state->tx_len,
+					 pkts, pkts_mask);
+	if (state->tx_len >= state->tx_threshold)
+		nic_tx_flush(brick, state);
 	return 0;
 }
 
@@ -244,7 +333,10 @@ static int nic_poll(struct pg_brick *brick, uint16_t *pkts_cnt,
 		pg_brick_get_state(brick, struct pg_nic_state);
 	struct rte_mbuf **pkts = state->pkts;
 
-	nb_pkts = rte_eth_rx_burst(state->portid, 0,
+	if (state->tx_len && rte_rdtsc() >= state->tx_deadline)
+		nic_tx_flush(brick, state);
+
+	nb_pkts = rte_eth_rx_burst(state->portid, state->queue,
 				   state->pkts, PG_MAX_PKTS_BURST);
 	if (!nb_pkts) {
 		*pkts_cnt = 0;
@@ -258,12 +350,29 @@ static int nic_poll(struct pg_brick *brick, uint16_t *pkts_cnt,
 	return nic_poll_forward(state, brick, nb_pkts, errp);
 }
 
-static int nic_init_ports(struct pg_nic_state *state, struct pg_error **errp)
+static uint64_t nic_rss_hf(uint32_t rss)
+{
+	uint64_t rss_hf = 0;
+
+	if (rss & PG_NIC_RSS_IP)
+		rss_hf |= ETH_RSS_IP;
+	if (rss & PG_NIC_RSS_UDP)
+		rss_hf |= ETH_RSS_UDP;
+	if (rss & PG_NIC_RSS_TCP)
+		rss_hf |= ETH_RSS_TCP;
+	return rss_hf;
+}
+
+static int nic_init_ports(uint8_t portid,
+			  const struct pg_nic_queues_params *params,
+			  struct pg_error **errp)
 {
 	int ret;
 	struct rte_mempool *mp = pg_get_mempool();
-	static const struct rte_eth_conf port_conf = {
+	struct rte_eth_dev_info dev_info;
+	struct rte_eth_conf port_conf = {
 		.rxmode = {
+			.mq_mode = ETH_MQ_RX_NONE,
 			.split_hdr_size = 0,
 			/**< Header Split disabled */
 			.header_split   = 0,
@@ -283,46 +392,90 @@ static int nic_init_ports(struct pg_nic_state *state, struct pg_error **errp)
 	static const struct rte_eth_txconf tx_conf = {
 		.txq_flags = 0,
 	};
+	uint16_t nb_queues = params->nb_queues;
+	uint16_t nb_rx_desc = params->nb_rx_desc ? params->nb_rx_desc :
+		NIC_DEFAULT_NB_DESC;
+	uint16_t nb_tx_desc = params->nb_tx_desc ? params->nb_tx_desc :
+		NIC_DEFAULT_NB_DESC;
+
+	rte_eth_dev_info_get(portid, &dev_info);
+	if (nb_queues > dev_info.max_rx_queues ||
+	    nb_queues > dev_info.max_tx_queues) {
+		*errp = pg_error_new(
+			"Port %u supports at most %u rx and %u tx queues",
+			portid, dev_info.max_rx_queues,
+			dev_info.max_tx_queues);
+		return -1;
+	}
 
-	ret = rte_eth_dev_configure(state->portid, 1, 1, &port_conf);
+	/* spread flows only on hash fields the device can handle */
+	if (nb_queues > 1) {
+		uint64_t rss_hf = nic_rss_hf(params->rss);
+
+		if (dev_info.flow_type_rss_offloads)
+			rss_hf &= dev_info.flow_type_rss_offloads;
+		if (rss_hf) {
+			port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+			port_conf.rx_adv_conf.rss_conf.rss_key = NULL;
+			port_conf.rx_adv_conf.rss_conf.rss_hf = rss_hf;
+		}
+	}
+
+	ret = rte_eth_dev_configure(portid, nb_queues, nb_queues, &port_conf);
 	if (ret < 0) {
 		*errp = pg_error_new(
 			"Port configuration %u failed (may already be in use)",
-			state->portid);
+			portid);
 		return -1;
 	}
 
 	/* Setup queues */
-	ret = rte_eth_rx_queue_setup(state->portid, 0, 128,
-				     rte_eth_dev_socket_id(state->portid),
-				     NULL,
-				     mp);
-	if (ret < 0) {
-		*errp = pg_error_new(
-			"Setup failed for port rx queue 0, port %d",
-			state->portid);
-		return -1;
+	for (uint16_t q = 0; q < nb_queues; q++) {
+		ret = rte_eth_rx_queue_setup(portid, q, nb_rx_desc,
+					     rte_eth_dev_socket_id(portid),
+					     NULL,
+					     mp);
+		if (ret < 0) {
+			*errp = pg_error_new(
+				"Setup failed for port rx queue %u, port %d",
+				q, portid);
+			return -1;
+		}
+
+		ret = rte_eth_tx_queue_setup(portid, q, nb_tx_desc,
+					     rte_eth_dev_socket_id(portid),
+					     &tx_conf);
+		if (ret < 0) {
+			*errp = pg_error_new(
+				"Setup failed for port tx queue %u, port %d",
+				q, portid);
+			return -1;
+		}
 	}
 
-	ret = rte_eth_tx_queue_setup(state->portid, 0, 128,
-				     rte_eth_dev_socket_id(state->portid),
-				     &tx_conf);
+	ret = rte_eth_dev_start(portid);
 	if (ret < 0) {
-		*errp = pg_error_new(
-			"Setup failed for port tx queue 0, port %d",
-			state->portid);
+		*errp = pg_error_new("Device failed to start on port %d",
+				     portid);
 		return -1;
 	}
+	rte_eth_promiscuous_enable(portid);
 	return 0;
 }
 
+static void nic_close_port(uint8_t portid)
+{
+	rte_eth_xstats_reset(portid);
+	rte_eth_dev_stop(portid);
+	rte_eth_dev_close(portid);
+}
+
 static int nic_init(struct pg_brick *brick, struct pg_brick_config *config,
 		    struct pg_error **errp)
 {
 	struct pg_nic_state *state;
 	struct pg_nic_config *nic_config;
 	struct rte_eth_txq_info qinfo;
-	int ret;
 
 	state = pg_brick_get_state(brick, struct pg_nic_state);
 	nic_config = config->brick_config;
@@ -346,19 +499,21 @@ static int nic_init(struct pg_brick *brick, struct pg_brick_config *config,
 		return -1;
 	}
 
-	if (nic_init_ports(state, errp) < 0)
-		return -1;
+	state->queue = nic_config->queue;
+	state->shared = nic_config->shared;
+	if (state->shared) {
+		nic_ports[state->portid].users++;
+	} else {
+		struct pg_nic_queues_params params = { .nb_queues = 1 };
 
-	ret = rte_eth_dev_start(state->portid);
-	if (ret < 0) {
-		*errp = pg_error_new("Device failed to start on port %d",
-				     state->portid);
-		return -1;
+		if (nic_init_ports(state->portid, &params, errp) < 0)
+			return -1;
+		nic_ports[state->portid].nb_queues = 1;
 	}
-	rte_eth_promiscuous_enable(state->portid);
 
 	/* check if nic supports offloading */
-	if (rte_eth_tx_queue_info_get(state->portid, 0, &qinfo) == 0 &&
+	if (rte_eth_tx_queue_info_get(state->portid, state->queue,
+				      &qinfo) == 0 &&
 	    ((qinfo.conf.txq_flags & ETH_TXQ_FLAGS_NOXSUMUDP) == 0 ||
 	     (qinfo.conf.txq_flags & ETH_TXQ_FLAGS_NOXSUMTCP) == 0)) {
 		brick->burst = nic_burst;
@@ -374,9 +529,12 @@ static void nic_destroy(struct pg_brick *brick, struct pg_error **errp)
 {
 	struct pg_nic_state *state =
 		pg_brick_get_state(brick, struct pg_nic_state);
-	rte_eth_xstats_reset(state->portid);
-	rte_eth_dev_stop(state->portid);
-	rte_eth_dev_close(state->portid);
+
+	nic_tx_flush(brick, state);
+	if (state->shared && --nic_ports[state->portid].users > 0)
+		return;
+	nic_ports[state->portid].nb_queues = 0;
+	nic_close_port(state->portid);
 }
 
 struct pg_brick *pg_nic_new(const char *name,
@@ -435,6 +593,127 @@ struct pg_brick *pg_nic_new_by_id(const char *name,
 	return ret;
 }
 
+int pg_nic_new_queues(const char *name,
+		      const char *ifname,
+		      const struct pg_nic_queues_params *params,
+		      struct pg_brick **nics,
+		      struct pg_error **errp)
+{
+	uint8_t portid;
+	uint16_t i;
+
+	if (!params->nb_queues) {
+		*errp = pg_error_new("At least one queue is needed");
+		return -1;
+	}
+	if (rte_eth_dev_attach(ifname, &portid) < 0) {
+		*errp = pg_error_new("Invalid parameter %s", ifname);
+		return -1;
+	}
+	if (nic_init_ports(portid, params, errp) < 0)
+		return -1;
+	nic_ports[portid].nb_queues = params->nb_queues;
+
+	for (i = 0; i < params->nb_queues; i++) {
+		gchar *qname = g_strdup_printf("%s-%u", name, i);
+		struct pg_brick_config *config = nic_config_new(qname, NULL,
+								portid);
+		struct pg_nic_config *nic_config = config->brick_config;
+
+		nic_config->queue = i;
+		nic_config->shared = 1;
+		nics[i] = pg_brick_new("nic", config, errp);
+		pg_brick_config_free(config);
+		g_free(qname);
+		if (!nics[i])
+			goto error;
+	}
+	return 0;
+error:
+	/* the last queue brick destroyed closes the port */
+	if (!i)
+		nic_close_port(portid);
+	while (i--)
+		pg_brick_destroy(nics[i]);
+	return -1;
+}
+
+int pg_nic_set_reta(struct pg_brick *nic, const uint16_t *queues,
+		    uint16_t size, struct pg_error **errp)
+{
+	struct pg_nic_state *state = pg_brick_get_state(nic,
+							struct pg_nic_state);
+	struct rte_eth_dev_info dev_info;
+	struct rte_eth_rss_reta_entry64 *reta_conf;
+	uint16_t nb_queues = nic_ports[state->portid].nb_queues;
+	int ret;
+
+	rte_eth_dev_info_get(state->portid, &dev_info);
+	if (size != dev_info.reta_size || size % RTE_RETA_GROUP_SIZE) {
+		*errp = pg_error_new("Invalid RETA size %u, port %u uses %u",
+				     size, state->portid, dev_info.reta_size);
+		return -1;
+	}
+
+	reta_conf = g_new0(struct rte_eth_rss_reta_entry64,
+			   size / RTE_RETA_GROUP_SIZE);
+	for (uint16_t i = 0; i < size; i++) {
+		struct rte_eth_rss_reta_entry64 *group =
+			&reta_conf[i / RTE_RETA_GROUP_SIZE];
+
+		if (queues[i] >= nb_queues) {
+			*errp = pg_error_new("Invalid queue %u in RETA",
+					     queues[i]);
+			g_free(reta_conf);
+			return -1;
+		}
+		group->mask |= ONE64 << (i % RTE_RETA_GROUP_SIZE);
+		group->reta[i % RTE_RETA_GROUP_SIZE] = queues[i];
+	}
+
+	ret = rte_eth_dev_rss_reta_update(state->portid, reta_conf, size);
+	g_free(reta_conf);
+	if (ret < 0) {
+		*errp = pg_error_new_errno(-ret, "cannot update RETA");
+		return -1;
+	}
+	return 0;
+}
+
+int pg_nic_set_tx_buffer(struct pg_brick *nic, uint16_t threshold,
+			 uint32_t flush_us, uint16_t retries,
+			 struct pg_error **errp)
+{
+	struct pg_nic_state *state = pg_brick_get_state(nic,
+							struct pg_nic_state);
+
+	if (threshold > PG_MAX_PKTS_BURST) {
+		*errp = pg_error_new("TX buffer threshold %u above %u",
+				     threshold, PG_MAX_PKTS_BURST);
+		return -1;
+	}
+	nic_tx_flush(nic, state);
+	state->tx_threshold = threshold;
+	state->tx_flush_cycles = rte_get_tsc_hz() * flush_us / 1000000;
+	state->tx_retries = retries;
+	return 0;
+}
+
+void pg_nic_tx_flush(struct pg_brick *nic)
+{
+	nic_tx_flush(nic, pg_brick_get_state(nic, struct pg_nic_state));
+}
+
+uint64_t pg_nic_tx_drops(struct pg_brick *nic, enum pg_nic_tx_drop reason)
+{
+	struct pg_nic_state *state = pg_brick_get_state(nic,
+							struct pg_nic_state);
+
+	if (reason >= PG_NIC_TX_DROP_MAX)
+		return 0;
+	return state->tx_drops[reason];
+}
+
 int pg_nic_port_count(void)
 {
 	return rte_eth_dev_count();
@@ -474,5 +753,7 @@ static struct pg_brick_ops nic_ops = {
 pg_brick_register(nic, &nic_ops);
 
 #undef NIC_ARGS_MAX_SIZE
+#undef NIC_DEFAULT_NB_DESC
+#undef NIC_TX_BUF_SIZE
 #undef TCP_PROTOCOL_NUMBER
 #undef UDP_PROTOCOL_NUMBER
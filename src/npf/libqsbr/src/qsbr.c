@@ -40,6 +40,9 @@
  */
 static_assert(sizeof(qsbr_epoch_t) == 8, "expected 64-bit counter");
 
+/* Local epoch of an offline thread, never behind any target. */
+#define	QSBR_OFFLINE		(~(qsbr_epoch_t)0)
+
 typedef struct qsbr_tls {
 	/*
 	 * The thread (local) epoch, observed at qsbr_checkpoint().
@@ -58,6 +61,18 @@ struct qsbr {
 	qsbr_tls_t *		list;
 };
 
+/*
+ * qsbr_exit: the record of an exiting thread stays in the list, but
+ * offline, until qsbr_destroy().
+ */
+static void
+qsbr_exit(void *arg)
+{
+	qsbr_tls_t *t = arg;
+
+	t->local_epoch = QSBR_OFFLINE;
+}
+
 qsbr_t *
 qsbr_create(void)
 {
@@ -66,7 +81,7 @@ qsbr_create(void)
 	if ((qs = calloc(1, sizeof(qsbr_t))) == NULL) {
 		return NULL;
 	}
-	if (pthread_key_create(&qs->tls_key, free) != 0) {
+	if (pthread_key_create(&qs->tls_key, qsbr_exit) != 0) {
 		free(qs);
 		return NULL;
 	}
@@ -77,7 +92,15 @@ qsbr_create(void)
 void
 qsbr_destroy(qsbr_t *qs)
 {
+	qsbr_tls_t *t = qs->list;
+
 	pthread_key_delete(qs->tls_key);
+	while (t) {
+		qsbr_tls_t *next = t->next;
+
+		free(t);
+		t = next;
+	}
 	free(qs);
 }
 
@@ -90,12 +113,14 @@ qsbr_register(qsbr_t *qs)
 	qsbr_tls_t *t, *head;
 
 	t = pthread_getspecific(qs->tls_key);
-	if (__predict_false(t == NULL)) {
-		if ((t = malloc(sizeof(qsbr_tls_t))) == NULL) {
-			return ENOMEM;
-		}
-		pthread_setspecific(qs->tls_key, t);
+	if (t != NULL) {
+		/* Already in the list. */
+		return 0;
+	}
+	if ((t = malloc(sizeof(qsbr_tls_t))) == NULL) {
+		return ENOMEM;
 	}
+	pthread_setspecific(qs->tls_key, t);
 	memset(t, 0, sizeof(qsbr_tls_t));
 
 	do {
@@ -115,12 +140,38 @@ qsbr_checkpoint(qsbr_t *qs)
 	qsbr_tls_t *t;
 
 	t = pthread_getspecific(qs->tls_key);
-	ASSERT(t != NULL);
+	if (__predict_false(t == NULL)) {
+		/* Register the thread on its first checkpoint. */
+		if (qsbr_register(qs) != 0) {
+			return;
+		}
+		t = pthread_getspecific(qs->tls_key);
+	}
 
-	/* Observe the current epoch. */
+	/*
+	 * Observe the current epoch.  The full barrier orders it before
+	 * any later load, as the thread may be coming back from offline.
+	 */
 	atomic_thread_fence(memory_order_release);
 	t->local_epoch = qs->global_epoch;
-	atomic_thread_fence(memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+/*
+ * qsbr_offline: indicate that the thread holds no reference until its
+ * next qsbr_checkpoint(), so that writers do not wait for an idle thread.
+ */
+void
+qsbr_offline(qsbr_t *qs)
+{
+	qsbr_tls_t *t;
+
+	t = pthread_getspecific(qs->tls_key);
+	if (t == NULL) {
+		return;
+	}
+	atomic_thread_fence(memory_order_release);
+	t->local_epoch = QSBR_OFFLINE;
 }
 
 qsbr_epoch_t
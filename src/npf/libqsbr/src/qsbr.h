@@ -22,6 +22,7 @@ void		qsbr_destroy(qsbr_t *);
 
 int		qsbr_register(qsbr_t *);
 void		qsbr_checkpoint(qsbr_t *);
+void		qsbr_offline(qsbr_t *);
 qsbr_epoch_t	qsbr_barrier(qsbr_t *);
 bool		qsbr_sync(qsbr_t *, qsbr_epoch_t);
 
@@ -173,9 +173,11 @@ atomic_exchange(volatile void *ptr, void *nptr)
 /*
  * memory_order_acquire	- membar_consumer/smp_rmb
  * memory_order_release	- membar_producer/smp_wmb
+ * memory_order_seq_cst	- membar_sync/smp_mb
  */
 #define	memory_order_acquire	__atomic_thread_fence(__ATOMIC_ACQUIRE)
 #define	memory_order_release	__atomic_thread_fence(__ATOMIC_RELEASE)
+#define	memory_order_seq_cst	__atomic_thread_fence(__ATOMIC_SEQ_CST)
 #define	atomic_thread_fence(m)	m
 #endif
 
@@ -125,6 +125,13 @@ dpdk_ifop_setname(ifnet_t *ifp, void *arg)
 
 /*
  * DPDK mbuf wrappers.
+ *
+ * NPF only handles layer 3: packets are given with their layer 2 header
+ * and l2_len of the first segment holds the offset of the layer 3 header.
+ * The nbuf skips it on the first segment only, as l2_len of the other
+ * segments is meaningless (rte_pktmbuf_attach copies it from the direct
+ * mbuf).  The mbufs are never modified, so that a packet may be shared
+ * between several threads or firewalls.
  */
 
 static struct mbuf *
@@ -174,6 +181,13 @@ dpdk_mbuf_getchainlen(const struct mbuf *m0)
 	return tlen;
 }
 
+static size_t
+dpdk_mbuf_getl3off(const struct mbuf *m0)
+{
+	const struct rte_mbuf *m = (const void *)m0;
+	return m->l2_len;
+}
+
 static bool
 dpdk_mbuf_ensure_something(struct mbuf **m, size_t len)
 {
@@ -192,6 +206,7 @@ static const npf_mbufops_t npf_mbufops = {
 	.getnext		= dpdk_mbuf_getnext,
 	.getlen			= dpdk_mbuf_getlen,
 	.getchainlen		= dpdk_mbuf_getchainlen,
+	.getl3off		= dpdk_mbuf_getl3off,
 	.ensure_contig		= dpdk_mbuf_ensure_something,
 	.ensure_writable	= dpdk_mbuf_ensure_something,
 };
@@ -81,6 +81,7 @@ npf_create(int flags, const npf_mbufops_t *mbufops, const npf_ifops_t *ifops)
 	}
 	npf->stats_percpu = percpu_alloc(NPF_STATS_SIZE);
 	npf->mbufops = mbufops;
+	npf->bpf_jit = (flags & NPF_NO_JIT) == 0;
 
 	npf_ifmap_init(npf, ifops);
 	npf_conn_init(npf, flags);
@@ -118,6 +119,32 @@ npf_load(npf_t *npf, void *ref, npf_error_t *err)
 	return npfctl_load(npf, 0, ref);
 }
 
+/*
+ * npf_dynrule_add: add a rule, built by npf_rule_build(), to a dynamic
+ * group of the active configuration without reloading it.
+ */
+__dso_public int
+npf_dynrule_add(npf_t *npf, const char *rname, void *ref, uint64_t *id)
+{
+	return npfctl_rule_add(npf, rname, ref, id);
+}
+
+__dso_public int
+npf_dynrule_remove(npf_t *npf, const char *rname, uint64_t id)
+{
+	return npfctl_rule_remove(npf, rname, id);
+}
+
+/*
+ * npf_table_ctl: add, remove or query entries of a table of the active
+ * configuration, 'data' is a npf_ioctl_table_t.
+ */
+__dso_public int
+npf_table_ctl(npf_t *npf, void *data)
+{
+	return npfctl_table(npf, data);
+}
+
 __dso_public void
 npf_gc(npf_t *npf)
 {
@@ -130,6 +157,18 @@ npf_thread_register(npf_t *npf)
 	pserialize_register(npf->qsbr);
 }
 
+__dso_public void
+npf_thread_checkpoint(npf_t *npf)
+{
+	pserialize_checkpoint(npf->qsbr);
+}
+
+__dso_public void
+npf_thread_offline(npf_t *npf)
+{
+	pserialize_offline(npf->qsbr);
+}
+
 void
 npf_setkernctx(npf_t *npf)
 {
@@ -49,7 +49,8 @@ __KERNEL_RCSID(0, "$NetBSD: npf_bpf.c,v 1.12 2016/12/26 23:05:06 christos Exp $"
 #include "npf_impl.h"
 
 #if defined(_NPF_STANDALONE)
-#define	m_length(m)		(nbuf)->nb_mops->getchainlen(m)
+#define	m_length(m)		\
+    ((nbuf)->nb_mops->getchainlen(m) - NBUF_L3OFF(nbuf, m))
 #endif
 
 /*
@@ -168,7 +168,9 @@ npf_config_load(npf_t *npf, npf_ruleset_t *rset, npf_tableset_t *tset,
 		npf_conn_tracking(npf, false);
 	}
 
-	/* Synchronise: drain all references. */
+	/* Invalidate cached connections, then drain all references. */
+	atomic_inc_64(&npf->conn_gen);
+	membar_sync();
 	pserialize_perform(npf->qsbr);
 	if (flush) {
 		npf_ifmap_flush(npf);
@@ -444,6 +444,21 @@ npf_conn_lookup(const npf_cache_t *npc, const int di, bool *forw)
 	return con;
 }
 
+/*
+ * npf_conn_prefetch: prefetch the connection store bucket which the
+ * lookup of this packet will use.
+ */
+void
+npf_conn_prefetch(const npf_cache_t *npc)
+{
+	npf_t *npf = npc->npc_ctx;
+	npf_connkey_t key;
+
+	if (npf_conn_trackable_p(npc) && npf_conn_conkey(npc, &key, true)) {
+		npf_conndb_prefetch(npf->conn_db, &key);
+	}
+}
+
 /*
  * npf_conn_inspect: lookup a connection and inspecting the protocol data.
  *
@@ -768,6 +783,57 @@ npf_conn_release(npf_conn_t *con)
 	atomic_dec_uint(&con->c_refcnt);
 }
 
+/*
+ * npf_conn_fastpath_p: check if the packets of this connection could
+ * be passed without inspection: a passing UDP connection without NAT
+ * nor rule procedure.  TCP is excluded since its state tracking must
+ * see every segment.
+ */
+bool
+npf_conn_fastpath_p(const npf_conn_t *con)
+{
+	return con->c_proto == IPPROTO_UDP &&
+	    (con->c_flags & CONN_PASS) != 0 &&
+	    con->c_rproc == NULL && con->c_nat == NULL;
+}
+
+/*
+ * npf_conn_fastpass: pass a packet of a connection returned by
+ * npf_packet_handler_conn() and update its activity time.
+ *
+ * => The caller must have checked that npf_conn_gen() did not change
+ *    since the connection was returned, after its last checkpoint.
+ */
+__dso_public bool
+npf_conn_fastpass(npf_conn_t *con, uint64_t now)
+{
+	const uint32_t flags = con->c_flags;
+
+	if (__predict_false((flags & (CONN_ACTIVE | CONN_EXPIRE)) !=
+	    CONN_ACTIVE)) {
+		return false;
+	}
+	if (con->c_atime != now) {
+		con->c_atime = now;
+	}
+	return true;
+}
+
+__dso_public uint64_t
+npf_conn_gen(npf_t *npf)
+{
+	return npf->conn_gen;
+}
+
+__dso_public uint64_t
+npf_conn_now(void)
+{
+	struct timespec tsnow;
+
+	getnanouptime(&tsnow);
+	return tsnow.tv_sec;
+}
+
 /*
  * npf_conn_getnat: return associated NAT data entry and indicate
  * whether it is a "forwards" or "backwards" stream.
@@ -803,30 +869,25 @@ npf_conn_expired(const npf_conn_t *con, uint64_t tsnow)
 }
 
 /*
- * npf_conn_gc: garbage collect the expired connections.
- *
- * => Must run in a single-threaded manner.
- * => If it is a flush request, then destroy all connections.
- * => If 'sync' is true, then perform passive serialisation.
+ * npf_conn_gc_shard: move the expired connections of a shard to the
+ * G/C list and return the new list.
  */
-void
-npf_conn_gc(npf_t *npf, npf_conndb_t *cd, bool flush, bool sync)
+static npf_conn_t *
+npf_conn_gc_shard(npf_conndb_t *cd, u_int s, bool flush, uint64_t now,
+    npf_conn_t *gclist)
 {
-	npf_conn_t *con, *prev, *gclist = NULL;
-	struct timespec tsnow;
-
-	getnanouptime(&tsnow);
+	npf_conn_t *con, *prev;
 
 	/*
 	 * Scan all connections and check them for expiration.
 	 */
 	prev = NULL;
-	con = npf_conndb_getlist(cd);
+	con = npf_conndb_getlist(cd, s);
 	while (con) {
 		npf_conn_t *next = con->c_next;
 
 		/* Expired?  Flushing all? */
-		if (!npf_conn_expired(con, tsnow.tv_sec) && !flush) {
+		if (!npf_conn_expired(con, now) && !flush) {
 			prev = con;
 			con = next;
 			continue;
@@ -848,14 +909,40 @@ npf_conn_gc(npf_t *npf, npf_conndb_t *cd, bool flush, bool sync)
 		mutex_exit(&con->c_lock);
 
 		/* Move to the G/C list. */
-		npf_conndb_dequeue(cd, con, prev);
+		npf_conndb_dequeue(cd, s, con, prev);
 		con->c_next = gclist;
 		gclist = con;
 
 		/* Next.. */
 		con = next;
 	}
-	npf_conndb_settail(cd, prev);
+	npf_conndb_settail(cd, s, prev);
+	return gclist;
+}
+
+/*
+ * npf_conn_gc: garbage collect the expired connections.
+ *
+ * => Must run in a single-threaded manner.
+ * => If it is a flush request, then destroy all connections.
+ * => If 'sync' is true, then perform passive serialisation.
+ */
+void
+npf_conn_gc(npf_t *npf, npf_conndb_t *cd, bool flush, bool sync)
+{
+	npf_conn_t *con, *gclist = NULL;
+	struct timespec tsnow;
+
+	getnanouptime(&tsnow);
+	for (u_int s = 0; s < NPF_CONNDB_SHARDS; s++) {
+		gclist = npf_conn_gc_shard(cd, s, flush, tsnow.tv_sec, gclist);
+	}
+
+	/* Invalidate cached connections before they are destroyed. */
+	if (gclist) {
+		atomic_inc_64(&npf->conn_gen);
+		membar_sync();
+	}
 
 	/*
 	 * Ensure it is safe to destroy the connections.
@@ -920,20 +1007,22 @@ npf_conndb_export(npf_t *npf, prop_array_t conlist)
 		mutex_exit(&npf->conn_lock);
 		return 0;
 	}
-	prev = NULL;
-	con = npf_conndb_getlist(npf->conn_db);
-	while (con) {
-		npf_conn_t *next = con->c_next;
-		prop_dictionary_t cdict;
-
-		if ((cdict = npf_conn_export(npf, con)) != NULL) {
-			prop_array_add(conlist, cdict);
-			prop_object_release(cdict);
+	for (u_int s = 0; s < NPF_CONNDB_SHARDS; s++) {
+		prev = NULL;
+		con = npf_conndb_getlist(npf->conn_db, s);
+		while (con) {
+			npf_conn_t *next = con->c_next;
+			prop_dictionary_t cdict;
+
+			if ((cdict = npf_conn_export(npf, con)) != NULL) {
+				prop_array_add(conlist, cdict);
+				prop_object_release(cdict);
+			}
+			prev = con;
+			con = next;
 		}
-		prev = con;
-		con = next;
+		npf_conndb_settail(npf->conn_db, s, prev);
 	}
-	npf_conndb_settail(npf->conn_db, prev);
 	mutex_exit(&npf->conn_lock);
 	return 0;
 }
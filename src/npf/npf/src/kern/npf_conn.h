@@ -107,6 +107,8 @@ npf_conn_t *	npf_conn_establish(npf_cache_t *, int, bool);
 void		npf_conn_release(npf_conn_t *);
 void		npf_conn_expire(npf_conn_t *);
 bool		npf_conn_pass(const npf_conn_t *, npf_rproc_t **);
+bool		npf_conn_fastpath_p(const npf_conn_t *);
+void		npf_conn_prefetch(const npf_cache_t *);
 void		npf_conn_setpass(npf_conn_t *, npf_rproc_t *);
 int		npf_conn_setnat(const npf_cache_t *, npf_conn_t *,
 		    npf_nat_t *, u_int);
@@ -122,20 +124,23 @@ void		npf_conn_print(const npf_conn_t *);
 /*
  * Connection database (aka state table) interface.
  */
+#define	NPF_CONNDB_SHARDS	8	/* power of 2 */
+
 npf_conndb_t *	npf_conndb_create(void);
 void		npf_conndb_destroy(npf_conndb_t *);
 
 npf_conn_t *	npf_conndb_lookup(npf_conndb_t *, const npf_connkey_t *,
 		    bool *);
+void		npf_conndb_prefetch(npf_conndb_t *, const npf_connkey_t *);
 bool		npf_conndb_insert(npf_conndb_t *, npf_connkey_t *,
 		    npf_conn_t *);
 npf_conn_t *	npf_conndb_remove(npf_conndb_t *, npf_connkey_t *);
 
 void		npf_conndb_enqueue(npf_conndb_t *, npf_conn_t *);
-void		npf_conndb_dequeue(npf_conndb_t *, npf_conn_t *,
+void		npf_conndb_dequeue(npf_conndb_t *, u_int, npf_conn_t *,
 		    npf_conn_t *);
-npf_conn_t *	npf_conndb_getlist(npf_conndb_t *);
-void		npf_conndb_settail(npf_conndb_t *, npf_conn_t *);
+npf_conn_t *	npf_conndb_getlist(npf_conndb_t *, u_int);
+void		npf_conndb_settail(npf_conndb_t *, u_int, npf_conn_t *);
 int		npf_conndb_export(npf_t *, prop_array_t);
 
 #endif	/* _NPF_CONN_H_ */
@@ -50,8 +50,9 @@ __KERNEL_RCSID(0, "$NetBSD: npf_conndb.c,v 1.3 2016/12/26 23:05:06 christos Exp
 #include "npf_conn.h"
 #include "npf_impl.h"
 
-#define	CONNDB_HASH_BUCKETS	1024	/* XXX tune + make tunable */
+#define	CONNDB_HASH_BUCKETS	1024	/* per shard, XXX tune + make tunable */
 #define	CONNDB_HASH_MASK	(CONNDB_HASH_BUCKETS - 1)
+#define	CONNDB_SHARD_MASK	(NPF_CONNDB_SHARDS - 1)
 
 typedef struct {
 	rb_tree_t		hb_tree;
@@ -59,13 +60,22 @@ typedef struct {
 	u_int			hb_count;
 } npf_hashbucket_t;
 
+/*
+ * The database is split in shards, each with its own hash table and
+ * lists, so that threads handling different connections do not share
+ * the "recent" list head nor the buckets.
+ */
+typedef struct {
+	npf_conn_t *		cs_recent;
+	npf_conn_t *		cs_list;
+	npf_conn_t *		cs_tail;
+	npf_hashbucket_t	cs_hashtbl[CONNDB_HASH_BUCKETS];
+} npf_conndb_shard_t;
+
 struct npf_conndb {
-	npf_conn_t *		cd_recent;
-	npf_conn_t *		cd_list;
-	npf_conn_t *		cd_tail;
 	uint32_t		cd_seed;
 	void *			cd_tree;
-	npf_hashbucket_t	cd_hashtbl[];
+	npf_conndb_shard_t	cd_shards[NPF_CONNDB_SHARDS];
 };
 
 /*
@@ -99,27 +109,55 @@ static const rb_tree_ops_t conndb_rbtree_ops = {
 	.rbto_context		= NULL
 };
 
+/*
+ * conndb_shard_index: hash the key symmetrically in its source and
+ * destination, so that both entries of a connection (unless translated)
+ * land in the same shard.
+ */
+static u_int
+conndb_shard_index(const npf_conndb_t *cd, const npf_connkey_t *key)
+{
+	const u_int nwords = NPF_CONN_GETALEN(key) >> 2;
+	const uint32_t *addrs = &key->ck_key[2];
+	uint32_t hash = cd->cd_seed ^ key->ck_key[0];
+
+	hash ^= (key->ck_key[1] >> 16) ^ (key->ck_key[1] & 0xffff);
+	for (u_int i = 0; i < nwords; i++) {
+		hash ^= addrs[i] ^ addrs[nwords + i];
+	}
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+	return hash & CONNDB_SHARD_MASK;
+}
+
 static npf_hashbucket_t *
 conndb_hash_bucket(npf_conndb_t *cd, const npf_connkey_t *key)
 {
+	npf_conndb_shard_t *cs = &cd->cd_shards[conndb_shard_index(cd, key)];
 	const u_int keylen = NPF_CONN_KEYLEN(key);
 	uint32_t hash = murmurhash2(key->ck_key, keylen, cd->cd_seed);
-	return &cd->cd_hashtbl[hash & CONNDB_HASH_MASK];
+	return &cs->cs_hashtbl[hash & CONNDB_HASH_MASK];
 }
 
 npf_conndb_t *
 npf_conndb_create(void)
 {
-	size_t len = offsetof(npf_conndb_t, cd_hashtbl[CONNDB_HASH_BUCKETS]);
 	npf_conndb_t *cd;
 
-	cd = kmem_zalloc(len, KM_SLEEP);
-	for (u_int i = 0; i < CONNDB_HASH_BUCKETS; i++) {
-		npf_hashbucket_t *hb = &cd->cd_hashtbl[i];
+	cd = kmem_zalloc(sizeof(npf_conndb_t), KM_SLEEP);
+	for (u_int s = 0; s < NPF_CONNDB_SHARDS; s++) {
+		npf_conndb_shard_t *cs = &cd->cd_shards[s];
 
-		rb_tree_init(&hb->hb_tree, &conndb_rbtree_ops);
-		rw_init(&hb->hb_lock);
-		hb->hb_count = 0;
+		for (u_int i = 0; i < CONNDB_HASH_BUCKETS; i++) {
+			npf_hashbucket_t *hb = &cs->cs_hashtbl[i];
+
+			rb_tree_init(&hb->hb_tree, &conndb_rbtree_ops);
+			rw_init(&hb->hb_lock);
+			hb->hb_count = 0;
+		}
 	}
 	cd->cd_seed = cprng_fast32();
 	return cd;
@@ -128,24 +166,27 @@ npf_conndb_create(void)
 void
 npf_conndb_destroy(npf_conndb_t *cd)
 {
-	size_t len = offsetof(npf_conndb_t, cd_hashtbl[CONNDB_HASH_BUCKETS]);
+	for (u_int s = 0; s < NPF_CONNDB_SHARDS; s++) {
+		npf_conndb_shard_t *cs = &cd->cd_shards[s];
 
-	KASSERT(cd->cd_recent == NULL);
-	KASSERT(cd->cd_list == NULL);
-	KASSERT(cd->cd_tail == NULL);
+		KASSERT(cs->cs_recent == NULL);
+		KASSERT(cs->cs_list == NULL);
+		KASSERT(cs->cs_tail == NULL);
 
-	for (u_int i = 0; i < CONNDB_HASH_BUCKETS; i++) {
-		npf_hashbucket_t *hb = &cd->cd_hashtbl[i];
+		for (u_int i = 0; i < CONNDB_HASH_BUCKETS; i++) {
+			npf_hashbucket_t *hb = &cs->cs_hashtbl[i];
 
-		KASSERT(hb->hb_count == 0);
-		KASSERT(!rb_tree_iterate(&hb->hb_tree, NULL, RB_DIR_LEFT));
-		rw_destroy(&hb->hb_lock);
+			KASSERT(hb->hb_count == 0);
+			KASSERT(!rb_tree_iterate(&hb->hb_tree, NULL,
+			    RB_DIR_LEFT));
+			rw_destroy(&hb->hb_lock);
+		}
 	}
 #ifdef USE_JUDY
 	Word_t bytes;
 	JHSFA(bytes, cd->cd_tree);
 #endif
-	kmem_free(cd, len);
+	kmem_free(cd, sizeof(npf_conndb_t));
 }
 
 /*
@@ -180,6 +221,17 @@ npf_conndb_lookup(npf_conndb_t *cd, const npf_connkey_t *key, bool *forw)
 	return con;
 }
 
+/*
+ * npf_conndb_prefetch: prefetch the hash bucket of the key.
+ */
+void
+npf_conndb_prefetch(npf_conndb_t *cd, const npf_connkey_t *key)
+{
+#ifndef USE_JUDY
+	__builtin_prefetch(conndb_hash_bucket(cd, key));
+#endif
+}
+
 /*
  * npf_conndb_insert: insert the key representing the connection.
  */
@@ -238,17 +290,20 @@ npf_conndb_remove(npf_conndb_t *cd, npf_connkey_t *key)
 
 /*
  * npf_conndb_enqueue: atomically insert the connection into the
- * singly-linked list of "recent" connections.
+ * singly-linked list of "recent" connections of the shard of its
+ * forwards entry.
  */
 void
 npf_conndb_enqueue(npf_conndb_t *cd, npf_conn_t *con)
 {
+	const u_int s = conndb_shard_index(cd, &con->c_forw_entry);
+	npf_conndb_shard_t *cs = &cd->cd_shards[s];
 	npf_conn_t *head;
 
 	do {
-		head = cd->cd_recent;
+		head = cs->cs_recent;
 		con->c_next = head;
-	} while (atomic_cas_ptr(&cd->cd_recent, head, con) != head);
+	} while (atomic_cas_ptr(&cs->cs_recent, head, con) != head);
 }
 
 /*
@@ -256,43 +311,49 @@ npf_conndb_enqueue(npf_conndb_t *cd, npf_conn_t *con)
  * given the previous element; no concurrent writers are allowed here.
  */
 void
-npf_conndb_dequeue(npf_conndb_t *cd, npf_conn_t *con, npf_conn_t *prev)
+npf_conndb_dequeue(npf_conndb_t *cd, u_int s, npf_conn_t *con,
+    npf_conn_t *prev)
 {
+	npf_conndb_shard_t *cs = &cd->cd_shards[s];
+
 	if (prev == NULL) {
-		KASSERT(cd->cd_list == con);
-		cd->cd_list = con->c_next;
+		KASSERT(cs->cs_list == con);
+		cs->cs_list = con->c_next;
 	} else {
 		prev->c_next = con->c_next;
 	}
 }
 
 /*
- * npf_conndb_getlist: atomically take the "recent" connections and add
- * them to the singly-linked list of the connections.
+ * npf_conndb_getlist: atomically take the "recent" connections of a
+ * shard and add them to the singly-linked list of its connections.
  */
 npf_conn_t *
-npf_conndb_getlist(npf_conndb_t *cd)
+npf_conndb_getlist(npf_conndb_t *cd, u_int s)
 {
+	npf_conndb_shard_t *cs = &cd->cd_shards[s];
 	npf_conn_t *con, *prev;
 
-	con = atomic_swap_ptr(&cd->cd_recent, NULL);
-	if ((prev = cd->cd_tail) == NULL) {
-		KASSERT(cd->cd_list == NULL);
-		cd->cd_list = con;
+	con = atomic_swap_ptr(&cs->cs_recent, NULL);
+	if ((prev = cs->cs_tail) == NULL) {
+		KASSERT(cs->cs_list == NULL);
+		cs->cs_list = con;
 	} else {
 		KASSERT(prev->c_next == NULL);
 		prev->c_next = con;
 	}
-	return cd->cd_list;
+	return cs->cs_list;
 }
 
 /*
  * npf_conndb_settail: assign a new tail of the singly-linked list.
  */
 void
-npf_conndb_settail(npf_conndb_t *cd, npf_conn_t *con)
+npf_conndb_settail(npf_conndb_t *cd, u_int s, npf_conn_t *con)
 {
-	KASSERT(con || cd->cd_list == NULL);
+	npf_conndb_shard_t *cs = &cd->cd_shards[s];
+
+	KASSERT(con || cs->cs_list == NULL);
 	KASSERT(!con || con->c_next == NULL);
-	cd->cd_tail = con;
+	cs->cs_tail = con;
 }
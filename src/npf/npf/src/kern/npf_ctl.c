@@ -345,7 +345,7 @@ npf_mk_singlerule(npf_t *npf, prop_dictionary_t rldict, npf_rprocset_t *rpset,
 		if (error) {
 			goto err;
 		}
-		npf_rule_setcode(rl, type, code, len);
+		npf_rule_setcode(npf, rl, type, code, len);
 	}
 
 	*rlret = rl;
@@ -863,6 +863,61 @@ out:
 	return error;
 }
 
+/*
+ * npfctl_rule_add: insert the rule into the dynamic group 'rname' of the
+ * active configuration and return its ID.
+ *
+ * => Unlike a reload, this does not wait for a grace period.
+ */
+int
+npfctl_rule_add(npf_t *npf, const char *rname, prop_dictionary_t rldict,
+    uint64_t *id)
+{
+	prop_dictionary_t errdict;
+	npf_rule_t *rl;
+	int error;
+
+	errdict = prop_dictionary_create();
+	error = npf_mk_singlerule(npf, rldict, NULL, &rl, errdict);
+	prop_object_release(errdict);
+	if (error) {
+		return error;
+	}
+
+	npf_config_enter(npf);
+	error = npf_ruleset_add(npf_config_ruleset(npf), rname, rl);
+	if (!error) {
+		*id = npf_rule_getid(rl);
+	}
+	npf_config_exit(npf);
+
+	if (error) {
+		npf_rule_free(rl);
+	}
+	return error;
+}
+
+/*
+ * npfctl_rule_remove: remove the dynamic rule given its ID and destroy
+ * it once it cannot be used by the packet handlers anymore.
+ */
+int
+npfctl_rule_remove(npf_t *npf, const char *rname, uint64_t id)
+{
+	npf_ruleset_t *rlset;
+	int error;
+
+	npf_config_enter(npf);
+	rlset = npf_config_ruleset(npf);
+	error = npf_ruleset_remove(rlset, rname, id);
+	if (!error) {
+		npf_config_sync(npf);
+		npf_ruleset_gc(rlset);
+	}
+	npf_config_exit(npf);
+	return error;
+}
+
 /*
  * npfctl_table: add, remove or query entries in the specified table.
  *
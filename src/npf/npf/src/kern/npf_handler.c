@@ -117,170 +117,223 @@ npf_reassembly(npf_t *npf, npf_cache_t *npc, struct mbuf **mp)
 }
 
 /*
- * npf_packet_handler: main packet handling routine for layer 3.
- *
- * Note: packet flow and inspection logic is in strict order.
+ * Packet state kept across the handling steps, so that a burst of
+ * packets can go through each step before the next one.
  */
-__dso_public int
-npf_packet_handler(npf_t *npf, struct mbuf **mp, ifnet_t *ifp, int di)
+typedef struct {
+	nbuf_t		nbuf;
+	npf_cache_t	npc;
+	npf_conn_t *	con;
+	npf_rproc_t *	rp;
+	int		error;
+	int		retfl;
+	int		decision;
+} npf_pktstate_t;
+
+/* Next step of a packet. */
+#define	NPF_STEP_CONN		0
+#define	NPF_STEP_RULESET	1
+#define	NPF_STEP_ESTABLISH	2
+#define	NPF_STEP_PASS		3
+#define	NPF_STEP_BLOCK		4
+#define	NPF_STEP_OUT		5
+#define	NPF_STEP_DONE		6
+
+/*
+ * npf_packet_cache: initialise the packet state and cache the headers.
+ */
+static int
+npf_packet_cache(npf_t *npf, npf_pktstate_t *ps, struct mbuf **mp,
+    ifnet_t *ifp)
 {
-	nbuf_t nbuf;
-	npf_cache_t npc;
-	npf_conn_t *con;
-	npf_rule_t *rl;
-	npf_rproc_t *rp;
-	int error, retfl;
+	npf_cache_t *npc = &ps->npc;
 	uint32_t ntag;
-	int decision;
 
-	/* QSBR checkpoint. */
-	pserialize_checkpoint(npf->qsbr);
 	KASSERT(ifp != NULL);
 
 	/*
 	 * Initialise packet information cache.
 	 * Note: it is enough to clear the info bits.
 	 */
-	npc.npc_ctx = npf;
-	nbuf_init(npf, &nbuf, *mp, ifp);
-	npc.npc_nbuf = &nbuf;
-	npc.npc_info = 0;
+	npc->npc_ctx = npf;
+	nbuf_init(npf, &ps->nbuf, *mp, ifp);
+	npc->npc_nbuf = &ps->nbuf;
+	npc->npc_info = 0;
 
-	decision = NPF_DECISION_BLOCK;
-	error = 0;
-	retfl = 0;
-	rp = NULL;
+	ps->decision = NPF_DECISION_BLOCK;
+	ps->error = 0;
+	ps->retfl = 0;
+	ps->con = NULL;
+	ps->rp = NULL;
 
 	/* Cache everything.  Determine whether it is an IP fragment. */
-	if (__predict_false(npf_cache_all(&npc) & NPC_IPFRAG)) {
+	if (__predict_false(npf_cache_all(npc) & NPC_IPFRAG)) {
 		/*
 		 * Pass to IPv4 or IPv6 reassembly mechanism.
 		 */
-		error = npf_reassembly(npf, &npc, mp);
-		if (error) {
-			con = NULL;
-			goto out;
+		ps->error = npf_reassembly(npf, npc, mp);
+		if (ps->error) {
+			return NPF_STEP_OUT;
 		}
 		if (*mp == NULL) {
 			/* More fragments should come; return. */
-			return 0;
+			return NPF_STEP_DONE;
 		}
 	}
 
 	/* Just pass-through if specially tagged. */
-	if (nbuf_find_tag(&nbuf, &ntag) == 0 && (ntag & NPF_NTAG_PASS) != 0) {
-		con = NULL;
-		goto pass;
+	if (nbuf_find_tag(&ps->nbuf, &ntag) == 0 &&
+	    (ntag & NPF_NTAG_PASS) != 0) {
+		return NPF_STEP_PASS;
 	}
+	return NPF_STEP_CONN;
+}
 
+/*
+ * npf_packet_conn: inspect the list of connections.
+ */
+static int
+npf_packet_conn(npf_t *npf, npf_pktstate_t *ps, int di)
+{
 	/* Inspect the list of connections (if found, acquires a reference). */
-	con = npf_conn_inspect(&npc, di, &error);
+	ps->con = npf_conn_inspect(&ps->npc, di, &ps->error);
 
 	/* If "passing" connection found - skip the ruleset inspection. */
-	if (con && npf_conn_pass(con, &rp)) {
+	if (ps->con && npf_conn_pass(ps->con, &ps->rp)) {
 		npf_stats_inc(npf, NPF_STAT_PASS_CONN);
-		KASSERT(error == 0);
-		goto pass;
+		KASSERT(ps->error == 0);
+		return NPF_STEP_PASS;
 	}
-	if (__predict_false(error)) {
-		if (error == ENETUNREACH)
-			goto block;
-		goto out;
+	if (__predict_false(ps->error)) {
+		if (ps->error == ENETUNREACH)
+			return NPF_STEP_BLOCK;
+		return NPF_STEP_OUT;
 	}
+	return NPF_STEP_RULESET;
+}
 
-	/* Acquire the lock, inspect the ruleset using this packet. */
-	int slock = npf_config_read_enter();
-	npf_ruleset_t *rlset = npf_config_ruleset(npf);
+/*
+ * npf_packet_ruleset: inspect the ruleset using this packet.
+ *
+ * => Caller should be in the config read section.
+ */
+static int
+npf_packet_ruleset(npf_t *npf, npf_ruleset_t *rlset, npf_pktstate_t *ps,
+    int di)
+{
+	npf_rule_t *rl;
 
-	rl = npf_ruleset_inspect(&npc, rlset, di, NPF_LAYER_3);
+	rl = npf_ruleset_inspect(&ps->npc, rlset, di, NPF_LAYER_3);
 	if (__predict_false(rl == NULL)) {
-		const bool pass = npf_default_pass(npf);
-		npf_config_read_exit(slock);
-
-		if (pass) {
+		if (npf_default_pass(npf)) {
 			npf_stats_inc(npf, NPF_STAT_PASS_DEFAULT);
-			goto pass;
+			return NPF_STEP_PASS;
 		}
 		npf_stats_inc(npf, NPF_STAT_BLOCK_DEFAULT);
-		goto block;
+		return NPF_STEP_BLOCK;
 	}
 
 	/*
 	 * Get the rule procedure (acquires a reference) for association
 	 * with a connection (if any) and execution.
 	 */
-	KASSERT(rp == NULL);
-	rp = npf_rule_getrproc(rl);
-
-	/* Conclude with the rule and release the lock. */
-	error = npf_rule_conclude(rl, &retfl);
-	npf_config_read_exit(slock);
+	KASSERT(ps->rp == NULL);
+	ps->rp = npf_rule_getrproc(rl);
 
-	if (error) {
+	/* Conclude with the rule. */
+	ps->error = npf_rule_conclude(rl, &ps->retfl);
+	if (ps->error) {
 		npf_stats_inc(npf, NPF_STAT_BLOCK_RULESET);
-		goto block;
+		return NPF_STEP_BLOCK;
 	}
 	npf_stats_inc(npf, NPF_STAT_PASS_RULESET);
+	return NPF_STEP_ESTABLISH;
+}
 
-	/*
-	 * Establish a "pass" connection, if required.  Just proceed if
-	 * connection creation fails (e.g. due to unsupported protocol).
-	 */
-	if ((retfl & NPF_RULE_STATEFUL) != 0 && !con) {
-		con = npf_conn_establish(&npc, di,
-		    (retfl & NPF_RULE_MULTIENDS) == 0);
-		if (con) {
-			/*
-			 * Note: the reference on the rule procedure is
-			 * transfered to the connection.  It will be
-			 * released on connection destruction.
-			 */
-			npf_conn_setpass(con, rp);
+/*
+ * npf_packet_finish: apply the decision of the previous steps.
+ * If 'fastcon' is set, it is filled with the connection of a passed
+ * packet when later packets of this connection may skip inspection.
+ */
+static int
+npf_packet_finish(npf_t *npf, npf_pktstate_t *ps, struct mbuf **mp, int di,
+    int step, npf_conn_t **fastcon)
+{
+	npf_cache_t *npc = &ps->npc;
+
+	switch (step) {
+	case NPF_STEP_DONE:
+		return 0;
+	case NPF_STEP_ESTABLISH:
+		/*
+		 * Establish a "pass" connection, if required.  Just proceed
+		 * if connection creation fails (e.g. due to unsupported
+		 * protocol).
+		 */
+		if ((ps->retfl & NPF_RULE_STATEFUL) != 0 && !ps->con) {
+			ps->con = npf_conn_establish(npc, di,
+			    (ps->retfl & NPF_RULE_MULTIENDS) == 0);
+			if (ps->con) {
+				/*
+				 * Note: the reference on the rule procedure
+				 * is transfered to the connection.  It will
+				 * be released on connection destruction.
+				 */
+				npf_conn_setpass(ps->con, ps->rp);
+			}
 		}
-	}
-pass:
-	decision = NPF_DECISION_PASS;
-	KASSERT(error == 0);
-	/*
-	 * Perform NAT.
-	 */
-	error = npf_do_nat(&npc, con, di);
-block:
-	/*
-	 * Execute the rule procedure, if any is associated.
-	 * It may reverse the decision from pass to block.
-	 */
-	if (rp && !npf_rproc_run(&npc, rp, &decision)) {
-		if (con) {
-			npf_conn_release(con);
+		/* FALLTHROUGH */
+	case NPF_STEP_PASS:
+		ps->decision = NPF_DECISION_PASS;
+		KASSERT(ps->error == 0);
+		/*
+		 * Perform NAT.
+		 */
+		ps->error = npf_do_nat(npc, ps->con, di);
+		/* FALLTHROUGH */
+	case NPF_STEP_BLOCK:
+		/*
+		 * Execute the rule procedure, if any is associated.
+		 * It may reverse the decision from pass to block.
+		 */
+		if (ps->rp && !npf_rproc_run(npc, ps->rp, &ps->decision)) {
+			if (ps->con) {
+				npf_conn_release(ps->con);
+			}
+			npf_rproc_release(ps->rp);
+			*mp = NULL;
+			return 0;
 		}
-		npf_rproc_release(rp);
-		*mp = NULL;
-		return 0;
+		/* FALLTHROUGH */
+	default:
+		break;
 	}
-out:
+
 	/*
 	 * Release the reference on a connection.  Release the reference
 	 * on a rule procedure only if there was no association.
 	 */
-	if (con) {
-		npf_conn_release(con);
-	} else if (rp) {
-		npf_rproc_release(rp);
+	if (ps->con) {
+		npf_conn_release(ps->con);
+	} else if (ps->rp) {
+		npf_rproc_release(ps->rp);
 	}
 
 	/* Reset mbuf pointer before returning to the caller. */
-	if ((*mp = nbuf_head_mbuf(&nbuf)) == NULL) {
-		return error ? error : ENOMEM;
+	if ((*mp = nbuf_head_mbuf(&ps->nbuf)) == NULL) {
+		return ps->error ? ps->error : ENOMEM;
 	}
 
 	/* Pass the packet if decided and there is no error. */
-	if (decision == NPF_DECISION_PASS && !error) {
+	if (ps->decision == NPF_DECISION_PASS && !ps->error) {
 		/*
 		 * XXX: Disable for now, it will be set accordingly later,
 		 * for optimisations (to reduce inspection).
 		 */
 		m_clear_flag(*mp, M_CANFASTFWD);
+		if (fastcon && ps->con && npf_conn_fastpath_p(ps->con)) {
+			*fastcon = ps->con;
+		}
 		return 0;
 	}
 
@@ -289,12 +342,12 @@ out:
 	 * Depending on the flags and protocol, return TCP reset (RST) or
 	 * ICMP destination unreachable.
 	 */
-	if (retfl && npf_return_block(&npc, retfl)) {
+	if (ps->retfl && npf_return_block(npc, ps->retfl)) {
 		*mp = NULL;
 	}
 
-	if (!error) {
-		error = ENETUNREACH;
+	if (!ps->error) {
+		ps->error = ENETUNREACH;
 	}
 
 	if (*mp) {
@@ -302,5 +355,119 @@ out:
 		m_freem(*mp);
 		*mp = NULL;
 	}
-	return error;
+	return ps->error;
+}
+
+/*
+ * npf_packet_handle: main packet handling routine for layer 3.
+ *
+ * Note: packet flow and inspection logic is in strict order.
+ */
+static int
+npf_packet_handle(npf_t *npf, struct mbuf **mp, ifnet_t *ifp, int di,
+    npf_conn_t **fastcon)
+{
+	npf_pktstate_t ps;
+	int step;
+
+	/* QSBR checkpoint. */
+	pserialize_checkpoint(npf->qsbr);
+
+	step = npf_packet_cache(npf, &ps, mp, ifp);
+	if (step == NPF_STEP_CONN) {
+		step = npf_packet_conn(npf, &ps, di);
+	}
+	if (step == NPF_STEP_RULESET) {
+		/* Acquire the lock, inspect the ruleset using this packet. */
+		int slock = npf_config_read_enter();
+
+		step = npf_packet_ruleset(npf, npf_config_ruleset(npf),
+		    &ps, di);
+		npf_config_read_exit(slock);
+	}
+	return npf_packet_finish(npf, &ps, mp, di, step, fastcon);
+}
+
+__dso_public int
+npf_packet_handler(npf_t *npf, struct mbuf **mp, ifnet_t *ifp, int di)
+{
+	return npf_packet_handle(npf, mp, ifp, di, NULL);
+}
+
+/*
+ * npf_packet_handler_conn: same as npf_packet_handler, but also return
+ * the connection (or NULL) which packets may be passed with
+ * npf_conn_fastpass() as long as npf_conn_gen() does not change.
+ */
+__dso_public int
+npf_packet_handler_conn(npf_t *npf, struct mbuf **mp, ifnet_t *ifp, int di,
+    npf_conn_t **con)
+{
+	*con = NULL;
+	return npf_packet_handle(npf, mp, ifp, di, con);
+}
+
+/*
+ * npf_packet_handler_burst: handle up to NPF_BURST_MAX packets going in
+ * the same direction and return the mask of the passed ones.
+ *
+ * Each step is done on the whole burst: the connection buckets of all
+ * packets are prefetched before the first lookup and the packets which
+ * miss the connections are inspected in a single config read section.
+ * Therefore, packets of a connection established within the burst are
+ * still inspected by the ruleset.  If 'cons' is set, it is filled as
+ * by npf_packet_handler_conn().
+ */
+__dso_public uint64_t
+npf_packet_handler_burst(npf_t *npf, struct mbuf **mps, unsigned n,
+    ifnet_t *ifp, int di, npf_conn_t **cons)
+{
+	npf_pktstate_t ps[NPF_BURST_MAX];
+	int steps[NPF_BURST_MAX];
+	bool ruleset = false;
+	uint64_t passed = 0;
+	unsigned i;
+
+	KASSERT(n <= NPF_BURST_MAX);
+
+	/* QSBR checkpoint. */
+	pserialize_checkpoint(npf->qsbr);
+
+	for (i = 0; i < n; i++) {
+		steps[i] = npf_packet_cache(npf, &ps[i], &mps[i], ifp);
+		if (steps[i] == NPF_STEP_CONN) {
+			npf_conn_prefetch(&ps[i].npc);
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (steps[i] == NPF_STEP_CONN) {
+			steps[i] = npf_packet_conn(npf, &ps[i], di);
+			ruleset |= steps[i] == NPF_STEP_RULESET;
+		}
+	}
+	if (ruleset) {
+		int slock = npf_config_read_enter();
+		npf_ruleset_t *rlset = npf_config_ruleset(npf);
+
+		for (i = 0; i < n; i++) {
+			if (steps[i] == NPF_STEP_RULESET) {
+				steps[i] = npf_packet_ruleset(npf, rlset,
+				    &ps[i], di);
+			}
+		}
+		npf_config_read_exit(slock);
+	}
+	for (i = 0; i < n; i++) {
+		npf_conn_t **con = NULL;
+
+		if (cons) {
+			cons[i] = NULL;
+			con = &cons[i];
+		}
+		if (npf_packet_finish(npf, &ps[i], &mps[i], di, steps[i],
+		    con) == 0) {
+			passed |= (uint64_t)1 << i;
+		}
+	}
+	return passed;
 }
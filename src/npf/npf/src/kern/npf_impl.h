@@ -155,8 +155,12 @@ struct nbuf {
 	unsigned	nb_ifid;
 	int		nb_flags;
 	const npf_mbufops_t *nb_mops;
+	/* data of the first mbuf before the layer 3 header, skipped */
+	size_t		nb_l3off;
 };
 
+#define	NBUF_L3OFF(nbuf, m)	((m) == (nbuf)->nb_mbuf0 ? (nbuf)->nb_l3off : 0)
+
 /*
  * NPF INSTANCE (CONTEXT) STRUCTURE AND AUXILIARY OPERATIONS.
  */
@@ -167,8 +171,9 @@ struct npf {
 	pserialize_t		qsbr;
 	npf_config_t *		config;
 
-	/* BPF byte-code context. */
+	/* BPF byte-code context and whether rules are JIT-compiled. */
 	bpf_ctx_t *		bpfctx;
+	bool			bpf_jit;
 	const npf_mbufops_t *	mbufops;
 
 	/*
@@ -180,6 +185,13 @@ struct npf {
 	npf_conndb_t *		conn_db;
 	pool_cache_t		conn_cache;
 
+	/*
+	 * Connection generation: incremented before connections are
+	 * destroyed or the configuration is reloaded, so that external
+	 * caches of connection pointers can detect stale entries.
+	 */
+	volatile uint64_t	conn_gen;
+
 	/* ALGs. */
 	npf_algset_t *		algset;
 
@@ -234,6 +246,9 @@ int		npfctl_reload(u_long, void *);
 int		npfctl_save(npf_t *, u_long, void *);
 int		npfctl_load(npf_t *, u_long, void *);
 int		npfctl_rule(npf_t *, u_long, void *);
+int		npfctl_rule_add(npf_t *, const char *, prop_dictionary_t,
+		    uint64_t *);
+int		npfctl_rule_remove(npf_t *, const char *, uint64_t);
 int		npfctl_conn_lookup(npf_t *, u_long, void *);
 int		npfctl_table(npf_t *, void *);
 
@@ -337,7 +352,7 @@ int		npf_rule_conclude(const npf_rule_t *, int *);
 
 /* Rule interface. */
 npf_rule_t *	npf_rule_alloc(npf_t *, prop_dictionary_t);
-void		npf_rule_setcode(npf_rule_t *, int, void *, size_t);
+void		npf_rule_setcode(npf_t *, npf_rule_t *, int, void *, size_t);
 void		npf_rule_setrproc(npf_rule_t *, npf_rproc_t *);
 void		npf_rule_free(npf_rule_t *);
 uint64_t	npf_rule_getid(const npf_rule_t *);
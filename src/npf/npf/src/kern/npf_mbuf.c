@@ -47,12 +47,15 @@ __KERNEL_RCSID(0, "$NetBSD: npf_mbuf.c,v 1.18 2016/12/26 23:05:06 christos Exp $
 #include "npf_impl.h"
 
 #if defined(_NPF_STANDALONE)
-#define	m_length(m)		(nbuf)->nb_mops->getchainlen(m)
-#define	m_buflen(m)		(nbuf)->nb_mops->getlen(m)
+#define	m_length(m)		\
+    ((nbuf)->nb_mops->getchainlen(m) - NBUF_L3OFF(nbuf, m))
+#define	m_buflen(m)		\
+    ((nbuf)->nb_mops->getlen(m) - NBUF_L3OFF(nbuf, m))
 #define	m_next_ptr(m)		(nbuf)->nb_mops->getnext(m)
 #define	m_ensure_contig(m,t)	(nbuf)->nb_mops->ensure_contig((m), (t))
 #define	m_makewritable(m,o,l,f)	(nbuf)->nb_mops->ensure_writable((m), (o+l))
-#define	mtod(m,t)		((t)((nbuf)->nb_mops->getdata(m)))
+#define	mtod(m,t)		\
+    ((t)((uintptr_t)(nbuf)->nb_mops->getdata(m) + NBUF_L3OFF(nbuf, m)))
 #define	m_flags_p(m,f)		true
 #else
 #define	m_next_ptr(m)		(m)->m_next
@@ -73,6 +76,10 @@ nbuf_init(npf_t *npf, nbuf_t *nbuf, struct mbuf *m, const ifnet_t *ifp)
 	nbuf->nb_mops = npf->mbufops;
 
 	nbuf->nb_mbuf0 = m;
+#if defined(_NPF_STANDALONE)
+	nbuf->nb_l3off = nbuf->nb_mops->getl3off ?
+	    nbuf->nb_mops->getl3off(m) : 0;
+#endif
 	nbuf->nb_ifp = ifp;
 	nbuf->nb_ifid = ifid;
 	nbuf_reset(nbuf);
@@ -755,17 +755,19 @@ npf_rule_export(npf_t *npf, const npf_ruleset_t *rlset,
  * npf_rule_setcode: assign filter code to the rule.
  *
  * => The code must be validated by the caller.
- * => JIT compilation may be performed here.
+ * => JIT compilation is performed here unless disabled; if it fails,
+ *    the byte-code is interpreted.
  */
 void
-npf_rule_setcode(npf_rule_t *rl, const int type, void *code, size_t size)
+npf_rule_setcode(npf_t *npf, npf_rule_t *rl, const int type, void *code,
+    size_t size)
 {
 	KASSERT(type == NPF_CODE_BPF);
 
 	rl->r_type = type;
 	rl->r_code = code;
 	rl->r_clen = size;
-	rl->r_jcode = npf_bpf_compile(code, size);
+	rl->r_jcode = npf->bpf_jit ? npf_bpf_compile(code, size) : NULL;
 }
 
 /*
@@ -34,6 +34,7 @@
 
 struct mbuf;
 struct ifnet;
+struct npf_conn;
 
 #if defined(_NPF_STANDALONE) || !defined(__NetBSD__)
 #define PFIL_IN		0x00000001	// incoming packet
@@ -41,6 +42,7 @@ struct ifnet;
 #endif
 
 #define	NPF_NO_GC	0x01
+#define	NPF_NO_JIT	0x02
 
 typedef struct {
 	const char *	(*getname)(struct ifnet *);
@@ -57,6 +59,8 @@ typedef struct {
 	struct mbuf *	(*getnext)(struct mbuf *);
 	size_t		(*getlen)(const struct mbuf *);
 	size_t		(*getchainlen)(const struct mbuf *);
+	/* offset of the layer 3 header in the first mbuf, may be NULL */
+	size_t		(*getl3off)(const struct mbuf *);
 	bool		(*ensure_contig)(struct mbuf **, size_t);
 	bool		(*ensure_writable)(struct mbuf **, size_t);
 } npf_mbufops_t;
@@ -66,11 +70,27 @@ void	npf_sysfini(void);
 
 npf_t *	npf_create(int, const npf_mbufops_t *, const npf_ifops_t *);
 int	npf_load(npf_t *, void *, npf_error_t *);
+int	npf_dynrule_add(npf_t *, const char *, void *, uint64_t *);
+int	npf_dynrule_remove(npf_t *, const char *, uint64_t);
+int	npf_table_ctl(npf_t *, void *);
 void	npf_gc(npf_t *);
 void	npf_destroy(npf_t *);
 
 void	npf_thread_register(npf_t *);
+void	npf_thread_checkpoint(npf_t *);
+void	npf_thread_offline(npf_t *);
 int	npf_packet_handler(npf_t *, struct mbuf **, struct ifnet *, int);
+int	npf_packet_handler_conn(npf_t *, struct mbuf **, struct ifnet *, int,
+	    struct npf_conn **);
+
+#define	NPF_BURST_MAX	64
+
+uint64_t npf_packet_handler_burst(npf_t *, struct mbuf **, unsigned,
+	    struct ifnet *, int, struct npf_conn **);
+
+uint64_t npf_conn_gen(npf_t *);
+uint64_t npf_conn_now(void);
+bool	npf_conn_fastpass(struct npf_conn *, uint64_t);
 void	npf_ifmap_attach(npf_t *, struct ifnet *);
 void	npf_ifmap_detach(npf_t *, struct ifnet *);
 void	npf_stats(npf_t *, uint64_t *);
@@ -67,6 +67,7 @@
 #include "cext.h"
 
 #include "mempool.h"
+#include "tls.h"
 #include "rbtree.h"
 #include "bpf.h"
 
@@ -126,12 +127,15 @@ npfkern_qsbr_wait(qsbr_t *qsbr)
 	while (!qsbr_sync(qsbr, target)) {
 		(void)nanosleep(&dtime, NULL);
 	}
+	/* Do not hold back the next writer until our next checkpoint. */
+	qsbr_offline(qsbr);
 }
 
 #define	pserialize_create()	qsbr_create()
 #define	pserialize_destroy(p)	qsbr_destroy(p)
 #define	pserialize_register(p)	qsbr_register(p)
 #define	pserialize_checkpoint(p) qsbr_checkpoint(p)
+#define	pserialize_offline(p)	qsbr_offline(p)
 #define	pserialize_perform(p)	npfkern_qsbr_wait(p)
 #define	pserialize_read_enter()	0x50505050
 #define	pserialize_read_exit(s)	assert((s) == 0x50505050)
@@ -159,6 +163,7 @@ npfkern_atomic_swap_ptr(volatile void *ptr, void *nval)
 #define	membar_sync()		__sync_synchronize()
 #define	membar_producer()	__sync_synchronize()
 #define	atomic_inc_uint(x)	__sync_fetch_and_add(x, 1)
+#define	atomic_inc_64(x)	__sync_fetch_and_add(x, 1)
 #define	atomic_dec_uint(x)	__sync_sub_and_fetch(x, 1)
 #define	atomic_dec_uint_nv(x)	__sync_sub_and_fetch(x, 1)
 #define	atomic_or_uint(x, v)	__sync_fetch_and_or(x, v)
@@ -218,14 +223,14 @@ typedef mempool_t *	pool_cache_t;
 #define	kfree(ptr, type)		free(ptr)
 
 /*
- * FIXME/TODO: To be implemented using TLS ..
+ * Per-CPU storage, one slot per thread (see tls_pth.c).
  */
-#define	percpu_t			void
-#define	percpu_alloc(s)			calloc(1, s)
-#define	percpu_free(p, s)		free(p)
-#define	percpu_getref(p)		p
+#define	percpu_t			tls_percpu_t
+#define	percpu_alloc(s)			tls_percpu_create(s)
+#define	percpu_free(p, s)		tls_percpu_destroy(p)
+#define	percpu_getref(p)		tls_percpu_get(p)
 #define	percpu_putref(p)
-#define	percpu_foreach(p, f, b)		f(p, b, NULL)
+#define	percpu_foreach(p, f, b)		tls_percpu_foreach(p, f, b)
 
 static inline int
 npfkern_copy(void *dst, const void *src, size_t len)
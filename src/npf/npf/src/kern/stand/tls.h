@@ -14,4 +14,13 @@ tls_key_t *	tls_create(size_t);
 void *		tls_get(tls_key_t *);
 void		tls_destroy(tls_key_t *);
 
+struct cpu_info;
+typedef struct tls_percpu tls_percpu_t;
+
+tls_percpu_t *	tls_percpu_create(size_t);
+void *		tls_percpu_get(tls_percpu_t *);
+void		tls_percpu_foreach(tls_percpu_t *,
+		    void (*)(void *, void *, struct cpu_info *), void *);
+void		tls_percpu_destroy(tls_percpu_t *);
+
 #endif
@@ -13,6 +13,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 
 #include "tls.h"
@@ -59,3 +60,63 @@ tls_destroy(tls_key_t *tk)
 	pthread_key_delete(tk->key);
 	free(tk);
 }
+
+/*
+ * Per-CPU storage: every thread gets its own slot, slots are shared
+ * once more than TLS_PERCPU_MAX threads used them.  Slots are cache
+ * line aligned so that threads never write to the same line.
+ */
+
+#define	TLS_PERCPU_MAX		64
+
+struct tls_percpu {
+	void *		slots;
+	size_t		stride;
+};
+
+static unsigned			tls_percpu_next;
+static __thread int		tls_percpu_slot = -1;
+
+tls_percpu_t *
+tls_percpu_create(size_t size)
+{
+	tls_percpu_t *pc;
+
+	if ((pc = zalloc(sizeof(tls_percpu_t))) == NULL) {
+		return NULL;
+	}
+	pc->stride = roundup2(size, CACHE_LINE_SIZE);
+	if (posix_memalign(&pc->slots, CACHE_LINE_SIZE,
+	    pc->stride * TLS_PERCPU_MAX) != 0) {
+		free(pc);
+		return NULL;
+	}
+	memset(pc->slots, 0, pc->stride * TLS_PERCPU_MAX);
+	return pc;
+}
+
+void *
+tls_percpu_get(tls_percpu_t *pc)
+{
+	if (__predict_false(tls_percpu_slot < 0)) {
+		tls_percpu_slot = __sync_fetch_and_add(&tls_percpu_next, 1) %
+		    TLS_PERCPU_MAX;
+	}
+	return (char *)pc->slots + tls_percpu_slot * pc->stride;
+}
+
+void
+tls_percpu_foreach(tls_percpu_t *pc,
+    void (*func)(void *, void *, struct cpu_info *), void *arg)
+{
+	for (unsigned i = 0; i < TLS_PERCPU_MAX; i++) {
+		func((char *)pc->slots + i * pc->stride, arg, NULL);
+	}
+}
+
+void
+tls_percpu_destroy(tls_percpu_t *pc)
+{
+	free(pc->slots);
+	free(pc);
+}
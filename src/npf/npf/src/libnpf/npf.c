@@ -680,6 +680,12 @@ npf_rule_export(nl_rule_t *rl, size_t *length)
 	return xml;
 }
 
+void *
+npf_rule_build(nl_rule_t *rl)
+{
+	return (void *)rl->nrl_dict;
+}
+
 bool
 npf_rule_exists_p(nl_config_t *ncf, const char *name)
 {
@@ -95,6 +95,7 @@ int		npf_rule_setinfo(nl_rule_t *, const void *, size_t);
 bool		npf_rule_exists_p(nl_config_t *, const char *);
 int		npf_rule_insert(nl_config_t *, nl_rule_t *, nl_rule_t *);
 void *		npf_rule_export(nl_rule_t *, size_t *);
+void *		npf_rule_build(nl_rule_t *);
 void		npf_rule_destroy(nl_rule_t *);
 
 nl_rproc_t *	npf_rproc_create(const char *);
@@ -68,6 +68,7 @@ struct rte_mbuf **pg_packets_append_blank(struct rte_mbuf **pkts,
 		if (!tmp)					\
 			return NULL;				\
 		rte_memcpy(tmp, buf, len);			\
+		pg_utils_reset_metadata(pkts[j]);		\
 	}
 
 struct rte_mbuf **pg_packets_append_buf(struct rte_mbuf **pkts,
@@ -99,6 +100,7 @@ struct rte_mbuf **pg_packets_prepend_buf(struct rte_mbuf **pkts,
 		if (!tmp)						\
 			return NULL;					\
 		strcpy(tmp, str);					\
+		pg_utils_reset_metadata(pkts[j]);			\
 	}
 
 struct rte_mbuf **pg_packets_append_str(struct rte_mbuf **pkts,
@@ -141,6 +143,7 @@ struct rte_mbuf **pg_packets_prepend_str(struct rte_mbuf **pkts,
 		if (!tmp)						\
 			return NULL;					\
 		rte_memcpy(tmp, &ip_hdr, sizeof(ip_hdr));		\
+		pg_utils_reset_metadata(pkts[j]);			\
 		pkts[j]->l3_len = sizeof(struct ipv4_hdr);		\
 	}								\
 
@@ -185,6 +188,7 @@ struct rte_mbuf **pg_packets_prepend_ipv4(struct rte_mbuf **pkts,
 		if (!tmp)						\
 			return NULL;					\
 		rte_memcpy(tmp, &ip_hdr, sizeof(ip_hdr));		\
+		pg_utils_reset_metadata(pkts[j]);			\
 		pkts[j]->l3_len = sizeof(struct ipv6_hdr);		\
 	}
 
@@ -216,6 +220,7 @@ struct rte_mbuf **pg_packets_append_ipv6(struct rte_mbuf **pkts,
 		if (!tmp)						\
 			return NULL;					\
 		memcpy(tmp, &udp_hdr, sizeof(udp_hdr));			\
+		pg_utils_reset_metadata(pkts[j]);			\
 	}								\
 
 struct rte_mbuf **pg_packets_append_udp(struct rte_mbuf **pkts,
@@ -253,6 +258,7 @@ struct rte_mbuf **pg_packets_prepend_udp(struct rte_mbuf **pkts,
 		if (!tmp)						\
 			return NULL;					\
 		rte_memcpy(tmp, &vx_hdr, sizeof(vx_hdr));		\
+		pg_utils_reset_metadata(pkts[j]);			\
 	}								\
 
 struct rte_mbuf **pg_packets_append_vxlan(struct rte_mbuf **pkts,
@@ -287,6 +293,7 @@ struct rte_mbuf **pg_packets_prepend_vxlan(struct rte_mbuf **pkts,
 		if (!tmp)						\
 			return NULL;					\
 		rte_memcpy(tmp, &eth_hdr, sizeof(eth_hdr));		\
+		pg_utils_reset_metadata(pkts[j]);			\
 		pkts[j]->l2_len = sizeof(struct ether_hdr);		\
 	}								\
 
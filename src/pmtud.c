@@ -18,8 +18,12 @@
 
 #include <packetgraph/pmtud.h>
 #include <rte_config.h>
+#include <rte_cycles.h>
+#include <rte_hash_crc.h>
 #include <rte_ip.h>
 #include <rte_ether.h>
+#include <rte_memcpy.h>
+#include <rte_tcp.h>
 #include "utils/mempool.h"
 #include "utils/bitmask.h"
 #include "utils/network.h"
@@ -27,34 +31,50 @@
 #include "brick-int.h"
 
 #define ICMP_PROTOCOL_NUMBER 0x01
+/* number of token buckets, sources sharing a bucket share their limit */
+#define PMTUD_BUCKETS 1024
+/* an ICMPv6 error must not exceed the IPv6 minimum MTU (rfc4443) */
+#define PMTUD_IPV6_MIN_MTU 1280
+#define PMTUD_TCP_SYN 0x02
+#define PMTUD_TCP_OPT_EOL 0
+#define PMTUD_TCP_OPT_NOP 1
+#define PMTUD_TCP_OPT_MSS 2
 
 struct pg_pmtud_config {
 	enum pg_side output;
 	uint32_t mtu_size;
 };
 
+struct pmtud_bucket {
+	uint64_t tsc;
+	uint32_t tokens;
+};
+
 struct pg_pmtud_state {
 	struct pg_brick brick;
 	enum pg_side output;
 	uint32_t eth_mtu_size;
 	uint32_t icmp_mtu_size;
-	struct rte_mbuf *icmp;
+	bool mss_clamp;
+	/* cycles needed to earn a token, 0 when ICMP are not limited */
+	uint64_t token_cycles;
+	uint32_t icmp_burst;
+	struct pmtud_bucket buckets[PMTUD_BUCKETS];
 };
 
 struct icmp_hdr {
 	uint8_t type;
 	uint8_t code;
 	uint16_t checksum;
-	uint16_t unused;
-	uint16_t next_hop_mtu;
-	struct ipv4_hdr ip;
-	uint64_t last_msg;
-} __attribute__((__packed__));
-
-struct icmp_full_hdr {
-	struct ether_hdr eth;
-	struct ipv4_hdr ip;
-	struct icmp_hdr icmp;
+	union {
+		/* ICMP destination unreachable */
+		struct {
+			uint16_t unused;
+			uint16_t next_hop_mtu;
+		};
+		/* ICMPv6 packet too big */
+		uint32_t mtu;
+	};
 } __attribute__((__packed__));
 
 static struct pg_brick_config *pmtud_config_new(const char *name,
@@ -71,14 +91,236 @@ static struct pg_brick_config *pmtud_config_new(const char *name,
 	return pg_brick_config_init(config, name, 1, 1, PG_DIPOLE);
 }
 
-static inline uint16_t icmp_checksum(struct icmp_hdr *msg)
+static void pmtud_buckets_reset(struct pg_pmtud_state *state)
+{
+	uint64_t now = rte_rdtsc();
+
+	for (int i = 0; i < PMTUD_BUCKETS; i++) {
+		state->buckets[i].tsc = now;
+		state->buckets[i].tokens = state->icmp_burst;
+	}
+}
+
+/* take a token from the bucket of a source, as suggested by rfc1812 */
+static inline bool pmtud_icmp_allowed(struct pg_pmtud_state *state,
+				      const void *src, uint32_t len,
+				      uint64_t now)
+{
+	struct pmtud_bucket *b;
+	uint64_t earned;
+
+	if (!state->token_cycles)
+		return true;
+	b = &state->buckets[rte_hash_crc(src, len, 0) & (PMTUD_BUCKETS - 1)];
+	earned = (now - b->tsc) / state->token_cycles;
+	if (earned >= state->icmp_burst - b->tokens) {
+		b->tokens = state->icmp_burst;
+		b->tsc = now;
+	} else {
+		b->tokens += earned;
+		b->tsc += earned * state->token_cycles;
+	}
+	if (!b->tokens)
+		return false;
+	b->tokens--;
+	return true;
+}
+
+/*
+ * Allocate an ICMP message answering pkt, with the layer 2 header of pkt
+ * in the other direction, and copy the quoted part of pkt at its end.
+ */
+static struct rte_mbuf *pmtud_icmp_alloc(struct rte_mbuf *pkt,
+					 uint16_t hdrs_len,
+					 uint16_t quote_len)
+{
+	struct rte_mbuf *icmp = rte_pktmbuf_alloc(pg_get_mempool());
+	struct ether_hdr *eth;
+	const void *quote;
+	char *data;
+
+	if (unlikely(!icmp))
+		return NULL;
+	data = rte_pktmbuf_append(icmp, pkt->l2_len + hdrs_len + quote_len);
+	if (unlikely(!data)) {
+		rte_pktmbuf_free(icmp);
+		return NULL;
+	}
+	rte_memcpy(data, rte_pktmbuf_mtod(pkt, void *), pkt->l2_len);
+	eth = (struct ether_hdr *)data;
+	ether_addr_copy(&eth->s_addr, &eth->d_addr);
+	ether_addr_copy(rte_pktmbuf_mtod(pkt, struct ether_addr *),
+			&eth->s_addr);
+
+	data += pkt->l2_len + hdrs_len;
+	quote = rte_pktmbuf_read(pkt, pkt->l2_len, quote_len, data);
+	if (quote != data)
+		rte_memcpy(data, quote, quote_len);
+	icmp->l2_len = pkt->l2_len;
+	return icmp;
+}
+
+/* ICMP fragmentation needed quoting the IP header and 8 bytes of data */
+static struct rte_mbuf *pmtud_icmp_ipv4(struct pg_pmtud_state *state,
+					struct rte_mbuf *pkt)
+{
+	struct ipv4_hdr *ip = pg_utils_get_l3(pkt);
+	uint16_t quote_len = RTE_MIN((uint32_t)pkt->l3_len + 8,
+				     pkt->pkt_len - pkt->l2_len);
+	struct rte_mbuf *icmp_pkt;
+	struct ipv4_hdr *icmp_ip;
+	struct icmp_hdr *icmp;
+
+	icmp_pkt = pmtud_icmp_alloc(pkt, sizeof(struct ipv4_hdr) +
+				    sizeof(struct icmp_hdr), quote_len);
+	if (unlikely(!icmp_pkt))
+		return NULL;
+	icmp_ip = pg_utils_get_l3(icmp_pkt);
+	icmp_ip->version_ihl = 0x45;
+	icmp_ip->type_of_service = 0;
+	icmp_ip->total_length = rte_cpu_to_be_16(sizeof(struct ipv4_hdr) +
+						 sizeof(struct icmp_hdr) +
+						 quote_len);
+	icmp_ip->packet_id = 0;
+	icmp_ip->fragment_offset = 0;
+	icmp_ip->time_to_live = 64;
+	icmp_ip->next_proto_id = ICMP_PROTOCOL_NUMBER;
+	icmp_ip->src_addr = ip->dst_addr;
+	icmp_ip->dst_addr = ip->src_addr;
+	icmp_ip->hdr_checksum = 0;
+	icmp_ip->hdr_checksum = rte_ipv4_cksum(icmp_ip);
+
+	icmp = (struct icmp_hdr *)(icmp_ip + 1);
+	icmp->type = 3;
+	icmp->code = 4;
+	icmp->unused = 0;
+	icmp->next_hop_mtu = rte_cpu_to_be_16(state->icmp_mtu_size);
+	icmp->checksum = 0;
+	icmp->checksum = ~rte_raw_cksum(icmp, sizeof(struct icmp_hdr) +
+					quote_len);
+	icmp_pkt->l3_len = sizeof(struct ipv4_hdr);
+	return icmp_pkt;
+}
+
+/* ICMPv6 packet too big quoting as much of pkt as allowed */
+static struct rte_mbuf *pmtud_icmp_ipv6(struct pg_pmtud_state *state,
+					struct rte_mbuf *pkt)
 {
-	uint16_t sum = 0;
+	struct ipv6_hdr *ip = pg_utils_get_l3(pkt);
+	uint16_t hdrs_len = sizeof(struct ipv6_hdr) + sizeof(struct icmp_hdr);
+	uint16_t quote_len = RTE_MIN(pkt->pkt_len - pkt->l2_len,
+				     RTE_MIN((uint32_t)PMTUD_IPV6_MIN_MTU,
+					     state->icmp_mtu_size) - hdrs_len);
+	struct rte_mbuf *icmp_pkt;
+	struct ipv6_hdr *icmp_ip;
+	struct icmp_hdr *icmp;
 
-	sum = rte_raw_cksum(msg, sizeof(struct icmp_hdr));
+	icmp_pkt = pmtud_icmp_alloc(pkt, hdrs_len, quote_len);
+	if (unlikely(!icmp_pkt))
+		return NULL;
+	icmp_ip = pg_utils_get_l3(icmp_pkt);
+	icmp_ip->vtc_flow = rte_cpu_to_be_32(6 << 28);
+	icmp_ip->payload_len = rte_cpu_to_be_16(sizeof(struct icmp_hdr) +
+						quote_len);
+	icmp_ip->proto = PG_IP_TYPE_ICMPV6;
+	icmp_ip->hop_limits = 255;
+	rte_memcpy(icmp_ip->src_addr, ip->dst_addr, 16);
+	rte_memcpy(icmp_ip->dst_addr, ip->src_addr, 16);
+
+	icmp = (struct icmp_hdr *)(icmp_ip + 1);
+	icmp->type = 2;
+	icmp->code = 0;
+	icmp->mtu = rte_cpu_to_be_32(state->icmp_mtu_size);
+	icmp->checksum = 0;
+	icmp->checksum = rte_ipv6_udptcp_cksum(icmp_ip, icmp);
+	icmp_pkt->l3_len = sizeof(struct ipv6_hdr);
+	return icmp_pkt;
+}
+
+/* incremental update of a checksum when a 16 bits word changes (rfc1624) */
+static inline uint16_t pmtud_cksum_update(uint16_t cksum, uint16_t old,
+					  uint16_t new)
+{
+	uint32_t sum = (uint16_t)~cksum + (uint16_t)~old + new;
+
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
 	return ~sum;
 }
 
+/* lower the MSS option of a TCP SYN to mss, options span len bytes */
+static void pmtud_clamp_tcp(struct rte_mbuf *pkt, struct tcp_hdr *tcp,
+			    uint16_t len, uint16_t mss)
+{
+	uint8_t *opt = (uint8_t *)(tcp + 1);
+	uint8_t *end = (uint8_t *)tcp + len;
+
+	while (opt < end && *opt != PMTUD_TCP_OPT_EOL) {
+		uint16_t old;
+		uint16_t new;
+
+		if (*opt == PMTUD_TCP_OPT_NOP) {
+			opt++;
+			continue;
+		}
+		if (opt + 2 > end || opt[1] < 2 || opt + opt[1] > end)
+			return;
+		if (*opt != PMTUD_TCP_OPT_MSS || opt[1] != 4) {
+			opt += opt[1];
+			continue;
+		}
+		old = *(unaligned_uint16_t *)(opt + 2);
+		if (rte_be_to_cpu_16(old) <= mss)
+			return;
+		new = rte_cpu_to_be_16(mss);
+		*(unaligned_uint16_t *)(opt + 2) = new;
+		/* the checksum is left to the NIC */
+		if (pkt->ol_flags & PKT_TX_TCP_CKSUM)
+			return;
+		/* an odd offset swaps the bytes of the summed words */
+		if ((opt + 2 - (uint8_t *)tcp) & 1) {
+			old = rte_bswap16(old);
+			new = rte_bswap16(new);
+		}
+		tcp->cksum = pmtud_cksum_update(tcp->cksum, old, new);
+		return;
+	}
+}
+
+/* clamp the MSS of TCP SYN and SYN-ACK so segments fit in the MTU */
+static void pmtud_clamp_mss(struct pg_pmtud_state *state,
+			    struct rte_mbuf **pkts, uint64_t pkts_mask)
+{
+	PG_FOREACH_BIT(pkts_mask, i) {
+		struct rte_mbuf *pkt = pkts[i];
+		struct tcp_hdr *tcp;
+		uint16_t hdrs_len;
+		uint16_t len;
+
+		pg_utils_parse(pkt);
+		if ((pkt->packet_type & RTE_PTYPE_L4_MASK) != RTE_PTYPE_L4_TCP)
+			continue;
+		/* other references to the data must not see it change */
+		if (unlikely(rte_mbuf_refcnt_read(pkt) > 1 ||
+			     RTE_MBUF_INDIRECT(pkt)))
+			continue;
+		tcp = pg_utils_get_l4(pkt);
+		if (likely(!(tcp->tcp_flags & PMTUD_TCP_SYN)) ||
+		    pkt->l4_len <= sizeof(struct tcp_hdr))
+			continue;
+		/* MSS does not count IP and TCP options (rfc6691) */
+		hdrs_len = pkt->l2_len + sizeof(struct tcp_hdr) +
+			(RTE_ETH_IS_IPV4_HDR(pkt->packet_type) ?
+			 sizeof(struct ipv4_hdr) : sizeof(struct ipv6_hdr));
+		if (unlikely(state->eth_mtu_size <= hdrs_len))
+			continue;
+		len = RTE_MIN((uint32_t)pkt->l4_len,
+			      (uint32_t)(rte_pktmbuf_data_len(pkt) -
+					 pkt->l2_len - pkt->l3_len));
+		pmtud_clamp_tcp(pkt, tcp, len, state->eth_mtu_size - hdrs_len);
+	}
+}
+
 static int pmtud_burst(struct pg_brick *brick, enum pg_side from,
 		       uint16_t edge_index, struct rte_mbuf **pkts,
 		       uint64_t pkts_mask, struct pg_error **errp)
@@ -89,48 +331,58 @@ static int pmtud_burst(struct pg_brick *brick, enum pg_side from,
 	struct pg_brick_side *s = &brick->sides[to];
 	struct pg_brick_side *s_from = &brick->sides[from];
 	uint32_t eth_mtu_size = state->eth_mtu_size;
+	struct rte_mbuf *icmps[PG_MAX_PKTS_BURST];
+	uint16_t nb_icmps = 0;
+	uint64_t now = 0;
 
+	if (state->mss_clamp)
+		pmtud_clamp_mss(state, pkts, pkts_mask);
 	if (state->output == from) {
 		PG_FOREACH_BIT(pkts_mask, i) {
-			struct ipv4_hdr *ip = pg_utils_get_l3(pkts[i]);
-			struct ether_hdr *eth =
-				rte_pktmbuf_mtod(pkts[i], struct ether_hdr *);
-			uint64_t *beg_msg = (uint64_t *)(ip + 1);
-			int dont_fragment = ip->fragment_offset &
-				rte_cpu_to_be_16(IPV4_HDR_DF_FLAG);
-			int is_ipv4 = pg_utils_get_ether_type(pkts[i]) ==
-				PG_BE_ETHER_TYPE_IPv4;
-
-			if (is_ipv4 && dont_fragment &&
-			    pkts[i]->pkt_len > eth_mtu_size) {
-				struct icmp_full_hdr *icmp_buf =
-					rte_pktmbuf_mtod(
-						state->icmp,
-						struct icmp_full_hdr *);
-
-				pkts_mask ^= (ONE64 << i);
-				icmp_buf->eth.s_addr = eth->d_addr;
-				icmp_buf->eth.d_addr = eth->s_addr;
-				icmp_buf->ip.src_addr = ip->dst_addr;
-				icmp_buf->ip.dst_addr = ip->src_addr;
-				icmp_buf->ip.hdr_checksum = 0;
-				icmp_buf->ip.hdr_checksum =
-					rte_ipv4_cksum(&icmp_buf->ip);
-				icmp_buf->icmp.ip = *ip;
-				icmp_buf->icmp.last_msg = *beg_msg;
-				icmp_buf->icmp.checksum = 0;
-
-				icmp_buf->icmp.checksum =
-					icmp_checksum(&icmp_buf->icmp);
-				if (pg_brick_burst(s_from->edge.link, to,
-						   s_from->edge.pair_index,
-						   &state->icmp, 1, errp) < 0) {
-					return -1;
-				}
+			struct rte_mbuf *icmp;
+			struct ipv4_hdr *ip;
+			struct ipv6_hdr *ip6;
+			bool is_ipv4;
 
+			if (pkts[i]->pkt_len <= eth_mtu_size)
+				continue;
+			pg_utils_parse(pkts[i]);
+			ip = pg_utils_get_l3(pkts[i]);
+			ip6 = pg_utils_get_l3(pkts[i]);
+			is_ipv4 = RTE_ETH_IS_IPV4_HDR(pkts[i]->packet_type);
+			if (is_ipv4) {
+				if (!(ip->fragment_offset &
+				      rte_cpu_to_be_16(IPV4_HDR_DF_FLAG)))
+					continue;
+			} else if (!RTE_ETH_IS_IPV6_HDR(pkts[i]->packet_type)) {
+				continue;
 			}
+
+			pkts_mask ^= (ONE64 << i);
+			if (!s_from->edge.link)
+				continue;
+			if (!now)
+				now = rte_rdtsc();
+			if (is_ipv4 ?
+			    !pmtud_icmp_allowed(state, &ip->src_addr, 4, now) :
+			    !pmtud_icmp_allowed(state, ip6->src_addr, 16, now))
+				continue;
+			icmp = is_ipv4 ? pmtud_icmp_ipv4(state, pkts[i]) :
+				pmtud_icmp_ipv6(state, pkts[i]);
+			if (icmp)
+				icmps[nb_icmps++] = icmp;
 		}
 	}
+	if (nb_icmps) {
+		uint64_t icmps_mask = pg_mask_firsts(nb_icmps);
+		int ret = pg_brick_burst(s_from->edge.link, to,
+					 s_from->edge.pair_index,
+					 icmps, icmps_mask, errp);
+
+		pg_packets_free(icmps, icmps_mask);
+		if (ret < 0)
+			return -1;
+	}
 	if (unlikely(pkts_mask == 0))
 		return 0;
 	return pg_brick_burst(s->edge.link, from, s->edge.pair_index,
@@ -144,8 +396,6 @@ static int pmtud_init(struct pg_brick *brick,
 	struct pg_pmtud_state *state =
 		pg_brick_get_state(brick, struct pg_pmtud_state);
 	struct pg_pmtud_config *pmtud_config;
-	struct ether_addr eth = { {0} };
-	struct icmp_hdr *icmp;
 
 	pmtud_config = (struct pg_pmtud_config *) config->brick_config;
 
@@ -163,26 +413,7 @@ static int pmtud_init(struct pg_brick *brick,
 	state->eth_mtu_size = pmtud_config->mtu_size;
 	state->icmp_mtu_size = pmtud_config->mtu_size -
 		sizeof(struct ether_hdr);
-	state->icmp = rte_pktmbuf_alloc(pg_get_mempool());
-	if (!state->icmp) {
-		*errp = pg_error_new("cannot allocate icmp packet");
-		return -1;
-	}
-	pg_packets_append_ether(&state->icmp,
-				1,  &eth, &eth,
-				ETHER_TYPE_IPv4);
-	pg_packets_append_ipv4(&state->icmp, 1, 1, 2,
-			       sizeof(struct icmp_hdr) +
-			       sizeof(struct ipv4_hdr),
-			       ICMP_PROTOCOL_NUMBER);
-	state->icmp->l2_len = sizeof(struct ether_hdr);
-	state->icmp->l2_type = PG_BE_ETHER_TYPE_IPv4;
-	icmp = (struct icmp_hdr *)rte_pktmbuf_append(state->icmp,
-						     sizeof(struct icmp_hdr));
-	icmp->type = 3;
-	icmp->code = 4;
-	icmp->unused = 0;
-	icmp->next_hop_mtu = rte_cpu_to_be_16(state->icmp_mtu_size);
+	pg_pmtud_set_icmp_rate(brick, PG_PMTUD_ICMP_RATE, PG_PMTUD_ICMP_BURST);
 	return 0;
 }
 
@@ -199,13 +430,20 @@ struct pg_brick *pg_pmtud_new(const char *name,
 	return ret;
 }
 
-static void pmtud_destroy(struct pg_brick *brick, struct pg_error **errp)
+void pg_pmtud_set_icmp_rate(struct pg_brick *brick, uint32_t rate,
+			    uint32_t burst)
 {
 	struct pg_pmtud_state *state =
 		pg_brick_get_state(brick, struct pg_pmtud_state);
 
-	rte_pktmbuf_free(state->icmp);
-	state->icmp = NULL;
+	state->token_cycles = rate ? RTE_MAX(rte_get_tsc_hz() / rate, 1UL) : 0;
+	state->icmp_burst = RTE_MAX(burst, 1U);
+	pmtud_buckets_reset(state);
+}
+
+void pg_pmtud_set_tcp_mss_clamp(struct pg_brick *brick, bool enable)
+{
+	pg_brick_get_state(brick, struct pg_pmtud_state)->mss_clamp = enable;
 }
 
 static struct pg_brick_ops pmtud_ops = {
@@ -213,7 +451,6 @@ static struct pg_brick_ops pmtud_ops = {
 	.state_size	= sizeof(struct pg_pmtud_state),
 
 	.init		= pmtud_init,
-	.destroy	= pmtud_destroy,
 
 	.unlink		= pg_brick_generic_unlink,
 };
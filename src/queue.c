@@ -16,13 +16,41 @@
  */
 
 #include <rte_config.h>
+#include <rte_common.h>
+#include <rte_atomic.h>
+#include <rte_malloc.h>
+#include <rte_memcpy.h>
 #include <packetgraph/packetgraph.h>
 #include "utils/bitmask.h"
 #include "brick-int.h"
 #include "packets.h"
 
+enum pg_queue_backend {
+	/* bursts are allocated and pushed in a GAsyncQueue */
+	PG_QUEUE_ASYNC,
+	/* bursts are copied in a preallocated lock-free SPSC ring */
+	PG_QUEUE_RING
+};
+
 struct pg_queue_config {
 	uint32_t rx_max_size;
+	enum pg_queue_backend backend;
+};
+
+struct pg_queue_burst {
+	struct rte_mbuf *pkts[PG_MAX_PKTS_BURST];
+	uint64_t mask;
+};
+
+/**
+ * Single producer, single consumer ring of bursts.
+ * head is only written by the thread bursting in the queue and tail by the
+ * thread polling the friend queue, each one has it's own cache line.
+ */
+struct pg_queue_ring {
+	volatile uint32_t head __rte_cache_aligned;
+	volatile uint32_t tail __rte_cache_aligned;
+	struct pg_queue_burst slots[] __rte_cache_aligned;
 };
 
 struct pg_queue_state {
@@ -31,25 +59,27 @@ struct pg_queue_state {
 	enum pg_side output;
 	/* maximal queue size */
 	uint32_t rx_max_size;
-	/* store bursted packets in queue */
+	/* store bursted packets in queue (PG_QUEUE_ASYNC) */
 	GAsyncQueue *rx;
 	/* queue's friend */
 	struct pg_queue_state *friend;
-};
-
-struct pg_queue_burst {
-	struct rte_mbuf **pkts;
-	uint64_t mask;
+	enum pg_queue_backend backend;
+	/* store bursted packets in queue (PG_QUEUE_RING) */
+	struct pg_queue_ring *ring;
+	/* number of ring slots - 1, slots count is a power of two */
+	uint32_t ring_mask;
 };
 
 static struct pg_brick_config *queue_config_new(const char *name,
-						uint32_t rx_max_size)
+						uint32_t rx_max_size,
+						enum pg_queue_backend backend)
 {
 	struct pg_brick_config *config = g_new0(struct pg_brick_config, 1);
 	struct pg_queue_config *queue_config = g_new0(struct pg_queue_config,
 						      1);
 
 	queue_config->rx_max_size = rx_max_size;
+	queue_config->backend = backend;
 	config->brick_config = (void *) queue_config;
 	return pg_brick_config_init(config, name, 1, 1, PG_MONOPOLE);
 }
@@ -58,11 +88,28 @@ uint8_t pg_queue_pressure(struct pg_brick *queue)
 {
 	struct pg_queue_state *state =
 		pg_brick_get_state(queue, struct pg_queue_state);
-	int queue_size = g_async_queue_length(state->rx);
+	int queue_size;
+
+	if (state->backend == PG_QUEUE_RING)
+		queue_size = state->ring->head - state->ring->tail;
+	else
+		queue_size = g_async_queue_length(state->rx);
 
 	return queue_size <= 0 ? 0 : queue_size * 255 / state->rx_max_size;
 }
 
+/* Copy packet pointers so the caller can reuse it's array after the burst */
+static inline void queue_burst_copy(struct pg_queue_burst *burst,
+				    struct rte_mbuf **pkts,
+				    uint64_t pkts_mask)
+{
+	burst->mask = pkts_mask;
+	if (likely(pkts_mask))
+		rte_memcpy(burst->pkts, pkts,
+			   pg_last_bit_pos(pkts_mask) *
+			   sizeof(struct rte_mbuf *));
+}
+
 static int queue_burst(struct pg_brick *brick, enum pg_side from,
 		       uint16_t edge_index, struct rte_mbuf **pkts,
 		       uint64_t pkts_mask, struct pg_error **error)
@@ -81,8 +128,7 @@ static int queue_burst(struct pg_brick *brick, enum pg_side from,
 	}
 
 	burst = g_new(struct pg_queue_burst, 1);
-	burst->pkts = pkts;
-	burst->mask = pkts_mask;
+	queue_burst_copy(burst, pkts, pkts_mask);
 	pg_packets_incref(pkts, pkts_mask);
 	g_async_queue_push(state->rx, burst);
 
@@ -130,6 +176,77 @@ static int queue_poll(struct pg_brick *brick, uint16_t *pkts_cnt,
 	return ret;
 }
 
+static int queue_ring_burst(struct pg_brick *brick, enum pg_side from,
+			    uint16_t edge_index, struct rte_mbuf **pkts,
+			    uint64_t pkts_mask, struct pg_error **error)
+{
+	struct pg_queue_state *state =
+		pg_brick_get_state(brick, struct pg_queue_state);
+	struct pg_queue_ring *ring = state->ring;
+	uint32_t head = ring->head;
+
+	/* Only the polling thread can release old bursts, so when the ring
+	 * is full, the new burst is throw away.
+	 */
+	if (unlikely(head - ring->tail >= state->rx_max_size)) {
+		pkts_mask = 0;
+	} else if (likely(pkts_mask)) {
+		queue_burst_copy(&ring->slots[head & state->ring_mask],
+				 pkts, pkts_mask);
+		pg_packets_incref(pkts, pkts_mask);
+		/* slot must be written before being published */
+		rte_smp_wmb();
+		ring->head = head + 1;
+	}
+
+#ifdef PG_QUEUE_BENCH
+	struct pg_brick_side *side = &brick->side;
+
+	if (side->burst_count_cb != NULL) {
+		side->burst_count_cb(side->burst_count_private_data,
+				     pg_mask_count(pkts_mask));
+	}
+#endif /* #ifdef PG_QUEUE_BENCH */
+	return 0;
+}
+
+static int queue_ring_poll(struct pg_brick *brick, uint16_t *pkts_cnt,
+			   struct pg_error **error)
+{
+	int ret;
+	struct pg_queue_ring *ring;
+	struct pg_queue_burst *burst;
+	struct pg_queue_state *state =
+		pg_brick_get_state(brick, struct pg_queue_state);
+	struct pg_brick_side *s = &brick->side;
+	uint32_t tail;
+
+	if (!state->friend) {
+		*pkts_cnt = 0;
+		return 0;
+	}
+
+	ring = state->friend->ring;
+	tail = ring->tail;
+	if (tail == ring->head) {
+		*pkts_cnt = 0;
+		return 0;
+	}
+	/* head must be read before the slot content */
+	rte_smp_rmb();
+	burst = &ring->slots[tail & state->friend->ring_mask];
+
+	*pkts_cnt = pg_mask_count(burst->mask);
+	ret = pg_brick_burst(s->edge.link, state->output,
+			     s->edge.pair_index,
+			     burst->pkts, burst->mask, error);
+	pg_packets_free(burst->pkts, burst->mask);
+	/* slot must be fully consumed before being given back */
+	rte_smp_rmb();
+	ring->tail = tail + 1;
+	return ret;
+}
+
 static int queue_init(struct pg_brick *brick,
 		      struct pg_brick_config *config,
 		      struct pg_error **error)
@@ -143,13 +260,31 @@ static int queue_init(struct pg_brick *brick,
 		queue_config->rx_max_size = 10;
 	}
 
+	state->rx_max_size = queue_config->rx_max_size;
+	state->friend = NULL;
+	state->backend = queue_config->backend;
+
+	if (state->backend == PG_QUEUE_RING) {
+		state->ring_mask = rte_align32pow2(state->rx_max_size) - 1;
+		state->ring = rte_zmalloc("pg_queue_ring",
+					  sizeof(struct pg_queue_ring) +
+					  (state->ring_mask + 1) *
+					  sizeof(struct pg_queue_burst),
+					  RTE_CACHE_LINE_SIZE);
+		if (state->ring == NULL) {
+			*error = pg_error_new("Queue allocation failed");
+			return -1;
+		}
+		brick->burst = queue_ring_burst;
+		brick->poll = queue_ring_poll;
+		return 0;
+	}
+
 	state->rx = g_async_queue_new();
 	if (state->rx == NULL) {
 		*error = pg_error_new("Queue allocation failed");
 		return -1;
 	}
-	state->rx_max_size = queue_config->rx_max_size;
-	state->friend = NULL;
 	brick->burst = queue_burst;
 	brick->poll = queue_poll;
 	return 0;
@@ -176,6 +311,13 @@ int pg_queue_friend(struct pg_brick *queue_1,
 		return -1;
 	}
 
+	if (state1->backend != state2->backend) {
+		*error = pg_error_new("Queues %s and %s use different backends",
+				      pg_brick_name(&state1->brick),
+				      pg_brick_name(&state2->brick));
+		return -1;
+	}
+
 	state1->friend = state2;
 	state2->friend = state1;
 	return 0;
@@ -210,6 +352,16 @@ static inline void empty(struct pg_queue_state *state)
 	struct pg_queue_burst *burst = NULL;
 	GAsyncQueue *queue = state->rx;
 
+	if (state->backend == PG_QUEUE_RING) {
+		struct pg_queue_ring *ring = state->ring;
+
+		for (; ring->tail != ring->head; ring->tail++) {
+			burst = &ring->slots[ring->tail & state->ring_mask];
+			pg_packets_free(burst->pkts, burst->mask);
+		}
+		return;
+	}
+
 	while ((burst = g_async_queue_try_pop(queue)) != NULL) {
 		pg_packets_free(burst->pkts, burst->mask);
 		g_free(burst);
@@ -228,13 +380,28 @@ static void queue_destroy(struct pg_brick *brick, struct pg_error **error)
 
 	unfriend(state);
 	empty(state);
-	g_async_queue_unref(state->rx);
+	if (state->backend == PG_QUEUE_RING)
+		rte_free(state->ring);
+	else
+		g_async_queue_unref(state->rx);
 }
 
 struct pg_brick *pg_queue_new(const char *name, int size,
 			      struct pg_error **error)
 {
-	struct pg_brick_config *config = queue_config_new(name, size);
+	struct pg_brick_config *config = queue_config_new(name, size,
+							  PG_QUEUE_ASYNC);
+	struct pg_brick *ret = pg_brick_new("queue", config, error);
+
+	pg_brick_config_free(config);
+	return ret;
+}
+
+struct pg_brick *pg_queue_ring_new(const char *name, int size,
+				   struct pg_error **error)
+{
+	struct pg_brick_config *config = queue_config_new(name, size,
+							  PG_QUEUE_RING);
 	struct pg_brick *ret = pg_brick_new("queue", config, error);
 
 	pg_brick_config_free(config);
@@ -16,6 +16,7 @@
  */
 
 #include <rte_config.h>
+#include <rte_cycles.h>
 #include <rte_errno.h>
 #include <rte_ether.h>
 #include <rte_hash_crc.h>
@@ -25,6 +26,11 @@
 #define HASH_ENTRIES		(1024 * 32)
 #define HASH_KEY_SIZE		8
 
+/* default time before a MAC address not seen is forgotten */
+#define PG_SWITCH_DEFAULT_AGING	300
+/* number of table slots checked for aging at each burst */
+#define PG_SWITCH_SWEEP_SLOTS	32
+
 #include <packetgraph/packetgraph.h>
 #include "brick-int.h"
 #include "packets.h"
@@ -37,6 +43,13 @@ struct pg_address_source {
 	enum pg_side from;	/* side of the switch the packet came from */
 };
 
+/* a learned MAC address */
+struct pg_switch_entry {
+	uint64_t last_seen;	/* TSC of the last packet from this address */
+	uint16_t edge_index;
+	enum pg_side from;
+};
+
 struct pg_switch_side {
 	struct pg_address_source *sources;
 	uint64_t *masks;	/* outgoing packet masks (one per port) */
@@ -46,6 +59,11 @@ struct pg_switch_state {
 	struct pg_brick brick;
 	struct pg_mac_table table;
 	enum pg_side output;
+	uint64_t aging;		/* in TSC cycles, 0 disable aging */
+	uint32_t sweep_slot;	/* next table slot to check for aging */
+	uint64_t learned;
+	uint64_t aged;
+	uint64_t moved;
 	/* sides of the switch */
 	struct pg_switch_side sides[PG_MAX_SIDE];
 };
@@ -144,51 +162,114 @@ static inline bool is_filtered(struct ether_addr *eth_addr)
 		eth_addr->addr_bytes[5] <= 0x0F;
 }
 
-static inline void learn_addr(struct pg_switch_state *state,
-			     uint8_t *key,
-			     struct pg_address_source *source)
+static inline bool is_aged(struct pg_switch_state *state,
+			   struct pg_switch_entry *entry, uint64_t now)
 {
-	pg_mac_table_ptr_set(&state->table, *((union pg_mac *)key),
-			     source);
+	return state->aging && now - entry->last_seen > state->aging;
 }
 
-static void do_learn_filter_multicast(struct pg_switch_state *state,
-				     struct pg_address_source *source,
-				     struct rte_mbuf **pkts,
-				     uint64_t pkts_mask,
-				     uint64_t *unicast_mask,
-				     struct pg_error **errp)
+/**
+ * Associate an address to the port its packets came from
+ */
+static inline void learn_entry(struct pg_switch_state *state,
+			       struct pg_switch_entry *entry, int is_new,
+			       struct pg_address_source *source,
+			       uint64_t now)
 {
-	uint64_t filtered_mask = 0, flood_mask = 0, mask;
-
-	for (mask = pkts_mask; mask;) {
-		struct ether_hdr *eth_hdr;
-		struct rte_mbuf *pkt;
-		uint64_t bit;
-		uint16_t i;
+	if (unlikely(is_new)) {
+		state->learned++;
+	} else if (unlikely(entry->from != source->from ||
+			    entry->edge_index != source->edge_index)) {
+		/* an aged entry is a new one, not a move */
+		if (is_aged(state, entry, now))
+			state->learned++;
+		else
+			state->moved++;
+	} else {
+		entry->last_seen = now;
+		return;
+	}
+	entry->from = source->from;
+	entry->edge_index = source->edge_index;
+	entry->last_seen = now;
+}
 
-		pg_low_bit_iterate_full(mask, bit, i);
+static void do_learn(struct pg_switch_state *state,
+		     struct pg_address_source *source,
+		     union pg_mac *src, uint64_t pkts_mask, uint64_t now)
+{
+	struct pg_switch_entry *entries[PG_MAX_PKTS_BURST];
+	uint64_t known_mask;
+
+	known_mask = pg_mac_table_elem_get_bulk(&state->table, src, pkts_mask,
+						(void **)entries);
+	/* update all known addresses before adding new ones: an insertion
+	 * can move other entries around and invalidate our pointers
+	 */
+	PG_FOREACH_BIT(known_mask, i)
+		learn_entry(state, entries[i], 0, source, now);
+
+	PG_FOREACH_BIT(pkts_mask & ~known_mask, i) {
+		struct pg_switch_entry *entry;
+		int is_new;
+
+		entry = pg_mac_table_elem_get_or_add(
+			&state->table, src[i],
+			sizeof(struct pg_switch_entry), &is_new);
+		/* table is full, packets to this address will be flooded */
+		if (unlikely(!entry))
+			continue;
+		learn_entry(state, entry, is_new, source, now);
+	}
+}
 
-		pkt = pkts[i];
+/**
+ * Forget aged addresses of a small part of the table, so the whole table is
+ * walked after a few bursts without ever stalling the datapath.
+ */
+static void sweep(struct pg_switch_state *state, uint64_t now)
+{
+	struct pg_mac_table *table = &state->table;
+	uint32_t nb_slots = pg_mac_table_nb_slots(table);
 
-		eth_hdr = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
+	if (!state->aging || !pg_mac_table_count(table))
+		return;
 
-		/* associate source mac address with its source port */
-		learn_addr(state, (void *) &eth_hdr->s_addr,
-			   source);
+	for (int i = 0; i < PG_SWITCH_SWEEP_SLOTS; i++) {
+		uint32_t slot = state->sweep_slot++ & (nb_slots - 1);
+		struct pg_switch_entry *entry;
 
-		/* http://standards.ieee.org/regauth/groupmac/tutorial.html */
-		if (unlikely(is_filtered(&eth_hdr->d_addr))) {
-			filtered_mask |= bit;
+		if (!pg_mac_table_slot_used(table, slot))
 			continue;
+		entry = (struct pg_switch_entry *)
+			pg_mac_table_slot_value(table, slot);
+		if (is_aged(state, entry, now)) {
+			pg_mac_table_slot_unset(table, slot);
+			state->aged++;
 		}
+	}
+}
 
-		/* if the packet is multicast or broadcast flood it */
-		if (unlikely(is_multicast_ether_addr(&eth_hdr->d_addr))) {
-			flood_mask |= bit;
+static void do_filter_multicast(struct pg_switch_state *state,
+			       struct pg_address_source *source,
+			       union pg_mac *dst,
+			       uint64_t pkts_mask,
+			       uint64_t *unicast_mask)
+{
+	uint64_t filtered_mask = 0, flood_mask = 0;
+
+	PG_FOREACH_BIT(pkts_mask, i) {
+		struct ether_addr *d_addr = (struct ether_addr *)&dst[i];
+
+		/* http://standards.ieee.org/regauth/groupmac/tutorial.html */
+		if (unlikely(is_filtered(d_addr))) {
+			filtered_mask |= ONE64 << i;
 			continue;
 		}
 
+		/* if the packet is multicast or broadcast flood it */
+		if (unlikely(is_multicast_ether_addr(d_addr)))
+			flood_mask |= ONE64 << i;
 	}
 
 	flood(state, source, flood_mask);
@@ -198,39 +279,31 @@ static void do_learn_filter_multicast(struct pg_switch_state *state,
 
 static void do_switch(struct pg_switch_state *state,
 		      struct pg_address_source *source,
-		      struct rte_mbuf **pkts,
-		      uint64_t pkts_mask)
+		      union pg_mac *dst,
+		      uint64_t pkts_mask,
+		      uint64_t now)
 {
-	uint64_t flood_mask = 0;
-	struct ether_hdr *eth_hdr;
-
-	for ( ; pkts_mask; ) {
-		struct pg_switch_side *switch_side;
-		struct pg_address_source *entry;
-		uint16_t edge_index;
-		uint64_t bit;
-		uint16_t i;
-
-		pg_low_bit_iterate_full(pkts_mask, bit, i);
-
-		eth_hdr = rte_pktmbuf_mtod(pkts[i], struct ether_hdr *);
-		entry = pg_mac_table_ptr_get(
-			&state->table,
-			*((union pg_mac *)&eth_hdr->d_addr));
-		if (entry) {
-			switch_side = &state->sides[entry->from];
-			edge_index = entry->edge_index;
-
-		/* the lookup table entry is stale due to a port hotplug */
-		} else {
-			flood_mask |= bit;
+	struct pg_switch_entry *entries[PG_MAX_PKTS_BURST];
+	uint64_t flood_mask;
+
+	flood_mask = pkts_mask & ~pg_mac_table_elem_get_bulk(
+		&state->table, dst, pkts_mask, (void **)entries);
+
+	PG_FOREACH_BIT(pkts_mask & ~flood_mask, i) {
+		struct pg_switch_entry *entry = entries[i];
+
+		/* aged but not yet removed */
+		if (unlikely(is_aged(state, entry, now))) {
+			flood_mask |= ONE64 << i;
 			continue;
 		}
 
 		/* mark the packet for forwarding on the correct port */
-		switch_side->masks[edge_index] |= bit;
+		state->sides[entry->from].masks[entry->edge_index] |=
+			ONE64 << i;
 	}
 
+	/* unknown, aged or removed by a port hotplug */
 	flood(state, source, flood_mask);
 }
 
@@ -241,19 +314,39 @@ static int switch_burst(struct pg_brick *brick, enum pg_side from,
 {
 	struct pg_switch_state *state =
 		pg_brick_get_state(brick, struct pg_switch_state);
+	union pg_mac src[PG_MAX_PKTS_BURST];
+	union pg_mac dst[PG_MAX_PKTS_BURST];
 	uint64_t unicast_mask = 0;
 	struct pg_address_source *source;
+	uint64_t now = rte_rdtsc();
 
 	source = &state->sides[from].sources[edge_index];
 	source->from = from;
 	source->edge_index = edge_index;
 
-	do_learn_filter_multicast(state, source, pkts,
-				  pkts_mask, &unicast_mask, errp);
+	/* gather all addresses first so table lookups can be done in bulk */
+	pg_packets_prefetch(pkts, pkts_mask);
+	PG_FOREACH_BIT(pkts_mask, i) {
+		struct ether_hdr *eth_hdr =
+			rte_pktmbuf_mtod(pkts[i], struct ether_hdr *);
+
+		dst[i].mac = 0;
+		src[i].mac = 0;
+		memcpy(dst[i].bytes, &eth_hdr->d_addr, ETHER_ADDR_LEN);
+		memcpy(src[i].bytes, &eth_hdr->s_addr, ETHER_ADDR_LEN);
+	}
+
+	/* associate source mac addresses with their source port */
+	do_learn(state, source, src, pkts_mask, now);
 
-	do_switch(state, source, pkts, unicast_mask);
+	do_filter_multicast(state, source, dst, pkts_mask, &unicast_mask);
 
-	return forward_bursts(state, source, pkts, errp);
+	do_switch(state, source, dst, unicast_mask, now);
+
+	if (forward_bursts(state, source, pkts, errp) < 0)
+		return -1;
+	sweep(state, now);
+	return 0;
 }
 
 static int switch_init(struct pg_brick *brick,
@@ -279,6 +372,7 @@ static int switch_init(struct pg_brick *brick,
 		state->sides[i].sources	= g_new0(struct pg_address_source, max);
 	}
 	zero_masks(state);
+	state->aging = PG_SWITCH_DEFAULT_AGING * rte_get_tsc_hz();
 	state->output =
 	  ((struct pg_switch_config *)config->brick_config)->output;
 	return 0;
@@ -334,14 +428,43 @@ static void switch_unlink_notify(struct pg_brick *brick,
 	struct pg_switch_state *state =
 		pg_brick_get_state(brick, struct pg_switch_state);
 
-	PG_MAC_TABLE_FOREACH_PTR(&state->table, cur_mac,
-				 struct pg_address_source, src) {
-		if (src->from == side &&
-		    src->edge_index == edge_index)
+	PG_MAC_TABLE_FOREACH_ELEM(&state->table, cur_mac,
+				  struct pg_switch_entry, entry) {
+		if (entry->from == side &&
+		    entry->edge_index == edge_index)
 			pg_mac_table_ptr_unset(&state->table, cur_mac);
 	}
 }
 
+void pg_switch_set_aging(struct pg_brick *brick, uint32_t seconds)
+{
+	struct pg_switch_state *state =
+		pg_brick_get_state(brick, struct pg_switch_state);
+
+	state->aging = seconds * rte_get_tsc_hz();
+}
+
+uint64_t pg_switch_learned_count(struct pg_brick *brick)
+{
+	return pg_brick_get_state(brick, struct pg_switch_state)->learned;
+}
+
+uint64_t pg_switch_aged_count(struct pg_brick *brick)
+{
+	return pg_brick_get_state(brick, struct pg_switch_state)->aged;
+}
+
+uint64_t pg_switch_moved_count(struct pg_brick *brick)
+{
+	return pg_brick_get_state(brick, struct pg_switch_state)->moved;
+}
+
+uint32_t pg_switch_mac_count(struct pg_brick *brick)
+{
+	return pg_mac_table_count(
+		&pg_brick_get_state(brick, struct pg_switch_state)->table);
+}
+
 static struct pg_brick_ops switch_ops = {
 	.name		= "switch",
 	.state_size	= sizeof(struct pg_switch_state),
@@ -20,154 +20,423 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <rte_common.h>
 #include <rte_memcpy.h>
+#include <rte_prefetch.h>
+#include <rte_hash_crc.h>
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
 #include "utils/mac.h"
 #include "utils/bitmask.h"
 
 #ifndef PG_UTILS_MAC_TABLE_H
 #define PG_UTILS_MAC_TABLE_H
 
-#define PG_MAC_TABLE_MASK_SIZE (0xffffff / 64 + 1)
-
-struct pg_mac_table_ptr {
-	uint64_t mask[PG_MAC_TABLE_MASK_SIZE];
-	void **entries;
-};
+/**
+ * MAC table is a bucketized cuckoo hash table:
+ * - a key is a 48 bits MAC address stored in a 64 bits word with the highest
+ *   bit set to mark the slot as used (an empty slot is 0).
+ * - a bucket holds 8 keys in one cache line, keys of a bucket are compared
+ *   at once using SIMD.
+ * - a key can only be in one of it's two buckets, so a lookup reads at
+ *   most two cache lines (plus the value).
+ * - values are stored in a separated array, indexed by slot.
+ * - the table starts small and double it's size when an insertion fails,
+ *   up to a maximal size.
+ */
 
-struct pg_mac_table_elem {
-	uint64_t mask[PG_MAC_TABLE_MASK_SIZE];
-	int8_t *entries;
-};
+#define PG_MAC_TABLE_BUCKET_ENTRIES 8
+#define PG_MAC_TABLE_MIN_SIZE 128
+#define PG_MAC_TABLE_DEFAULT_MAX_SIZE (1 << 22)
+#define PG_MAC_TABLE_MAX_KICKS 32
+#define PG_MAC_TABLE_USED (ONE64 << 63)
+#define PG_MAC_TABLE_KEY_MASK 0x0000ffffffffffffLLU
+#define PG_MAC_TABLE_SEED1 0x5bd1e995
+#define PG_MAC_TABLE_SEED2 0x1b873593
 
+struct pg_mac_table_bucket {
+	uint64_t keys[PG_MAC_TABLE_BUCKET_ENTRIES];
+} __attribute__((aligned(64)));
 
 /**
  * A mac array contening a ptr
  */
 struct pg_mac_table {
-	uint64_t mask[PG_MAC_TABLE_MASK_SIZE];
-	union {
-		struct pg_mac_table_ptr **ptrs;
-		struct pg_mac_table_elem **elems;
-	};
+	struct pg_mac_table_bucket *buckets;
+	/* values of each slot, NULL until the first set */
+	int8_t *values;
+	uint32_t mask;		/* number of buckets - 1 */
+	uint32_t count;		/* number of entries */
+	uint32_t max_size;	/* maximal number of entries */
+	uint32_t elem_size;	/* size of a value */
+	uint32_t kick;		/* used to choose cuckoo victims */
 };
 
 struct pg_mac_table_iterator {
 	struct pg_mac_table *table;
-	union pg_mac key;
+	uint32_t slot;
 	int is_end;
 };
 
-#define pg_mac_table_mask_idx(mac_p) ((mac_p) / 64)
-#define pg_mac_table_mask_pos(mac_p) ((mac_p) & 63)
+#define pg_mac_table_key(addr) (((addr).mac & PG_MAC_TABLE_KEY_MASK) |	\
+				PG_MAC_TABLE_USED)
+#define pg_mac_table_slot_key(ma, slot)					\
+	((ma)->buckets[(slot) / PG_MAC_TABLE_BUCKET_ENTRIES].keys	\
+	 [(slot) & (PG_MAC_TABLE_BUCKET_ENTRIES - 1)])
+#define pg_mac_table_slot_value(ma, slot)			\
+	((ma)->values + (size_t)(slot) * (ma)->elem_size)
 
-#define pg_mac_table_is_set(ma, mac_p)			\
-	(!!((ma).mask[pg_mac_table_mask_idx(mac_p)] &	\
-	    (ONE64 << pg_mac_table_mask_pos(mac_p))))
+static inline uint32_t pg_mac_table_hash1(uint64_t key)
+{
+	return rte_hash_crc_8byte(key, PG_MAC_TABLE_SEED1);
+}
 
-#define pg_mac_table_mask_set(ma, mac_p)		\
-	((ma).mask[pg_mac_table_mask_idx(mac_p)] |=	\
-	 (ONE64 << pg_mac_table_mask_pos(mac_p)))
+static inline uint32_t pg_mac_table_hash2(uint64_t key)
+{
+	return rte_hash_crc_8byte(key, PG_MAC_TABLE_SEED2);
+}
 
-#define pg_mac_table_mask_unset(ma, mac_p)		\
-	((ma).mask[pg_mac_table_mask_idx(mac_p)] ^=	\
-	 (ONE64 << pg_mac_table_mask_pos(mac_p)))
+/**
+ * @return	a mask of slots of the bucket equal to key
+ */
+static inline uint32_t
+pg_mac_table_bucket_match(const struct pg_mac_table_bucket *bucket,
+			  uint64_t key)
+{
+#ifdef __SSE4_1__
+	const __m128i *keys = (const __m128i *)bucket->keys;
+	__m128i k = _mm_set1_epi64x(key);
+	uint32_t ret = 0;
 
+	for (int i = 0; i < PG_MAC_TABLE_BUCKET_ENTRIES / 2; ++i) {
+		__m128i cmp = _mm_cmpeq_epi64(_mm_load_si128(keys + i), k);
 
-static inline int pg_mac_table_init(struct pg_mac_table *ma)
+		ret |= _mm_movemask_pd(_mm_castsi128_pd(cmp)) << (i * 2);
+	}
+	return ret;
+#else
+	uint32_t ret = 0;
+
+	for (int i = 0; i < PG_MAC_TABLE_BUCKET_ENTRIES; ++i)
+		ret |= (bucket->keys[i] == key) << i;
+	return ret;
+#endif
+}
+
+/**
+ * @return	the slot of the key or -1 if not found
+ */
+static inline int64_t pg_mac_table_bucket_find(struct pg_mac_table *ma,
+					       uint32_t bucket,
+					       uint64_t key)
 {
-	ma->ptrs = malloc((0xffffff + 1) * sizeof(struct pg_mac_table_ptr *));
-	if (!ma->ptrs)
+	uint32_t match = pg_mac_table_bucket_match(&ma->buckets[bucket], key);
+
+	if (!match)
 		return -1;
-	memset(ma->mask, 0, (PG_MAC_TABLE_MASK_SIZE) * sizeof(uint64_t));
-	return 0;
+	return bucket * PG_MAC_TABLE_BUCKET_ENTRIES + ctz64(match);
 }
 
-static inline void pg_mac_table_free(struct pg_mac_table *ma)
+static inline int64_t pg_mac_table_lookup(struct pg_mac_table *ma,
+					  uint64_t key)
 {
-	if (!ma)
-		return;
-	for (int i = 0; i < (PG_MAC_TABLE_MASK_SIZE); ++i) {
-		if (!ma->mask[i])
-			continue;
-		PG_FOREACH_BIT(ma->mask[i], it) {
-			struct pg_mac_table_ptr *cur = ma->ptrs[i * 64 + it];
+	int64_t slot;
 
-			free(cur->entries);
-			free(cur);
+	if (unlikely(!ma->values))
+		return -1;
+	slot = pg_mac_table_bucket_find(ma, pg_mac_table_hash1(key) & ma->mask,
+					key);
+	if (slot >= 0)
+		return slot;
+	return pg_mac_table_bucket_find(ma, pg_mac_table_hash2(key) & ma->mask,
+					key);
+}
+
+static inline void pg_mac_table_slot_move(struct pg_mac_table *ma,
+					  uint32_t src, uint32_t dst)
+{
+	pg_mac_table_slot_key(ma, dst) = pg_mac_table_slot_key(ma, src);
+	rte_memcpy(pg_mac_table_slot_value(ma, dst),
+		   pg_mac_table_slot_value(ma, src), ma->elem_size);
+}
+
+/**
+ * Find a free slot for a new key, moving other keys to their alternative
+ * bucket if needed.
+ *
+ * @return	a free slot or -1 if the table is too full
+ */
+static inline int64_t pg_mac_table_slot_free(struct pg_mac_table *ma,
+					     uint64_t key)
+{
+	uint32_t path[PG_MAC_TABLE_MAX_KICKS];
+	uint32_t bucket = pg_mac_table_hash1(key) & ma->mask;
+	int64_t slot;
+
+	slot = pg_mac_table_bucket_find(ma, bucket, 0);
+	if (slot >= 0)
+		return slot;
+	slot = pg_mac_table_bucket_find(ma, pg_mac_table_hash2(key) & ma->mask,
+					0);
+	if (slot >= 0)
+		return slot;
+
+	/* Both buckets are full, look for a path of keys to move */
+	for (int n = 0; n < PG_MAC_TABLE_MAX_KICKS; ++n) {
+		uint32_t victim = bucket * PG_MAC_TABLE_BUCKET_ENTRIES +
+			(ma->kick++ & (PG_MAC_TABLE_BUCKET_ENTRIES - 1));
+		uint64_t victim_key = pg_mac_table_slot_key(ma, victim);
+		uint32_t alt = pg_mac_table_hash1(victim_key) & ma->mask;
+
+		for (int i = 0; i < n; ++i) {
+			if (path[i] == victim)
+				return -1;
 		}
+		path[n] = victim;
+		if (alt == bucket)
+			alt = pg_mac_table_hash2(victim_key) & ma->mask;
+
+		slot = pg_mac_table_bucket_find(ma, alt, 0);
+		if (slot < 0) {
+			bucket = alt;
+			continue;
+		}
+		/* move all keys of the path, starting from the end */
+		for (; n >= 0; --n) {
+			pg_mac_table_slot_move(ma, path[n], slot);
+			slot = path[n];
+		}
+		return slot;
 	}
-	free(ma->ptrs);
+	return -1;
 }
 
-#define pg_mac_table_part2(mac) (mac.part2 & 0x00ffffff)
-#define pg_mac_table_part1(mac) (mac.bytes32[0] & 0x00ffffff)
+static inline int pg_mac_table_alloc(struct pg_mac_table *ma,
+				     uint32_t nb_buckets)
+{
+	size_t size = nb_buckets * sizeof(struct pg_mac_table_bucket);
 
-static inline void pg_mac_table_elem_set(struct pg_mac_table *ma,
-					 union pg_mac mac, void *entry,
-					 size_t elem_size)
+	ma->buckets = NULL;
+	ma->values = NULL;
+	if (posix_memalign((void **)&ma->buckets, 64, size))
+		return -1;
+	memset(ma->buckets, 0, size);
+	ma->mask = nb_buckets - 1;
+	ma->count = 0;
+	if (!ma->elem_size)
+		return 0;
+	ma->values = malloc((size_t)nb_buckets * PG_MAC_TABLE_BUCKET_ENTRIES *
+			    ma->elem_size);
+	if (!ma->values) {
+		free(ma->buckets);
+		ma->buckets = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Rehash all keys in a bigger table
+ */
+static inline int pg_mac_table_grow(struct pg_mac_table *ma)
 {
-	uint32_t part1 = pg_mac_table_part1(mac);
-	uint32_t part2 = pg_mac_table_part2(mac);
-
-	/* Part 1 is unset */
-	if (unlikely(!pg_mac_table_is_set(*ma, part1))) {
-		pg_mac_table_mask_set(*ma, part1);
-		ma->elems[part1] = malloc(sizeof(struct pg_mac_table_elem));
-		g_assert(ma->elems[part1]);
-		memset(ma->ptrs[part1]->mask, 0,
-		       (PG_MAC_TABLE_MASK_SIZE) * sizeof(uint64_t));
-		ma->elems[part1]->entries = malloc((0xffffff + 1) * elem_size);
+	struct pg_mac_table old = *ma;
+	uint32_t nb_slots = (ma->mask + 1) * PG_MAC_TABLE_BUCKET_ENTRIES;
+
+	if (nb_slots * 2 > ma->max_size)
+		return -1;
+	if (pg_mac_table_alloc(ma, (ma->mask + 1) * 2) < 0)
+		goto error;
+
+	for (uint32_t i = 0; i < nb_slots; ++i) {
+		uint64_t key = pg_mac_table_slot_key(&old, i);
+		int64_t slot;
+
+		if (!key)
+			continue;
+		slot = pg_mac_table_slot_free(ma, key);
+		if (slot < 0) {
+			free(ma->buckets);
+			free(ma->values);
+			goto error;
+		}
+		pg_mac_table_slot_key(ma, slot) = key;
+		rte_memcpy(pg_mac_table_slot_value(ma, slot),
+			   pg_mac_table_slot_value(&old, i), ma->elem_size);
+		ma->count++;
 	}
+	free(old.buckets);
+	free(old.values);
+	return 0;
+error:
+	*ma = old;
+	return -1;
+}
+
+/**
+ * Get the slot of a key, create it if needed.
+ *
+ * @is_new	set to 1 if the key has been created
+ * @return	the slot of the key or -1 if the table is full
+ */
+static inline int64_t pg_mac_table_slot_get(struct pg_mac_table *ma,
+					    uint64_t key, size_t elem_size,
+					    int *is_new)
+{
+	int64_t slot;
+
+	*is_new = 0;
+	if (unlikely(!ma->values)) {
+		int8_t *values;
+
+		ma->elem_size = elem_size;
+		values = malloc((size_t)(ma->mask + 1) *
+				PG_MAC_TABLE_BUCKET_ENTRIES * elem_size);
+		if (!values)
+			return -1;
+		ma->values = values;
+	}
+
+	slot = pg_mac_table_lookup(ma, key);
+	if (slot >= 0)
+		return slot;
+
+	while ((slot = pg_mac_table_slot_free(ma, key)) < 0) {
+		if (pg_mac_table_grow(ma) < 0)
+			return -1;
+	}
+	pg_mac_table_slot_key(ma, slot) = key;
+	ma->count++;
+	*is_new = 1;
+	return slot;
+}
+
+/**
+ * Initialize a MAC table
+ *
+ * @ma		table to initialize
+ * @max_size	maximal number of entries the table can store
+ * @return	0 on success, -1 on error
+ */
+static inline int pg_mac_table_init_size(struct pg_mac_table *ma,
+					 uint32_t max_size)
+{
+	memset(ma, 0, sizeof(struct pg_mac_table));
+	if (max_size < PG_MAC_TABLE_MIN_SIZE)
+		max_size = PG_MAC_TABLE_MIN_SIZE;
+	ma->max_size = rte_align32pow2(max_size);
+	return pg_mac_table_alloc(ma, PG_MAC_TABLE_MIN_SIZE /
+				  PG_MAC_TABLE_BUCKET_ENTRIES);
+}
 
-	if (pg_mac_table_is_set(*ma->elems[part1], part2))
+static inline int pg_mac_table_init(struct pg_mac_table *ma)
+{
+	return pg_mac_table_init_size(ma, PG_MAC_TABLE_DEFAULT_MAX_SIZE);
+}
+
+static inline void pg_mac_table_free(struct pg_mac_table *ma)
+{
+	if (!ma)
 		return;
+	free(ma->buckets);
+	free(ma->values);
+	memset(ma, 0, sizeof(struct pg_mac_table));
+}
 
-	pg_mac_table_mask_set(*ma->elems[part1], part2);
-	rte_memcpy(ma->elems[part1]->entries + (part2 * elem_size),
-		   entry, elem_size);
+static inline uint32_t pg_mac_table_count(struct pg_mac_table *ma)
+{
+	return ma->count;
 }
 
-static inline void pg_mac_table_ptr_set(struct pg_mac_table *ma,
-					union pg_mac mac, void *entry)
+/**
+ * Get an element, create it if needed, a new element is left uninitialized
+ *
+ * @is_new	set to 1 if the element has been created
+ * @return	a pointer to the element or NULL if the table is full
+ */
+static inline void *pg_mac_table_elem_get_or_add(struct pg_mac_table *ma,
+						 union pg_mac mac,
+						 size_t elem_size,
+						 int *is_new)
 {
-	uint32_t part1 = pg_mac_table_part1(mac);
-	uint32_t part2 = pg_mac_table_part2(mac);
-
-	/* Part 1 is unset */
-	if (unlikely(!pg_mac_table_is_set(*ma, part1))) {
-		pg_mac_table_mask_set(*ma, part1);
-		ma->ptrs[part1] = malloc(sizeof(struct pg_mac_table_ptr));
-		g_assert(ma->ptrs[part1]);
-		memset(ma->ptrs[part1]->mask, 0,
-		       (PG_MAC_TABLE_MASK_SIZE) * sizeof(uint64_t));
-		ma->ptrs[part1]->entries =
-			malloc((0xffffff + 1) * sizeof(void *));
-	}
+	int64_t slot = pg_mac_table_slot_get(ma, pg_mac_table_key(mac),
+					     elem_size, is_new);
+
+	if (unlikely(slot < 0))
+		return NULL;
+	return pg_mac_table_slot_value(ma, slot);
+}
+
+/**
+ * Slots can be used to walk the table a little at a time, a slot number stay
+ * valid as long as no new element is added.
+ */
+static inline uint32_t pg_mac_table_nb_slots(struct pg_mac_table *ma)
+{
+	return (ma->mask + 1) * PG_MAC_TABLE_BUCKET_ENTRIES;
+}
+
+static inline int pg_mac_table_slot_used(struct pg_mac_table *ma,
+					 uint32_t slot)
+{
+	return !!pg_mac_table_slot_key(ma, slot);
+}
 
-	/*
-	 * Admiting Part 1 is set
-	 * Set part 2 regarless if it was set before
-	 */
-	pg_mac_table_mask_set(*ma->ptrs[part1], part2);
-	ma->ptrs[part1]->entries[part2] = entry;
+static inline void pg_mac_table_slot_unset(struct pg_mac_table *ma,
+					   uint32_t slot)
+{
+	pg_mac_table_slot_key(ma, slot) = 0;
+	ma->count--;
+}
+
+/**
+ * Set an element if not already set
+ *
+ * @return	0 on success, -1 if the table is full
+ */
+static inline int pg_mac_table_elem_set(struct pg_mac_table *ma,
+					union pg_mac mac, void *entry,
+					size_t elem_size)
+{
+	int is_new;
+	int64_t slot = pg_mac_table_slot_get(ma, pg_mac_table_key(mac),
+					     elem_size, &is_new);
+
+	if (unlikely(slot < 0))
+		return -1;
+	if (is_new)
+		rte_memcpy(pg_mac_table_slot_value(ma, slot), entry,
+			   elem_size);
+	return 0;
+}
+
+/**
+ * Set a pointer regarless if it was set before
+ *
+ * @return	0 on success, -1 if the table is full
+ */
+static inline int pg_mac_table_ptr_set(struct pg_mac_table *ma,
+				       union pg_mac mac, void *entry)
+{
+	int is_new;
+	int64_t slot = pg_mac_table_slot_get(ma, pg_mac_table_key(mac),
+					     sizeof(void *), &is_new);
+
+	if (unlikely(slot < 0))
+		return -1;
+	((void **)ma->values)[slot] = entry;
+	return 0;
 }
 
 static inline void pg_mac_table_ptr_unset(struct pg_mac_table *ma,
 					  union pg_mac mac)
 {
-	uint32_t part1 = pg_mac_table_part1(mac);
-	uint32_t part2 = pg_mac_table_part2(mac);
+	int64_t slot = pg_mac_table_lookup(ma, pg_mac_table_key(mac));
 
-	if (!pg_mac_table_is_set(*ma, part1))
+	if (slot < 0)
 		return;
-	if (!pg_mac_table_is_set(*ma->ptrs[part1], part2))
-		return;
-	pg_mac_table_mask_unset(*ma->ptrs[part1], part2);
-	if (!ma->ptrs[part1]->mask[pg_mac_table_mask_idx(part2)]) {
-		free(ma->ptrs[part1]->entries);
-		free(ma->ptrs[part1]);
-		pg_mac_table_mask_unset(*ma, part1);
-	}
+	pg_mac_table_slot_unset(ma, slot);
 }
 
 #define pg_mac_table_elem_get(ma, mac, elem_type)			\
@@ -178,69 +447,78 @@ static inline void *pg_mac_table_elem_get_internal(struct pg_mac_table *ma,
 						   union pg_mac mac,
 						   size_t elem_size)
 {
-	uint32_t part1 = pg_mac_table_part1(mac);
-	uint32_t part2 = pg_mac_table_part2(mac);
+	int64_t slot = pg_mac_table_lookup(ma, pg_mac_table_key(mac));
 
-	/* Part 1 is unset */
-	if (unlikely(!pg_mac_table_is_set(*ma, part1)))
-		return NULL;
-	if (unlikely(!pg_mac_table_is_set(*ma->ptrs[part1], part2)))
+	if (unlikely(slot < 0))
 		return NULL;
-	return ma->elems[part1]->entries + (part2 * elem_size);
+	return pg_mac_table_slot_value(ma, slot);
+}
+
+/**
+ * Lookup many addresses at once: buckets of all addresses are prefetched
+ * before any key is compared, then the values found are prefetched, so
+ * memory latency is paid once per burst instead of once per address.
+ *
+ * @macs	addresses to look for, indexed by the bits of mask
+ * @mask	mask of addresses to look for (up to 64)
+ * @elems	set to the element of each address found
+ * @return	mask of addresses found
+ */
+static inline uint64_t pg_mac_table_elem_get_bulk(struct pg_mac_table *ma,
+						  const union pg_mac *macs,
+						  uint64_t mask,
+						  void **elems)
+{
+	uint32_t bucket1[64];
+	uint32_t bucket2[64];
+	uint64_t keys[64];
+	uint64_t found = 0;
+
+	if (unlikely(!ma->values))
+		return 0;
+
+	PG_FOREACH_BIT(mask, i) {
+		keys[i] = pg_mac_table_key(macs[i]);
+		bucket1[i] = pg_mac_table_hash1(keys[i]) & ma->mask;
+		bucket2[i] = pg_mac_table_hash2(keys[i]) & ma->mask;
+		rte_prefetch0(&ma->buckets[bucket1[i]]);
+		rte_prefetch0(&ma->buckets[bucket2[i]]);
+	}
+
+	PG_FOREACH_BIT(mask, i) {
+		int64_t slot = pg_mac_table_bucket_find(ma, bucket1[i],
+							keys[i]);
+
+		if (slot < 0)
+			slot = pg_mac_table_bucket_find(ma, bucket2[i],
+							keys[i]);
+		if (slot < 0)
+			continue;
+		elems[i] = pg_mac_table_slot_value(ma, slot);
+		rte_prefetch0(elems[i]);
+		found |= ONE64 << i;
+	}
+	return found;
 }
 
 static inline void *pg_mac_table_ptr_get(struct pg_mac_table *ma,
 					 union pg_mac mac)
 {
-	uint32_t part1 = pg_mac_table_part1(mac);
-	uint32_t part2 = pg_mac_table_part2(mac);
+	int64_t slot = pg_mac_table_lookup(ma, pg_mac_table_key(mac));
 
-	/* Part 1 is unset */
-	if (unlikely(!pg_mac_table_is_set(*ma, part1)))
+	if (unlikely(slot < 0))
 		return NULL;
-	if (unlikely(!pg_mac_table_is_set(*ma->ptrs[part1], part2)))
-		return NULL;
-	return ma->ptrs[part1]->entries[part2];
+	return ((void **)ma->values)[slot];
 }
 
 static inline void pg_mac_table_iterator_next(struct pg_mac_table_iterator *it)
 {
 	struct pg_mac_table *ma = it->table;
-	uint32_t part1 = pg_mac_table_part1(it->key);
-	uint32_t part2 = pg_mac_table_part2(it->key);
-	int first_mask = pg_mac_table_mask_idx(part1);
-	int first_sub_mask = pg_mac_table_mask_idx(part2);
-	uint64_t *masks = ma->mask;
-	uint64_t unset;
-	uint64_t sub_unset;
-
-	unset = ~((ONE64 << (pg_mac_table_mask_pos(part1) + 1)) - ONE64);
-	sub_unset = ~((ONE64 << (pg_mac_table_mask_pos(part2) + 1)) - ONE64);
-
-	for (int i = first_mask; i < (PG_MAC_TABLE_MASK_SIZE); ++i) {
-		if (!masks[i])
-			continue;
-
-		PG_FOREACH_BIT(ma->mask[i] & unset, i2) {
-			uint64_t *sub_masks = ma->ptrs[(i * 64) + i2]->mask;
-
-			for (int j = first_sub_mask;
-			     j < (PG_MAC_TABLE_MASK_SIZE); ++j) {
-
-				if (!sub_masks[j])
-					continue;
+	uint32_t nb_slots = (ma->mask + 1) * PG_MAC_TABLE_BUCKET_ENTRIES;
 
-				PG_FOREACH_BIT(sub_masks[j] & sub_unset,
-					       j2) {
-					it->key.bytes32[0] = (i * 64) + i2;
-					it->key.part2 = (j * 64) + j2;
-					return;
-				}
-				sub_unset = 0;
-			}
-			first_sub_mask = 0;
-		}
-		unset = 0;
+	while (++it->slot < nb_slots) {
+		if (pg_mac_table_slot_key(ma, it->slot))
+			return;
 	}
 	it->is_end = 1;
 }
@@ -248,12 +526,11 @@ static inline void pg_mac_table_iterator_next(struct pg_mac_table_iterator *it)
 static inline void pg_mac_table_iterator_init(struct pg_mac_table_iterator *it,
 					      struct pg_mac_table *tbl)
 {
-	it->key.mac = 0;
-	it->is_end = 0;
+	it->slot = 0;
+	it->is_end = !tbl->values;
 	it->table = tbl;
 
-	/* If 0 is set we don't need to increment it iterator */
-	if (pg_mac_table_ptr_get(tbl, it->key))
+	if (it->is_end || pg_mac_table_slot_key(tbl, 0))
 		return;
 	pg_mac_table_iterator_next(it);
 }
@@ -266,14 +543,34 @@ static inline int pg_mac_table_iterator_is_end(struct pg_mac_table_iterator *it)
 static inline union pg_mac pg_mac_table_iterator_get_key(
 	struct pg_mac_table_iterator *it)
 {
-	return it->key;
+	union pg_mac key;
+
+	key.mac = pg_mac_table_slot_key(it->table, it->slot) &
+		PG_MAC_TABLE_KEY_MASK;
+	return key;
 }
 
 static inline void *pg_mac_table_iterator_get(struct pg_mac_table_iterator *it)
 {
-	return pg_mac_table_ptr_get(it->table, it->key);
+	return ((void **)it->table->values)[it->slot];
+}
+
+static inline void *
+pg_mac_table_iterator_get_elem(struct pg_mac_table_iterator *it)
+{
+	return pg_mac_table_slot_value(it->table, it->slot);
 }
 
+#define PG_MAC_TABLE_FOREACH_ELEM(ma, key, elem_type, elem)		\
+	struct pg_mac_table_iterator it;				\
+	union pg_mac key;						\
+	elem_type *elem = NULL;						\
+	for (pg_mac_table_iterator_init(&it, (ma));			\
+	     !pg_mac_table_iterator_is_end(&it) &&			\
+		     ((key = pg_mac_table_iterator_get_key(&it)).mac || 1) && \
+		     ((elem = pg_mac_table_iterator_get_elem(&it)) || 1); \
+	     pg_mac_table_iterator_next(&it))
+
 #define PG_MAC_TABLE_FOREACH_PTR(ma, key, val_type, val)		\
 	struct pg_mac_table_iterator it;				\
 	union pg_mac key;						\
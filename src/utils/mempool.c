@@ -21,6 +21,7 @@
 #include "utils/mempool.h"
 
 struct rte_mempool *mp;
+struct rte_mempool *mp_indirect;
 
 void pg_alloc_mempool(void)
 {
@@ -31,5 +32,14 @@ void pg_alloc_mempool(void)
 				rte_pktmbuf_init, NULL,
 				rte_socket_id(), 0);
 	g_assert(mp);
+	/* indirect mbufs point to the data of other mbufs */
+	mp_indirect = rte_mempool_create("pg_mempool_indirect", PG_NUM_MBUFS,
+					 sizeof(struct rte_mbuf),
+					 PG_MBUF_CACHE_SIZE,
+					 sizeof(struct rte_pktmbuf_pool_private),
+					 rte_pktmbuf_pool_init, NULL,
+					 rte_pktmbuf_init, NULL,
+					 rte_socket_id(), 0);
+	g_assert(mp_indirect);
 }
 
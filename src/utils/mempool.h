@@ -26,6 +26,7 @@
 #define PG_MBUF_SIZE (2048 + sizeof(struct rte_mbuf) + RTE_PKTMBUF_HEADROOM)
 
 extern struct rte_mempool *mp;
+extern struct rte_mempool *mp_indirect;
 
 void pg_alloc_mempool(void);
 
@@ -34,4 +35,10 @@ static inline struct rte_mempool *pg_get_mempool(void)
 	return mp;
 }
 
+/* pool of mbufs without data room, to be attached to other mbufs */
+static inline struct rte_mempool *pg_get_indirect_mempool(void)
+{
+	return mp_indirect;
+}
+
 #endif /* _PG_UTILS_MEMPOOL_H */
@@ -24,7 +24,11 @@
 #include <rte_udp.h>
 #include <rte_tcp.h>
 #include <rte_ether.h>
+#include <rte_mbuf.h>
+#include <rte_hash_crc.h>
 #include <endian.h>
+#include <netinet/in.h>
+#include <stdbool.h>
 
 #include "utils/bitmask.h"
 
@@ -102,63 +106,305 @@ inline void *pg_utils_get_l3(struct rte_mbuf *pkt)
 	return rte_pktmbuf_mtod(pkt, char *) + pkt->l2_len;
 }
 
-inline int pg_utils_get_ipv6_l4(struct rte_mbuf *pkt, uint8_t *ip_type,
-				uint8_t **ip_payload)
+static inline void *pg_utils_get_l4(struct rte_mbuf *pkt)
+{
+	return rte_pktmbuf_mtod(pkt, char *) + pkt->l2_len + pkt->l3_len;
+}
+
+/**
+ * Walk IPv6 extension headers.
+ *
+ * @param	h6 IPv6 header
+ * @param	end end of the packet data
+ * @param	proto set to the upper layer protocol
+ * @param	frag set if a fragment header was found
+ * @return	length of the IPv6 header and its extensions, 0 on error
+ */
+static inline uint16_t pg_utils_ipv6_hdr_len(struct ipv6_hdr *h6,
+					     uint8_t *end, uint8_t *proto,
+					     bool *frag)
 {
-	/* jump all ipv6 extension headers to ICMPv6 */
-	struct ipv6_hdr *h6 = (struct ipv6_hdr *) pg_utils_get_l3(pkt);
 	uint8_t next_header = h6->proto;
 	uint8_t *next_data = (uint8_t *)(h6 + 1);
-	uint8_t loop_cnt = 0;
-	bool loop = true;
 
-	while (loop) {
-		if (++loop_cnt == 8)
-			return -1;
+	*frag = false;
+	for (uint8_t loop_cnt = 0; loop_cnt < 8; loop_cnt++) {
+		if (next_data > end)
+			return 0;
 		switch (next_header) {
 		case PG_IP_TYPE_IPV6_OPTION_DESTINATION:
 		case PG_IP_TYPE_IPV6_OPTION_HOP_BY_HOP:
 		case PG_IP_TYPE_IPV6_OPTION_ROUTING:
 		case PG_IP_TYPE_IPV6_OPTION_MOBILITY:
+			if (next_data + 2 > end)
+				return 0;
 			next_header = next_data[0];
 			next_data = next_data + (next_data[1] + 1) * 8;
 			break;
 		case PG_IP_TYPE_IPV6_OPTION_FRAGMENT:
+			if (next_data + 2 > end)
+				return 0;
+			*frag = true;
 			next_header = next_data[0];
 			next_data = next_data + 8;
 			break;
 		case PG_IP_TYPE_IPV6_OPTION_AUTHENTICATION_HEADER:
+			if (next_data + 2 > end)
+				return 0;
 			next_header = next_data[0];
 			next_data = next_data + (next_data[1] + 2) * 4;
 			break;
 		case PG_IP_TYPE_IPV6_OPTION_ESP:
 			/* cannot get into this */
 		default:
-			loop = false;
+			*proto = next_header;
+			return next_data - (uint8_t *)h6;
 		}
 	}
-	*ip_type = next_header;
-	*ip_payload = next_data;
 	return 0;
 }
 
-inline void pg_utils_guess_l2(struct rte_mbuf *pkt)
+static inline uint32_t pg_utils_l4_ptype(uint8_t proto)
 {
-	struct ether_hdr *eth;
+	switch (proto) {
+	case IPPROTO_TCP:
+		return RTE_PTYPE_L4_TCP;
+	case IPPROTO_UDP:
+		return RTE_PTYPE_L4_UDP;
+	case IPPROTO_ICMP:
+	case PG_IP_TYPE_ICMPV6:
+		return RTE_PTYPE_L4_ICMP;
+	default:
+		return RTE_PTYPE_L4_NONFRAG;
+	}
+}
 
-	pkt->l2_type = RTE_PTYPE_L2_ETHER;
-	pkt->l2_len = sizeof(struct ether_hdr);
+static inline void pg_utils_set_l4_len(struct rte_mbuf *pkt, uint8_t *end)
+{
+	uint8_t *l4 = pg_utils_get_l4(pkt);
+
+	switch (pkt->packet_type & RTE_PTYPE_L4_MASK) {
+	case RTE_PTYPE_L4_TCP:
+		if (l4 + sizeof(struct tcp_hdr) <= end)
+			pkt->l4_len = (((struct tcp_hdr *)l4)->data_off >> 4) *
+				4;
+		break;
+	case RTE_PTYPE_L4_UDP:
+		pkt->l4_len = sizeof(struct udp_hdr);
+		break;
+	}
+}
 
-	eth = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
-	if (eth->ether_type == PG_BE_ETHER_TYPE_VLAN) {
+/**
+ * Parse L2, L3 and L4 headers of a packet and fill l2_len, l3_len, l4_len
+ * and packet_type. IP packets always get a L4 type, a L4 type of 0 means
+ * the IP header could not be parsed.
+ */
+static inline void pg_utils_parse_sw(struct rte_mbuf *pkt)
+{
+	uint8_t *data = rte_pktmbuf_mtod(pkt, uint8_t *);
+	uint8_t *end = data + rte_pktmbuf_data_len(pkt);
+	struct ether_hdr *eth = (struct ether_hdr *)data;
+	uint16_t ether_type;
+	uint32_t ptype = RTE_PTYPE_L2_ETHER;
+	uint8_t proto;
+
+	pkt->l2_len = sizeof(struct ether_hdr);
+	pkt->l3_len = 0;
+	pkt->l4_len = 0;
+	if (unlikely((uint8_t *)(eth + 1) > end))
+		goto l2_only;
+	ether_type = eth->ether_type;
+	if (ether_type == PG_BE_ETHER_TYPE_VLAN) {
+		if (unlikely(data + pkt->l2_len + sizeof(struct vlan_802_1q) >
+			     end))
+			goto l2_only;
 		pkt->l2_len += sizeof(struct vlan_802_1q);
-		pkt->l2_type |= RTE_PTYPE_L2_ETHER_VLAN;
+		ptype = RTE_PTYPE_L2_ETHER_VLAN;
+		ether_type = ((struct vlan_802_1q *)(eth + 1))->ether_type;
+	}
+
+	if (ether_type == PG_BE_ETHER_TYPE_IPv4) {
+		struct ipv4_hdr *ip = (struct ipv4_hdr *)(data + pkt->l2_len);
+
+		if ((uint8_t *)(ip + 1) > end)
+			goto l2_only;
+		pkt->l3_len = (ip->version_ihl & IPV4_HDR_IHL_MASK) *
+			IPV4_IHL_MULTIPLIER;
+		if (unlikely(pkt->l3_len < sizeof(struct ipv4_hdr) ||
+			     (uint8_t *)ip + pkt->l3_len > end)) {
+			pkt->l3_len = 0;
+			goto l2_only;
+		}
+		ptype |= pkt->l3_len == sizeof(struct ipv4_hdr) ?
+			RTE_PTYPE_L3_IPV4 : RTE_PTYPE_L3_IPV4_EXT;
+		if (ip->fragment_offset &
+		    rte_cpu_to_be_16(IPV4_HDR_OFFSET_MASK | IPV4_HDR_MF_FLAG))
+			ptype |= RTE_PTYPE_L4_FRAG;
+		else
+			ptype |= pg_utils_l4_ptype(ip->next_proto_id);
+	} else if (ether_type == PG_BE_ETHER_TYPE_IPv6) {
+		struct ipv6_hdr *ip = (struct ipv6_hdr *)(data + pkt->l2_len);
+		bool frag;
+
+		if ((uint8_t *)(ip + 1) > end)
+			goto l2_only;
+		pkt->l3_len = pg_utils_ipv6_hdr_len(ip, end, &proto, &frag);
+		ptype |= pkt->l3_len == sizeof(struct ipv6_hdr) ?
+			RTE_PTYPE_L3_IPV6 : RTE_PTYPE_L3_IPV6_EXT;
+		if (unlikely(!pkt->l3_len))
+			pkt->l3_len = sizeof(struct ipv6_hdr);
+		else if (frag)
+			ptype |= RTE_PTYPE_L4_FRAG;
+		else
+			ptype |= pg_utils_l4_ptype(proto);
+	}
+l2_only:
+	pkt->packet_type = ptype;
+	pg_utils_set_l4_len(pkt, end);
+}
+
+/**
+ * Fill header lengths from a packet_type given by the NIC, falling back to
+ * pg_utils_parse_sw when the NIC gives no L4 type or a bad IPv4 header.
+ */
+static inline void pg_utils_parse_hw(struct rte_mbuf *pkt)
+{
+	uint8_t *data = rte_pktmbuf_mtod(pkt, uint8_t *);
+	uint8_t *end = data + rte_pktmbuf_data_len(pkt);
+	uint32_t ptype = pkt->packet_type;
+
+	switch (ptype & RTE_PTYPE_L2_MASK) {
+	case RTE_PTYPE_L2_ETHER_VLAN:
+		pkt->l2_len = sizeof(struct ether_hdr) +
+			sizeof(struct vlan_802_1q);
+		break;
+	case RTE_PTYPE_L2_ETHER_QINQ:
+		pkt->l2_len = sizeof(struct ether_hdr) +
+			2 * sizeof(struct vlan_802_1q);
+		break;
+	default:
+		pkt->l2_len = sizeof(struct ether_hdr);
+	}
+
+	pkt->l4_len = 0;
+	if (!(ptype & RTE_PTYPE_L4_MASK)) {
+		pg_utils_parse_sw(pkt);
+		return;
+	}
+	if (RTE_ETH_IS_IPV4_HDR(ptype)) {
+		struct ipv4_hdr *ip = pg_utils_get_l3(pkt);
+
+		pkt->l3_len = (ip->version_ihl & IPV4_HDR_IHL_MASK) *
+			IPV4_IHL_MULTIPLIER;
+		if (unlikely(pkt->l3_len < sizeof(struct ipv4_hdr) ||
+			     (uint8_t *)ip + pkt->l3_len > end)) {
+			pg_utils_parse_sw(pkt);
+			return;
+		}
+	} else if ((ptype & RTE_PTYPE_L3_MASK) == RTE_PTYPE_L3_IPV6) {
+		pkt->l3_len = sizeof(struct ipv6_hdr);
+	} else {
+		/* IPv6 extensions are not described by the NIC */
+		pg_utils_parse_sw(pkt);
+		return;
 	}
+	pg_utils_set_l4_len(pkt, end);
+}
+
+/**
+ * Forget parsed metadata and cached flow hash, to be called after
+ * rewriting packet headers.
+ */
+static inline void pg_utils_reset_metadata(struct rte_mbuf *pkt)
+{
+	pkt->packet_type = 0;
+	pkt->ol_flags &= ~PKT_RX_RSS_HASH;
 }
 
-inline void pg_utils_guess_metadata(struct rte_mbuf *pkt)
+/**
+ * Parse a packet unless it was already done.
+ * Bricks modifying headers must call pg_utils_reset_metadata.
+ */
+static inline void pg_utils_parse(struct rte_mbuf *pkt)
+{
+	if (likely(pkt->packet_type))
+		return;
+	pg_utils_parse_sw(pkt);
+}
+
+/**
+ * Hash the flow of a packet (addresses, protocol and ports).
+ * The RSS hash computed by the NIC is reused when there is one, else the
+ * computed hash is cached in the same place.
+ */
+static inline uint32_t pg_utils_flow_hash(struct rte_mbuf *pkt)
+{
+	uint32_t ptype;
+	uint32_t hash;
+
+	if (pkt->ol_flags & PKT_RX_RSS_HASH)
+		return pkt->hash.rss;
+
+	pg_utils_parse(pkt);
+	ptype = pkt->packet_type;
+	if (RTE_ETH_IS_IPV4_HDR(ptype)) {
+		struct ipv4_hdr *ip = pg_utils_get_l3(pkt);
+
+		hash = rte_hash_crc(&ip->src_addr, 2 * sizeof(uint32_t),
+				    ip->next_proto_id);
+	} else if (RTE_ETH_IS_IPV6_HDR(ptype)) {
+		struct ipv6_hdr *ip = pg_utils_get_l3(pkt);
+
+		hash = rte_hash_crc(ip->src_addr, 32,
+				    ptype & RTE_PTYPE_L4_MASK);
+	} else {
+		/* not IP, hash MAC addresses */
+		hash = rte_hash_crc(rte_pktmbuf_mtod(pkt, void *),
+				    2 * ETHER_ADDR_LEN, 0);
+		goto cache;
+	}
+
+	/* only the first fragment has ports, and we don't flag it */
+	if (((ptype & RTE_PTYPE_L4_MASK) == RTE_PTYPE_L4_TCP ||
+	     (ptype & RTE_PTYPE_L4_MASK) == RTE_PTYPE_L4_UDP) &&
+	    pkt->l2_len + pkt->l3_len + sizeof(uint32_t) <=
+	    rte_pktmbuf_data_len(pkt))
+		/* source and destination ports */
+		hash = rte_hash_crc_4byte(*(uint32_t *)pg_utils_get_l4(pkt),
+					  hash);
+cache:
+	pkt->hash.rss = hash;
+	pkt->ol_flags |= PKT_RX_RSS_HASH;
+	return hash;
+}
+
+/**
+ * Tell if a parsed packet has an IP ethertype but an IP header which could
+ * not be parsed (bad IHL, truncated header...), such packets must not be
+ * taken for non-IP ones by filtering bricks.
+ */
+static inline bool pg_utils_is_bad_ip(struct rte_mbuf *pkt)
+{
+	uint16_t ether_type;
+
+	if (likely(pkt->packet_type & RTE_PTYPE_L3_MASK) ||
+	    rte_pktmbuf_data_len(pkt) < pkt->l2_len)
+		return false;
+	ether_type = pg_utils_get_ether_type(pkt);
+	return ether_type == PG_BE_ETHER_TYPE_IPv4 ||
+		ether_type == PG_BE_ETHER_TYPE_IPv6;
+}
+
+/**
+ * Set metadata of a packet just received from outside of the graph.
+ */
+static inline void pg_utils_guess_metadata(struct rte_mbuf *pkt)
 {
-	pg_utils_guess_l2(pkt);
+	if (pkt->packet_type & RTE_PTYPE_L3_MASK)
+		pg_utils_parse_hw(pkt);
+	else
+		pg_utils_parse_sw(pkt);
 }
 
 #endif /* ifndef _PG_UTILS_NETWORK_H */
@@ -56,15 +56,19 @@ struct headers {
 	struct vxlan_hdr vxlan; /* define in rte_ether.h */
 } __attribute__((__packed__));
 
-struct full_header {
+/**
+ * Outer headers prepended by the VTEP, 50 bytes for IPv4 and 70 for IPv6
+ */
+struct outer_header {
 	struct ether_hdr ethernet; /* define in rte_ether.h */
 	struct headers outer;
-	struct eth_ip_l4 inner;
 } __attribute__((__packed__));
 
 struct dest_addresses {
 	struct ether_addr mac;
 	IP_TYPE ip;
+	/* ready to copy outer header, lengths and ids are patched per packet */
+	struct outer_header hdr;
 };
 
 struct vtep_config {
@@ -80,12 +84,14 @@ struct vtep_config {
 #define UDP_MIN_PORT 49152
 #define UDP_PORT_RANGE 16383
 #define UDP_PROTOCOL_NUMBER 17
-#define TCP_PROTOCOL_NUMBER 6
+
+#define OUTER_PTYPE_L3_(version) CAT(RTE_PTYPE_L3_IPV, version)
+#define OUTER_PTYPE_L3 OUTER_PTYPE_L3_(IP_VERSION)
 
 #define ip_udptcp_cksum(a, b, version)			\
 	CATCAT(rte_ipv, version, _udptcp_cksum)(a, b)
 
-#define HEADER_LENGTH (sizeof(struct headers) + sizeof(struct ether_hdr))
+#define HEADER_LENGTH sizeof(struct outer_header)
 
 #define ETHER_TYPE_IP_(version) CAT(ETHER_TYPE_IPv, version)
 #define ETHER_TYPE_IP ETHER_TYPE_IP_(IP_VERSION)
@@ -107,6 +113,7 @@ struct vtep_config {
 struct vtep_port {
 	uint32_t vni;		/* the VNI of this ethernet port */
 	IP_TYPE multicast_ip;
+	struct outer_header multicast_hdr;	/* see dest_addresses */
 	struct pg_mac_table mac_to_dst;
 	struct pg_mac_table known_mac;	/* is the MAC adress on this port  */
 };
@@ -117,6 +124,12 @@ struct vtep_state {
 	enum pg_side output;		/* side the VTEP packets will go */
 	uint16_t udp_dst_port_be;		/* UDP destination port */
 	struct vtep_port *ports;
+	uint16_t ports_max;
+	/* open addressing hash of VNIs, contain port index + 1, 0 is empty */
+	uint32_t *vni_index;
+	uint32_t vni_index_mask;
+	/* packets of each port during decapsulation, always zeroed after */
+	uint64_t *ports_mask;
 	uint16_t packet_id;       /* IP identification number */
 	int flags;
 	struct rte_mbuf *pkts[64];
@@ -148,26 +161,66 @@ static inline void ip6_build(struct vtep_state *state, struct ipv6_hdr *ip_hdr,
 	pg_ip_copy(dst_ip, ip_hdr->dst_addr);
 }
 
-static inline void ip4_build(struct vtep_state *state, struct ipv4_hdr *ip_hdr,
-			     uint32_t src_ip, uint32_t dst_ip,
-			     uint16_t datagram_len)
+/**
+ * Build an IP header template with zero length and id, see ip_patch
+ */
+static inline void ip6_template_build(struct vtep_state *state,
+				      struct ipv6_hdr *ip_hdr,
+				      union pg_ipv6_addr src_ip,
+				      union pg_ipv6_addr dst_ip)
 {
+	ip6_build(state, ip_hdr, src_ip, dst_ip, 0);
+}
+
+static inline void ip4_template_build(struct vtep_state *state,
+				      struct ipv4_hdr *ip_hdr,
+				      uint32_t src_ip, uint32_t dst_ip)
+{
+	memset(ip_hdr, 0, sizeof(struct ipv4_hdr));
 	ip_hdr->version_ihl = 0x45;
-	ip_hdr->total_length = rte_cpu_to_be_16(datagram_len);
-	state->packet_id += 1;
-	ip_hdr->packet_id = state->packet_id;
 	ip_hdr->time_to_live = 64;
-	ip_hdr->hdr_checksum = 0;
 	ip_hdr->next_proto_id = UDP_PROTOCOL_NUMBER;
 	ip_hdr->src_addr = src_ip;
 	ip_hdr->dst_addr = dst_ip;
 	ip_hdr->hdr_checksum = rte_ipv4_cksum(ip_hdr);
 }
 
-#define ip_build(state, ip_hdr, src_ip, dst_ip, len)		\
-	(_Generic((ip_hdr), struct ipv4_hdr * : ip4_build,	\
-		 struct ipv6_hdr * : ip6_build)			\
-	 (state, ip_hdr, src_ip, dst_ip, len))
+#define ip_template_build(state, ip_hdr, src_ip, dst_ip)		\
+	(_Generic((ip_hdr), struct ipv4_hdr * : ip4_template_build,	\
+		 struct ipv6_hdr * : ip6_template_build)		\
+	 (state, ip_hdr, src_ip, dst_ip))
+
+static inline void ip6_patch(struct vtep_state *state,
+			     struct ipv6_hdr *ip_hdr,
+			     uint16_t pkt_len)
+{
+	ip_hdr->payload_len = rte_cpu_to_be_16(pkt_len);
+}
+
+/**
+ * Set length and id of an IP header copied from a template, the checksum
+ * is updated incrementally as both fields were zero in the template.
+ */
+static inline void ip4_patch(struct vtep_state *state,
+			     struct ipv4_hdr *ip_hdr,
+			     uint16_t datagram_len)
+{
+	uint16_t len = rte_cpu_to_be_16(datagram_len);
+	uint32_t sum;
+
+	state->packet_id += 1;
+	ip_hdr->total_length = len;
+	ip_hdr->packet_id = state->packet_id;
+	sum = (uint16_t)~ip_hdr->hdr_checksum + len + state->packet_id;
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	ip_hdr->hdr_checksum = ~sum;
+}
+
+#define ip_patch(state, ip_hdr, len)				\
+	(_Generic((ip_hdr), struct ipv4_hdr * : ip4_patch,	\
+		 struct ipv6_hdr * : ip6_patch)			\
+	 (state, ip_hdr, len))
 
 /**
  * Build the VXLAN header
@@ -241,6 +294,26 @@ static inline void ethernet_build(struct ether_hdr *eth_hdr,
 	eth_hdr->ether_type = PG_BE_ETHER_TYPE_IP;
 }
 
+/**
+ * Build an outer header template
+ *
+ * @param	hdr pointer to the template to build
+ * @param	dst_mac destination MAC address
+ * @param	dst_ip destination IP
+ * @param	vni VNI as in the VXLAN header
+ */
+static inline void outer_header_build(struct vtep_state *state,
+				      struct outer_header *hdr,
+				      struct ether_addr *dst_mac,
+				      IP_TYPE dst_ip,
+				      uint32_t vni)
+{
+	ethernet_build(&hdr->ethernet, &state->mac, dst_mac);
+	ip_template_build(state, &hdr->outer.ip, state->ip, dst_ip);
+	udp_build(&hdr->outer.udp, state->udp_dst_port_be, 0, 0);
+	vxlan_build(&hdr->outer.vxlan, vni);
+}
+
 static inline uint16_t udp_overhead(void)
 {
 	return sizeof(struct vxlan_hdr) + sizeof(struct udp_hdr);
@@ -252,6 +325,43 @@ static inline uint16_t ip_overhead(void)
 }
 
 
+/* map the packet type of a packet to the inner packet type of a tunnel */
+static inline uint32_t inner_ptype_get(uint32_t ptype)
+{
+	/* only L4 types keep the same values, shifted, as inner types */
+	uint32_t inner = (ptype & RTE_PTYPE_L4_MASK) << 16;
+
+	switch (ptype & RTE_PTYPE_L2_MASK) {
+	case RTE_PTYPE_L2_ETHER:
+		inner |= RTE_PTYPE_INNER_L2_ETHER;
+		break;
+	case RTE_PTYPE_L2_ETHER_VLAN:
+		inner |= RTE_PTYPE_INNER_L2_ETHER_VLAN;
+		break;
+	}
+	switch (ptype & RTE_PTYPE_L3_MASK) {
+	case RTE_PTYPE_L3_IPV4:
+		inner |= RTE_PTYPE_INNER_L3_IPV4;
+		break;
+	case RTE_PTYPE_L3_IPV4_EXT:
+		inner |= RTE_PTYPE_INNER_L3_IPV4_EXT;
+		break;
+	case RTE_PTYPE_L3_IPV4_EXT_UNKNOWN:
+		inner |= RTE_PTYPE_INNER_L3_IPV4_EXT_UNKNOWN;
+		break;
+	case RTE_PTYPE_L3_IPV6:
+		inner |= RTE_PTYPE_INNER_L3_IPV6;
+		break;
+	case RTE_PTYPE_L3_IPV6_EXT:
+		inner |= RTE_PTYPE_INNER_L3_IPV6_EXT;
+		break;
+	case RTE_PTYPE_L3_IPV6_EXT_UNKNOWN:
+		inner |= RTE_PTYPE_INNER_L3_IPV6_EXT_UNKNOWN;
+		break;
+	}
+	return inner;
+}
+
 static inline void do_add_mac(struct vtep_port *port, struct ether_addr *mac);
 
 static inline int vtep_header_prepend(struct vtep_state *state,
@@ -263,49 +373,54 @@ static inline int vtep_header_prepend(struct vtep_state *state,
 {
 	struct ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
 	uint16_t packet_len = rte_pktmbuf_data_len(pkt);
-	struct full_header *full_header;
+	struct outer_header *outer_header;
 	struct headers *headers;
-	struct ether_hdr *ethernet;
+	uint32_t inner_ptype;
+	uint32_t flow_hash;
 
-	full_header =
-		(struct full_header *)rte_pktmbuf_prepend(pkt, HEADER_LENGTH);
-	if (unlikely(!full_header)) {
+	pg_utils_parse(pkt);
+	inner_ptype = pkt->packet_type;
+	flow_hash = pg_utils_flow_hash(pkt);
+
+	outer_header =
+		(struct outer_header *)rte_pktmbuf_prepend(pkt, HEADER_LENGTH);
+	if (unlikely(!outer_header)) {
 		*errp = pg_error_new("%s on a packet of %ld/%d",
 				     "No enough headroom to add VTEP headers",
 				     HEADER_LENGTH, pkt->pkt_len);
 		return -1;
 	}
 
-	ethernet = &full_header->ethernet;
-	headers = &full_header->outer;
-	vxlan_build(&headers->vxlan, port->vni);
-
 	/* select destination IP and MAC address */
 	if (likely(unicast)) {
-		ethernet_build(ethernet, &state->mac, &entry->mac);
-		ip_build(state, &headers->ip, state->ip, entry->ip,
-			 packet_len + ip_overhead());
+		rte_memcpy(outer_header, &entry->hdr, HEADER_LENGTH);
 	} else {
-		struct ether_addr dst =
-			pg_multicast_get_dst_addr(port->multicast_ip);
-
 		if (!(state->flags & PG_VTEP_NO_INNERMAC_CHECK))
 			do_add_mac(port, &eth_hdr->s_addr);
-		ethernet_build(ethernet, &state->mac, &dst);
-		ip_build(state, &headers->ip, state->ip, port->multicast_ip,
-			 packet_len + ip_overhead());
+		rte_memcpy(outer_header, &port->multicast_hdr, HEADER_LENGTH);
 	}
+	headers = &outer_header->outer;
+	ip_patch(state, &headers->ip, packet_len + ip_overhead());
 	/* It is recommended to have UDP source port randomized to be
-	 * ECMP/load-balancing friendly. Let's use computed hash from
-	 * IP header. */
-	udp_build(&headers->udp, state->udp_dst_port_be,
-		  packet_len + udp_overhead(), ((uint16_t *)pkt)[0]);
-
-	pkt->l2_len = HEADER_LENGTH + sizeof(struct ether_hdr);
+	 * ECMP/load-balancing friendly, see RFC7348 section 5.
+	 */
+	headers->udp.src_port =
+		rte_cpu_to_be_16(src_port_compute(flow_hash ^
+						  (flow_hash >> 16)));
+	headers->udp.dgram_len =
+		rte_cpu_to_be_16(packet_len + udp_overhead());
+
+	/* outer headers are seen as L2 so offloads apply to the inner packet */
+	pkt->l2_len += HEADER_LENGTH;
+	pkt->packet_type = RTE_PTYPE_L2_ETHER | OUTER_PTYPE_L3 |
+		RTE_PTYPE_L4_UDP | RTE_PTYPE_TUNNEL_VXLAN |
+		inner_ptype_get(inner_ptype);
 
 	if (unlikely(pkt->udata64 & PG_FRAGMENTED_MBUF)) {
 		pkt->l2_len = sizeof(struct ether_hdr);
 		pkt->l3_len = sizeof(struct ipv4_hdr);
+		pkt->packet_type = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4 |
+			RTE_PTYPE_L4_UDP;
 		pkt->ol_flags = PKT_TX_UDP_CKSUM;
 	} else if (pkt->ol_flags & PKT_TX_TCP_SEG) {
 		pkt->ol_flags = PKT_TX_IPV4 | PKT_TX_IP_CKSUM |
@@ -394,6 +509,85 @@ static inline int to_vtep(struct pg_brick *brick, enum pg_side from,
 	return ret;
 }
 
+static inline uint32_t vni_hash(uint32_t vni)
+{
+	return rte_hash_crc_4byte(vni, 0);
+}
+
+/**
+ * @param	vni VNI as in the VXLAN header
+ * @return	index of the port using this VNI or -1
+ */
+static inline int vni_index_lookup(struct vtep_state *state, uint32_t vni)
+{
+	uint32_t mask = state->vni_index_mask;
+
+	for (uint32_t h = vni_hash(vni) & mask; state->vni_index[h];
+	     h = (h + 1) & mask) {
+		uint32_t port = state->vni_index[h] - 1;
+
+		if (state->ports[port].vni == vni)
+			return port;
+	}
+	return -1;
+}
+
+static inline void vni_index_add(struct vtep_state *state, uint16_t port)
+{
+	uint32_t mask = state->vni_index_mask;
+	uint32_t h = vni_hash(state->ports[port].vni) & mask;
+
+	/* the index is twice as big as the number of ports: never full */
+	while (state->vni_index[h])
+		h = (h + 1) & mask;
+	state->vni_index[h] = port + 1;
+}
+
+/* removing VNIs is rare enough to simply rebuild the whole index */
+static void vni_index_rebuild(struct vtep_state *state)
+{
+	memset(state->vni_index, 0,
+	       (state->vni_index_mask + 1) * sizeof(uint32_t));
+	for (uint16_t i = 0; i < state->ports_max; ++i) {
+		if (pg_is_multicast_ip(state->ports[i].multicast_ip))
+			vni_index_add(state, i);
+	}
+}
+
+/**
+ * Dispatch packets to their port using the VNI index, in one pass
+ *
+ * @hitted_ports	set to the indexes of ports having packets,
+ *			packets of each port are in state->ports_mask
+ * @return		number of ports having packets
+ */
+static inline int dispatch_vni_pkts(struct vtep_state *state,
+				    struct pg_brick_side *s,
+				    uint64_t mask,
+				    struct headers **hdrs,
+				    uint16_t *hitted_ports)
+{
+	uint32_t last_vni = 0;
+	int port = -1;
+	int nb = 0;
+
+	PG_FOREACH_BIT(mask, j) {
+		uint32_t vni = hdrs[j]->vxlan.vx_vni;
+
+		/* packets of a burst often belong to the same VNI */
+		if (port < 0 || vni != last_vni) {
+			port = vni_index_lookup(state, vni);
+			last_vni = vni;
+		}
+		if (unlikely(port < 0 || !s->edges[port].link))
+			continue;
+		if (!state->ports_mask[port])
+			hitted_ports[nb++] = port;
+		state->ports_mask[port] |= ONE64 << j;
+	}
+	return nb;
+}
+
 static inline void add_dst_iner_macs(struct vtep_state *state,
 				     struct vtep_port *port,
 				     struct rte_mbuf **pkts,
@@ -410,21 +604,28 @@ static inline void add_dst_iner_macs(struct vtep_state *state,
 
 	for (mask = multicast_mask; mask;) {
 		int i;
-		struct dest_addresses dst;
+		int is_new;
+		struct dest_addresses *dst;
 		struct ether_hdr *pkt_addr;
 
 		pg_low_bit_iterate_full(mask, bit, i);
 
 		pkt_addr = rte_pktmbuf_mtod(pkts[i], struct ether_hdr *);
-		ether_addr_copy(eths[i], &dst.mac);
+		rte_memcpy(tmp.bytes, &pkt_addr->s_addr.addr_bytes, 6);
+		dst = pg_mac_table_elem_get_or_add(
+			&port->mac_to_dst, tmp,
+			sizeof(struct dest_addresses), &is_new);
+		if (!dst || !is_new)
+			continue;
+
+		ether_addr_copy(eths[i], &dst->mac);
 #if IP_VERSION == 4
-		dst.ip = hdrs[i]->ip.src_addr;
+		dst->ip = hdrs[i]->ip.src_addr;
 #else
-		pg_ip_copy(hdrs[i]->ip.src_addr, &dst.ip);
+		pg_ip_copy(hdrs[i]->ip.src_addr, &dst->ip);
 #endif
-		rte_memcpy(tmp.bytes, &pkt_addr->s_addr.addr_bytes, 6);
-		pg_mac_table_elem_set(&port->mac_to_dst, tmp, &dst,
-				      sizeof(struct dest_addresses));
+		outer_header_build(state, &dst->hdr, &dst->mac, dst->ip,
+				   port->vni);
 	}
 }
 
@@ -457,6 +658,7 @@ static inline void classify_pkts(struct rte_mbuf **pkts,
 		struct headers *tmp;
 
 		pg_low_bit_iterate(mask, i);
+		pg_utils_parse(pkts[i]);
 		tmp = pg_utils_get_l3(pkts[i]);
 		eths[i] = pg_util_get_ether_src_addr(pkts[i]);
 		hdrs[i] = tmp;
@@ -476,38 +678,31 @@ static inline void classify_pkts(struct rte_mbuf **pkts,
 	}
 }
 
-static inline uint64_t check_and_clone_vni_pkts(struct vtep_state *state,
-						struct rte_mbuf **pkts,
-						uint64_t mask,
-						struct headers **hdrs,
-						struct vtep_port *port,
-						struct rte_mbuf **out_pkts)
+static inline uint64_t clone_vni_pkts(struct vtep_state *state,
+				      struct rte_mbuf **pkts,
+				      uint64_t mask,
+				      struct rte_mbuf **out_pkts)
 {
 	uint64_t vni_mask = 0;
 
-	for (; mask;) {
-		int j;
-
-		pg_low_bit_iterate(mask, j);
-		if (hdrs[j]->vxlan.vx_vni == port->vni) {
-			struct rte_mbuf *tmp;
+	PG_FOREACH_BIT(mask, j) {
+		struct rte_mbuf *tmp;
 
-			if (unlikely(!(state->flags & PG_VTEP_NO_COPY))) {
-				struct rte_mempool *mp = pg_get_mempool();
+		if (unlikely(!(state->flags & PG_VTEP_NO_COPY))) {
+			struct rte_mempool *mp = pg_get_mempool();
 
-				tmp = rte_pktmbuf_clone(pkts[j], mp);
-			} else {
-				tmp = pkts[j];
-			}
-			if (unlikely(!tmp))
-				return 0;
-			out_pkts[j] = tmp;
-			if (!rte_pktmbuf_adj(out_pkts[j],
-					     out_pkts[j]->l2_len +
-					     sizeof(struct headers)))
-				return 0;
-			vni_mask |= (1LLU << j);
+			tmp = rte_pktmbuf_clone(pkts[j], mp);
+		} else {
+			tmp = pkts[j];
 		}
+		if (unlikely(!tmp))
+			return 0;
+		out_pkts[j] = tmp;
+		if (!rte_pktmbuf_adj(out_pkts[j],
+				     out_pkts[j]->l2_len +
+				     sizeof(struct headers)))
+			return 0;
+		vni_mask |= ONE64 << j;
 	}
 	return vni_mask;
 }
@@ -517,17 +712,8 @@ static inline void restore_metadata(struct rte_mbuf **pkts,
 				    uint64_t vni_mask)
 {
 	PG_FOREACH_BIT(vni_mask, it) {
-		pkts[it]->l2_len = sizeof(struct ether_hdr);
-		uint16_t eth_type = pg_utils_get_ether_type(pkts[it]);
-
-		switch (eth_type) {
-		case PG_BE_ETHER_TYPE_IPv4:
-			pkts[it]->l3_len = sizeof(struct ipv4_hdr);
-			break;
-		case PG_BE_ETHER_TYPE_IPv6:
-			pkts[it]->l3_len = sizeof(struct ipv6_hdr);
-			break;
-		}
+		pg_utils_reset_metadata(pkts[it]);
+		pg_utils_parse(pkts[it]);
 	}
 }
 
@@ -537,30 +723,31 @@ static inline int decapsulate(struct pg_brick *brick, enum pg_side from,
 {
 	struct vtep_state *state = pg_brick_get_state(brick, struct vtep_state);
 	struct pg_brick_side *s = &brick->sides[pg_flip_side(from)];
-	int i;
 	struct vtep_port *ports = state->ports;
 	struct ether_addr *eths[64];
 	struct headers *hdrs[64];
+	uint16_t hitted_ports[64];
 	struct rte_mbuf **out_pkts = state->pkts;
 	uint64_t multicast_mask;
+	int nb;
 
 	classify_pkts(pkts, pkts_mask, eths, hdrs, &multicast_mask, &pkts_mask,
 		      state->udp_dst_port_be);
+	nb = dispatch_vni_pkts(state, s, pkts_mask, hdrs, hitted_ports);
 
-	for (i = 0; i < s->nb; ++i) {
+	for (int k = 0; k < nb; ++k) {
+		uint16_t i = hitted_ports[k];
 		struct vtep_port *port = &ports[i];
 		uint64_t hitted_mask = 0;
 		uint64_t vni_mask;
 
-		if (!pkts_mask)
-			break;
-		/* Decaspulate and check the vni*/
-		vni_mask = check_and_clone_vni_pkts(state, pkts, pkts_mask,
-						    hdrs, port, out_pkts);
+		/* Decaspulate */
+		vni_mask = clone_vni_pkts(state, pkts, state->ports_mask[i],
+					  out_pkts);
+		state->ports_mask[i] = 0;
 		if (!vni_mask)
 			continue;
 
-		pkts_mask ^= vni_mask;
 		if (state->flags & PG_VTEP_NO_INNERMAC_CHECK) {
 			hitted_mask = vni_mask;
 		} else {
@@ -589,7 +776,7 @@ static inline int decapsulate(struct pg_brick *brick, enum pg_side from,
 						    errp) < 0)) {
 				if (!(state->flags & PG_VTEP_NO_COPY))
 					pg_packets_free(out_pkts, vni_mask);
-				return -1;
+				goto error;
 			}
 		}
 
@@ -597,28 +784,18 @@ static inline int decapsulate(struct pg_brick *brick, enum pg_side from,
 			pg_packets_free(out_pkts, vni_mask);
 	}
 	return 0;
+error:
+	/* keep ports_mask zeroed for next bursts */
+	for (int k = 0; k < nb; ++k)
+		state->ports_mask[hitted_ports[k]] = 0;
+	return -1;
 }
 
-static inline uint64_t check_vni_pkts(struct rte_mbuf **pkts,
-				      uint64_t mask,
-				      struct headers **hdrs,
-				      struct vtep_port *port)
+static inline void decap_vni_pkts(struct rte_mbuf **pkts, uint64_t mask)
 {
-	uint64_t vni_mask = 0;
-
-	for (; mask;) {
-		int j;
-		uint64_t bit;
-
-		pg_low_bit_iterate_full(mask, bit, j);
-		if (hdrs[j]->vxlan.vx_vni == port->vni) {
-			rte_pktmbuf_adj(pkts[j],
-					pkts[j]->l2_len +
-					sizeof(struct headers));
-			vni_mask |= bit;
-		}
-	}
-	return vni_mask;
+	PG_FOREACH_BIT(mask, j)
+		rte_pktmbuf_adj(pkts[j], pkts[j]->l2_len +
+				sizeof(struct headers));
 }
 
 static inline int decapsulate_simple(struct pg_brick *brick, enum pg_side from,
@@ -632,32 +809,35 @@ static inline int decapsulate_simple(struct pg_brick *brick, enum pg_side from,
 	struct vtep_port *ports =  state->ports;
 	struct ether_addr *eths[64];
 	struct headers *hdrs[64];
+	uint16_t hitted_ports[64];
 	struct pg_brick_edge *edges = s->edges;
 	uint64_t multicast_mask;
+	int nb;
+	int ret = 0;
 
 	classify_pkts(pkts, pkts_mask, eths, hdrs, &multicast_mask, &pkts_mask,
 		      state->udp_dst_port_be);
+	nb = dispatch_vni_pkts(state, s, pkts_mask, hdrs, hitted_ports);
 
-	for (int i = 0, nb = s->nb; pkts_mask && i < nb; ++i) {
+	for (int k = 0; k < nb; ++k) {
+		uint16_t i = hitted_ports[k];
 		struct vtep_port *port = &ports[i];
-		uint64_t vni_mask;
+		uint64_t vni_mask = state->ports_mask[i];
 
-		/* Decaspulate and check the vni*/
-		vni_mask = check_vni_pkts(pkts, pkts_mask,
-					  hdrs, port);
-		if (!vni_mask)
+		state->ports_mask[i] = 0;
+		if (unlikely(ret < 0))
 			continue;
 
-		pkts_mask ^= vni_mask;
+		/* Decaspulate */
+		decap_vni_pkts(pkts, vni_mask);
 		add_dst_iner_macs(state, port, pkts, eths, hdrs,
 				  vni_mask, multicast_mask);
 		restore_metadata(pkts, hdrs, vni_mask);
 
-		if (unlikely(pg_brick_burst(edges[i].link, from, i, pkts,
-					    vni_mask, errp) < 0))
-			return -1;
+		ret = pg_brick_burst(edges[i].link, from, i, pkts,
+				     vni_mask, errp);
 	}
-	return 0;
+	return ret < 0 ? -1 : 0;
 }
 
 static inline int from_vtep(struct pg_brick *brick, enum pg_side from,
@@ -680,6 +860,7 @@ static int do_add_vni(struct vtep_state *state, uint16_t edge_index,
 		       struct pg_error **errp)
 {
 	struct vtep_port *port = &state->ports[edge_index];
+	struct ether_addr mac;
 
 	if (unlikely(!port)) {
 		*errp = pg_error_new("bad vtep internal port provided");
@@ -696,9 +877,13 @@ static int do_add_vni(struct vtep_state *state, uint16_t edge_index,
 	/* vni is on the first 24 bits */
 	port->vni = rte_cpu_to_be_32(vni << 8);
 	pg_ip_copy(multicast_ip, &port->multicast_ip);
+	mac = pg_multicast_get_dst_addr(multicast_ip);
+	outer_header_build(state, &port->multicast_hdr, &mac, multicast_ip,
+			   port->vni);
 
 	g_assert(!pg_mac_table_init(&port->mac_to_dst));
 	g_assert(!pg_mac_table_init(&port->known_mac));
+	vni_index_add(state, edge_index);
 
 	multicast_subscribe(state, port, multicast_ip, errp);
 	return 0;
@@ -733,6 +918,7 @@ static void do_remove_vni(struct vtep_state *state,
 
 	/* clear for next user */
 	memset(port, 0, sizeof(struct vtep_port));
+	vni_index_rebuild(state);
 }
 
 /**
@@ -761,6 +947,10 @@ static void vtep_unlink_notify(struct pg_brick *brick,
 
 static void vtep_destroy(struct pg_brick *brick, struct pg_error **errp)
 {
+	struct vtep_state *state = pg_brick_get_state(brick, struct vtep_state);
+
+	g_free(state->vni_index);
+	g_free(state->ports_mask);
 }
 
 static struct pg_brick_config *vtep_config_new(const char *name,
@@ -825,6 +1015,10 @@ static int vtep_init(struct pg_brick *brick,
 	 */
 	max = pg_side_get_max(brick, pg_flip_side(state->output));
 	state->ports = g_new0(struct vtep_port, max);
+	state->ports_max = max;
+	state->ports_mask = g_new0(uint64_t, max);
+	state->vni_index_mask = rte_align32pow2(max * 2) - 1;
+	state->vni_index = g_new0(uint32_t, state->vni_index_mask + 1);
 
 	brick->burst = vtep_burst;
 	return 0;
@@ -838,13 +1032,13 @@ int pg_vtep_add_mac_(struct pg_brick *brick, uint32_t vni,
 {
 	struct vtep_state *state = pg_brick_get_state(brick, struct vtep_state);
 	struct pg_brick_side *s = &brick->sides[pg_flip_side(state->output)];
+	int i;
 
 	vni = rte_cpu_to_be_32(vni << 8);
-	for (int i = 0; i < s->nb; ++i) {
-		if (state->ports[i].vni == vni) {
-			do_add_mac(&state->ports[i], mac);
-			return 0;
-		}
+	i = vni_index_lookup(state, vni);
+	if (i >= 0 && i < s->nb) {
+		do_add_mac(&state->ports[i], mac);
+		return 0;
 	}
 	*errp = pg_error_new("vni '%d' not found in brick '%s'", vni,
 			     brick->name);
@@ -947,7 +1141,8 @@ int pg_vtep_add_vni_(struct pg_brick *brick,
 #undef UDP_MIN_PORT
 #undef UDP_PORT_RANGE
 #undef UDP_PROTOCOL_NUMBER
-#undef TCP_PROTOCOL_NUMBER
+#undef OUTER_PTYPE_L3_
+#undef OUTER_PTYPE_L3
 #undef CATCAT
 #undef CAT
 #undef ip_udptcp_cksum
@@ -964,7 +1159,8 @@ int pg_vtep_add_vni_(struct pg_brick *brick,
 #undef multicast_subscribe
 #undef multicast_unsubscribe_
 #undef multicast_unsubscribe
-#undef ip_build
+#undef ip_template_build
+#undef ip_patch
 #undef BRICK_NAME_4
 #undef BRICK_NAME_6
 #undef BRICK_NAME_
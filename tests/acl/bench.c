@@ -0,0 +1,169 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Packetgraph.
+ *
+ * Packetgraph is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Packetgraph is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <rte_config.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <packetgraph/packetgraph.h>
+#include "utils/tests.h"
+#include <packetgraph/acl.h>
+#include <packetgraph/firewall.h>
+
+#include "utils/bench.h"
+#include "utils/bitmask.h"
+#include "packets.h"
+#include "utils/mempool.h"
+
+/*
+ * The same stateless rules in both bricks: every packet misses all rules
+ * but the last one, which allows UDP.
+ */
+static struct pg_brick *bench_acl_new(int nb_rules)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *acl = pg_acl_new("acl", &error);
+	struct pg_acl_rule rule;
+
+	g_assert(!error);
+	for (int i = 0; i < nb_rules - 1; i++) {
+		memset(&rule, 0, sizeof(rule));
+		rule.family = AF_INET;
+		rule.proto = 6;
+		rule.src[0] = 10;
+		rule.src[1] = 1;
+		rule.src[2] = i / 250;
+		rule.src[3] = i % 250 + 1;
+		rule.src_prefix_len = 32;
+		rule.src_port_max = UINT16_MAX;
+		rule.dst_port_min = 1000 + i;
+		rule.dst_port_max = 1000 + i;
+		rule.action = PG_ACL_ALLOW;
+		g_assert(!pg_acl_rule_add(acl, &rule, PG_WEST_SIDE, NULL,
+					  &error));
+	}
+	memset(&rule, 0, sizeof(rule));
+	rule.family = AF_INET;
+	rule.proto = 17;
+	rule.src_port_max = UINT16_MAX;
+	rule.dst_port_max = UINT16_MAX;
+	rule.action = PG_ACL_ALLOW;
+	g_assert(!pg_acl_rule_add(acl, &rule, PG_WEST_SIDE, NULL, &error));
+	g_assert(!pg_acl_reload(acl, &error));
+	g_assert(!error);
+	return acl;
+}
+
+static struct pg_brick *bench_firewall_new(int nb_rules)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fw = pg_firewall_new("firewall", PG_NO_FLOW_CACHE,
+					      &error);
+
+	g_assert(!error);
+	for (int i = 0; i < nb_rules - 1; i++) {
+		gchar *filter = g_strdup_printf(
+			"src host 10.1.%d.%d and tcp dst port %d",
+			i / 250, i % 250 + 1, 1000 + i);
+
+		g_assert(!pg_firewall_rule_add(fw, filter, PG_WEST_SIDE, 0,
+					       &error));
+		g_free(filter);
+	}
+	g_assert(!pg_firewall_rule_add(fw, "udp", PG_WEST_SIDE, 0, &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+	return fw;
+}
+
+static void test_benchmark_acl(int argc, char **argv, int nb_rules,
+			       bool firewall)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *brick;
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
+	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	uint32_t ip_src;
+	uint32_t ip_dst;
+	uint32_t len;
+	gchar *title = g_strdup_printf("%s, %d stateless rules",
+				       firewall ? "firewall" : "acl",
+				       nb_rules);
+
+	g_assert(!pg_bench_init(&bench, title, argc, argv, &error));
+	brick = firewall ? bench_firewall_new(nb_rules) :
+		bench_acl_new(nb_rules);
+
+	bench.input_brick = brick;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = brick;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 10000000 / nb_rules;
+	bench.count_brick = NULL;
+	bench.post_burst_op = NULL;
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac1, &mac2,
+		ETHER_TYPE_IPv4);
+	bench.brick_full_burst = 1;
+	len = sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr) + 1400;
+	inet_pton(AF_INET, "10.0.0.1", (void *) &ip_src);
+	inet_pton(AF_INET, "10.0.0.2", (void *) &ip_dst);
+	pg_packets_append_ipv4(
+		bench.pkts,
+		bench.pkts_mask,
+		ip_src, ip_dst, len, 17);
+	bench.pkts = pg_packets_append_udp(
+		bench.pkts,
+		bench.pkts_mask,
+		1000, 2000, 1400);
+	bench.pkts = pg_packets_append_blank(bench.pkts, bench.pkts_mask, 1400);
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	pg_bench_print(&stats);
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	pg_brick_destroy(brick);
+	g_free(title);
+}
+
+int main(int argc, char **argv)
+{
+	static const int nb_rules[] = {10, 100, 1000};
+	int r;
+
+	g_test_init(&argc, &argv, NULL);
+	g_assert(pg_start(argc, argv) >= 0);
+	for (unsigned i = 0; i < G_N_ELEMENTS(nb_rules); i++) {
+		test_benchmark_acl(argc, argv, nb_rules[i], false);
+		test_benchmark_acl(argc, argv, nb_rules[i], true);
+	}
+	r = g_test_run();
+	pg_stop();
+	return r;
+}
@@ -0,0 +1,2 @@
+#!/bin/sh
+sudo ./bench-acl -c1 -n1 --socket-mem 64 --no-shconf -- $@
@@ -0,0 +1,2 @@
+#!/bin/sh
+sudo ./tests-acl -c1 -n1 --socket-mem 64 --no-shconf
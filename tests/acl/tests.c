@@ -0,0 +1,334 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Packetgraph.
+ *
+ * Packetgraph is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Packetgraph is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <rte_config.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+
+#include <packetgraph/packetgraph.h>
+#include <packetgraph/acl.h>
+#include "utils/tests.h"
+#include "utils/bitmask.h"
+#include "utils/mempool.h"
+#include "brick-int.h"
+#include "collect.h"
+#include "packets.h"
+#include "utils/network.h"
+
+static struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+
+/* set packet i of the burst to a UDP packet */
+static void acl_udp(struct rte_mbuf **pkts, int i, const char *src,
+		    const char *dst, uint16_t src_port, uint16_t dst_port)
+{
+	uint64_t mask = ONE64 << i;
+	uint8_t src_ip[16];
+	uint8_t dst_ip[16];
+
+	if (strchr(src, ':')) {
+		pg_packets_append_ether(pkts, mask, &mac, &mac,
+					ETHER_TYPE_IPv6);
+		g_assert(inet_pton(AF_INET6, src, src_ip) == 1);
+		g_assert(inet_pton(AF_INET6, dst, dst_ip) == 1);
+		pg_packets_append_ipv6(pkts, mask, src_ip, dst_ip,
+				       sizeof(struct udp_hdr), 17);
+	} else {
+		uint32_t src_ip4, dst_ip4;
+
+		pg_packets_append_ether(pkts, mask, &mac, &mac,
+					ETHER_TYPE_IPv4);
+		g_assert(inet_pton(AF_INET, src, &src_ip4) == 1);
+		g_assert(inet_pton(AF_INET, dst, &dst_ip4) == 1);
+		pg_packets_append_ipv4(pkts, mask, src_ip4, dst_ip4,
+				       sizeof(struct ipv4_hdr) +
+				       sizeof(struct udp_hdr), 17);
+	}
+	pg_packets_append_udp(pkts, mask, src_port, dst_port,
+			      sizeof(struct udp_hdr));
+}
+
+static void acl_rule(struct pg_acl_rule *rule, const char *src,
+		     uint8_t src_prefix_len, uint16_t dst_port_min,
+		     uint16_t dst_port_max, enum pg_acl_action action)
+{
+	memset(rule, 0, sizeof(*rule));
+	rule->family = strchr(src, ':') ? AF_INET6 : AF_INET;
+	g_assert(inet_pton(rule->family, src, rule->src) == 1);
+	rule->proto = 17;
+	rule->src_prefix_len = src_prefix_len;
+	rule->src_port_max = UINT16_MAX;
+	rule->dst_port_min = dst_port_min;
+	rule->dst_port_max = dst_port_max;
+	rule->action = action;
+}
+
+/* burst pkts_mask from a side and return the mask of passed packets */
+static uint64_t acl_burst(struct pg_brick *acl, struct pg_brick *col,
+			  struct rte_mbuf **pkts, uint64_t pkts_mask,
+			  enum pg_side from)
+{
+	struct pg_error *error = NULL;
+	uint64_t mask;
+
+	pg_brick_reset(col, &error);
+	g_assert(!error);
+	if (from == PG_WEST_SIDE) {
+		pg_brick_burst_to_east(acl, 0, pkts, pkts_mask, &error);
+		g_assert(!error);
+		pg_brick_west_burst_get(col, &mask, &error);
+	} else {
+		pg_brick_burst_to_west(acl, 0, pkts, pkts_mask, &error);
+		g_assert(!error);
+		pg_brick_east_burst_get(col, &mask, &error);
+	}
+	g_assert(!error);
+	return mask;
+}
+
+static void test_acl_filter(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *acl, *col;
+	struct rte_mbuf **pkts = pg_packets_create(pg_mask_firsts(7));
+	struct pg_acl_rule rule;
+	uint32_t deny_id, allow_id, allow6_id;
+
+	acl = pg_acl_new("acl", &error);
+	g_assert(!error);
+	col = pg_collect_new("col", &error);
+	g_assert(!error);
+	pg_brick_link(acl, col, &error);
+	g_assert(!error);
+
+	acl_udp(pkts, 0, "10.0.0.1", "10.0.1.1", 1000, 2000);
+	acl_udp(pkts, 1, "10.0.0.1", "10.0.1.1", 1000, 2011);
+	acl_udp(pkts, 2, "10.0.2.1", "10.0.1.1", 1000, 2000);
+	acl_udp(pkts, 3, "10.0.0.5", "10.0.1.1", 1000, 2005);
+	acl_udp(pkts, 4, "2001:db8::1", "2001:db8:1::1", 1000, 2000);
+	acl_udp(pkts, 5, "2001:db9::1", "2001:db8:1::1", 1000, 2000);
+	pg_packets_append_ether(pkts, ONE64 << 6, &mac, &mac, ETHER_TYPE_ARP);
+	pg_packets_append_blank(pkts, ONE64 << 6, 28);
+
+	/* without rules, only non-IP packets pass */
+	g_assert(acl_burst(acl, col, pkts, pg_mask_firsts(7),
+			   PG_WEST_SIDE) == ONE64 << 6);
+
+	/* the first matching rule wins */
+	acl_rule(&rule, "10.0.0.5", 32, 0, UINT16_MAX, PG_ACL_DENY);
+	g_assert(!pg_acl_rule_add(acl, &rule, PG_MAX_SIDE, &deny_id, &error));
+	acl_rule(&rule, "10.0.0.0", 24, 2000, 2010, PG_ACL_ALLOW);
+	g_assert(!pg_acl_rule_add(acl, &rule, PG_MAX_SIDE, &allow_id,
+				  &error));
+	acl_rule(&rule, "2001:db8::", 32, 2000, 2000, PG_ACL_ALLOW);
+	g_assert(!pg_acl_rule_add(acl, &rule, PG_WEST_SIDE, &allow6_id,
+				  &error));
+	g_assert(!error);
+	/* not loaded yet */
+	g_assert(acl_burst(acl, col, pkts, pg_mask_firsts(7),
+			   PG_WEST_SIDE) == ONE64 << 6);
+	g_assert(!pg_acl_reload(acl, &error));
+	g_assert(!error);
+
+	g_assert(acl_burst(acl, col, pkts, pg_mask_firsts(7),
+			   PG_WEST_SIDE) == (1 | ONE64 << 4 | ONE64 << 6));
+	g_assert(pg_acl_rule_hits(acl, deny_id) == 1);
+	g_assert(pg_acl_rule_hits(acl, allow_id) == 1);
+	g_assert(pg_acl_rule_hits(acl, allow6_id) == 1);
+	g_assert(pg_acl_rule_hits(acl, allow6_id + 1) == 0);
+
+	/* the IPv6 rule only applies to packets from the west side */
+	g_assert(acl_burst(acl, col, pkts, pg_mask_firsts(7),
+			   PG_EAST_SIDE) == (1 | ONE64 << 6));
+	g_assert(pg_acl_rule_hits(acl, allow_id) == 2);
+
+	/* counters restart with the new rules */
+	pg_acl_rule_flush(acl);
+	acl_rule(&rule, "0.0.0.0", 0, 0, UINT16_MAX, PG_ACL_ALLOW);
+	g_assert(!pg_acl_rule_add(acl, &rule, PG_MAX_SIDE, &allow_id,
+				  &error));
+	g_assert(allow_id == 0);
+	g_assert(!pg_acl_reload(acl, &error));
+	g_assert(!error);
+	g_assert(pg_acl_rule_hits(acl, allow_id) == 0);
+	g_assert(acl_burst(acl, col, pkts, pg_mask_firsts(7),
+			   PG_WEST_SIDE) == (pg_mask_firsts(4) | ONE64 << 6));
+	g_assert(pg_acl_rule_hits(acl, allow_id) == 4);
+
+	pg_brick_destroy(acl);
+	pg_brick_destroy(col);
+	pg_packets_free(pkts, pg_mask_firsts(7));
+	g_free(pkts);
+}
+
+static void test_acl_invalid_rules(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *acl;
+	struct pg_acl_rule rule;
+
+	acl = pg_acl_new("acl", &error);
+	g_assert(!error);
+
+	acl_rule(&rule, "10.0.0.0", 33, 0, UINT16_MAX, PG_ACL_ALLOW);
+	g_assert(pg_acl_rule_add(acl, &rule, PG_MAX_SIDE, NULL, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+
+	acl_rule(&rule, "10.0.0.0", 8, 2000, 1000, PG_ACL_ALLOW);
+	g_assert(pg_acl_rule_add(acl, &rule, PG_MAX_SIDE, NULL, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+
+	acl_rule(&rule, "10.0.0.0", 8, 0, UINT16_MAX, PG_ACL_ALLOW);
+	rule.family = AF_UNIX;
+	g_assert(pg_acl_rule_add(acl, &rule, PG_MAX_SIDE, NULL, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+
+	g_assert(!pg_acl_reload(acl, &error));
+	g_assert(!error);
+	pg_brick_destroy(acl);
+}
+
+struct acl_reload_thread {
+	struct pg_brick *acl;
+	struct pg_brick *col;
+	struct rte_mbuf **pkts;
+	volatile bool stop;
+};
+
+static gpointer acl_reload_thread(gpointer data)
+{
+	struct acl_reload_thread *t = data;
+
+	while (!t->stop) {
+		uint64_t mask = acl_burst(t->acl, t->col, t->pkts, 1,
+					  PG_WEST_SIDE);
+
+		/* one of the two sets is loaded, both allow the packet */
+		g_assert(mask == 1);
+	}
+	return NULL;
+}
+
+static void test_acl_reload_burst(void)
+{
+	struct pg_error *error = NULL;
+	struct acl_reload_thread t = { .stop = false };
+	struct pg_acl_rule rule;
+	GThread *thread;
+
+	t.acl = pg_acl_new("acl", &error);
+	g_assert(!error);
+	t.col = pg_collect_new("col", &error);
+	g_assert(!error);
+	pg_brick_link(t.acl, t.col, &error);
+	g_assert(!error);
+	t.pkts = pg_packets_create(1);
+	acl_udp(t.pkts, 0, "10.0.0.1", "10.0.1.1", 1000, 2000);
+	acl_rule(&rule, "10.0.0.0", 8, 0, UINT16_MAX, PG_ACL_ALLOW);
+	g_assert(!pg_acl_rule_add(t.acl, &rule, PG_MAX_SIDE, NULL, &error));
+	g_assert(!pg_acl_reload(t.acl, &error));
+
+	thread = g_thread_new("acl-burst", acl_reload_thread, &t);
+	for (int i = 0; i < 1000; i++) {
+		acl_rule(&rule, "10.0.0.1", 32, 0, UINT16_MAX, PG_ACL_ALLOW);
+		g_assert(!pg_acl_rule_add(t.acl, &rule, PG_WEST_SIDE, NULL,
+					  &error));
+		g_assert(!pg_acl_reload(t.acl, &error));
+		g_assert(!error);
+		if (i % 100 == 0)
+			pg_acl_rule_flush(t.acl);
+		g_assert(!pg_acl_rule_add(t.acl, &rule, PG_MAX_SIDE, NULL,
+					  &error));
+	}
+	t.stop = true;
+	g_thread_join(thread);
+
+	pg_brick_destroy(t.acl);
+	pg_brick_destroy(t.col);
+	pg_packets_free(t.pkts, 1);
+	g_free(t.pkts);
+}
+
+static void test_acl_malformed_ip(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *acl, *col;
+	struct rte_mbuf **pkts = pg_packets_create(pg_mask_firsts(3));
+	struct pg_acl_rule rule;
+	struct ipv4_hdr *ip;
+
+	acl = pg_acl_new("acl", &error);
+	g_assert(!error);
+	col = pg_collect_new("col", &error);
+	g_assert(!error);
+	pg_brick_link(acl, col, &error);
+	g_assert(!error);
+	acl_rule(&rule, "0.0.0.0", 0, 0, UINT16_MAX, PG_ACL_ALLOW);
+	g_assert(!pg_acl_rule_add(acl, &rule, PG_MAX_SIDE, NULL, &error));
+	g_assert(!pg_acl_reload(acl, &error));
+	g_assert(!error);
+
+	/* a valid packet, one with an IHL of 4 and a truncated IP header */
+	acl_udp(pkts, 0, "10.0.0.1", "10.0.1.1", 1000, 2000);
+	acl_udp(pkts, 1, "10.0.0.1", "10.0.1.1", 1000, 2000);
+	ip = rte_pktmbuf_mtod_offset(pkts[1], struct ipv4_hdr *,
+				     sizeof(struct ether_hdr));
+	ip->version_ihl = 0x44;
+	pg_packets_append_ether(pkts, ONE64 << 2, &mac, &mac, ETHER_TYPE_IPv4);
+	pg_packets_append_blank(pkts, ONE64 << 2, 6);
+	for (int i = 0; i < 3; i++)
+		pg_utils_reset_metadata(pkts[i]);
+
+	/* even an allow-all rule can't match unparsable IP packets */
+	g_assert(acl_burst(acl, col, pkts, pg_mask_firsts(3),
+			   PG_WEST_SIDE) == 1);
+
+	pg_brick_destroy(acl);
+	pg_brick_destroy(col);
+	pg_packets_free(pkts, pg_mask_firsts(3));
+	g_free(pkts);
+}
+
+static void test_acl(void)
+{
+	pg_test_add_func("/acl/filter", test_acl_filter);
+	pg_test_add_func("/acl/invalid_rules", test_acl_invalid_rules);
+	pg_test_add_func("/acl/reload_burst", test_acl_reload_burst);
+	pg_test_add_func("/acl/malformed_ip", test_acl_malformed_ip);
+}
+
+int main(int argc, char **argv)
+{
+	int r;
+
+	g_test_init(&argc, &argv, NULL);
+	g_assert(pg_start(argc, argv) >= 0);
+	test_acl();
+	r = g_test_run();
+	pg_stop();
+	return r;
+}
@@ -16,6 +16,7 @@
  */
 
 #include "bench.h"
+#include <string.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <rte_config.h>
@@ -82,3 +83,58 @@ void test_benchmark_antispoof(int argc, char **argv)
 	pg_packets_free(bench.pkts, bench.pkts_mask);
 	pg_brick_destroy(antispoof);
 }
+
+/* ARP packets whose sender IP is the last of nb_ips allowed IPs */
+void test_benchmark_antispoof_arp(int argc, char **argv, uint32_t nb_ips)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *antispoof;
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
+	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr mac2 = {{0xff, 0xff, 0xff, 0xff, 0xff, 0xff} };
+	uint32_t sender_ip = htobe32(IPv4(10, 0, 0, 0) + nb_ips - 1);
+	/* request from mac1 */
+	uint8_t arp[28] = {0x00, 0x01, 0x08, 0x00, 0x06, 0x04, 0x00, 0x01,
+			   0x52, 0x54, 0x00, 0x12, 0x34, 0x11};
+	gchar *title = g_strdup_printf("antispoof, ARP with %u allowed IPs",
+				       nb_ips);
+
+	memcpy(&arp[14], &sender_ip, sizeof(sender_ip));
+	g_assert(!pg_bench_init(&bench, title, argc, argv, &error));
+	antispoof = pg_antispoof_new("antispoof", PG_EAST_SIDE,
+				     &mac1, &error);
+	g_assert(!error);
+	pg_antispoof_arp_enable(antispoof);
+	for (uint32_t i = 0; i < nb_ips; i++)
+		g_assert(!pg_antispoof_arp_add(antispoof,
+					       htobe32(IPv4(10, 0, 0, 0) + i),
+					       &error));
+
+	bench.input_brick = antispoof;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = antispoof;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 10000000;
+	bench.count_brick = NULL;
+	bench.post_burst_op = NULL;
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac1, &mac2,
+		ETHER_TYPE_ARP);
+	bench.brick_full_burst = 1;
+	bench.pkts = pg_packets_append_buf(bench.pkts, bench.pkts_mask,
+					   arp, sizeof(arp));
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	pg_bench_print(&stats);
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	pg_brick_destroy(antispoof);
+	g_free(title);
+}
@@ -25,6 +25,9 @@ int main(int argc, char **argv)
 	g_test_init(&argc, &argv, NULL);
 	g_assert(pg_start(argc, argv) >= 0);
 	test_benchmark_antispoof(argc, argv);
+	test_benchmark_antispoof_arp(argc, argv, 10);
+	test_benchmark_antispoof_arp(argc, argv, 100);
+	test_benchmark_antispoof_arp(argc, argv, 10000);
 	int r = g_test_run();
 
 	pg_stop();
@@ -20,3 +20,4 @@
 #include <packetgraph/packetgraph.h>
 
 void test_benchmark_antispoof(int argc, char **argv);
+void test_benchmark_antispoof_arp(int argc, char **argv, uint32_t nb_ips);
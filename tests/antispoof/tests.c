@@ -17,9 +17,12 @@
 
 #include <glib.h>
 #include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
 #include <rte_config.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
+#include <rte_udp.h>
 #include <packetgraph/packetgraph.h>
 #include "utils/tests.h"
 #include <packetgraph/antispoof.h>
@@ -32,6 +35,7 @@
 #include "fail.h"
 #include "utils/mac.h"
 #include "utils/ip.h"
+#include "utils/network.h"
 
 static struct rte_mbuf *build_packet(const unsigned char *data, size_t len)
 {
@@ -576,6 +580,207 @@ static void test_antispoof_ndp(void)
 	pg_brick_destroy(antispoof);
 }
 
+/* more addresses than a VM usually has, added and removed in any order */
+static void test_antispoof_arp_many(void)
+{
+#	include "test-arp-request.c"
+	struct ether_addr inside_mac;
+	uint32_t inside_ip = htobe32(IPv4(192, 168, 21, 253));
+	struct pg_brick *antispoof;
+	struct pg_error *error = NULL;
+	struct rte_mbuf *packet;
+
+	pg_scan_ether_addr(&inside_mac, "00:e0:81:d5:02:91");
+	antispoof = pg_antispoof_new("antispoof", PG_EAST_SIDE,
+				     &inside_mac, &error);
+	g_assert(!error);
+	pg_antispoof_arp_enable(antispoof);
+
+	for (uint32_t i = 0; i < 1000; i++) {
+		g_assert(!pg_antispoof_arp_add(antispoof,
+					       htobe32(IPv4(10, 0, i >> 8, i)),
+					       &error));
+		if (i == 500)
+			g_assert(!pg_antispoof_arp_add(antispoof, inside_ip,
+						       &error));
+	}
+	g_assert(!error);
+	packet = build_packet(pkt1, 42);
+	g_assert(test_antispoof_filter(antispoof, packet) > 0);
+	pg_packets_free(&packet, pg_mask_firsts(1));
+
+	/* adding twice the same IP does nothing */
+	g_assert(!pg_antispoof_arp_add(antispoof, inside_ip, &error));
+	for (uint32_t i = 0; i < 1000; i += 2)
+		g_assert(!pg_antispoof_arp_del(antispoof,
+					       htobe32(IPv4(10, 0, i >> 8, i)),
+					       &error));
+	g_assert(!error);
+	packet = build_packet(pkt1, 42);
+	g_assert(test_antispoof_filter(antispoof, packet) > 0);
+	pg_packets_free(&packet, pg_mask_firsts(1));
+
+	g_assert(!pg_antispoof_arp_del(antispoof, inside_ip, &error));
+	g_assert(!error);
+	packet = build_packet(pkt1, 42);
+	g_assert(test_antispoof_filter(antispoof, packet) == 0);
+	pg_packets_free(&packet, pg_mask_firsts(1));
+
+	/* remaining IPs are still there */
+	for (uint32_t i = 1; i < 1000; i += 2)
+		g_assert(!pg_antispoof_arp_del(antispoof,
+					       htobe32(IPv4(10, 0, i >> 8, i)),
+					       &error));
+	g_assert(!error);
+	g_assert(pg_antispoof_arp_del(antispoof, htobe32(IPv4(10, 0, 0, 1)),
+				      &error) == -1);
+	g_assert(error);
+	pg_error_free(error);
+
+	pg_brick_destroy(antispoof);
+}
+
+static struct rte_mbuf *build_ip_packet(struct ether_addr *mac, int family,
+				       const char *src)
+{
+	struct rte_mbuf **pkts = pg_packets_create(pg_mask_firsts(1));
+	struct rte_mbuf *pkt = pkts[0];
+	struct ether_addr dst_mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	uint8_t ip6_src[16];
+	uint8_t ip6_dst[16];
+	uint32_t ip4_src;
+
+	if (family == AF_INET) {
+		pg_packets_append_ether(pkts, 1, mac, &dst_mac,
+					ETHER_TYPE_IPv4);
+		inet_pton(AF_INET, src, &ip4_src);
+		pg_packets_append_ipv4(pkts, 1, ip4_src, 0x0100000a,
+				       sizeof(struct ipv4_hdr) +
+				       sizeof(struct udp_hdr), 17);
+	} else {
+		pg_packets_append_ether(pkts, 1, mac, &dst_mac,
+					ETHER_TYPE_IPv6);
+		pg_ip_from_str(ip6_src, src);
+		pg_ip_from_str(ip6_dst, "2001:db8:42::1");
+		pg_packets_append_ipv6(pkts, 1, ip6_src, ip6_dst,
+				       sizeof(struct udp_hdr), 17);
+	}
+	pg_packets_append_udp(pkts, 1, 1000, 2000, 0);
+	g_free(pkts);
+	return pkt;
+}
+
+static bool antispoof_ip_pass(struct pg_brick *antispoof,
+			      struct ether_addr *mac, int family,
+			      const char *src)
+{
+	struct rte_mbuf *packet = build_ip_packet(mac, family, src);
+	bool ret = test_antispoof_filter(antispoof, packet) > 0;
+
+	pg_packets_free(&packet, pg_mask_firsts(1));
+	return ret;
+}
+
+/* an IPv4 packet with an IHL of 4, or truncated in its IP header */
+static bool antispoof_malformed_ip_pass(struct pg_brick *antispoof,
+					struct ether_addr *mac,
+					bool truncated)
+{
+	struct rte_mbuf *packet = build_ip_packet(mac, AF_INET, "10.0.0.7");
+	struct ipv4_hdr *ip = rte_pktmbuf_mtod_offset(packet, struct ipv4_hdr *,
+						      sizeof(struct ether_hdr));
+	bool ret;
+
+	if (truncated)
+		rte_pktmbuf_trim(packet, rte_pktmbuf_pkt_len(packet) -
+				 sizeof(struct ether_hdr) - 6);
+	else
+		ip->version_ihl = 0x44;
+	pg_utils_reset_metadata(packet);
+	ret = test_antispoof_filter(antispoof, packet) > 0;
+	pg_packets_free(&packet, pg_mask_firsts(1));
+	return ret;
+}
+
+static void test_antispoof_ip(void)
+{
+	struct ether_addr inside_mac;
+	struct pg_brick *antispoof;
+	struct pg_error *error = NULL;
+	uint8_t ip6[16];
+
+	pg_scan_ether_addr(&inside_mac, "52:54:00:12:34:02");
+	antispoof = pg_antispoof_new("antispoof", PG_EAST_SIDE,
+				     &inside_mac, &error);
+	g_assert(!error);
+
+	/* disabled by default */
+	g_assert(antispoof_ip_pass(antispoof, &inside_mac, AF_INET,
+				   "10.0.0.7"));
+
+	pg_antispoof_ip_enable(antispoof);
+	g_assert(!pg_antispoof_ipv4_add(antispoof, htobe32(IPv4(10, 0, 0, 0)),
+					24, &error));
+	g_assert(!pg_antispoof_ipv4_add(antispoof,
+					htobe32(IPv4(192, 168, 1, 5)), 32,
+					&error));
+	pg_ip_from_str(ip6, "2001:db8::");
+	g_assert(!pg_antispoof_ipv6_add(antispoof, ip6, 64, &error));
+	g_assert(!error);
+
+	g_assert(antispoof_ip_pass(antispoof, &inside_mac, AF_INET,
+				   "10.0.0.7"));
+	g_assert(!antispoof_ip_pass(antispoof, &inside_mac, AF_INET,
+				    "10.0.1.7"));
+	g_assert(antispoof_ip_pass(antispoof, &inside_mac, AF_INET,
+				   "192.168.1.5"));
+	g_assert(!antispoof_ip_pass(antispoof, &inside_mac, AF_INET,
+				    "192.168.1.6"));
+	g_assert(antispoof_ip_pass(antispoof, &inside_mac, AF_INET6,
+				   "2001:db8::1"));
+	g_assert(!antispoof_ip_pass(antispoof, &inside_mac, AF_INET6,
+				    "2001:db8:1::1"));
+
+	/* IP packets which can't be parsed can't be validated */
+	g_assert(!antispoof_malformed_ip_pass(antispoof, &inside_mac, false));
+	g_assert(!antispoof_malformed_ip_pass(antispoof, &inside_mac, true));
+
+	/* remove a prefix */
+	g_assert(!pg_antispoof_ipv4_del(antispoof, htobe32(IPv4(10, 0, 0, 0)),
+					24, &error));
+	g_assert(!error);
+	g_assert(!antispoof_ip_pass(antispoof, &inside_mac, AF_INET,
+				    "10.0.0.7"));
+	g_assert(pg_antispoof_ipv4_del(antispoof, htobe32(IPv4(10, 0, 0, 0)),
+				       24, &error) == -1);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+	g_assert(pg_antispoof_ipv4_del(antispoof, htobe32(IPv4(10, 0, 0, 0)),
+				       16, &error) == -1);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+	g_assert(pg_antispoof_ipv4_add(antispoof, 0, 33, &error) == -1);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+
+	/* remove all prefixes */
+	pg_antispoof_ip_del_all(antispoof);
+	g_assert(!antispoof_ip_pass(antispoof, &inside_mac, AF_INET,
+				    "192.168.1.5"));
+	g_assert(!antispoof_ip_pass(antispoof, &inside_mac, AF_INET6,
+				    "2001:db8::1"));
+
+	pg_antispoof_ip_disable(antispoof);
+	g_assert(antispoof_ip_pass(antispoof, &inside_mac, AF_INET,
+				   "192.168.1.5"));
+	g_assert(antispoof_malformed_ip_pass(antispoof, &inside_mac, false));
+
+	pg_brick_destroy(antispoof);
+}
+
 int main(int argc, char **argv)
 {
 	/* tests in the same order as the header function declarations */
@@ -596,10 +801,14 @@ int main(int argc, char **argv)
 			test_antispoof_arp_gratuitous);
 	pg_test_add_func("/antispoof/arp/disable",
 			test_pg_antispoof_arp_disable);
+	pg_test_add_func("/antispoof/arp/many",
+			test_antispoof_arp_many);
 	pg_test_add_func("/antispoof/mac/burst_not_propagate",
 			test_antispoof_empty_burst);
 	pg_test_add_func("/antispoof/ndp",
 			test_antispoof_ndp);
+	pg_test_add_func("/antispoof/ip",
+			test_antispoof_ip);
 	int r = g_test_run();
 
 	pg_stop();
@@ -0,0 +1,80 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Packetgraph.
+ *
+ * Packetgraph is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Packetgraph is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <rte_config.h>
+#include <rte_cycles.h>
+#include "utils/mac-table.h"
+
+static inline union pg_mac bench_mac(uint32_t i)
+{
+	union pg_mac mac;
+
+	/* spread addresses the way a real network would (same OUI) */
+	mac.mac = 0;
+	mac.bytes[0] = 0x52;
+	mac.bytes[1] = 0x54;
+	mac.bytes[2] = 0x00;
+	mac.bytes[3] = i >> 16;
+	mac.bytes[4] = i >> 8;
+	mac.bytes[5] = i;
+	return mac;
+}
+
+static void bench_mac_table_size(uint32_t nb)
+{
+	struct pg_mac_table table;
+	uint64_t start, insert, lookup, iterate;
+	uint64_t sum = 0;
+
+	g_assert(!pg_mac_table_init(&table));
+
+	start = rte_rdtsc();
+	for (uint32_t i = 0; i < nb; ++i)
+		g_assert(!pg_mac_table_ptr_set(&table, bench_mac(i),
+					       (void *)(uintptr_t)(i + 1)));
+	insert = rte_rdtsc() - start;
+	g_assert(pg_mac_table_count(&table) == nb);
+
+	start = rte_rdtsc();
+	for (uint32_t i = 0; i < nb; ++i)
+		sum += (uintptr_t)pg_mac_table_ptr_get(&table, bench_mac(i));
+	lookup = rte_rdtsc() - start;
+	g_assert(sum == (uint64_t)nb * (nb + 1) / 2);
+
+	sum = 0;
+	start = rte_rdtsc();
+	PG_MAC_TABLE_FOREACH_PTR(&table, key, void, ptr) {
+		g_assert(key.mac);
+		sum += (uintptr_t)ptr;
+	}
+	iterate = rte_rdtsc() - start;
+	g_assert(sum == (uint64_t)nb * (nb + 1) / 2);
+
+	printf("[mac-table] %8u entries: insert %6.1f, lookup %6.1f, iterate %6.1f cycles/entry\n",
+	       nb, (double)insert / nb, (double)lookup / nb,
+	       (double)iterate / nb);
+	pg_mac_table_free(&table);
+}
+
+void test_benchmark_mac_table(int argc, char **argv)
+{
+	bench_mac_table_size(1000);
+	bench_mac_table_size(100000);
+	bench_mac_table_size(1000000);
+}
@@ -26,6 +26,7 @@ int main(int argc, char **argv)
 	g_assert(pg_start(argc, argv) >= 0);
 	test_benchmark_nop(argc, argv);
 	test_benchmark_hub(argc, argv);
+	test_benchmark_mac_table(argc, argv);
 	int r = g_test_run();
 
 	pg_stop();
@@ -20,3 +20,4 @@
 
 void test_benchmark_nop(int argc, char **argv);
 void test_benchmark_hub(int argc, char **argv);
+void test_benchmark_mac_table(int argc, char **argv);
@@ -17,6 +17,8 @@
 
 #include <glib.h>
 #include <glib/gprintf.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <rte_config.h>
 #include <rte_ether.h>
@@ -689,6 +691,59 @@ static void test_graph_complex_merge(void)
 	pg_graph_destroy(g_west);
 }
 
+static void test_graph_profile(void)
+{
+	struct pg_graph *g;
+	struct pg_error *error = NULL;
+	struct pg_brick *nop_1, *nop_2;
+	struct rte_mbuf **pkts;
+	uint64_t mask = pg_mask_firsts(32);
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *fd;
+	int ret;
+
+	nop_1 = pg_nop_new("nop1", &error);
+	g_assert(!error);
+	nop_2 = pg_nop_new("nop2", &error);
+	g_assert(!error);
+	g_assert(!pg_brick_link(nop_1, nop_2, &error));
+	g = pg_graph_new("graph", nop_1, &error);
+	g_assert(g && !error);
+
+	pkts = pg_packets_create(mask);
+	for (int i = 0; i < 10; i++) {
+		pg_brick_burst_to_east(nop_1, 0, pkts, mask, &error);
+		g_assert(!error);
+	}
+
+	fd = open_memstream(&buf, &size);
+	g_assert(fd);
+	ret = pg_graph_profile_dump(g, fd, &error);
+	fclose(fd);
+#ifdef PG_BRICK_PROFILING
+	g_assert(ret == 0 && !error);
+	g_assert(strstr(buf, "nop1") && strstr(buf, "nop2"));
+	g_assert(nop_1->profile.calls == 10);
+	g_assert(nop_1->profile.pkts == 10 * 32);
+	g_assert(nop_2->profile.calls == 10);
+	/* nop1 total time includes nop2 */
+	g_assert(nop_1->profile.cycles >= nop_1->profile.self_cycles +
+		 nop_2->profile.cycles);
+	pg_graph_profile_reset(g);
+	g_assert(nop_1->profile.calls == 0);
+#else
+	g_assert(ret < 0 && error);
+	pg_error_free(error);
+	error = NULL;
+#endif
+	free(buf);
+
+	pg_packets_free(pkts, mask);
+	g_free(pkts);
+	pg_graph_destroy(g);
+}
+
 void test_graph(void)
 {
 	pg_test_add_func("/core/graph/lifecycle", test_graph_lifecycle);
@@ -697,4 +752,5 @@ void test_graph(void)
 	pg_test_add_func("/core/graph/poll", test_graph_poll);
 	pg_test_add_func("/core/graph/complex-merge", test_graph_complex_merge);
 	pg_test_add_func("/core/graph/split-merge", test_graph_split_merge);
+	pg_test_add_func("/core/graph/profile", test_graph_profile);
 }
@@ -0,0 +1,198 @@
+/* Copyright 2017 Outscale SAS
+ *
+ * This file is part of Packetgraph.
+ *
+ * Packetgraph is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Packetgraph is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#include "utils/bitmask.h"
+#include "utils/network.h"
+#include "utils/tests.h"
+#include "packets.h"
+#include "tests.h"
+
+static struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+static struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+
+static void test_network_parse_ipv4(void)
+{
+	struct rte_mbuf **pkts = pg_packets_create(pg_mask_firsts(1));
+	struct ipv4_hdr *ip;
+	uint32_t hash;
+
+	pg_packets_append_ether(pkts, 1, &mac1, &mac2, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, 1, 0x01010101, 0x02020202,
+			       sizeof(struct ipv4_hdr) +
+			       sizeof(struct udp_hdr) + 10, 17);
+	pg_packets_append_udp(pkts, 1, 1000, 2000, 10);
+	pg_packets_append_blank(pkts, 1, 10);
+
+	pg_utils_parse(pkts[0]);
+	g_assert(pkts[0]->packet_type == (RTE_PTYPE_L2_ETHER |
+					  RTE_PTYPE_L3_IPV4 |
+					  RTE_PTYPE_L4_UDP));
+	g_assert(pkts[0]->l2_len == sizeof(struct ether_hdr));
+	g_assert(pkts[0]->l3_len == sizeof(struct ipv4_hdr));
+	g_assert(pkts[0]->l4_len == sizeof(struct udp_hdr));
+
+	/* flow hash is cached and forgotten with the metadata */
+	hash = pg_utils_flow_hash(pkts[0]);
+	g_assert(pkts[0]->ol_flags & PKT_RX_RSS_HASH);
+	g_assert(pg_utils_flow_hash(pkts[0]) == hash);
+	((struct udp_hdr *)pg_utils_get_l4(pkts[0]))->src_port = 42;
+	pg_utils_reset_metadata(pkts[0]);
+	g_assert(pg_utils_flow_hash(pkts[0]) != hash);
+
+	/* non first fragments have no L4 header */
+	ip = pg_utils_get_l3(pkts[0]);
+	ip->fragment_offset = rte_cpu_to_be_16(8);
+	pg_utils_reset_metadata(pkts[0]);
+	pg_utils_parse(pkts[0]);
+	g_assert((pkts[0]->packet_type & RTE_PTYPE_L4_MASK) ==
+		 RTE_PTYPE_L4_FRAG);
+	g_assert(pkts[0]->l4_len == 0);
+
+	pg_packets_free(pkts, 1);
+	g_free(pkts);
+}
+
+static void test_network_parse_ipv6(void)
+{
+	struct rte_mbuf **pkts = pg_packets_create(pg_mask_firsts(1));
+	uint8_t ip1[16] = {0x20, 0x01, [15] = 1};
+	uint8_t ip2[16] = {0x20, 0x01, [15] = 2};
+	struct vlan_802_1q vlan = {.ether_type = PG_BE_ETHER_TYPE_IPv6};
+	/* hop-by-hop header with padding, followed by UDP */
+	uint8_t hbh[8] = {17, 0, 1, 4, 0, 0, 0, 0};
+
+	pg_packets_append_ether(pkts, 1, &mac1, &mac2, ETHER_TYPE_VLAN);
+	pg_packets_append_buf(pkts, 1, &vlan, sizeof(vlan));
+	pg_packets_append_ipv6(pkts, 1, ip1, ip2,
+			       sizeof(hbh) + sizeof(struct udp_hdr), 0);
+	pg_packets_append_buf(pkts, 1, hbh, sizeof(hbh));
+	pg_packets_append_udp(pkts, 1, 1000, 2000, 0);
+
+	pg_utils_parse(pkts[0]);
+	g_assert(pkts[0]->packet_type == (RTE_PTYPE_L2_ETHER_VLAN |
+					  RTE_PTYPE_L3_IPV6_EXT |
+					  RTE_PTYPE_L4_UDP));
+	g_assert(pkts[0]->l2_len == sizeof(struct ether_hdr) +
+		 sizeof(struct vlan_802_1q));
+	g_assert(pkts[0]->l3_len == sizeof(struct ipv6_hdr) + sizeof(hbh));
+	g_assert(pkts[0]->l4_len == sizeof(struct udp_hdr));
+	g_assert(pg_utils_get_ether_type(pkts[0]) == PG_BE_ETHER_TYPE_IPv6);
+
+	/* truncated extension header: no L4 */
+	rte_pktmbuf_trim(pkts[0], sizeof(struct udp_hdr) + 4);
+	pg_utils_reset_metadata(pkts[0]);
+	pg_utils_parse(pkts[0]);
+	g_assert(RTE_ETH_IS_IPV6_HDR(pkts[0]->packet_type));
+	g_assert((pkts[0]->packet_type & RTE_PTYPE_L4_MASK) == 0);
+
+	pg_packets_free(pkts, 1);
+	g_free(pkts);
+}
+
+static void test_network_parse_bad_ihl(void)
+{
+	struct rte_mbuf **pkts = pg_packets_create(pg_mask_firsts(1));
+	struct ipv4_hdr *ip;
+
+	pg_packets_append_ether(pkts, 1, &mac1, &mac2, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, 1, 0x01010101, 0x02020202,
+			       sizeof(struct ipv4_hdr) +
+			       sizeof(struct udp_hdr), 17);
+	pg_packets_append_udp(pkts, 1, 1000, 2000, 0);
+	ip = pg_utils_get_l3(pkts[0]);
+
+	/* IHL below 5 */
+	ip->version_ihl = 0x44;
+	pg_utils_reset_metadata(pkts[0]);
+	pg_utils_parse(pkts[0]);
+	g_assert(pkts[0]->packet_type == RTE_PTYPE_L2_ETHER);
+	g_assert(pkts[0]->l3_len == 0);
+	pkts[0]->packet_type = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4 |
+		RTE_PTYPE_L4_UDP;
+	pg_utils_guess_metadata(pkts[0]);
+	g_assert(pkts[0]->packet_type == RTE_PTYPE_L2_ETHER);
+
+	/* IHL past the end of the data */
+	ip->version_ihl = 0x4f;
+	pg_utils_reset_metadata(pkts[0]);
+	pg_utils_parse(pkts[0]);
+	g_assert(pkts[0]->packet_type == RTE_PTYPE_L2_ETHER);
+	g_assert(pkts[0]->l4_len == 0);
+
+	pg_packets_free(pkts, 1);
+	g_free(pkts);
+}
+
+static void test_network_parse_hw(void)
+{
+	struct rte_mbuf **pkts = pg_packets_create(pg_mask_firsts(1));
+
+	pg_packets_append_ether(pkts, 1, &mac1, &mac2, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, 1, 0x01010101, 0x02020202,
+			       sizeof(struct ipv4_hdr) +
+			       sizeof(struct udp_hdr), 17);
+	pg_packets_append_udp(pkts, 1, 1000, 2000, 0);
+
+	/* the NIC gives no L4 type */
+	pkts[0]->packet_type = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4;
+	pg_utils_guess_metadata(pkts[0]);
+	g_assert(pkts[0]->packet_type == (RTE_PTYPE_L2_ETHER |
+					  RTE_PTYPE_L3_IPV4 |
+					  RTE_PTYPE_L4_UDP));
+	g_assert(pkts[0]->l3_len == sizeof(struct ipv4_hdr));
+	g_assert(pkts[0]->l4_len == sizeof(struct udp_hdr));
+
+	/* the NIC gives a L4 type */
+	pkts[0]->packet_type = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4 |
+		RTE_PTYPE_L4_UDP;
+	pkts[0]->l3_len = 0;
+	pg_utils_guess_metadata(pkts[0]);
+	g_assert(pkts[0]->l3_len == sizeof(struct ipv4_hdr));
+	g_assert(pkts[0]->l4_len == sizeof(struct udp_hdr));
+
+	pg_packets_free(pkts, 1);
+	g_free(pkts);
+}
+
+static void test_network_parse_arp(void)
+{
+	struct rte_mbuf **pkts = pg_packets_create(pg_mask_firsts(1));
+
+	pg_packets_append_ether(pkts, 1, &mac1, &mac2, ETHER_TYPE_ARP);
+	pg_packets_append_blank(pkts, 1, 28);
+	pg_utils_parse(pkts[0]);
+	g_assert(pkts[0]->packet_type == RTE_PTYPE_L2_ETHER);
+	g_assert(pkts[0]->l2_len == sizeof(struct ether_hdr));
+	g_assert(pkts[0]->l3_len == 0);
+
+	pg_packets_free(pkts, 1);
+	g_free(pkts);
+}
+
+void test_network(void)
+{
+	pg_test_add_func("/core/network/parse/ipv4", test_network_parse_ipv4);
+	pg_test_add_func("/core/network/parse/ipv6", test_network_parse_ipv6);
+	pg_test_add_func("/core/network/parse/bad_ihl",
+			 test_network_parse_bad_ihl);
+	pg_test_add_func("/core/network/parse/hw", test_network_parse_hw);
+	pg_test_add_func("/core/network/parse/arp", test_network_parse_arp);
+}
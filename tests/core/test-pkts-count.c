@@ -156,6 +156,47 @@ static void test_brick_pkts_count_east(void)
 	TEST_PKTS_COUNT_DESTROY();
 }
 
+static void test_brick_stats(void)
+{
+	TEST_PKTS_COUNT_INIT();
+	struct pg_brick_stats stats;
+	int j;
+
+	for (i = 0; i < NB_PKTS; i++)
+		g_assert(rte_pktmbuf_append(pkts[i], 100));
+
+	for (j = 1; j <= NB_LOOP; ++j) {
+		pg_brick_burst_to_east(brick, 0, pkts,
+				       pg_mask_firsts(NB_PKTS), &error);
+		g_assert(!error);
+
+		g_assert(!pg_brick_stats_get(brick, PG_WEST_SIDE, -1,
+					     &stats, &error));
+		g_assert(stats.pkts_in == (uint64_t)j * NB_PKTS);
+		g_assert(stats.bytes_in == (uint64_t)j * NB_PKTS * 100);
+		g_assert(stats.bursts_in == (uint64_t)j);
+		g_assert(stats.pkts_out == 0);
+
+		g_assert(!pg_brick_stats_get(brick, PG_EAST_SIDE, 0,
+					     &stats, &error));
+		g_assert(stats.pkts_in == 0);
+		g_assert(stats.pkts_out == (uint64_t)j * NB_PKTS);
+		g_assert(stats.bytes_out == (uint64_t)j * NB_PKTS * 100);
+		g_assert(stats.bursts_out == (uint64_t)j);
+
+		g_assert(!pg_brick_stats_get(collect_east, PG_WEST_SIDE, 0,
+					     &stats, &error));
+		g_assert(stats.pkts_in == (uint64_t)j * NB_PKTS);
+		g_assert(stats.drops[PG_DROP_FILTERED] == 0);
+	}
+	g_assert(pg_brick_stats_get(brick, PG_EAST_SIDE, 1,
+				    &stats, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+	TEST_PKTS_COUNT_DESTROY();
+}
+
 #undef	TEST_PKTS_COUNT_CHECK
 #undef	TEST_PKTS_COUNT_INIT
 #undef	TEST_PKTS_COUNT_DESTROY
@@ -165,4 +206,5 @@ void test_pkts_count(void)
 	/* tests in the same order as the header function declarations */
 	pg_test_add_func("/core/pkts-counter/west", test_brick_pkts_count_west);
 	pg_test_add_func("/core/pkts-counter/east", test_brick_pkts_count_east);
+	pg_test_add_func("/core/pkts-counter/stats", test_brick_stats);
 }
@@ -80,6 +80,7 @@ int main(int argc, char **argv)
 	test_brick_dot();
 	test_hub();
 	test_graph();
+	test_network();
 
 	return g_test_run();
 }
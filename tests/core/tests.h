@@ -32,6 +32,7 @@ void test_pkts_count(void);
 void test_benchmark_nop(void);
 void test_hub(void);
 void test_graph(void);
+void test_network(void);
 
 extern uint16_t  max_pkts;
 
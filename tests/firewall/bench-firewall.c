@@ -18,11 +18,14 @@
 #include "bench.h"
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <inttypes.h>
+#include <string.h>
 #include <rte_config.h>
 #include <rte_common.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
 #include <rte_udp.h>
+#include <rte_cycles.h>
 #include <packetgraph/packetgraph.h>
 #include "utils/tests.h"
 #include <packetgraph/firewall.h>
@@ -31,6 +34,399 @@
 #include "utils/bench.h"
 #include "utils/mempool.h"
 #include "utils/bitmask.h"
+#include "utils/network.h"
+
+/* number of concurrent UDP flows, a multiple of 64 */
+#define BENCH_FLOWS 16384
+
+static uint16_t flows_port;
+
+static void next_flows(struct pg_bench *bench)
+{
+	flows_port = (flows_port + 64) % BENCH_FLOWS;
+	for (int i = 0; i < 64; i++) {
+		struct udp_hdr *udp = (struct udp_hdr *)
+			(rte_pktmbuf_mtod(bench->pkts[i], uint8_t *) +
+			 sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr));
+
+		udp->src_port = rte_cpu_to_be_16(1024 + flows_port + i);
+		pg_utils_reset_metadata(bench->pkts[i]);
+	}
+}
+
+static void bench_firewall_flows(int argc, char **argv, uint64_t flags)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fw;
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
+	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	uint32_t ip_src;
+	uint32_t ip_dst;
+	uint32_t len;
+	uint64_t hits, misses;
+	const char *name = flags & PG_NO_FLOW_CACHE ?
+		"firewall-udp-flows-no-cache" : "firewall-udp-flows";
+
+	g_assert(!pg_bench_init(&bench, name, argc, argv, &error));
+	fw = pg_firewall_new(name, flags, &error);
+	g_assert(!error);
+	g_assert(!pg_firewall_rule_add(fw, "udp", PG_WEST_SIDE, 1, &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+
+	bench.input_brick = fw;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = fw;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 1000000;
+	bench.count_brick = NULL;
+	bench.post_burst_op = next_flows;
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac1, &mac2,
+		ETHER_TYPE_IPv4);
+	bench.brick_full_burst = 1;
+	len = sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr) + 1400;
+	inet_pton(AF_INET, "10.0.0.1", (void *) &ip_src);
+	inet_pton(AF_INET, "10.0.0.2", (void *) &ip_dst);
+	pg_packets_append_ipv4(
+		bench.pkts,
+		bench.pkts_mask,
+		ip_src, ip_dst, len, 17);
+	bench.pkts = pg_packets_append_udp(
+		bench.pkts,
+		bench.pkts_mask,
+		1000, 2000, 1400);
+	bench.pkts = pg_packets_append_blank(bench.pkts, bench.pkts_mask, 1400);
+	flows_port = BENCH_FLOWS - 64;
+	next_flows(&bench);
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	pg_bench_print(&stats);
+	pg_firewall_flow_cache_stats(fw, &hits, &misses);
+	printf("flow cache hits: %"PRIu64", misses: %"PRIu64"\n",
+	       hits, misses);
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	pg_brick_destroy(fw);
+}
+
+void test_benchmark_firewall_flows(int argc, char **argv)
+{
+	bench_firewall_flows(argc, argv, PG_NONE);
+	bench_firewall_flows(argc, argv, PG_NO_FLOW_CACHE);
+}
+
+/* security group size and bursts between two rule changes */
+#define BENCH_CHURN_RULES 1000
+#define BENCH_CHURN_PERIOD 1000
+
+static struct {
+	struct pg_brick *fw;
+	bool reload;
+	uint64_t bursts;
+	uint64_t id;
+	uint64_t last;
+	uint64_t max;
+} churn;
+
+/* change one rule now and then, and track the longest burst */
+static void churn_rules(struct pg_bench *bench)
+{
+	struct pg_error *error = NULL;
+	uint64_t now;
+
+	if (++churn.bursts % BENCH_CHURN_PERIOD == 0) {
+		if (churn.reload) {
+			g_assert(!pg_firewall_reload(churn.fw, &error));
+		} else if (churn.id) {
+			g_assert(!pg_firewall_rule_remove(churn.fw, churn.id,
+							  &error));
+			churn.id = 0;
+		} else {
+			g_assert(!pg_firewall_rule_insert(churn.fw,
+							  "udp dst port 4242",
+							  PG_WEST_SIDE, 0,
+							  &churn.id, &error));
+		}
+	}
+	now = rte_rdtsc();
+	if (churn.last && now - churn.last > churn.max)
+		churn.max = now - churn.last;
+	churn.last = now;
+}
+
+static void bench_firewall_churn(int argc, char **argv, bool reload)
+{
+	struct pg_error *error = NULL;
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
+	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	uint32_t ip_src;
+	uint32_t ip_dst;
+	uint32_t len;
+
+	g_assert(!pg_bench_init(&bench, reload ? "firewall-churn-reload" :
+				"firewall-churn-insert", argc, argv, &error));
+	memset(&churn, 0, sizeof(churn));
+	churn.reload = reload;
+	churn.fw = pg_firewall_new("firewall", 0, &error);
+	g_assert(churn.fw);
+	for (int i = 0; i < BENCH_CHURN_RULES; i++) {
+		gchar *filter = g_strdup_printf(
+			"src host 10.1.%d.%d and tcp dst port %d",
+			i / 250, i % 250 + 1, 1000 + i);
+
+		g_assert(!pg_firewall_rule_add(churn.fw, filter,
+					       PG_WEST_SIDE, 0, &error));
+		g_free(filter);
+	}
+	g_assert(!pg_firewall_rule_add(churn.fw, "udp", PG_WEST_SIDE, 1,
+				       &error));
+	g_assert(!pg_firewall_reload(churn.fw, &error));
+
+	bench.input_brick = churn.fw;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = churn.fw;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 100000;
+	bench.count_brick = NULL;
+	bench.post_burst_op = churn_rules;
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac1, &mac2,
+		ETHER_TYPE_IPv4);
+	bench.brick_full_burst = 1;
+	len = sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr) + 1400;
+	inet_pton(AF_INET, "10.0.0.1", (void *) &ip_src);
+	inet_pton(AF_INET, "10.0.0.2", (void *) &ip_dst);
+	pg_packets_append_ipv4(
+		bench.pkts,
+		bench.pkts_mask,
+		ip_src, ip_dst, len, 17);
+	bench.pkts = pg_packets_append_udp(
+		bench.pkts,
+		bench.pkts_mask,
+		1000, 2000, 1400);
+	bench.pkts = pg_packets_append_blank(bench.pkts, bench.pkts_mask, 1400);
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	pg_bench_print(&stats);
+	printf("longest burst: %.1f us\n",
+	       churn.max * 1000000.0 / rte_get_tsc_hz());
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	pg_brick_destroy(churn.fw);
+}
+
+void test_benchmark_firewall_churn(int argc, char **argv)
+{
+	bench_firewall_churn(argc, argv, true);
+	bench_firewall_churn(argc, argv, false);
+}
+
+/* maximum number of threads bursting a shared firewall */
+/*
+ * Every packet misses all rules but the last stateless one, so each one
+ * costs a full ruleset evaluation, as the first packet of a connection.
+ */
+static void bench_firewall_rules(int argc, char **argv, int nb_rules,
+				 uint64_t flags)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fw;
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
+	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	uint32_t ip_src;
+	uint32_t ip_dst;
+	uint32_t len;
+	gchar *name = g_strdup_printf("firewall-rules-%d%s", nb_rules,
+				      flags & PG_NO_JIT ? "-no-jit" : "");
+
+	g_assert(!pg_bench_init(&bench, name, argc, argv, &error));
+	fw = pg_firewall_new(name, PG_NO_FLOW_CACHE | flags, &error);
+	g_assert(!error);
+	for (int i = 0; i < nb_rules - 1; i++) {
+		gchar *filter = g_strdup_printf(
+			"src host 10.1.%d.%d and tcp dst port %d",
+			i / 250, i % 250 + 1, 1000 + i);
+
+		g_assert(!pg_firewall_rule_add(fw, filter, PG_WEST_SIDE, 0,
+					       &error));
+		g_free(filter);
+	}
+	g_assert(!pg_firewall_rule_add(fw, "udp", PG_WEST_SIDE, 0, &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+
+	bench.input_brick = fw;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = fw;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 10000000 / nb_rules;
+	bench.count_brick = NULL;
+	bench.post_burst_op = NULL;
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac1, &mac2,
+		ETHER_TYPE_IPv4);
+	bench.brick_full_burst = 1;
+	len = sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr) + 1400;
+	inet_pton(AF_INET, "10.0.0.1", (void *) &ip_src);
+	inet_pton(AF_INET, "10.0.0.2", (void *) &ip_dst);
+	pg_packets_append_ipv4(
+		bench.pkts,
+		bench.pkts_mask,
+		ip_src, ip_dst, len, 17);
+	bench.pkts = pg_packets_append_udp(
+		bench.pkts,
+		bench.pkts_mask,
+		1000, 2000, 1400);
+	bench.pkts = pg_packets_append_blank(bench.pkts, bench.pkts_mask, 1400);
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	pg_bench_print(&stats);
+	printf("%d rules: %.1f ns per packet\n", nb_rules,
+	       stats.duration_s * 1e9 / stats.pkts_received);
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	pg_brick_destroy(fw);
+	g_free(name);
+}
+
+void test_benchmark_firewall_rules(int argc, char **argv)
+{
+	static const int nb_rules[] = {10, 100, 1000};
+
+	for (unsigned i = 0; i < G_N_ELEMENTS(nb_rules); i++) {
+		bench_firewall_rules(argc, argv, nb_rules[i], PG_NONE);
+		bench_firewall_rules(argc, argv, nb_rules[i], PG_NO_JIT);
+	}
+}
+
+#define BENCH_SHARED_MAX 8
+
+struct bench_shared {
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
+};
+
+static gpointer bench_shared_run(gpointer data)
+{
+	struct bench_shared *b = data;
+	struct pg_error *error = NULL;
+
+	g_assert(pg_bench_run(&b->bench, &b->stats, &error) == 0);
+	return NULL;
+}
+
+static void bench_firewall_shared(int argc, char **argv, uint16_t nb)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fws[BENCH_SHARED_MAX];
+	struct bench_shared b[BENCH_SHARED_MAX];
+	GThread *threads[BENCH_SHARED_MAX];
+	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	uint32_t ip_src;
+	uint32_t ip_dst;
+	uint32_t len;
+	double mpps = 0;
+	gchar *name = g_strdup_printf("firewall-shared-%u-threads", nb);
+
+	/* every packet goes through the NPF connection lookup */
+	g_assert(!pg_firewall_new_shared(name, nb, PG_NO_FLOW_CACHE, fws,
+					 &error));
+	g_assert(!pg_firewall_rule_add(fws[0], "udp", PG_WEST_SIDE, 1,
+				       &error));
+	g_assert(!pg_firewall_reload(fws[0], &error));
+	g_assert(!error);
+
+	len = sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr) + 1400;
+	inet_pton(AF_INET, "10.0.0.1", (void *) &ip_src);
+	inet_pton(AF_INET, "10.0.0.2", (void *) &ip_dst);
+	for (uint16_t i = 0; i < nb; i++) {
+		struct pg_bench *bench = &b[i].bench;
+
+		g_assert(!pg_bench_init(bench, name, argc, argv, &error));
+		bench->input_brick = fws[i];
+		bench->input_side = PG_WEST_SIDE;
+		bench->output_brick = fws[i];
+		bench->output_side = PG_EAST_SIDE;
+		bench->output_poll = false;
+		bench->max_burst_cnt = 100000;
+		bench->count_brick = NULL;
+		bench->pkts_nb = 64;
+		bench->pkts_mask = pg_mask_firsts(64);
+		bench->pkts = pg_packets_create(bench->pkts_mask);
+		bench->pkts = pg_packets_append_ether(
+			bench->pkts,
+			bench->pkts_mask,
+			&mac1, &mac2,
+			ETHER_TYPE_IPv4);
+		bench->brick_full_burst = 1;
+		pg_packets_append_ipv4(
+			bench->pkts,
+			bench->pkts_mask,
+			ip_src, ip_dst, len, 17);
+		bench->pkts = pg_packets_append_udp(
+			bench->pkts,
+			bench->pkts_mask,
+			1000, 2000, 1400);
+		bench->pkts = pg_packets_append_blank(bench->pkts,
+						      bench->pkts_mask, 1400);
+		/* one connection per packet, none shared between threads */
+		for (int j = 0; j < 64; j++) {
+			struct udp_hdr *udp = (struct udp_hdr *)
+				(rte_pktmbuf_mtod(bench->pkts[j], uint8_t *) +
+				 sizeof(struct ether_hdr) +
+				 sizeof(struct ipv4_hdr));
+
+			udp->src_port = rte_cpu_to_be_16(1024 + i * 64 + j);
+		}
+	}
+
+	for (uint16_t i = 0; i < nb; i++)
+		threads[i] = g_thread_new(name, bench_shared_run, &b[i]);
+	for (uint16_t i = 0; i < nb; i++) {
+		g_thread_join(threads[i]);
+		pg_bench_print(&b[i].stats);
+		mpps += b[i].stats.received_packet_speed;
+	}
+	printf("%u threads: %.2f Mpps\n", nb, mpps);
+
+	for (uint16_t i = 0; i < nb; i++) {
+		pg_packets_free(b[i].bench.pkts, b[i].bench.pkts_mask);
+		pg_brick_destroy(fws[i]);
+	}
+	g_free(name);
+}
+
+void test_benchmark_firewall_shared(int argc, char **argv)
+{
+	for (uint16_t nb = 1; nb <= BENCH_SHARED_MAX; nb *= 2)
+		bench_firewall_shared(argc, argv, nb);
+}
 
 void test_benchmark_firewall(int argc, char **argv)
 {
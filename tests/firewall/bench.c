@@ -36,6 +36,11 @@ int main(int argc, char **argv)
 	test_benchmark_firewall(argc, argv);
 	pg_npf_nworkers = 0;
 	test_benchmark_firewall(argc, argv);
+	pg_npf_nworkers = 1;
+	test_benchmark_firewall_flows(argc, argv);
+	test_benchmark_firewall_churn(argc, argv);
+	test_benchmark_firewall_shared(argc, argv);
+	test_benchmark_firewall_rules(argc, argv);
 	int r = g_test_run();
 
 	pg_stop();
@@ -19,3 +19,7 @@
 #include <packetgraph/packetgraph.h>
 
 void test_benchmark_firewall(int argc, char **argv);
+void test_benchmark_firewall_flows(int argc, char **argv);
+void test_benchmark_firewall_churn(int argc, char **argv);
+void test_benchmark_firewall_shared(int argc, char **argv);
+void test_benchmark_firewall_rules(int argc, char **argv);
@@ -41,6 +41,7 @@
 #include "utils/mempool.h"
 #include "utils/mac.h"
 #include "utils/bitmask.h"
+#include "utils/network.h"
 
 struct header {
 	struct ether_hdr eth;
@@ -816,6 +817,544 @@ static void test_firewall_empty_burst(void)
 	g_free(pkts);
 }
 
+static void firewall_flow_cache_burst(struct pg_brick *fw,
+				      struct rte_mbuf **pkts,
+				      enum pg_side from, uint64_t *hits,
+				      uint64_t *misses)
+{
+	struct pg_error *error = NULL;
+
+	if (from == PG_WEST_SIDE)
+		pg_brick_burst_to_east(fw, 0, pkts, pg_mask_firsts(4), &error);
+	else
+		pg_brick_burst_to_west(fw, 0, pkts, pg_mask_firsts(4), &error);
+	g_assert(!error);
+	pg_firewall_flow_cache_stats(fw, hits, misses);
+}
+
+static void test_firewall_flow_cache(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fw, *col_east, *col_west;
+	struct rte_mbuf **pkts, **replies;
+	struct ether_addr eth;
+	uint64_t hits, misses, mask;
+
+	pg_scan_ether_addr(&eth, "00:18:b9:56:2e:73");
+	fw = pg_firewall_new("fw", PG_NO_CONN_WORKER, &error);
+	g_assert(!error);
+	col_east = pg_collect_new("col-east", &error);
+	g_assert(!error);
+	col_west = pg_collect_new("col-west", &error);
+	g_assert(!error);
+	pg_brick_chained_links(&error, col_west, fw, col_east);
+	g_assert(!error);
+
+	g_assert(!pg_firewall_rule_add(fw, "udp", PG_WEST_SIDE, 1, &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+
+	pkts = pg_packets_create(pg_mask_firsts(4));
+	pg_packets_append_ether(pkts, pg_mask_firsts(4), &eth, &eth,
+				ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, pg_mask_firsts(4), 0x0100000a,
+			       0x0200000a, 28, 17);
+	pg_packets_append_udp(pkts, pg_mask_firsts(4), 1000, 2000, 8);
+	replies = pg_packets_create(pg_mask_firsts(4));
+	pg_packets_append_ether(replies, pg_mask_firsts(4), &eth, &eth,
+				ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(replies, pg_mask_firsts(4), 0x0200000a,
+			       0x0100000a, 28, 17);
+	pg_packets_append_udp(replies, pg_mask_firsts(4), 2000, 1000, 8);
+
+	/* replies are not allowed before the connection is established */
+	firewall_flow_cache_burst(fw, replies, PG_EAST_SIDE, &hits, &misses);
+	g_assert(hits == 0 && misses == 4);
+	pg_brick_east_burst_get(col_west, &mask, &error);
+	g_assert(!mask);
+
+	/* the cache is filled by the burst which creates the connection */
+	firewall_flow_cache_burst(fw, pkts, PG_WEST_SIDE, &hits, &misses);
+	g_assert(hits == 0 && misses == 8);
+	pg_brick_west_burst_get(col_east, &mask, &error);
+	g_assert(mask == pg_mask_firsts(4));
+
+	/* each side has its own cache entry */
+	firewall_flow_cache_burst(fw, replies, PG_EAST_SIDE, &hits, &misses);
+	g_assert(hits == 0 && misses == 12);
+	pg_brick_east_burst_get(col_west, &mask, &error);
+	g_assert(mask == pg_mask_firsts(4));
+
+	firewall_flow_cache_burst(fw, pkts, PG_WEST_SIDE, &hits, &misses);
+	g_assert(hits == 4 && misses == 12);
+	firewall_flow_cache_burst(fw, replies, PG_EAST_SIDE, &hits, &misses);
+	g_assert(hits == 8 && misses == 12);
+
+	/* reloading invalidates the cache, not the connection */
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+	firewall_flow_cache_burst(fw, pkts, PG_WEST_SIDE, &hits, &misses);
+	g_assert(hits == 8 && misses == 16);
+	pg_brick_west_burst_get(col_east, &mask, &error);
+	g_assert(mask == pg_mask_firsts(4));
+	firewall_flow_cache_burst(fw, pkts, PG_WEST_SIDE, &hits, &misses);
+	g_assert(hits == 12 && misses == 16);
+	pg_brick_west_burst_get(col_east, &mask, &error);
+	g_assert(mask == pg_mask_firsts(4));
+
+	pg_brick_destroy(fw);
+	pg_brick_destroy(col_east);
+	pg_brick_destroy(col_west);
+	pg_packets_free(pkts, pg_mask_firsts(4));
+	pg_packets_free(replies, pg_mask_firsts(4));
+	g_free(pkts);
+	g_free(replies);
+}
+
+static struct rte_mbuf **firewall_udp_packets(uint32_t src, uint32_t dst,
+					       uint16_t src_port,
+					       uint16_t dst_port)
+{
+	struct rte_mbuf **pkts = pg_packets_create(pg_mask_firsts(1));
+	struct ether_addr eth;
+
+	pg_scan_ether_addr(&eth, "00:18:b9:56:2e:73");
+	pg_packets_append_ether(pkts, 1, &eth, &eth, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, 1, src, dst, 28, 17);
+	pg_packets_append_udp(pkts, 1, src_port, dst_port, 8);
+	return pkts;
+}
+
+/* burst one packet and return true if it went through the firewall */
+static bool firewall_pass(struct pg_brick *fw, struct pg_brick *col,
+			  struct rte_mbuf **pkts, enum pg_side from)
+{
+	struct pg_error *error = NULL;
+	uint64_t mask;
+
+	pg_brick_reset(col, &error);
+	g_assert(!error);
+	if (from == PG_WEST_SIDE) {
+		pg_brick_burst_to_east(fw, 0, pkts, 1, &error);
+		g_assert(!error);
+		pg_brick_west_burst_get(col, &mask, &error);
+	} else {
+		pg_brick_burst_to_west(fw, 0, pkts, 1, &error);
+		g_assert(!error);
+		pg_brick_east_burst_get(col, &mask, &error);
+	}
+	g_assert(!error);
+	return mask == 1;
+}
+
+static void test_firewall_dynamic_rules(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fw, *col_east, *col_west;
+	struct rte_mbuf **pkts, **replies, **other;
+	uint64_t id1, id2;
+
+	fw = pg_firewall_new("fw", PG_NO_CONN_WORKER, &error);
+	g_assert(!error);
+	col_east = pg_collect_new("col-east", &error);
+	g_assert(!error);
+	col_west = pg_collect_new("col-west", &error);
+	g_assert(!error);
+	pg_brick_chained_links(&error, col_west, fw, col_east);
+	g_assert(!error);
+	pkts = firewall_udp_packets(0x0100000a, 0x0200000a, 1000, 2000);
+	replies = firewall_udp_packets(0x0200000a, 0x0100000a, 2000, 1000);
+	other = firewall_udp_packets(0x0100000a, 0x0200000a, 1001, 3000);
+
+	g_assert(!pg_firewall_rule_add(fw, "tcp", PG_WEST_SIDE, 1, &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!firewall_pass(fw, col_east, pkts, PG_WEST_SIDE));
+
+	/* inserted rules apply at once */
+	g_assert(!pg_firewall_rule_insert(fw, "udp", PG_WEST_SIDE, 1, &id1,
+					  &error));
+	g_assert(!error);
+	g_assert(firewall_pass(fw, col_east, pkts, PG_WEST_SIDE));
+	g_assert(firewall_pass(fw, col_west, replies, PG_EAST_SIDE));
+
+	/* inserted rules survive reloads */
+	g_assert(!pg_firewall_rule_insert(fw, "udp dst port 3000",
+					  PG_WEST_SIDE, 0, &id2, &error));
+	g_assert(!error);
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+	g_assert(firewall_pass(fw, col_east, other, PG_WEST_SIDE));
+
+	/* removing a rule keeps its connections */
+	g_assert(!pg_firewall_rule_remove(fw, id1, &error));
+	g_assert(!error);
+	g_assert(firewall_pass(fw, col_east, pkts, PG_WEST_SIDE));
+	g_assert(firewall_pass(fw, col_west, replies, PG_EAST_SIDE));
+	g_assert(firewall_pass(fw, col_east, other, PG_WEST_SIDE));
+	g_assert(!pg_firewall_rule_remove(fw, id2, &error));
+	g_assert(!error);
+	g_assert(!firewall_pass(fw, col_east, other, PG_WEST_SIDE));
+
+	g_assert(pg_firewall_rule_remove(fw, id2, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+	g_assert(pg_firewall_rule_insert(fw, "not a filter (", PG_WEST_SIDE,
+					 0, &id1, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+
+	pg_brick_destroy(fw);
+	pg_brick_destroy(col_east);
+	pg_brick_destroy(col_west);
+	pg_packets_free(pkts, 1);
+	pg_packets_free(replies, 1);
+	pg_packets_free(other, 1);
+	g_free(pkts);
+	g_free(replies);
+	g_free(other);
+}
+
+/* interpreted and JIT-compiled rules must filter the same way */
+static void firewall_jit(uint64_t flags)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fw, *col;
+	struct rte_mbuf **pkts, **other_port, **other_src;
+
+	fw = pg_firewall_new("fw", PG_NO_CONN_WORKER | flags, &error);
+	g_assert(!error);
+	col = pg_collect_new("col", &error);
+	g_assert(!error);
+	pg_brick_link(fw, col, &error);
+	g_assert(!error);
+	pkts = firewall_udp_packets(0x0100000a, 0x0200000a, 1000, 2000);
+	other_port = firewall_udp_packets(0x0100000a, 0x0200000a, 1000, 3000);
+	other_src = firewall_udp_packets(0x0300000a, 0x0200000a, 1000, 2000);
+
+	g_assert(!pg_firewall_rule_add(fw, "src host 10.0.0.1 and "
+				       "udp dst port 2000", PG_WEST_SIDE, 0,
+				       &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+	g_assert(firewall_pass(fw, col, pkts, PG_WEST_SIDE));
+	g_assert(!firewall_pass(fw, col, other_port, PG_WEST_SIDE));
+	g_assert(!firewall_pass(fw, col, other_src, PG_WEST_SIDE));
+
+	pg_brick_destroy(fw);
+	pg_brick_destroy(col);
+	pg_packets_free(pkts, 1);
+	pg_packets_free(other_port, 1);
+	pg_packets_free(other_src, 1);
+	g_free(pkts);
+	g_free(other_port);
+	g_free(other_src);
+}
+
+static void test_firewall_jit(void)
+{
+	firewall_jit(PG_NONE);
+	firewall_jit(PG_NO_JIT);
+}
+
+/* packets are filtered without being modified, they may be shared */
+static void test_firewall_shared_packets(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fw1, *fw2, *col1, *col2;
+	struct rte_mbuf **pkts;
+	uint16_t data_off;
+	uint8_t hdr[sizeof(struct ether_hdr)];
+
+	fw1 = pg_firewall_new("fw1", PG_NO_CONN_WORKER, &error);
+	g_assert(!error);
+	fw2 = pg_firewall_new("fw2", PG_NO_CONN_WORKER, &error);
+	g_assert(!error);
+	col1 = pg_collect_new("col1", &error);
+	g_assert(!error);
+	col2 = pg_collect_new("col2", &error);
+	g_assert(!error);
+	pg_brick_link(fw1, col1, &error);
+	g_assert(!error);
+	pg_brick_link(fw2, col2, &error);
+	g_assert(!error);
+	g_assert(!pg_firewall_rule_add(fw1, "udp dst port 2000",
+				       PG_WEST_SIDE, 0, &error));
+	g_assert(!pg_firewall_reload(fw1, &error));
+	g_assert(!pg_firewall_rule_add(fw2, "udp dst port 3000",
+				       PG_WEST_SIDE, 0, &error));
+	g_assert(!pg_firewall_reload(fw2, &error));
+	g_assert(!error);
+
+	pkts = firewall_udp_packets(0x0100000a, 0x0200000a, 1000, 2000);
+	rte_mbuf_refcnt_update(pkts[0], 1);
+	data_off = pkts[0]->data_off;
+	memcpy(hdr, rte_pktmbuf_mtod(pkts[0], void *), sizeof(hdr));
+
+	g_assert(firewall_pass(fw1, col1, pkts, PG_WEST_SIDE));
+	g_assert(pkts[0]->data_off == data_off);
+	g_assert(!firewall_pass(fw2, col2, pkts, PG_WEST_SIDE));
+	g_assert(pkts[0]->data_off == data_off);
+	g_assert(!memcmp(hdr, rte_pktmbuf_mtod(pkts[0], void *),
+			 sizeof(hdr)));
+	g_assert(firewall_pass(fw1, col1, pkts, PG_WEST_SIDE));
+
+	pg_brick_destroy(fw1);
+	pg_brick_destroy(fw2);
+	pg_brick_destroy(col1);
+	pg_brick_destroy(col2);
+	rte_mbuf_refcnt_update(pkts[0], -1);
+	pg_packets_free(pkts, 1);
+	g_free(pkts);
+}
+
+/*
+ * The UDP header sits in a second segment whose l2_len is copied from the
+ * first one, like payloads attached by the ip-fragment brick.
+ */
+static struct rte_mbuf **firewall_chained_packets(uint16_t dst_port)
+{
+	struct rte_mbuf **pkts = pg_packets_create(pg_mask_firsts(1));
+	struct rte_mbuf **seg = pg_packets_create(pg_mask_firsts(1));
+	struct ether_addr eth;
+
+	pg_scan_ether_addr(&eth, "00:18:b9:56:2e:73");
+	pg_packets_append_ether(pkts, 1, &eth, &eth, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, 1, 0x0100000a, 0x0200000a, 28, 17);
+	pg_packets_append_udp(seg, 1, 1000, dst_port, 8);
+	seg[0]->l2_len = pkts[0]->l2_len;
+	g_assert(!rte_pktmbuf_chain(pkts[0], seg[0]));
+	g_free(seg);
+	return pkts;
+}
+
+static void test_firewall_chained_packets(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fw, *col;
+	struct rte_mbuf **pkts, **other;
+
+	fw = pg_firewall_new("fw", PG_NO_CONN_WORKER, &error);
+	g_assert(!error);
+	col = pg_collect_new("col", &error);
+	g_assert(!error);
+	pg_brick_link(fw, col, &error);
+	g_assert(!error);
+	g_assert(!pg_firewall_rule_add(fw, "udp dst port 2000",
+				       PG_WEST_SIDE, 0, &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+
+	pkts = firewall_chained_packets(2000);
+	other = firewall_chained_packets(3000);
+	g_assert(pkts[0]->nb_segs == 2);
+	g_assert(firewall_pass(fw, col, pkts, PG_WEST_SIDE));
+	g_assert(!firewall_pass(fw, col, other, PG_WEST_SIDE));
+
+	pg_brick_destroy(fw);
+	pg_brick_destroy(col);
+	pg_packets_free(pkts, 1);
+	pg_packets_free(other, 1);
+	g_free(pkts);
+	g_free(other);
+}
+
+/* IP packets which can't be parsed are dropped, not taken for non-IP ones */
+static void test_firewall_malformed_ip(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fw, *col;
+	struct rte_mbuf **bad_ihl, **truncated;
+	struct ether_addr eth;
+	struct ipv4_hdr *ip;
+
+	fw = pg_firewall_new("fw", PG_NO_CONN_WORKER, &error);
+	g_assert(!error);
+	col = pg_collect_new("col", &error);
+	g_assert(!error);
+	pg_brick_link(fw, col, &error);
+	g_assert(!error);
+	g_assert(!pg_firewall_rule_add(fw, "udp", PG_WEST_SIDE, 0, &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+
+	bad_ihl = firewall_udp_packets(0x0100000a, 0x0200000a, 1000, 2000);
+	g_assert(firewall_pass(fw, col, bad_ihl, PG_WEST_SIDE));
+	ip = rte_pktmbuf_mtod_offset(bad_ihl[0], struct ipv4_hdr *,
+				     sizeof(struct ether_hdr));
+	ip->version_ihl = 0x44;
+	pg_utils_reset_metadata(bad_ihl[0]);
+	g_assert(!firewall_pass(fw, col, bad_ihl, PG_WEST_SIDE));
+
+	/* a 20 bytes frame, too short for an IPv4 header */
+	truncated = pg_packets_create(1);
+	pg_scan_ether_addr(&eth, "00:18:b9:56:2e:73");
+	pg_packets_append_ether(truncated, 1, &eth, &eth, ETHER_TYPE_IPv4);
+	pg_packets_append_blank(truncated, 1, 6);
+	g_assert(rte_pktmbuf_pkt_len(truncated[0]) == 20);
+	g_assert(!firewall_pass(fw, col, truncated, PG_WEST_SIDE));
+
+	pg_brick_destroy(fw);
+	pg_brick_destroy(col);
+	pg_packets_free(bad_ihl, 1);
+	pg_packets_free(truncated, 1);
+	g_free(bad_ihl);
+	g_free(truncated);
+}
+
+static void test_firewall_tables(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fw, *col;
+	struct rte_mbuf **pkts;
+	uint32_t net = 0x0000000a;
+	uint32_t host = 0x0100000a;
+	uint8_t net6[16] = {0x20, 0x01};
+
+	fw = pg_firewall_new("fw", PG_NONE, &error);
+	g_assert(!error);
+	col = pg_collect_new("col", &error);
+	g_assert(!error);
+	pg_brick_link(fw, col, &error);
+	g_assert(!error);
+	pkts = firewall_udp_packets(host, 0x0200000a, 1000, 2000);
+
+	/* tables only exist after a reload */
+	g_assert(pg_firewall_table_add(fw, "allowed", AF_INET, &net, 24,
+				       &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+
+	g_assert(!pg_firewall_rule_add_table(fw, "allowed", 1, PG_WEST_SIDE,
+					     0, &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+	g_assert(!firewall_pass(fw, col, pkts, PG_WEST_SIDE));
+
+	g_assert(!pg_firewall_table_add(fw, "allowed", AF_INET, &net, 24,
+					&error));
+	g_assert(!error);
+	g_assert(!pg_firewall_table_add(fw, "allowed", AF_INET6, net6, 16,
+					&error));
+	g_assert(!error);
+	g_assert(firewall_pass(fw, col, pkts, PG_WEST_SIDE));
+
+	/* entries are kept across reloads */
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+	g_assert(firewall_pass(fw, col, pkts, PG_WEST_SIDE));
+
+	g_assert(!pg_firewall_table_remove(fw, "allowed", AF_INET, &net, 24,
+					   &error));
+	g_assert(!error);
+	g_assert(!firewall_pass(fw, col, pkts, PG_WEST_SIDE));
+
+	g_assert(!pg_firewall_table_add(fw, "allowed", AF_INET, &host, 32,
+					&error));
+	g_assert(!error);
+	g_assert(firewall_pass(fw, col, pkts, PG_WEST_SIDE));
+
+	g_assert(pg_firewall_table_add(fw, "allowed", AF_INET, &host, 33,
+				       &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+
+	pg_brick_destroy(fw);
+	pg_brick_destroy(col);
+	pg_packets_free(pkts, 1);
+	g_free(pkts);
+}
+
+struct firewall_shared_thread {
+	struct pg_brick *fw;
+	struct pg_brick *col;
+	struct rte_mbuf **pkts;
+};
+
+static gpointer firewall_shared_thread(gpointer data)
+{
+	struct firewall_shared_thread *t = data;
+
+	for (int i = 0; i < 10000; i++)
+		g_assert(firewall_pass(t->fw, t->col, t->pkts, PG_WEST_SIDE));
+	return NULL;
+}
+
+static void test_firewall_shared(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fws[2], *cols_east[2], *cols_west[2];
+	struct firewall_shared_thread threads[2];
+	GThread *gthreads[2];
+	struct rte_mbuf **pkts, **replies;
+	uint64_t id;
+
+	g_assert(!pg_firewall_new_shared("fw", 2, PG_NO_CONN_WORKER, fws,
+					 &error));
+	g_assert(!error);
+	g_assert(!g_strcmp0(pg_brick_name(fws[1]), "fw-1"));
+	for (int i = 0; i < 2; i++) {
+		cols_east[i] = pg_collect_new("col-east", &error);
+		g_assert(!error);
+		cols_west[i] = pg_collect_new("col-west", &error);
+		g_assert(!error);
+		pg_brick_chained_links(&error, cols_west[i], fws[i],
+				       cols_east[i]);
+		g_assert(!error);
+	}
+	pkts = firewall_udp_packets(0x0100000a, 0x0200000a, 1000, 2000);
+	replies = firewall_udp_packets(0x0200000a, 0x0100000a, 2000, 1000);
+
+	/* rules set through a brick apply to all of them */
+	g_assert(!pg_firewall_rule_add(fws[1], "udp", PG_WEST_SIDE, 1,
+				       &error));
+	g_assert(!pg_firewall_reload(fws[0], &error));
+	g_assert(!error);
+	g_assert(!firewall_pass(fws[1], cols_west[1], replies, PG_EAST_SIDE));
+
+	/* and so do connections */
+	g_assert(firewall_pass(fws[0], cols_east[0], pkts, PG_WEST_SIDE));
+	g_assert(firewall_pass(fws[1], cols_west[1], replies, PG_EAST_SIDE));
+
+	/* concurrent bursts while rules change */
+	for (int i = 0; i < 2; i++) {
+		threads[i].fw = fws[i];
+		threads[i].col = cols_east[i];
+		threads[i].pkts = firewall_udp_packets(0x0100000a, 0x0200000a,
+						       3000 + i, 2000);
+		gthreads[i] = g_thread_new("firewall", firewall_shared_thread,
+					   &threads[i]);
+	}
+	for (int i = 0; i < 100; i++) {
+		g_assert(!pg_firewall_rule_insert(fws[i % 2], "tcp",
+						  PG_WEST_SIDE, 0, &id,
+						  &error));
+		g_assert(!pg_firewall_rule_remove(fws[1 - i % 2], id,
+						  &error));
+		g_assert(!error);
+	}
+	for (int i = 0; i < 2; i++) {
+		g_thread_join(gthreads[i]);
+		pg_packets_free(threads[i].pkts, 1);
+		g_free(threads[i].pkts);
+	}
+
+	/* the NPF instance lives until the last brick is destroyed */
+	pg_brick_destroy(fws[0]);
+	g_assert(firewall_pass(fws[1], cols_west[1], replies, PG_EAST_SIDE));
+	pg_brick_destroy(fws[1]);
+
+	for (int i = 0; i < 2; i++) {
+		pg_brick_destroy(cols_east[i]);
+		pg_brick_destroy(cols_west[i]);
+	}
+	pg_packets_free(pkts, 1);
+	pg_packets_free(replies, 1);
+	g_free(pkts);
+	g_free(replies);
+}
+
 static void test_firewall(void)
 {
 	pg_test_add_func("/firewall/filter", test_firewall_filter);
@@ -827,6 +1366,17 @@ static void test_firewall(void)
 	pg_test_add_func("/firewall/tcp6", test_firewall_tcp6);
 	pg_test_add_func("/firewall/exotic", test_firewall_exotic);
 	pg_test_add_func("/firewall/empty_rules", test_firewall_empty_rules);
+	pg_test_add_func("/firewall/flow_cache", test_firewall_flow_cache);
+	pg_test_add_func("/firewall/dynamic_rules",
+			 test_firewall_dynamic_rules);
+	pg_test_add_func("/firewall/tables", test_firewall_tables);
+	pg_test_add_func("/firewall/jit", test_firewall_jit);
+	pg_test_add_func("/firewall/shared", test_firewall_shared);
+	pg_test_add_func("/firewall/shared_packets",
+			 test_firewall_shared_packets);
+	pg_test_add_func("/firewall/chained_packets",
+			 test_firewall_chained_packets);
+	pg_test_add_func("/firewall/malformed_ip", test_firewall_malformed_ip);
 }
 
 int main(int argc, char **argv)
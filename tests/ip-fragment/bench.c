@@ -84,6 +84,63 @@ static void test_benchmark_ip_fragment(int mtu, int max_burst_cnt,
 	pg_brick_destroy(ip_fragment);
 }
 
+/* bursts mixing packets below and above the MTU */
+static void test_benchmark_ip_fragment_mixed(int mtu, int argc, char **argv)
+{
+	static const int pkt_lens[] = {100, 700, 1400, 1900};
+	struct pg_error *error = NULL;
+	struct pg_brick *ip_fragment;
+	struct pg_bench bench;
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct pg_bench_stats stats;
+	gchar *title = g_strdup_printf(
+		"fragment packets of 100 to 1900 bytes, mtu: %d", mtu);
+
+	g_assert(!pg_bench_init(&bench, title, argc, argv, &error));
+	ip_fragment = pg_ip_fragment_new("ip_fragment",
+					 PG_EAST_SIDE, mtu, &error);
+	g_assert(!error);
+
+	bench.input_brick = ip_fragment;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = ip_fragment;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 1000000;
+	bench.count_brick = NULL;
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac, &mac,
+		ETHER_TYPE_IPv4);
+	bench.brick_full_burst = 1;
+	for (unsigned k = 0; k < G_N_ELEMENTS(pkt_lens); k++) {
+		uint64_t mask = 0;
+		uint32_t len = sizeof(struct ipv4_hdr) + pkt_lens[k];
+
+		for (unsigned i = k; i < 64; i += G_N_ELEMENTS(pkt_lens))
+			mask |= ONE64 << i;
+		pg_packets_append_ipv4(bench.pkts, mask,
+				       0x000000EE, 0x000000CC, len, 17);
+		pg_packets_append_blank(bench.pkts, mask, pkt_lens[k]);
+	}
+	PG_FOREACH_BIT(bench.pkts_mask, i) {
+		struct eth_ipv4_hdr *pkt_buf =
+			rte_pktmbuf_mtod(bench.pkts[i], struct eth_ipv4_hdr *);
+		pkt_buf->ip.fragment_offset = 0;
+	}
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	pg_bench_print(&stats);
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	pg_brick_destroy(ip_fragment);
+	g_free(title);
+}
+
 static void test_benchmark_ip_defragment(int mtu, const char *title,
 					 int argc, char **argv)
 {
@@ -228,6 +285,9 @@ int main(int argc, char **argv)
 	test_benchmark_ip_fragment(3000, 10000000,
 				   "fragment packets, mtu: 3000",
 				   argc, argv);
+	test_benchmark_ip_fragment_mixed(576, argc, argv);
+	test_benchmark_ip_fragment_mixed(1000, argc, argv);
+	test_benchmark_ip_fragment_mixed(1504, argc, argv);
 	test_benchmark_ip_defragment(3000,
 				     "reassemble packets, mtu: 3000",
 				     argc, argv);
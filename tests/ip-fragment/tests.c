@@ -16,6 +16,8 @@
  */
 
 #include <glib.h>
+#include <string.h>
+#include <netinet/in.h>
 #include <packetgraph/packetgraph.h>
 #include "utils/tests.h"
 
@@ -75,7 +77,8 @@ static void test_fragment(void)
 		g_assert(!error);
 		tmp_pkts = pg_brick_west_burst_get(col_east, &mask, &error);
 		g_assert(!error);
-		g_assert(pg_mask_count(mask) == 4);
+		/* fragments of the whole burst are sent at once */
+		g_assert(pg_mask_count(mask) == 16 * 4);
 		g_assert(pg_brick_pkts_count_get(col_east, PG_EAST_SIDE) ==
 			 16 * 4 * (i + 1));
 		PG_FOREACH_BIT(mask, i) {
@@ -89,6 +92,8 @@ static void test_fragment(void)
 		}
 	}
 
+	/* fragments of the first packet */
+	mask = pg_mask_firsts(4);
 	pg_brick_burst_to_west(frag, 0, tmp_pkts, mask, &error);
 	g_assert(!error);
 	tmp_pkts = pg_brick_east_burst_get(col_west, &mask, &error);
@@ -101,6 +106,168 @@ static void test_fragment(void)
 	g_free(pkts);
 }
 
+/* more fragments than a burst can hold */
+static void test_fragment_overflow(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *frag;
+	struct pg_brick *col_east;
+	uint64_t mask = pg_mask_firsts(16);
+	struct rte_mbuf **pkts = pg_packets_create(mask);
+	struct ether_addr eth = {{1, 0, 0, 0, 0, 0} };
+	struct eth_ipv4_hdr *pkt_buf;
+
+	pg_packets_append_ether(pkts, mask,  &eth, &eth,
+				ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, mask, 1, 2,
+			       1600 - sizeof(struct eth_ipv4_hdr), 0);
+	PG_FOREACH_BIT(mask, i) {
+		pkt_buf = rte_pktmbuf_mtod(pkts[i], struct eth_ipv4_hdr *);
+		pkt_buf->ip.fragment_offset = 0;
+	}
+	pg_packets_append_blank(pkts, mask,
+				1600 - sizeof(struct ipv4_hdr) -
+				sizeof(struct ether_hdr));
+
+	/* 7 fragments of 256 bytes per packet */
+	frag = pg_ip_fragment_new("frag", PG_EAST_SIDE, 296, &error);
+	g_assert(!error);
+	col_east = pg_collect_new("col_east", &error);
+	g_assert(!error);
+	pg_brick_link(frag, col_east, &error);
+	g_assert(!error);
+
+	pg_brick_burst_to_east(frag, 0, pkts, mask, &error);
+	g_assert(!error);
+	g_assert(pg_brick_pkts_count_get(col_east, PG_EAST_SIDE) == 16 * 7);
+	/* the first burst held 9 packets, the last one the 7 others */
+	pg_brick_west_burst_get(col_east, &mask, &error);
+	g_assert(!error);
+	g_assert(pg_mask_count(mask) == 7 * 7);
+
+	pg_brick_destroy(col_east);
+	pg_brick_destroy(frag);
+	pg_packets_free(pkts, pg_mask_firsts(16));
+	g_free(pkts);
+}
+
+static void test_fragment_ipv4_options(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *frag;
+	struct pg_brick *col_east;
+	uint64_t mask = pg_mask_firsts(16);
+	struct rte_mbuf **pkts = pg_packets_create(mask);
+	struct rte_mbuf **tmp_pkts;
+	struct ether_addr eth = {{1, 0, 0, 0, 0, 0} };
+	struct {
+		struct ipv4_hdr ip;
+		uint8_t options[4];
+	} __attribute__((__packed__)) hdr = {
+		.ip = {
+			.version_ihl = 0x46,
+			/* 1600 bytes with the ethernet header */
+			.total_length = rte_cpu_to_be_16(1586),
+			.time_to_live = 64,
+			.src_addr = 1,
+			.dst_addr = 2,
+		},
+		/* no-operation options */
+		.options = {1, 1, 1, 1},
+	};
+
+	hdr.ip.hdr_checksum = ~rte_raw_cksum(&hdr, sizeof(hdr));
+	pg_packets_append_ether(pkts, mask,  &eth, &eth,
+				ETHER_TYPE_IPv4);
+	pg_packets_append_buf(pkts, mask, &hdr, sizeof(hdr));
+	pg_packets_append_blank(pkts, mask, 1600 - sizeof(hdr) -
+				sizeof(struct ether_hdr));
+
+	frag = pg_ip_fragment_new("frag", PG_EAST_SIDE, 296, &error);
+	g_assert(!error);
+	col_east = pg_collect_new("col_east", &error);
+	g_assert(!error);
+	pg_brick_link(frag, col_east, &error);
+	g_assert(!error);
+
+	/* no packet passes without being fragmented */
+	pg_brick_burst_to_east(frag, 0, pkts, mask, &error);
+	g_assert(!error);
+	g_assert(pg_brick_pkts_count_get(col_east, PG_EAST_SIDE) >= 16 * 7);
+	tmp_pkts = pg_brick_west_burst_get(col_east, &mask, &error);
+	g_assert(!error);
+	g_assert(mask);
+	PG_FOREACH_BIT(mask, i)
+		g_assert(tmp_pkts[i]->pkt_len <= 296);
+
+	pg_brick_destroy(col_east);
+	pg_brick_destroy(frag);
+	pg_packets_free(pkts, pg_mask_firsts(16));
+	g_free(pkts);
+}
+
+static void test_fragment_ipv6(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *frag;
+	struct pg_brick *col_east;
+	struct pg_brick *col_west;
+	uint64_t mask = pg_mask_firsts(1);
+	struct rte_mbuf **pkts = pg_packets_create(mask);
+	struct rte_mbuf **tmp_pkts;
+	struct ether_addr eth = {{1, 0, 0, 0, 0, 0} };
+	uint8_t ip1[16] = {0x20, 0x01, [15] = 1};
+	uint8_t ip2[16] = {0x20, 0x01, [15] = 2};
+	uint16_t payload_len = 1600 - sizeof(struct ether_hdr) -
+		sizeof(struct ipv6_hdr);
+	struct ipv6_hdr *ip6;
+
+	pg_packets_append_ether(pkts, mask, &eth, &eth, ETHER_TYPE_IPv6);
+	pg_packets_append_ipv6(pkts, mask, ip1, ip2, payload_len, 17);
+	pg_packets_append_blank(pkts, mask, payload_len);
+
+	frag = pg_ip_fragment_new_full("frag", PG_EAST_SIDE, 432, 16, 1000,
+				       &error);
+	g_assert(!error);
+	col_east = pg_collect_new("col_east", &error);
+	g_assert(!error);
+	col_west = pg_collect_new("col_west", &error);
+	g_assert(!error);
+	pg_brick_chained_links(&error, col_west, frag, col_east);
+	g_assert(!error);
+
+	/* 368 bytes of payload per fragment */
+	pg_brick_burst_to_east(frag, 0, pkts, mask, &error);
+	g_assert(!error);
+	tmp_pkts = pg_brick_west_burst_get(col_east, &mask, &error);
+	g_assert(!error);
+	g_assert(pg_mask_count(mask) == 5);
+	PG_FOREACH_BIT(mask, i) {
+		g_assert(tmp_pkts[i]->pkt_len <= 432);
+		ip6 = rte_pktmbuf_mtod_offset(tmp_pkts[i], struct ipv6_hdr *,
+					      sizeof(struct ether_hdr));
+		g_assert(ip6->proto == IPPROTO_FRAGMENT);
+		g_assert(!memcmp(ip6->src_addr, ip1, 16));
+	}
+
+	pg_brick_burst_to_west(frag, 0, tmp_pkts, mask, &error);
+	g_assert(!error);
+	tmp_pkts = pg_brick_east_burst_get(col_west, &mask, &error);
+	g_assert(!error);
+	g_assert(pg_mask_count(mask) == 1);
+	g_assert(tmp_pkts[0]->pkt_len == 1600);
+	ip6 = rte_pktmbuf_mtod_offset(tmp_pkts[0], struct ipv6_hdr *,
+				      sizeof(struct ether_hdr));
+	g_assert(ip6->proto == 17);
+	g_assert(rte_be_to_cpu_16(ip6->payload_len) == payload_len);
+
+	pg_brick_destroy(col_east);
+	pg_brick_destroy(col_west);
+	pg_brick_destroy(frag);
+	pg_packets_free(pkts, pg_mask_firsts(1));
+	g_free(pkts);
+}
+
 int main(int argc, char **argv)
 {
 	/* tests in the same order as the header function declarations */
@@ -110,6 +277,10 @@ int main(int argc, char **argv)
 	g_assert(pg_start(argc, argv) >= 0);
 
 	pg_test_add_func("/ip_fragment/fragment", test_fragment);
+	pg_test_add_func("/ip_fragment/overflow", test_fragment_overflow);
+	pg_test_add_func("/ip_fragment/ipv4_options",
+			 test_fragment_ipv4_options);
+	pg_test_add_func("/ip_fragment/ipv6", test_fragment_ipv6);
 	int r = g_test_run();
 
 	pg_stop();
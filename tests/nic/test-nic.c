@@ -25,11 +25,13 @@
 #include <unistd.h>
 #include <packetgraph/common.h>
 #include <packetgraph/nic.h>
+#include <packetgraph/nop.h>
 #include <packetgraph/errors.h>
 #include "utils/tests.h"
 #include "utils/mempool.h"
 #include "utils/config.h"
 #include "brick-int.h"
+#include "packets.h"
 #include "collect.h"
 #include "tests.h"
 
@@ -109,10 +111,131 @@ static void test_nic_simple_flow(void)
 	g_assert(g_unlink("out.pcap") == 0);
 }
 
+static void test_nic_queues(void)
+{
+	struct pg_nic_queues_params params = {
+		.nb_queues = 4,
+		.nb_rx_desc = 256,
+		.nb_tx_desc = 256,
+		.rss = PG_NIC_RSS_IP | PG_NIC_RSS_UDP | PG_NIC_RSS_TCP,
+	};
+	struct pg_brick *nics[4];
+	struct pg_brick *nops[4];
+	struct pg_error *error = NULL;
+	struct ether_addr eth = {{0}};
+	struct rte_mbuf **pkts;
+	uint64_t pkts_mask = pg_mask_firsts(8);
+	uint16_t nb_pkts;
+
+	/* ring pmd loops each tx queue back on the rx queue of same id */
+	g_assert(pg_nic_new_queues("nic", "eth_ring1", &params,
+				   nics, &error) == 0);
+	CHECK_ERROR(error);
+	for (int q = 0; q < 4; q++) {
+		nops[q] = pg_nop_new("nop", &error);
+		CHECK_ERROR(error);
+		pg_brick_link(nics[q], nops[q], &error);
+		CHECK_ERROR(error);
+	}
+
+	pkts = pg_packets_append_ether(pg_packets_create(pkts_mask),
+				       pkts_mask, &eth, &eth,
+				       ETHER_TYPE_IPv4);
+	max_pkts = 64;
+	for (int q = 0; q < 4; q++) {
+		pg_brick_burst_to_east(nics[q], 0, pkts, pkts_mask, &error);
+		CHECK_ERROR(error);
+		for (int i = 0; i < 4; i++) {
+			pg_brick_poll(nics[i], &nb_pkts, &error);
+			CHECK_ERROR(error);
+			g_assert(nb_pkts == (i == q ? 8 : 0));
+		}
+	}
+
+	/* the port stays usable until the last queue brick is gone */
+	for (int q = 0; q < 3; q++) {
+		pg_brick_destroy(nics[q]);
+		pg_brick_destroy(nops[q]);
+	}
+	pg_brick_burst_to_east(nics[3], 0, pkts, pkts_mask, &error);
+	CHECK_ERROR(error);
+	pg_brick_poll(nics[3], &nb_pkts, &error);
+	CHECK_ERROR(error);
+	g_assert(nb_pkts == 8);
+	pg_brick_destroy(nics[3]);
+	pg_brick_destroy(nops[3]);
+
+	pg_packets_free(pkts, pkts_mask);
+	g_free(pkts);
+}
+
+static void test_nic_tx_buffer(void)
+{
+	struct pg_brick *nic, *nop;
+	struct pg_error *error = NULL;
+	struct ether_addr eth = {{0}};
+	struct rte_mbuf **pkts;
+	uint64_t pkts_mask = pg_mask_firsts(16);
+	uint16_t nb_pkts;
+
+	nic = pg_nic_new("nic", "eth_ring2", &error);
+	CHECK_ERROR(error);
+	nop = pg_nop_new("nop", &error);
+	CHECK_ERROR(error);
+	pg_brick_link(nic, nop, &error);
+	CHECK_ERROR(error);
+	g_assert(pg_nic_set_tx_buffer(nic, PG_MAX_PKTS_BURST + 1, 0, 0,
+				      &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+	g_assert(pg_nic_set_tx_buffer(nic, 32, 1000000, 4, &error) == 0);
+	CHECK_ERROR(error);
+
+	pkts = pg_packets_append_ether(pg_packets_create(pkts_mask),
+				       pkts_mask, &eth, &eth,
+				       ETHER_TYPE_IPv4);
+	max_pkts = 64;
+
+	/* below the threshold, packets wait in the buffer */
+	pg_brick_burst_to_east(nic, 0, pkts, pkts_mask, &error);
+	CHECK_ERROR(error);
+	pg_brick_poll(nic, &nb_pkts, &error);
+	CHECK_ERROR(error);
+	g_assert(nb_pkts == 0);
+
+	/* reaching it sends everything at once */
+	pg_brick_burst_to_east(nic, 0, pkts, pkts_mask, &error);
+	CHECK_ERROR(error);
+	pg_brick_poll(nic, &nb_pkts, &error);
+	CHECK_ERROR(error);
+	g_assert(nb_pkts == 32);
+
+	/* the poll loop flushes once the deadline is reached */
+	g_assert(pg_nic_set_tx_buffer(nic, 32, 1, 4, &error) == 0);
+	CHECK_ERROR(error);
+	pg_brick_burst_to_east(nic, 0, pkts, pkts_mask, &error);
+	CHECK_ERROR(error);
+	usleep(10);
+	pg_brick_poll(nic, &nb_pkts, &error);
+	CHECK_ERROR(error);
+	g_assert(nb_pkts == 16);
+
+	g_assert(pg_nic_tx_drops(nic, PG_NIC_TX_DROP_FULL) == 0);
+	g_assert(pg_nic_tx_drops(nic, PG_NIC_TX_DROP_PREPARE) == 0);
+
+	pg_brick_destroy(nic);
+	pg_brick_destroy(nop);
+	pg_packets_free(pkts, pkts_mask);
+	g_free(pkts);
+}
+
 #undef NB_PKTS
 #undef CHECK_ERROR
 
 void test_nic(void)
 {
 	pg_test_add_func("/nic/pcap/nic-pcap", test_nic_simple_flow);
+	pg_test_add_func("/nic/ring/queues", test_nic_queues);
+	pg_test_add_func("/nic/ring/tx-buffer", test_nic_tx_buffer);
 }
@@ -23,11 +23,12 @@
 #include <packetgraph/packetgraph.h>
 #include "utils/tests.h"
 #include <packetgraph/pmtud.h>
+#include <packetgraph/nop.h>
 #include "utils/bench.h"
 #include "utils/bitmask.h"
 #include "packets.h"
 
-static void test_benchmark_pmtud(int argc, char **argv)
+static void test_benchmark_pmtud(int argc, char **argv, bool mss_clamp)
 {
 	struct pg_error *error = NULL;
 	struct pg_brick *pmtud;
@@ -36,9 +37,11 @@ static void test_benchmark_pmtud(int argc, char **argv)
 	uint32_t len;
 	struct pg_bench_stats stats;
 
-	g_assert(!pg_bench_init(&bench, "pmtud", argc, argv, &error));
+	g_assert(!pg_bench_init(&bench, mss_clamp ? "pmtud mss clamp" :
+				"pmtud", argc, argv, &error));
 	pmtud = pg_pmtud_new("pmtud", PG_WEST_SIDE, 1500, &error);
 	g_assert(!error);
+	pg_pmtud_set_tcp_mss_clamp(pmtud, mss_clamp);
 
 	bench.input_brick = pmtud;
 	bench.input_side = PG_WEST_SIDE;
@@ -74,11 +77,71 @@ static void test_benchmark_pmtud(int argc, char **argv)
 	pg_brick_destroy(pmtud);
 }
 
+/* every packet is too big and is answered, up to the rate limit */
+static void test_benchmark_pmtud_icmp(int argc, char **argv, bool limited)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *pmtud;
+	struct pg_brick *nop;
+	struct pg_bench bench;
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	uint32_t len;
+	struct pg_bench_stats stats;
+
+	g_assert(!pg_bench_init(&bench, limited ? "pmtud icmp limited" :
+				"pmtud icmp", argc, argv, &error));
+	pmtud = pg_pmtud_new("pmtud", PG_WEST_SIDE, 1000, &error);
+	g_assert(!error);
+	nop = pg_nop_new("nop", &error);
+	g_assert(!error);
+	g_assert(!pg_brick_link(nop, pmtud, &error));
+	if (!limited)
+		pg_pmtud_set_icmp_rate(pmtud, 0, 0);
+
+	bench.input_brick = pmtud;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = pmtud;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 1000000;
+	bench.count_brick = NULL;
+	bench.post_burst_op = NULL;
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac, &mac,
+		ETHER_TYPE_IPv4);
+	bench.brick_full_burst = 1;
+	len = sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr) + 1400;
+	pg_packets_append_ipv4(
+		bench.pkts,
+		bench.pkts_mask,
+		0x000000EE, 0x000000CC, len, 17);
+	bench.pkts = pg_packets_append_udp(
+		bench.pkts,
+		bench.pkts_mask,
+		1000, 2000, 1400);
+	bench.pkts = pg_packets_append_blank(bench.pkts, bench.pkts_mask, 1400);
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	pg_bench_print(&stats);
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	pg_brick_destroy(pmtud);
+	pg_brick_destroy(nop);
+}
+
 int main(int argc, char **argv)
 {
 	g_test_init(&argc, &argv, NULL);
 	g_assert(pg_start(argc, argv) >= 0);
-	test_benchmark_pmtud(argc, argv);
+	test_benchmark_pmtud(argc, argv, false);
+	test_benchmark_pmtud(argc, argv, true);
+	test_benchmark_pmtud_icmp(argc, argv, true);
+	test_benchmark_pmtud_icmp(argc, argv, false);
 	int r = g_test_run();
 
 	pg_stop();
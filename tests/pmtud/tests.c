@@ -16,6 +16,7 @@
  */
 
 #include <glib.h>
+#include <string.h>
 #include <packetgraph/packetgraph.h>
 #include "utils/tests.h"
 #include <packetgraph/pmtud.h>
@@ -24,6 +25,7 @@
 #include <rte_config.h>
 #include <rte_ip.h>
 #include <rte_ether.h>
+#include <rte_tcp.h>
 
 #include "packetsgen.h"
 #include "utils/mempool.h"
@@ -31,6 +33,10 @@
 #include "brick-int.h"
 #include "packets.h"
 #include "collect.h"
+#include "utils/network.h"
+
+#define TCP_SYN 0x02
+#define TCP_ACK 0x10
 
 static void test_sorting_pmtud(void)
 {
@@ -126,13 +132,23 @@ struct icmp_hdr {
 	uint16_t next_hop_mtu;
 	struct ipv4_hdr ip;
 	uint64_t last_msg;
-};
+} __attribute__((__packed__));
 
 struct icmp_full_hdr {
 	struct ether_hdr eth;
 	struct ipv4_hdr ip;
 	struct icmp_hdr icmp;
-};
+} __attribute__((__packed__));
+
+struct icmp6_full_hdr {
+	struct ether_hdr eth;
+	struct ipv6_hdr ip;
+	uint8_t type;
+	uint8_t code;
+	uint16_t checksum;
+	uint32_t mtu;
+	struct ipv6_hdr quoted_ip;
+} __attribute__((__packed__));
 
 static void test_icmp_pmtud(void)
 {
@@ -146,6 +162,7 @@ static void test_icmp_pmtud(void)
 	/* FILE *west_file = fopen("west_file.pcap", "w+"); */
 	struct rte_mbuf **pkts;
 	struct rte_mbuf *tmp;
+	struct icmp_full_hdr *icmp;
 	uint64_t pkts_mask;
 	struct ether_addr eth_s = {{2} };
 	struct ether_addr eth_d = {{4} };
@@ -195,6 +212,7 @@ static void test_icmp_pmtud(void)
 
 	pg_brick_chained_links(&error, col_west, pmtud, col_east);
 	g_assert(!error);
+	pg_pmtud_set_icmp_rate(pmtud, 0, 0);
 
 	pg_brick_burst_to_east(pmtud, 0, pkts, pg_mask_firsts(64), &error);
 	g_assert(!error);
@@ -206,9 +224,26 @@ static void test_icmp_pmtud(void)
 	g_assert(pg_brick_pkts_count_get(pmtud, PG_EAST_SIDE) == 64);
 	g_assert(pg_brick_pkts_count_get(col_east, PG_EAST_SIDE) == 32);
 	g_assert(pg_brick_pkts_count_get(col_west, PG_WEST_SIDE) == 32);
+	/* all messages are sent in a single burst */
 	tmp = pg_brick_east_burst_get(col_west, &pkts_mask, &error)[0];
-	g_assert(pkts_mask == 1);
+	g_assert(pkts_mask == pg_mask_firsts(32));
 	g_assert(tmp);
+	g_assert(tmp->pkt_len == sizeof(struct icmp_full_hdr));
+	icmp = rte_pktmbuf_mtod(tmp, struct icmp_full_hdr *);
+	g_assert(is_same_ether_addr(&icmp->eth.s_addr, &eth_d));
+	g_assert(is_same_ether_addr(&icmp->eth.d_addr, &eth_s));
+	g_assert(icmp->ip.src_addr == 2);
+	g_assert(icmp->ip.dst_addr == 1);
+	g_assert(icmp->ip.next_proto_id == 1);
+	g_assert(rte_ipv4_cksum(&icmp->ip) == 0xffff);
+	g_assert(icmp->icmp.type == 3);
+	g_assert(icmp->icmp.code == 4);
+	g_assert(rte_be_to_cpu_16(icmp->icmp.next_hop_mtu) == 430 -
+		 sizeof(struct ether_hdr));
+	g_assert(icmp->icmp.ip.src_addr == 1);
+	g_assert(!memcmp(&icmp->icmp.last_msg, "siegzeon", 8));
+	g_assert(rte_raw_cksum(&icmp->icmp, sizeof(struct icmp_hdr)) ==
+		 0xffff);
 
 	pg_brick_destroy(col_west);
 	pg_brick_destroy(pmtud);
@@ -219,12 +254,252 @@ static void test_icmp_pmtud(void)
 	g_free(pkts);
 }
 
+static void test_icmp_pmtud_rate(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *pmtud;
+	struct pg_brick *col_east;
+	struct pg_brick *col_west;
+	struct rte_mbuf **pkts;
+	uint64_t pkts_mask;
+	struct ether_addr eth = {{0} };
+
+	/* two sources sending 32 oversize packets each */
+	pkts = pg_packets_append_ether(pg_packets_create(pg_mask_firsts(64)),
+				       pg_mask_firsts(64),  &eth, &eth,
+				       ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, pg_mask_firsts(32), 1, 2, 0, 0);
+	pg_packets_append_ipv4(pkts, pg_mask_firsts(64) & ~pg_mask_firsts(32),
+			       3, 2, 0, 0);
+	pg_packets_append_blank(pkts, pg_mask_firsts(64), 500);
+
+	pmtud = pg_pmtud_new("pmtud", PG_WEST_SIDE, 430, &error);
+	g_assert(!error);
+	col_east = pg_collect_new("col_east", &error);
+	g_assert(!error);
+	col_west = pg_collect_new("col_west", &error);
+	g_assert(!error);
+	pg_brick_chained_links(&error, col_west, pmtud, col_east);
+	g_assert(!error);
+
+	/* each source gets a full bucket */
+	pg_pmtud_set_icmp_rate(pmtud, 1, 4);
+	pg_brick_burst_to_east(pmtud, 0, pkts, pg_mask_firsts(64), &error);
+	g_assert(!error);
+	pg_brick_east_burst_get(col_west, &pkts_mask, &error);
+	g_assert(pkts_mask == pg_mask_firsts(8));
+	g_assert(pg_brick_pkts_count_get(col_west, PG_WEST_SIDE) == 8);
+	g_assert(pg_brick_pkts_count_get(col_east, PG_EAST_SIDE) == 0);
+
+	/* empty buckets, oversize packets are still dropped */
+	pg_brick_burst_to_east(pmtud, 0, pkts, pg_mask_firsts(64), &error);
+	g_assert(!error);
+	g_assert(pg_brick_pkts_count_get(col_west, PG_WEST_SIDE) == 8);
+	g_assert(pg_brick_pkts_count_get(col_east, PG_EAST_SIDE) == 0);
+
+	pg_pmtud_set_icmp_rate(pmtud, 0, 0);
+	pg_brick_burst_to_east(pmtud, 0, pkts, pg_mask_firsts(64), &error);
+	g_assert(!error);
+	g_assert(pg_brick_pkts_count_get(col_west, PG_WEST_SIDE) == 72);
+
+	pg_brick_destroy(col_west);
+	pg_brick_destroy(pmtud);
+	pg_brick_destroy(col_east);
+	pg_packets_free(pkts, pg_mask_firsts(64));
+	g_free(pkts);
+}
+
+static void test_icmp_pmtud_ipv6(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *pmtud;
+	struct pg_brick *col_east;
+	struct pg_brick *col_west;
+	struct rte_mbuf **pkts;
+	struct rte_mbuf *tmp;
+	struct icmp6_full_hdr *icmp;
+	uint64_t pkts_mask;
+	struct ether_addr eth_s = {{2} };
+	struct ether_addr eth_d = {{4} };
+	uint8_t ip_s[16] = {0x20, 0x01, [15] = 1};
+	uint8_t ip_d[16] = {0x20, 0x01, [15] = 2};
+	uint16_t cksum;
+
+	/* first packet is oversize, second one fits */
+	pkts = pg_packets_append_ether(pg_packets_create(pg_mask_firsts(2)),
+				       pg_mask_firsts(2), &eth_s, &eth_d,
+				       ETHER_TYPE_IPv6);
+	pg_packets_append_ipv6(pkts, 1, ip_s, ip_d, 1500, 17);
+	pg_packets_append_blank(pkts, 1, 1500);
+	pg_packets_append_ipv6(pkts, 2, ip_s, ip_d, 300, 17);
+	pg_packets_append_blank(pkts, 2, 300);
+
+	pmtud = pg_pmtud_new("pmtud", PG_WEST_SIDE, 430, &error);
+	g_assert(!error);
+	col_east = pg_collect_new("col_east", &error);
+	g_assert(!error);
+	col_west = pg_collect_new("col_west", &error);
+	g_assert(!error);
+	pg_brick_chained_links(&error, col_west, pmtud, col_east);
+	g_assert(!error);
+
+	pg_brick_burst_to_east(pmtud, 0, pkts, pg_mask_firsts(2), &error);
+	g_assert(!error);
+	pg_brick_west_burst_get(col_east, &pkts_mask, &error);
+	g_assert(pkts_mask == 2);
+
+	/* the message must not exceed the MTU */
+	tmp = pg_brick_east_burst_get(col_west, &pkts_mask, &error)[0];
+	g_assert(pkts_mask == 1);
+	g_assert(tmp->pkt_len == 430);
+	icmp = rte_pktmbuf_mtod(tmp, struct icmp6_full_hdr *);
+	g_assert(is_same_ether_addr(&icmp->eth.s_addr, &eth_d));
+	g_assert(is_same_ether_addr(&icmp->eth.d_addr, &eth_s));
+	g_assert(!memcmp(icmp->ip.src_addr, ip_d, 16));
+	g_assert(!memcmp(icmp->ip.dst_addr, ip_s, 16));
+	g_assert(icmp->ip.proto == 58);
+	g_assert(rte_be_to_cpu_16(icmp->ip.payload_len) ==
+		 430 - sizeof(struct ether_hdr) - sizeof(struct ipv6_hdr));
+	g_assert(icmp->type == 2);
+	g_assert(icmp->code == 0);
+	g_assert(rte_be_to_cpu_32(icmp->mtu) == 430 - sizeof(struct ether_hdr));
+	g_assert(!memcmp(icmp->quoted_ip.src_addr, ip_s, 16));
+	cksum = icmp->checksum;
+	icmp->checksum = 0;
+	g_assert(rte_ipv6_udptcp_cksum(&icmp->ip, &icmp->type) == cksum);
+
+	pg_brick_destroy(col_west);
+	pg_brick_destroy(pmtud);
+	pg_brick_destroy(col_east);
+	pg_packets_free(pkts, pg_mask_firsts(2));
+	g_free(pkts);
+}
+
+/* append a TCP header with 8 bytes of options and compute its checksum */
+static void append_tcp(struct rte_mbuf *pkt, uint8_t flags,
+		       const uint8_t opts[8])
+{
+	struct tcp_hdr *tcp;
+
+	pg_utils_reset_metadata(pkt);
+	pg_utils_parse(pkt);
+	tcp = (struct tcp_hdr *)rte_pktmbuf_append(pkt, sizeof(*tcp) + 8);
+	memset(tcp, 0, sizeof(*tcp));
+	tcp->data_off = (sizeof(*tcp) + 8) / 4 << 4;
+	tcp->tcp_flags = flags;
+	memcpy(tcp + 1, opts, 8);
+	if (RTE_ETH_IS_IPV4_HDR(pkt->packet_type))
+		tcp->cksum = rte_ipv4_udptcp_cksum(pg_utils_get_l3(pkt), tcp);
+	else
+		tcp->cksum = rte_ipv6_udptcp_cksum(pg_utils_get_l3(pkt), tcp);
+	pg_utils_reset_metadata(pkt);
+}
+
+/* return the MSS of a packet built by append_tcp, checking its checksum */
+static uint16_t tcp_mss(struct rte_mbuf *pkt, int mss_offset)
+{
+	struct tcp_hdr *tcp;
+	uint16_t cksum;
+
+	pg_utils_parse(pkt);
+	tcp = pg_utils_get_l4(pkt);
+	cksum = tcp->cksum;
+	tcp->cksum = 0;
+	if (RTE_ETH_IS_IPV4_HDR(pkt->packet_type))
+		g_assert(rte_ipv4_udptcp_cksum(pg_utils_get_l3(pkt), tcp) ==
+			 cksum);
+	else
+		g_assert(rte_ipv6_udptcp_cksum(pg_utils_get_l3(pkt), tcp) ==
+			 cksum);
+	tcp->cksum = cksum;
+	return rte_be_to_cpu_16(*(unaligned_uint16_t *)
+				((uint8_t *)(tcp + 1) + mss_offset));
+}
+
+static void test_mss_clamp(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *pmtud;
+	struct pg_brick *col_east;
+	struct rte_mbuf **pkts;
+	struct rte_mbuf **col_pkts;
+	uint64_t pkts_mask;
+	struct ether_addr eth = {{0} };
+	uint8_t ip6_s[16] = {0x20, 0x01, [15] = 1};
+	uint8_t ip6_d[16] = {0x20, 0x01, [15] = 2};
+	/* MSS 1460 and window scale */
+	const uint8_t opts[8] = {2, 4, 0x05, 0xb4, 1, 3, 3, 7};
+	/* MSS 1460 at an odd offset */
+	const uint8_t odd_opts[8] = {1, 2, 4, 0x05, 0xb4, 1, 1, 0};
+	/* MSS 300 */
+	const uint8_t small_opts[8] = {2, 4, 0x01, 0x2c, 0, 0, 0, 0};
+
+	pkts = pg_packets_create(pg_mask_firsts(5));
+	pg_packets_append_ether(pkts, 0xf, &eth, &eth, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, 0xf, 1, 2, sizeof(struct ipv4_hdr) +
+			       sizeof(struct tcp_hdr) + 8, 6);
+	pg_packets_append_ether(pkts, 0x10, &eth, &eth, ETHER_TYPE_IPv6);
+	pg_packets_append_ipv6(pkts, 0x10, ip6_s, ip6_d,
+			       sizeof(struct tcp_hdr) + 8, 6);
+	/* SYN, SYN-ACK, ACK, SYN with a small MSS, IPv6 SYN */
+	append_tcp(pkts[0], TCP_SYN, opts);
+	append_tcp(pkts[1], TCP_SYN | TCP_ACK, odd_opts);
+	append_tcp(pkts[2], TCP_ACK, opts);
+	append_tcp(pkts[3], TCP_SYN, small_opts);
+	append_tcp(pkts[4], TCP_SYN, opts);
+
+	pmtud = pg_pmtud_new("pmtud", PG_WEST_SIDE, 430, &error);
+	g_assert(!error);
+	col_east = pg_collect_new("col_east", &error);
+	g_assert(!error);
+	pg_brick_link(pmtud, col_east, &error);
+	g_assert(!error);
+
+	/* disabled by default */
+	pg_brick_burst_to_east(pmtud, 0, pkts, pg_mask_firsts(5), &error);
+	g_assert(!error);
+	g_assert(tcp_mss(pkts[0], 2) == 1460);
+
+	pg_pmtud_set_tcp_mss_clamp(pmtud, true);
+	pg_brick_burst_to_east(pmtud, 0, pkts, pg_mask_firsts(5), &error);
+	g_assert(!error);
+	col_pkts = pg_brick_west_burst_get(col_east, &pkts_mask, &error);
+	g_assert(pkts_mask == pg_mask_firsts(5));
+	g_assert(tcp_mss(col_pkts[0], 2) == 430 - 14 - 20 - 20);
+	g_assert(tcp_mss(col_pkts[1], 3) == 430 - 14 - 20 - 20);
+	g_assert(tcp_mss(col_pkts[2], 2) == 1460);
+	g_assert(tcp_mss(col_pkts[3], 2) == 300);
+	g_assert(tcp_mss(col_pkts[4], 2) == 430 - 14 - 40 - 20);
+	pg_packets_free(pkts, pg_mask_firsts(5));
+	g_free(pkts);
+
+	/* a SYN referenced elsewhere is not modified */
+	pkts = pg_packets_create(1);
+	pg_packets_append_ether(pkts, 1, &eth, &eth, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, 1, 1, 2, sizeof(struct ipv4_hdr) +
+			       sizeof(struct tcp_hdr) + 8, 6);
+	append_tcp(pkts[0], TCP_SYN, opts);
+	rte_mbuf_refcnt_update(pkts[0], 1);
+	pg_brick_burst_to_east(pmtud, 0, pkts, 1, &error);
+	g_assert(!error);
+	g_assert(tcp_mss(pkts[0], 2) == 1460);
+	rte_mbuf_refcnt_update(pkts[0], -1);
+
+	pg_brick_destroy(pmtud);
+	pg_brick_destroy(col_east);
+	pg_packets_free(pkts, 1);
+	g_free(pkts);
+}
+
 static void test_pmtud(void)
 {
 	/* tests in the same order as the header function declarations */
 	pg_test_add_func("/pmtud/sorting/df", test_sorting_pmtud_df);
 	pg_test_add_func("/pmtud/sorting/mtusize", test_sorting_pmtud);
 	pg_test_add_func("/pmtud/integrity/icmp", test_icmp_pmtud);
+	pg_test_add_func("/pmtud/icmp/rate", test_icmp_pmtud_rate);
+	pg_test_add_func("/pmtud/icmp/ipv6", test_icmp_pmtud_ipv6);
+	pg_test_add_func("/pmtud/mss_clamp", test_mss_clamp);
 }
 
 int main(int argc, char **argv)
@@ -36,23 +36,34 @@
 
 uint16_t max_pkts = PG_MAX_PKTS_BURST;
 
-void test_benchmark_queue(int argc, char **argv)
+/**
+ * [queue_enter] ~ [queue_exit]----[nop]
+ * Packets are bursted in queue_enter on the master lcore while queue_exit
+ * is polled by a pg_thread running on an other lcore.
+ */
+static void bench_queue(int argc, char **argv, const char *title,
+			struct pg_brick *(*queue_new)(const char *, int,
+						      struct pg_error **))
 {
 	struct pg_error *error = NULL;
 	struct pg_brick *queue_enter;
 	struct pg_brick *queue_exit;
+	struct pg_brick *nop;
+	struct pg_graph *graph;
 	struct pg_bench bench;
 	struct pg_bench_stats stats;
 	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
 	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
 	uint32_t len;
+	int16_t tid;
+	int32_t gid;
 
-	queue_enter = pg_queue_new("enter", 10, &error);
+	queue_enter = queue_new("enter", 10, &error);
 	if (error) {
 		pg_error_print(error);
 		g_assert(0);
 	}
-	queue_exit = pg_queue_new("enter", 10, &error);
+	queue_exit = queue_new("exit", 10, &error);
 	if (error) {
 		pg_error_print(error);
 		g_assert(0);
@@ -61,15 +72,29 @@ void test_benchmark_queue(int argc, char **argv)
 		pg_error_print(error);
 		g_assert(0);
 	}
+	nop = pg_nop_new("nop", &error);
+	g_assert(!error);
+	g_assert(!pg_brick_link(nop, queue_exit, &error));
+
+	graph = pg_graph_new("consumer", queue_exit, &error);
+	g_assert(graph);
+	tid = pg_thread_init(&error);
+	if (tid < 0) {
+		pg_error_print(error);
+		g_assert(0);
+	}
+	gid = pg_thread_add_graph(tid, graph);
+	g_assert(gid >= 0);
+	pg_thread_run(tid);
 
-	g_assert(!pg_bench_init(&bench, "queue", argc, argv, &error));
+	g_assert(!pg_bench_init(&bench, title, argc, argv, &error));
 	bench.input_brick = queue_enter;
 	bench.input_side = PG_WEST_SIDE;
 	bench.output_brick = queue_exit;
 	bench.output_side = PG_WEST_SIDE;
-	bench.output_poll = true;
+	bench.output_poll = false;
 	bench.max_burst_cnt = 1000000;
-	bench.count_brick = NULL;
+	bench.count_brick = nop;
 	bench.pkts_nb = 64;
 	bench.pkts_mask = pg_mask_firsts(64);
 	bench.pkts = pg_packets_create(bench.pkts_mask);
@@ -92,8 +117,20 @@ void test_benchmark_queue(int argc, char **argv)
 	g_assert(!pg_bench_run(&bench, &stats, &error));
 	pg_bench_print(&stats);
 
+	pg_thread_stop(tid);
+	g_assert(pg_thread_pop_graph(tid, gid) == graph);
+	pg_thread_destroy(tid);
+	pg_graph_empty(graph);
+	pg_graph_destroy(graph);
+
 	pg_packets_free(bench.pkts, bench.pkts_mask);
 	pg_brick_destroy(queue_enter);
 	pg_brick_destroy(queue_exit);
+	pg_brick_destroy(nop);
 }
 
+void test_benchmark_queue(int argc, char **argv)
+{
+	bench_queue(argc, argv, "queue (GAsyncQueue)", pg_queue_new);
+	bench_queue(argc, argv, "queue (SPSC ring)", pg_queue_ring_new);
+}
@@ -39,6 +39,9 @@ struct pg_queue_state {
 	uint32_t rx_max_size;
 	GAsyncQueue *rx;
 	struct pg_queue_state *friend;
+	int backend;
+	void *ring;
+	uint32_t ring_mask;
 };
 
 static void test_queue_lifecycle(void)
@@ -494,6 +497,124 @@ static void test_queue_reset(void)
 #	undef NB_PKTS
 }
 
+static void test_queue_ring(void)
+{
+#	define NB_PKTS 64
+	struct pg_error *error = NULL;
+	struct pg_brick *queue1, *queue2, *queue3, *collect;
+	struct rte_mbuf **result_pkts;
+	struct rte_mbuf *pkts[NB_PKTS];
+	struct rte_mbuf *tmp[NB_PKTS];
+	uint64_t pkts_mask, i, j;
+	uint16_t count = 0;
+	struct rte_mempool *mbuf_pool = pg_get_mempool();
+	struct pg_queue_state *state;
+
+	/**
+	 * Burst packets in queue1 to get them in collect
+	 * [queue1] ~ [queue2]----[collect]
+	 */
+	queue1 = pg_queue_ring_new("q1", 10, &error);
+	CHECK_ERROR(error);
+	queue2 = pg_queue_ring_new("q2", 10, &error);
+	CHECK_ERROR(error);
+	queue3 = pg_queue_new("q3", 10, &error);
+	CHECK_ERROR(error);
+	collect = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	state = pg_brick_get_state(queue1, struct pg_queue_state);
+	g_assert(state->rx_max_size == 10);
+	g_assert(state->ring_mask == 15);
+
+	pg_brick_link(queue2, collect, &error);
+	CHECK_ERROR(error);
+	/* ring and async queues can't be friends */
+	g_assert(pg_queue_friend(queue1, queue3, &error) == -1);
+	g_assert(pg_error_is_set(&error));
+	pg_error_free(error);
+	error = NULL;
+	g_assert(!pg_queue_friend(queue1, queue2, &error));
+	CHECK_ERROR(error);
+
+	for (i = 0; i < NB_PKTS; i++) {
+		pkts[i] = rte_pktmbuf_alloc(mbuf_pool);
+		g_assert(pkts[i]);
+		pkts[i]->udata64 = i;
+		pg_set_mac_addrs(pkts[i],
+				 "F0:F1:F2:F3:F4:F5",
+				 "E0:E1:E2:E3:E4:E5");
+	}
+
+	/* queue must not keep a reference on the caller's array */
+	for (j = 0; j < 100; j++) {
+		memcpy(tmp, pkts, sizeof(tmp));
+		pg_brick_burst_to_east(queue1, 0, tmp, pg_mask_firsts(NB_PKTS),
+				       &error);
+		CHECK_ERROR(error);
+		memset(tmp, 0, sizeof(tmp));
+
+		pg_brick_poll(queue2, &count, &error);
+		CHECK_ERROR(error);
+		g_assert(count == NB_PKTS);
+
+		result_pkts = pg_brick_west_burst_get(collect, &pkts_mask,
+						      &error);
+		CHECK_ERROR(error);
+		g_assert(pkts_mask == pg_mask_firsts(NB_PKTS));
+		for (i = 0; i < NB_PKTS; i++) {
+			g_assert(result_pkts[i]);
+			g_assert(result_pkts[i]->udata64 == i);
+		}
+		g_assert(pg_brick_reset(collect, &error) == 0);
+		CHECK_ERROR(error);
+	}
+
+	/* burst over queue limit: newest bursts are dropped */
+	for (j = 0; j < 100; j++) {
+		for (i = 0; i < NB_PKTS; i++)
+			pkts[i]->udata64 = i * j;
+		pg_brick_burst_to_east(queue1, 0, pkts, pg_mask_firsts(NB_PKTS),
+				       &error);
+		CHECK_ERROR(error);
+	}
+	g_assert(pg_queue_pressure(queue1) == 255);
+	g_assert(pg_queue_pressure(queue2) == 0);
+
+	for (j = 0; j < 10; j++) {
+		pg_brick_poll(queue2, &count, &error);
+		CHECK_ERROR(error);
+		g_assert(count == NB_PKTS);
+		g_assert(pg_brick_reset(collect, &error) == 0);
+	}
+	g_assert(pg_queue_pressure(queue1) == 0);
+	pg_brick_poll(queue2, &count, &error);
+	CHECK_ERROR(error);
+	g_assert(count == 0);
+
+	/* reset must release queued bursts */
+	pg_brick_burst_to_east(queue1, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	CHECK_ERROR(error);
+	g_assert(pg_queue_pressure(queue1) > 0);
+	g_assert(pg_brick_reset(queue1, &error) == 0);
+	g_assert(pg_queue_pressure(queue1) == 0);
+	for (i = 0; i < NB_PKTS; i++)
+		g_assert(rte_mbuf_refcnt_read(pkts[i]) == 1);
+
+	/* clean */
+	for (i = 0; i < NB_PKTS; i++)
+		rte_pktmbuf_free(pkts[i]);
+	pg_brick_decref(queue1, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(queue2, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(queue3, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(collect, &error);
+	CHECK_ERROR(error);
+#	undef NB_PKTS
+}
+
 int main(int argc, char **argv)
 {
 	/* tests in the same order as the header function declarations */
@@ -507,6 +628,7 @@ int main(int argc, char **argv)
 	pg_test_add_func("/queue/burst", test_queue_burst);
 	pg_test_add_func("/queue/limit", test_queue_limit);
 	pg_test_add_func("/queue/reset", test_queue_reset);
+	pg_test_add_func("/queue/ring", test_queue_ring);
 	int r = g_test_run();
 
 	pg_stop();
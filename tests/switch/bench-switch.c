@@ -20,6 +20,7 @@
 #include <arpa/inet.h>
 #include <rte_config.h>
 #include <rte_common.h>
+#include <rte_cycles.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
 #include <rte_udp.h>
@@ -80,6 +81,102 @@ static void test_switch_benchmarks(int argc, char **argv, int west_max,
 	pg_packets_free(bench.pkts, bench.pkts_mask);
 	pg_brick_destroy(sw);
 }
+
+/* number of destination addresses used by the bench */
+static uint32_t active_macs_nb;
+static uint32_t active_macs_cur;
+
+static inline void active_mac(struct ether_addr *addr, uint32_t i)
+{
+	addr->addr_bytes[0] = 0x52;
+	addr->addr_bytes[1] = 0x54;
+	addr->addr_bytes[2] = 0x01;
+	addr->addr_bytes[3] = i >> 16;
+	addr->addr_bytes[4] = i >> 8;
+	addr->addr_bytes[5] = i;
+}
+
+/* each burst goes to the next 64 destination addresses */
+static void active_macs_next(struct pg_bench *bench)
+{
+	PG_FOREACH_BIT(bench->pkts_mask, i) {
+		struct ether_hdr *eth = rte_pktmbuf_mtod(bench->pkts[i],
+							 struct ether_hdr *);
+
+		active_mac(&eth->d_addr, active_macs_cur);
+		if (++active_macs_cur == active_macs_nb)
+			active_macs_cur = 0;
+	}
+}
+
+static void test_switch_benchmark_macs(int argc, char **argv,
+				       uint32_t nb_macs)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *sw;
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
+	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	char *title;
+
+	sw = pg_switch_new("switch", 20, 20, PG_DEFAULT_SIDE, &error);
+	g_assert(!error);
+	title = g_strdup_printf("switch : %u active MAC addresses", nb_macs);
+	g_assert(!pg_bench_init(&bench, title, argc, argv, &error));
+	g_free(title);
+	bench.input_brick = sw;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = sw;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 1000000;
+	bench.count_brick = NULL;
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac1, &mac2,
+		ETHER_TYPE_IPv4);
+	bench.pkts = pg_packets_append_blank(bench.pkts, bench.pkts_mask, 64);
+	bench.brick_full_burst = 1;
+	bench.post_burst_op = active_macs_next;
+
+	/* learn all addresses on the first east port, where the count
+	 * brick will be linked
+	 */
+	for (uint32_t i = 0; i < nb_macs; i += 64) {
+		PG_FOREACH_BIT(bench.pkts_mask, j) {
+			struct ether_hdr *eth = rte_pktmbuf_mtod(
+				bench.pkts[j], struct ether_hdr *);
+
+			active_mac(&eth->s_addr, (i + j) % nb_macs);
+		}
+		g_assert(!pg_brick_burst_to_west(sw, 0, bench.pkts,
+						 bench.pkts_mask, &error));
+	}
+	PG_FOREACH_BIT(bench.pkts_mask, j) {
+		struct ether_hdr *eth = rte_pktmbuf_mtod(bench.pkts[j],
+							 struct ether_hdr *);
+
+		ether_addr_copy(&mac1, &eth->s_addr);
+	}
+	active_macs_nb = nb_macs;
+	active_macs_cur = 0;
+	active_macs_next(&bench);
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	pg_bench_print(&stats);
+	/* this include the cost of rewriting destination addresses */
+	printf("cycles/packet: %.1f\n",
+	       stats.duration_s * rte_get_tsc_hz() / stats.pkts_received);
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	pg_brick_destroy(sw);
+}
+
 void test_benchmark_switch(int argc, char **argv)
 {
 	test_switch_benchmarks(argc, argv, 20, 20,
@@ -90,4 +187,6 @@ void test_benchmark_switch(int argc, char **argv)
 			       "switch : 20 edge at WEST and 10000 at EAST");
 	test_switch_benchmarks(argc, argv, 10000, 10000,
 			       "switch : 10000 edges at each sides");
+	test_switch_benchmark_macs(argc, argv, 1000);
+	test_switch_benchmark_macs(argc, argv, 100000);
 }
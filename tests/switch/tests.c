@@ -17,6 +17,7 @@
 
 #include <glib.h>
 #include <string.h>
+#include <unistd.h>
 #include "brick-int.h"
 #include "packets.h"
 #include "utils/mempool.h"
@@ -1048,6 +1049,106 @@ static void test_switch_filtered(void)
 #undef FILTERED_COUNT
 }
 
+static void test_switch_aging(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *brick, *collect1, *collect2, *collect3;
+	struct rte_mbuf **result_pkts;
+	struct rte_mbuf *pkts[NB_PKTS];
+	uint64_t pkts_mask, i;
+
+	brick = pg_switch_new("switch", 4, 4, PG_DEFAULT_SIDE, &error);
+	g_assert(brick);
+	CHECK_ERROR(error);
+	collect1 = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	collect2 = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	collect3 = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	pg_brick_link(collect1, brick, &error);
+	CHECK_ERROR(error);
+	pg_brick_link(collect2, brick, &error);
+	CHECK_ERROR(error);
+	pg_brick_link(brick, collect3, &error);
+	CHECK_ERROR(error);
+
+	for (i = 0; i < NB_PKTS; i++) {
+		pkts[i] = rte_pktmbuf_alloc(mbuf_pool);
+		g_assert(pkts[i]);
+		pg_set_mac_addrs(pkts[i],
+				 "F0:F1:F2:F3:F4:F5", "E0:E1:E2:E3:E4:E5");
+	}
+
+	/* learn F0:... on west port 0 then see it moving on west port 1 */
+	pg_brick_burst_to_east(brick, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	CHECK_ERROR(error);
+	g_assert(pg_switch_learned_count(brick) == 1);
+	g_assert(pg_switch_moved_count(brick) == 0);
+	pg_brick_burst_to_east(brick, 1, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	CHECK_ERROR(error);
+	g_assert(pg_switch_learned_count(brick) == 1);
+	g_assert(pg_switch_moved_count(brick) == 1);
+
+	/* the answer only goes to west port 1 */
+	for (i = 0; i < NB_PKTS; i++)
+		pg_set_mac_addrs(pkts[i],
+				 "E0:E1:E2:E3:E4:E5", "F0:F1:F2:F3:F4:F5");
+	g_assert(pg_brick_reset(collect1, &error) == 0);
+	g_assert(pg_brick_reset(collect2, &error) == 0);
+	pg_brick_burst_to_west(brick, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	CHECK_ERROR(error);
+	g_assert(pg_switch_learned_count(brick) == 2);
+	g_assert(pg_switch_mac_count(brick) == 2);
+	result_pkts = pg_brick_east_burst_get(collect1, &pkts_mask, &error);
+	g_assert(!pkts_mask);
+	result_pkts = pg_brick_east_burst_get(collect2, &pkts_mask, &error);
+	g_assert(pkts_mask == pg_mask_firsts(NB_PKTS));
+	g_assert(result_pkts);
+
+	/* once aged, F0:... is unknown again and packets are flooded */
+	pg_switch_set_aging(brick, 1);
+	sleep(2);
+	for (i = 0; i < NB_PKTS; i++)
+		pg_set_mac_addrs(pkts[i],
+				 "D0:D1:D2:D3:D4:D5", "F0:F1:F2:F3:F4:F5");
+	g_assert(pg_brick_reset(collect1, &error) == 0);
+	g_assert(pg_brick_reset(collect2, &error) == 0);
+	pg_brick_burst_to_west(brick, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	CHECK_ERROR(error);
+	result_pkts = pg_brick_east_burst_get(collect1, &pkts_mask, &error);
+	g_assert(pkts_mask == pg_mask_firsts(NB_PKTS));
+	result_pkts = pg_brick_east_burst_get(collect2, &pkts_mask, &error);
+	g_assert(pkts_mask == pg_mask_firsts(NB_PKTS));
+
+	/* a few bursts are enough to sweep the whole (small) table */
+	for (i = 0; i < 16; i++) {
+		pg_brick_burst_to_west(brick, 0, pkts,
+				       pg_mask_firsts(NB_PKTS), &error);
+		CHECK_ERROR(error);
+	}
+	g_assert(pg_switch_aged_count(brick) == 2);
+	g_assert(pg_switch_mac_count(brick) == 1);
+	g_assert(pg_switch_learned_count(brick) == 3);
+
+	for (i = 0; i < NB_PKTS; i++)
+		rte_pktmbuf_free(pkts[i]);
+	pg_brick_unlink(brick, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(collect1, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(collect2, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(collect3, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(brick, &error);
+	CHECK_ERROR(error);
+}
+
 static void test_switch_perf_learn(void)
 {
 	struct pg_error *error = NULL;
@@ -1263,6 +1364,7 @@ static void test_switch(void)
 			test_switch_multicast_destination);
 	pg_test_add_func("/switch/multicast/both", test_switch_multicast_both);
 	pg_test_add_func("/switch/filtered", test_switch_filtered);
+	pg_test_add_func("/switch/aging", test_switch_aging);
 	pg_test_add_func("/switch/perf/learn", test_switch_perf_learn);
 	pg_test_add_func("/switch/perf/switch", test_switch_perf_switch);
 }
@@ -20,6 +20,7 @@
 #include <arpa/inet.h>
 #include <rte_config.h>
 #include <rte_common.h>
+#include <rte_cycles.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
 #include <rte_udp.h>
@@ -289,6 +290,118 @@ static void vxlan_to_inside(int flags, const char *title,
 	pg_brick_destroy(bench.count_brick);
 }
 
+static uint32_t vnis_nb;
+static uint32_t vnis_cur;
+
+/* add back VXLAN headers, each burst goes to the next 64 VNIs */
+static void add_vtep_hdr_vnis(struct pg_bench *bench)
+{
+	add_vtep_hdr(bench);
+	PG_FOREACH_BIT(bench->pkts_mask, i) {
+		struct headers4 *hdr = rte_pktmbuf_mtod(bench->pkts[i],
+							struct headers4 *);
+
+		hdr->vxlan.vx_vni = rte_cpu_to_be_32((vnis_cur + 1) << 8);
+		if (++vnis_cur == vnis_nb)
+			vnis_cur = 0;
+	}
+}
+
+static void vxlan_to_inside_vnis(int argc, char **argv, uint32_t nb_vnis)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *vtep;
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
+	struct pg_brick *outside_nop;
+	struct pg_brick **inside_nops;
+	struct ether_addr mac3 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x31} };
+	struct ether_addr mac4 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x41} };
+	static struct ether_addr mac_vtep = {{0xb0, 0xb1, 0xb2,
+					      0xb3, 0xb4, 0xb5} };
+	char *title;
+
+	headers_length = sizeof(struct headers4);
+	vtep = pg_vtep_new("vtep", nb_vnis, PG_WEST_SIDE, 0x000000EE,
+			   mac_vtep, PG_VTEP_DST_PORT, PG_VTEP_ALL_OPTI,
+			   &error);
+	g_assert(!error);
+
+	title = g_strdup_printf("vxlan 4 all opti with %u VNIs", nb_vnis);
+	g_assert(!pg_bench_init(&bench, title, argc, argv, &error));
+	g_free(title);
+	outside_nop = pg_nop_new("nop-outside", &error);
+	g_assert(!error);
+	pg_brick_link(outside_nop, vtep, &error);
+	g_assert(!error);
+	inside_nops = g_new0(struct pg_brick *, nb_vnis);
+	for (uint32_t i = 0; i < nb_vnis; ++i) {
+		inside_nops[i] = pg_nop_new("nop-inside", &error);
+		g_assert(!error);
+		pg_brick_link(vtep, inside_nops[i], &error);
+		g_assert(!error);
+		pg_vtep_add_vni(vtep, inside_nops[i], i + 1,
+				inet_addr("224.0.0.1"), &error);
+		g_assert(!pg_error_is_set(&error));
+	}
+
+	bench.input_brick = outside_nop;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = vtep;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 1000000;
+	/* only packets of the first VNI are counted as received */
+	bench.count_brick = inside_nops[0];
+	bench.post_burst_op = add_vtep_hdr_vnis;
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac_vtep, &mac_vtep,
+		ETHER_TYPE_IPv4);
+	bench.brick_full_burst = 1;
+	pg_packets_append_ipv4(
+		bench.pkts,
+		bench.pkts_mask,
+		0x000000EE, 0x000000CC, headers_length + 1400, 17);
+	bench.pkts = pg_packets_append_udp(
+		bench.pkts,
+		bench.pkts_mask,
+		1000, PG_VTEP_DST_PORT, 1400);
+	pg_packets_append_vxlan(bench.pkts, bench.pkts_mask, 1);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac3, &mac4,
+		ETHER_TYPE_IPv4);
+	bench.pkts = pg_packets_append_blank(bench.pkts, bench.pkts_mask, 1400);
+	memcpy(vxlan_hdr, rte_pktmbuf_mtod(bench.pkts[0], void *),
+	       headers_length);
+	vxlan_hdr[headers_length] = '\0';
+
+	/* spread the first burst on the first VNIs too */
+	vnis_nb = nb_vnis;
+	vnis_cur = 0;
+	PG_FOREACH_BIT(bench.pkts_mask, i)
+		rte_pktmbuf_adj(bench.pkts[i], headers_length);
+	add_vtep_hdr_vnis(&bench);
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	pg_bench_print(&stats);
+	printf("cycles/packet: %.1f\n",
+	       stats.duration_s * rte_get_tsc_hz() / stats.pkts_sent);
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	pg_brick_destroy(vtep);
+	pg_brick_destroy(outside_nop);
+	for (uint32_t i = 0; i < nb_vnis; ++i)
+		pg_brick_destroy(inside_nops[i]);
+	g_free(inside_nops);
+}
+
 void test_benchmark_vtep(int argc, char **argv)
 {
 	inside_to_vxlan(argc, argv, AF_INET);
@@ -310,5 +423,10 @@ void test_benchmark_vtep(int argc, char **argv)
 
 	vxlan_to_inside(0, "vxlan 4 bench slow", argc, argv, AF_INET);
 	vxlan_to_inside(0, "vxlan 6 bench slow", argc, argv, AF_INET6);
+
+	vxlan_to_inside_vnis(argc, argv, 1);
+	vxlan_to_inside_vnis(argc, argv, 64);
+	vxlan_to_inside_vnis(argc, argv, 512);
+	vxlan_to_inside_vnis(argc, argv, 4096);
 }
 
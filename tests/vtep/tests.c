@@ -1008,6 +1008,132 @@ static void test_vtep_flood_encapsulate(void)
 	pg_packets_free(pkts, pg_mask_firsts(NB_PKTS));
 }
 
+static void test_vtep_flow_src_port(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *vtep, *collect_west, *collect_east;
+	struct ether_addr mac_vtep = {{0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5} };
+	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	uint64_t mask = pg_mask_firsts(4);
+	struct rte_mbuf **pkts;
+	struct rte_mbuf **result_pkts;
+	uint16_t ports[4];
+	uint64_t pkts_mask;
+
+	vtep = pg_vtep_new("vtep", 1, PG_EAST_SIDE, inet_addr("1.2.3.4"),
+			   mac_vtep, PG_VTEP_DST_PORT, PG_VTEP_ALL_OPTI,
+			   &error);
+	CHECK_ERROR(error);
+	collect_west = pg_collect_new("collect-west", &error);
+	CHECK_ERROR(error);
+	collect_east = pg_collect_new("collect-east", &error);
+	CHECK_ERROR(error);
+	pg_brick_chained_links(&error, collect_west, vtep, collect_east);
+	CHECK_ERROR(error);
+	pg_vtep_add_vni(vtep, collect_west, 1, inet_addr("224.0.0.5"),
+			&error);
+	CHECK_ERROR(error);
+
+	/* packets 0, 1 and 3 are the same flow, packet 2 is another one */
+	pkts = pg_packets_create(mask);
+	pg_packets_append_ether(pkts, mask, &mac1, &mac2, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, mask, 0x0A000001, 0x0A000002,
+			       sizeof(struct ipv4_hdr) +
+			       sizeof(struct udp_hdr) + 10, 17);
+	pg_packets_append_udp(pkts, mask & ~0x4, 1000, 2000, 10);
+	pg_packets_append_udp(pkts, 0x4, 1001, 2000, 10);
+	pg_packets_append_blank(pkts, mask, 10);
+	/* but the NIC gave a RSS hash to packet 3 */
+	pkts[3]->ol_flags |= PKT_RX_RSS_HASH;
+	pkts[3]->hash.rss = 0x12345678;
+
+	g_assert(!pg_brick_burst_to_east(vtep, 0, pkts, mask, &error));
+	CHECK_ERROR(error);
+	result_pkts = pg_brick_west_burst_get(collect_east, &pkts_mask,
+					      &error);
+	CHECK_ERROR(error);
+	g_assert(pkts_mask == mask);
+	for (int i = 0; i < 4; ++i) {
+		struct headers *hdr = rte_pktmbuf_mtod(result_pkts[i],
+						       struct headers *);
+
+		ports[i] = rte_be_to_cpu_16(hdr->udp.src_port);
+		g_assert(ports[i] >= 49152);
+	}
+	g_assert(ports[0] == ports[1]);
+	g_assert(ports[0] != ports[2]);
+	/* (0x1234 ^ 0x5678) & 0x3fff + 49152 */
+	g_assert(ports[3] == 50252);
+
+	pg_brick_destroy(vtep);
+	pg_brick_destroy(collect_west);
+	pg_brick_destroy(collect_east);
+	pg_packets_free(pkts, mask);
+	g_free(pkts);
+}
+
+/* inner packet types of encapsulated packets must match their headers */
+static void test_vtep_inner_ptype(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *vtep, *collect_west, *collect_east;
+	struct ether_addr mac_vtep = {{0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5} };
+	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	uint8_t ip6_src[16] = {0x20, 0x01, 0x0d, 0xb8, [15] = 1};
+	uint8_t ip6_dst[16] = {0x20, 0x01, 0x0d, 0xb8, [15] = 2};
+	uint64_t mask = pg_mask_firsts(2);
+	uint32_t outer = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4 |
+		RTE_PTYPE_L4_UDP | RTE_PTYPE_TUNNEL_VXLAN;
+	struct rte_mbuf **pkts;
+	struct rte_mbuf **result_pkts;
+	uint64_t pkts_mask;
+
+	vtep = pg_vtep_new("vtep", 1, PG_EAST_SIDE, inet_addr("1.2.3.4"),
+			   mac_vtep, PG_VTEP_DST_PORT, PG_VTEP_ALL_OPTI,
+			   &error);
+	CHECK_ERROR(error);
+	collect_west = pg_collect_new("collect-west", &error);
+	CHECK_ERROR(error);
+	collect_east = pg_collect_new("collect-east", &error);
+	CHECK_ERROR(error);
+	pg_brick_chained_links(&error, collect_west, vtep, collect_east);
+	CHECK_ERROR(error);
+	pg_vtep_add_vni(vtep, collect_west, 1, inet_addr("224.0.0.5"),
+			&error);
+	CHECK_ERROR(error);
+
+	pkts = pg_packets_create(mask);
+	pg_packets_append_ether(pkts, 0x1, &mac1, &mac2, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, 0x1, 0x0A000001, 0x0A000002,
+			       sizeof(struct ipv4_hdr) +
+			       sizeof(struct udp_hdr), 17);
+	pg_packets_append_ether(pkts, 0x2, &mac1, &mac2, ETHER_TYPE_IPv6);
+	pg_packets_append_ipv6(pkts, 0x2, ip6_src, ip6_dst,
+			       sizeof(struct udp_hdr), 17);
+	pg_packets_append_udp(pkts, mask, 1000, 2000, sizeof(struct udp_hdr));
+
+	g_assert(!pg_brick_burst_to_east(vtep, 0, pkts, mask, &error));
+	CHECK_ERROR(error);
+	result_pkts = pg_brick_west_burst_get(collect_east, &pkts_mask,
+					      &error);
+	CHECK_ERROR(error);
+	g_assert(pkts_mask == mask);
+	g_assert(result_pkts[0]->packet_type ==
+		 (outer | RTE_PTYPE_INNER_L2_ETHER | RTE_PTYPE_INNER_L3_IPV4 |
+		  RTE_PTYPE_INNER_L4_UDP));
+	g_assert(result_pkts[1]->packet_type ==
+		 (outer | RTE_PTYPE_INNER_L2_ETHER | RTE_PTYPE_INNER_L3_IPV6 |
+		  RTE_PTYPE_INNER_L4_UDP));
+
+	pg_brick_destroy(vtep);
+	pg_brick_destroy(collect_west);
+	pg_brick_destroy(collect_east);
+	pg_packets_free(pkts, mask);
+	g_free(pkts);
+}
+
 static void test_vtep_fragment_encap_decap(void)
 {
 	struct pg_error *error = NULL;
@@ -1118,6 +1244,9 @@ int main(int argc, char **argv)
 	pg_test_add_func("/vtep/fragmented/encap-decap",
 			test_vtep_fragment_encap_decap);
 
+	pg_test_add_func("/vtep/flow-src-port", test_vtep_flow_src_port);
+	pg_test_add_func("/vtep/inner-ptype", test_vtep_inner_ptype);
+
 	r = g_test_run();
 
 	pg_stop();